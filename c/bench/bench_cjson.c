@@ -0,0 +1,183 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * bench_cjson [max keys]
+ *
+ * Times building cjson maps of 10, 100, ... max keys (default 1000000) with
+ * cjson_map_add_pair and looking every key up again with cjson_map_get, and building
+ * arrays of as many values with cjson_array_add_object, grown on demand ("push") or
+ * after cjson_array_reserve ("reserved"). "build"/"release" make an array of as many
+ * records with reference counted nodes and free it, "docbuild"/"docfree" the same in a
+ * cjson_document and "docintern" with interned keys. "allocs" counts the allocations for
+ * 10000 records, reference counted, in a document and in a document with interned keys.
+ * Output lines:  cjson <op> <keys> <ms> <ns/key>
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cjson.h"
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+#define ALLOC_RECORDS           10000
+#define ALLOC_RECORDS_MAX       (ALLOC_RECORDS*64)
+
+// {"id": i, "name": "record i", "score": i/4, "tags": ["a", "b", "c"], "active": i%3==0,
+//  "parent": null, "rank": i%10}
+static struct jsobj* make_record(struct cjson_document* doc, unsigned int i)
+{
+    static char* keys[] = {"id", "name", "score", "tags", "active", "parent", "rank"};
+    struct jsobj *record = cjson_document_make_map(doc), *tags = cjson_document_make_array(doc);
+    char name[32];
+
+    sprintf(name, "record %u", i);
+    cjson_array_push_move(tags, cjson_document_make_string(doc, "a"));
+    cjson_array_push_move(tags, cjson_document_make_string(doc, "b"));
+    cjson_array_push_move(tags, cjson_document_make_string(doc, "c"));
+    cjson_map_put_move(record, cjson_document_make_key(doc, keys[0]), cjson_document_make_int(doc, i));
+    cjson_map_put_move(record, cjson_document_make_key(doc, keys[1]), cjson_document_make_string(doc, name));
+    cjson_map_put_move(record, cjson_document_make_key(doc, keys[2]), cjson_document_make_double(doc, i/4.0));
+    cjson_map_put_move(record, cjson_document_make_key(doc, keys[3]), tags);
+    cjson_map_put_move(record, cjson_document_make_key(doc, keys[4]), cjson_document_make_bool(doc, i%3==0));
+    cjson_map_put_move(record, cjson_document_make_key(doc, keys[5]), cjson_document_make_nil(doc));
+    cjson_map_put_move(record, cjson_document_make_key(doc, keys[6]), cjson_document_make_int(doc, i%10));
+    return record;
+}
+
+// allocations made while building ALLOC_RECORDS records in doc (NULL: reference counted)
+static unsigned int count_allocations(struct cjson_document* doc, void** records)
+{
+    static unsigned int allocations, releases, off;
+    struct jsobj* array;
+    unsigned int i;
+
+    cjson_memory_profile(records, &allocations, records + ALLOC_RECORDS_MAX, &releases, ALLOC_RECORDS_MAX);
+    array = cjson_document_make_array(doc);
+    for (i=0; i<ALLOC_RECORDS; i++) cjson_array_push_move(array, make_record(doc, i));
+    cjson_memory_profile(NULL, &off, NULL, &off, 0);
+    cjson_release(array);
+    return allocations;
+}
+
+static void report(const char* op, unsigned int keys, double ms)
+{
+    printf("cjson %-8s %8u %10.3f %8.1f\n", op, keys, ms, ms*1000000.0/keys);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int max_keys = argc > 1 ? (unsigned int)atoi(argv[1]) : 1000000;
+    unsigned int keys, i, found;
+    struct jsobj **names, *map, *array, *value;
+    struct cjson_document* doc;
+    char name[16];
+    double t;
+
+    if (max_keys < 10) max_keys = 10;
+    names = malloc(sizeof(names[0]) * max_keys);
+    if (names == NULL) return 1;
+    for (i=0; i<max_keys; i++)
+    {
+        sprintf(name, "k%u", i);
+        names[i] = cjson_make_string(name);
+    }
+    value = cjson_make_int(1);
+
+    for (keys=10; keys<=max_keys; keys*=10)
+    {
+        t = now_ms();
+        map = cjson_make_map();
+        for (i=0; i<keys; i++) cjson_map_add_pair(map, names[i], value);
+        report("insert", keys, now_ms()-t);
+
+        t = now_ms();
+        for (i=0, found=0; i<keys; i++) found += cjson_map_get(map, names[i]) != NULL;
+        report("lookup", keys, now_ms()-t);
+        if (found != keys) printf("cjson lookup found %u of %u\n", found, keys);
+
+        cjson_release(map);
+
+        t = now_ms();
+        array = cjson_make_array();
+        for (i=0; i<keys; i++) cjson_array_add_object(array, value);
+        report("push", keys, now_ms()-t);
+        cjson_release(array);
+
+        t = now_ms();
+        array = cjson_make_array();
+        cjson_array_reserve(array, keys);
+        for (i=0; i<keys; i++) cjson_array_add_object(array, value);
+        report("reserved", keys, now_ms()-t);
+        cjson_release(array);
+
+        t = now_ms();
+        array = cjson_make_array();
+        for (i=0; i<keys; i++) cjson_array_push_move(array, make_record(NULL, i));
+        report("build", keys, now_ms()-t);
+        t = now_ms();
+        cjson_release(array);
+        report("release", keys, now_ms()-t);
+
+        t = now_ms();
+        doc = cjson_document_create(0);
+        array = cjson_document_make_array(doc);
+        for (i=0; i<keys; i++) cjson_array_push_move(array, make_record(doc, i));
+        report("docbuild", keys, now_ms()-t);
+        t = now_ms();
+        cjson_document_free(doc);
+        report("docfree", keys, now_ms()-t);
+
+        t = now_ms();
+        doc = cjson_document_create(0);
+        cjson_document_intern_keys(doc);
+        array = cjson_document_make_array(doc);
+        for (i=0; i<keys; i++) cjson_array_push_move(array, make_record(doc, i));
+        cjson_document_free(doc);
+        report("docintern", keys, now_ms()-t);
+
+        if (keys > max_keys/10) break;
+    }
+
+    void** records = malloc(sizeof(records[0]) * ALLOC_RECORDS_MAX * 2);
+    if (records)
+    {
+        struct cjson_document* docs[2] = {cjson_document_create(0), cjson_document_create(0)};
+        cjson_document_intern_keys(docs[1]);
+        printf("cjson allocs %u records: %u, document %u, interned %u\n", ALLOC_RECORDS,
+               count_allocations(NULL, records), count_allocations(docs[0], records),
+               count_allocations(docs[1], records));
+        cjson_document_free(docs[0]);
+        cjson_document_free(docs[1]);
+        free(records);
+    }
+
+    for (i=0; i<max_keys; i++) cjson_release(names[i]);
+    cjson_release(value);
+    free(names);
+    return 0;
+}
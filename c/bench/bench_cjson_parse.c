@@ -0,0 +1,218 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * bench_cjson_parse <corpus.json> [iterations] [threads]
+ *
+ * Parses one JSON document iterations times with cjson_parser, "parse" into reference
+ * counted values released after each run, "docparse" into a cjson_document freed after
+ * each run, "analyze" as the code segment of a runtime with cjson_source_analyze. "todybuf"
+ * writes the parsed document as JSON-dybuf, "fromdybuf" reads that back into
+ * a cjson_document freed after each run. Then
+ * 1, 2, 4, ... threads parse it at the same time, each with its own parser and documents,
+ * "threadsN" gives the total throughput of N threads.
+ * Output lines:  cjson <op> <ms/op> <MB/s of JSON text>
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "cjson_parser.h"
+#include "cjson_runtime.h"
+#include "cjson_dybuf.h"
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static char* read_file(const char* path, unsigned int* size)
+{
+    FILE* fp = fopen(path, "rb");
+    char* data;
+    long length;
+
+    if (fp == NULL) return NULL;
+    fseek(fp, 0, SEEK_END);
+    length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = (char*)malloc((size_t)length+1);
+    if (data && fread(data, 1, (size_t)length, fp) != (size_t)length)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    if (data) data[length] = 0;
+    *size = (unsigned int)length;
+    return data;
+}
+
+static const char* text;
+static unsigned int text_size;
+static unsigned int iterations;
+
+static void report(const char* op, double ms, unsigned int runs)
+{
+    printf("cjson %-10s %10.3f %10.1f\n", op, ms/runs, ms > 0 ? text_size/1048576.0*runs/(ms/1000.0) : 0.0);
+}
+
+static int parse_runs(struct cjson_parser* parser, boolean document)
+{
+    unsigned int i;
+
+    for (i=0; i<iterations; i++)
+    {
+        struct cjson_document* doc = document ? cjson_document_create(0) : NULL;
+        struct jsobj* value;
+
+        if (cjson_parser_parse(parser, doc, text, text_size, &value) != jserr_no_error)
+        {
+            printf("cjson parse error at %u\n", cjson_parser_error_offset(parser));
+            cjson_document_free(doc);
+            return 0;
+        }
+        if (doc) cjson_document_free(doc);
+        else cjson_release(value);
+    }
+    return 1;
+}
+
+static void* parse_thread(void* arg)
+{
+    struct cjson_parser* parser = cjson_parser_create();
+    long ok = parse_runs(parser, true);
+
+    (void)arg;
+    cjson_parser_release(parser);
+    return (void*)ok;
+}
+
+int main(int argc, char** argv)
+{
+    struct cjson_parser* parser;
+    struct cjson_rt_context* ctx;
+    pthread_t* threads;
+    unsigned int max_threads, count, i;
+    double start;
+
+    if (argc < 2)
+    {
+        printf("usage: %s <corpus.json> [iterations] [threads]\n", argv[0]);
+        return 1;
+    }
+    text = read_file(argv[1], &text_size);
+    if (text == NULL)
+    {
+        printf("cannot read %s\n", argv[1]);
+        return 1;
+    }
+    iterations = argc > 2 ? (unsigned int)atoi(argv[2]) : 100;
+    max_threads = argc > 3 ? (unsigned int)atoi(argv[3]) : 4;
+    if (iterations == 0) iterations = 1;
+    if (max_threads == 0) max_threads = 1;
+
+    parser = cjson_parser_create();
+    start = now_ms();
+    if (!parse_runs(parser, false)) return 1;
+    report("parse", now_ms() - start, iterations);
+    start = now_ms();
+    if (!parse_runs(parser, true)) return 1;
+    report("docparse", now_ms() - start, iterations);
+    ctx = cjson_rt_context_create();
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        enum jserr err;
+
+        cjson_rt_push_new_runtime(ctx);
+        err = cjson_source_push_from_buffer(ctx, text, text_size);
+        if (err == jserr_no_error) err = cjson_source_analyze(ctx);
+        cjson_release(cjson_rt_pop_last_runtime(ctx));
+        if (err != jserr_no_error)
+        {
+            printf("cjson analyze error %d\n", err);
+            return 1;
+        }
+    }
+    report("analyze", now_ms() - start, iterations);
+    cjson_rt_context_release(ctx);
+
+    {
+        struct cjson_document* doc = cjson_document_create(0);
+        dybuf* packed = dyb_create(NULL, text_size);
+        struct jsobj *value, *copy;
+
+        if (cjson_parser_parse(parser, doc, text, text_size, &value) != jserr_no_error) return 1;
+        start = now_ms();
+        for (i=0; i<iterations; i++)
+        {
+            dyb_set_position(packed, 0);
+            if (cjson_to_dybuf(value, packed) != jserr_no_error)
+            {
+                printf("cjson todybuf error\n");
+                return 1;
+            }
+        }
+        report("todybuf", now_ms() - start, iterations);
+        start = now_ms();
+        for (i=0; i<iterations; i++)
+        {
+            struct cjson_document* copy_doc = cjson_document_create(0);
+            dyb_set_position(packed, 0);
+            if (cjson_from_dybuf(packed, copy_doc, &copy) != jserr_no_error)
+            {
+                printf("cjson fromdybuf error\n");
+                return 1;
+            }
+            cjson_document_free(copy_doc);
+        }
+        report("fromdybuf", now_ms() - start, iterations);
+        dyb_release(packed);
+        cjson_document_free(doc);
+    }
+    cjson_parser_release(parser);
+
+    threads = (pthread_t*)malloc(sizeof(pthread_t)*max_threads);
+    for (count=1; count<=max_threads; count*=2)
+    {
+        char op[32];
+        int ok = 1;
+
+        start = now_ms();
+        for (i=0; i<count; i++) pthread_create(&threads[i], NULL, parse_thread, NULL);
+        for (i=0; i<count; i++)
+        {
+            void* result;
+            pthread_join(threads[i], &result);
+            if (result == NULL) ok = 0;
+        }
+        if (!ok) return 1;
+        sprintf(op, "threads%u", count);
+        report(op, now_ms() - start, iterations*count);
+    }
+    free(threads);
+    free((void*)text);
+    return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * bench_dyjson <corpus.json> [iterations] [threads]
+ *
+ * Times JSON-dybuf encode/decode of one JSON document with the dybuf_json library, and
+ * the conversions between JSON text and JSON-dybuf that build no values. "query" opens a
+ * view and reads the last item of the last root member, the rest of the payload is skipped.
+ * "lookup" reads LOOKUPS items of that member at random per view, "index" records the items
+ * of the document first and "indexed" does both. "stream" compares the records written as
+ * separate documents in version 1 and with shared dictionaries, "canonical" the size with
+ * frequency ordered dictionaries. "encode3" and "decode3" write and read arrays of objects
+ * by column (version 3). "encode1x" and "encodeNx" time the record array alone (the root
+ * when it is an array) with dyj_encode and with dyj_encode_parallel on N threads.
+ * Output lines have the same shape as the JavaScript and Python runs of
+ * tools/bench_json_dybuf.sh:  <impl> <op> <ms/op> <MB/s of JSON text>
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dyjson.h"
+
+#define LOOKUPS                 200
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static char* read_file(const char* path, uint* size)
+{
+    FILE* fp = fopen(path, "rb");
+    char* data;
+    long length;
+
+    if (fp == NULL) return NULL;
+    fseek(fp, 0, SEEK_END);
+    length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = (char*)malloc((size_t)length+1);
+    if (data && fread(data, 1, (size_t)length, fp) != (size_t)length)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    if (data) data[length] = 0;
+    *size = (uint)length;
+    return data;
+}
+
+// view of the last member of an object root, where the corpus keeps its records
+static enum dyj_err open_records(dyj_viewer* viewer, dybuf* in, boolean index, dyj_view* records)
+{
+    dyj_view root;
+    enum dyj_err err;
+
+    dyb_set_position(in, 0);
+    err = dyj_viewer_open(viewer, in, &root);
+    if (err == dyj_err_none && index) err = dyj_viewer_index(viewer, &root);
+    if (err == dyj_err_none && root.type == dyj_object && root.u.c.size)
+    {
+        return dyj_view_member(&root, root.u.c.size-1, null, null, records);
+    }
+    *records = root;
+    return err;
+}
+
+static enum dyj_err lookup_records(const dyj_view* records, uint seed)
+{
+    dyj_view item, value;
+    enum dyj_err err = dyj_err_none;
+    uint i;
+
+    if (records->type != dyj_array || records->u.c.size == 0) return dyj_err_none;
+    for (i=0; i<LOOKUPS && err == dyj_err_none; i++)
+    {
+        seed = seed*1103515245U + 12345U;
+        err = dyj_view_at(records, (seed>>8) % records->u.c.size, &item);
+        if (err == dyj_err_none && item.type == dyj_object && item.u.c.size)
+        {
+            err = dyj_view_member(&item, item.u.c.size-1, null, null, &value);
+        }
+    }
+    return err;
+}
+
+static void report(const char* op, double total_ms, int iterations, uint text_size)
+{
+    double per_op = total_ms/iterations;
+    printf("c %-8s %10.3f ms/op %10.1f MB/s\n", op, per_op, text_size/1048576.0/(per_op/1000.0));
+}
+
+int main(int argc, char** argv)
+{
+    uint text_size = 0, encoded_size = 0;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20, threads = argc > 3 ? atoi(argv[3]) : 4, i, j;
+    char* text;
+    dyj_document doc, out_doc;
+    dyj_value* value;
+    dyj_value* decoded = NULL;
+    dyj_writer* writer;
+    dyj_viewer* viewer;
+    dyj_view root, view;
+    dybuf *out, *out1;
+    enum dyj_err err;
+    double start;
+
+    if (argc < 2 || iterations <= 0 || threads <= 0)
+    {
+        fprintf(stderr, "Usage: %s <corpus.json> [iterations] [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    text = read_file(argv[1], &text_size);
+    if (text == NULL)
+    {
+        fprintf(stderr, "Failed to read %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    dyj_document_init(&doc);
+    dyj_document_init(&out_doc);
+    out = dyb_create(null, 1024);
+    out1 = dyb_create(null, 1024);
+    writer = dyj_writer_create();
+    viewer = dyj_viewer_create();
+
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        dyj_document_reset(&doc);
+        err = dyj_parse_text(&doc, text, text_size, &value);
+        if (err != dyj_err_none)
+        {
+            fprintf(stderr, "parse: %s\n", dyj_err_string(err));
+            return EXIT_FAILURE;
+        }
+    }
+    report("parse", now_ms()-start, iterations, text_size);
+
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        dyb_clear(out);
+        err = dyj_encode(out, value);
+        if (err != dyj_err_none)
+        {
+            fprintf(stderr, "encode: %s\n", dyj_err_string(err));
+            return EXIT_FAILURE;
+        }
+    }
+    report("encode", now_ms()-start, iterations, text_size);
+    dyb_flip(out);
+    encoded_size = dyb_get_limit(out);
+
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        dyb_clear(out1);
+        err = dyj_write_value(writer, value);
+        if (err == dyj_err_none) err = dyj_writer_finish(writer, out1);
+        else dyj_writer_reset(writer);
+        if (err != dyj_err_none)
+        {
+            fprintf(stderr, "encode1: %s\n", dyj_err_string(err));
+            return EXIT_FAILURE;
+        }
+    }
+    report("encode1", now_ms()-start, iterations, text_size);
+    if (dyb_get_position(out1) != encoded_size || memcmp(out1->_data, out->_data, encoded_size) != 0)
+    {
+        fprintf(stderr, "single-pass output differs from dyj_encode\n");
+        return EXIT_FAILURE;
+    }
+
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        dyb_clear(out1);
+        err = dyj_transcode_text(writer, text, text_size, out1);
+        if (err != dyj_err_none)
+        {
+            fprintf(stderr, "transcode: %s\n", dyj_err_string(err));
+            return EXIT_FAILURE;
+        }
+    }
+    report("transcode", now_ms()-start, iterations, text_size);
+    if (dyb_get_position(out1) != encoded_size || memcmp(out1->_data, out->_data, encoded_size) != 0)
+    {
+        fprintf(stderr, "transcoded output differs from dyj_encode\n");
+        return EXIT_FAILURE;
+    }
+
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        dyb_set_position(out, 0);
+        dyj_document_reset(&out_doc);
+        err = dyj_decode(out, &out_doc, &decoded);
+        if (err != dyj_err_none)
+        {
+            fprintf(stderr, "decode: %s\n", dyj_err_string(err));
+            return EXIT_FAILURE;
+        }
+    }
+    report("decode", now_ms()-start, iterations, text_size);
+
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        dyb_set_position(out, 0);
+        dyb_clear(out1);
+        err = dyj_emit_text(out, out1);
+        if (err != dyj_err_none)
+        {
+            fprintf(stderr, "emit: %s\n", dyj_err_string(err));
+            return EXIT_FAILURE;
+        }
+    }
+    report("emit", now_ms()-start, iterations, text_size);
+
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        dyb_set_position(out, 0);
+        err = dyj_viewer_open(viewer, out, &root);
+        if (err == dyj_err_none && root.type == dyj_object && root.u.c.size)
+        {
+            err = dyj_view_member(&root, root.u.c.size-1, null, null, &view);
+            if (err == dyj_err_none && view.type == dyj_array && view.u.c.size)
+            {
+                err = dyj_view_at(&view, view.u.c.size-1, &view);
+            }
+        }
+        if (err != dyj_err_none)
+        {
+            fprintf(stderr, "query: %s\n", dyj_err_string(err));
+            return EXIT_FAILURE;
+        }
+    }
+    report("query", now_ms()-start, iterations, text_size);
+
+    for (j=0; j<3; j++)
+    {
+        static const char* ops[] = {"lookup", "index", "indexed"};
+        start = now_ms();
+        for (i=0; i<iterations; i++)
+        {
+            err = open_records(viewer, out, j > 0, &view);
+            if (err == dyj_err_none && j != 1) err = lookup_records(&view, (uint)i);
+            if (err != dyj_err_none)
+            {
+                fprintf(stderr, "%s: %s\n", ops[j], dyj_err_string(err));
+                return EXIT_FAILURE;
+            }
+        }
+        report(ops[j], now_ms()-start, iterations, text_size);
+    }
+    dyj_document_reset(&doc);
+    if (dyj_parse_text(&doc, (const char*)out1->_data, dyb_get_position(out1), &value) != dyj_err_none)
+    {
+        fprintf(stderr, "emitted text does not parse\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!dyj_equal(value, decoded))
+    {
+        fprintf(stderr, "decoded value differs from the corpus\n");
+        return EXIT_FAILURE;
+    }
+    printf("c size     json %u bytes, dybuf %u bytes\n", text_size, encoded_size);
+    dyb_clear(out1);
+    err = dyj_encode_canonical(out1, decoded);
+    if (err != dyj_err_none)
+    {
+        fprintf(stderr, "canonical: %s\n", dyj_err_string(err));
+        return EXIT_FAILURE;
+    }
+    printf("c canonical dybuf %u bytes (%+.2f%%)\n", dyb_get_position(out1),
+           (dyb_get_position(out1) - (double)encoded_size)*100.0/encoded_size);
+
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        dyb_clear(out1);
+        err = dyj_encode_columnar(out1, decoded);
+        if (err != dyj_err_none)
+        {
+            fprintf(stderr, "encode3: %s\n", dyj_err_string(err));
+            return EXIT_FAILURE;
+        }
+    }
+    report("encode3", now_ms()-start, iterations, text_size);
+    dyb_flip(out1);
+    start = now_ms();
+    for (i=0; i<iterations; i++)
+    {
+        dyb_set_position(out1, 0);
+        dyj_document_reset(&doc);
+        err = dyj_decode(out1, &doc, &value);
+        if (err != dyj_err_none)
+        {
+            fprintf(stderr, "decode3: %s\n", dyj_err_string(err));
+            return EXIT_FAILURE;
+        }
+    }
+    report("decode3", now_ms()-start, iterations, text_size);
+    if (!dyj_equal(value, decoded))
+    {
+        fprintf(stderr, "columnar value differs from the corpus\n");
+        return EXIT_FAILURE;
+    }
+    printf("c columnar dybuf %u bytes (%+.2f%%)\n", dyb_get_limit(out1),
+           (dyb_get_limit(out1) - (double)encoded_size)*100.0/encoded_size);
+
+    value = decoded;
+    if (value->type == dyj_object && value->u.o.size) value = value->u.o.members[value->u.o.size-1].value;
+    if (value->type == dyj_array)
+    {
+        char op[24];
+        for (j=0; j<2; j++)
+        {
+            snprintf(op, sizeof(op), "encode%dx", j ? threads : 1);
+            start = now_ms();
+            for (i=0; i<iterations; i++)
+            {
+                dybuf* target = j ? out1 : out;
+                dyb_clear(target);
+                err = j ? dyj_encode_parallel(target, value, (uint)threads) : dyj_encode(target, value);
+                if (err != dyj_err_none)
+                {
+                    fprintf(stderr, "%s: %s\n", op, dyj_err_string(err));
+                    return EXIT_FAILURE;
+                }
+            }
+            report(op, now_ms()-start, iterations, text_size);
+        }
+        if (dyb_get_position(out1) != dyb_get_position(out) ||
+            memcmp(out1->_data, out->_data, dyb_get_position(out)) != 0)
+        {
+            fprintf(stderr, "parallel output differs from dyj_encode\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (decoded->type == dyj_object && decoded->u.o.size)
+    {
+        const dyj_value* records = decoded->u.o.members[decoded->u.o.size-1].value;
+        dyj_dict_cache* cache = dyj_dict_cache_create();
+        uint count = records->type == dyj_array ? records->u.a.size : 0, size0 = 0, size1 = 0;
+
+        dyj_writer_share_dictionaries(writer, 1);
+        for (i=0; i<(int)count; i++)
+        {
+            dyb_clear(out);
+            dyj_encode(out, records->u.a.items[i]);
+            size0 += dyb_get_position(out);
+            dyb_clear(out1);
+            dyj_write_value(writer, records->u.a.items[i]);
+            err = dyj_writer_finish(writer, out1);
+            size1 += dyb_get_position(out1);
+            dyb_flip(out1);
+            dyj_document_reset(&doc);
+            if (err == dyj_err_none) err = dyj_decode_shared(out1, cache, &doc, &value);
+            if (err != dyj_err_none || !dyj_equal(value, records->u.a.items[i]))
+            {
+                fprintf(stderr, "stream: %s\n", dyj_err_string(err));
+                return EXIT_FAILURE;
+            }
+        }
+        printf("c stream   %u docs, version 1 %u bytes, shared %u bytes\n", count, size0, size1);
+        dyj_dict_cache_release(cache);
+    }
+
+    dyb_release(out);
+    dyb_release(out1);
+    dyj_writer_release(writer);
+    dyj_viewer_release(viewer);
+    dyj_document_release(&out_doc);
+    dyj_document_release(&doc);
+    free(text);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * bench_numbers [count]
+ *
+ * Times number text conversion on count (default 1000000) random finite doubles and
+ * 64-bit ints. "parse17" reads doubles printed with 17 digits and "parse" doubles printed
+ * shortest, with dyj_parse_number and, as "strtod17"/"strtod", with strtod. "parseint"
+ * reads the ints, "strtoll" with strtoll. "format" prints the doubles with
+ * dyj_format_double, "printf17" with "%.17g".
+ * Output lines:  number <op> <ms> <ns/number>
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dyjson.h"
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static uint64 random_state = 88172645463325252ULL;
+
+static uint64 random_u64(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static void report(const char* op, double ms, uint count)
+{
+    printf("number %-10s %10.3f %8.1f\n", op, ms, ms*1000000.0/count);
+}
+
+int main(int argc, char** argv)
+{
+    uint count = argc > 1 ? (uint)atoi(argv[1]) : 1000000, n, i;
+    double* values;
+    char (*texts17)[32], (*texts)[DYJ_DOUBLE_BUFFER_SIZE], (*ints)[24];
+    char buffer[32];
+    double sum = 0, start;
+    int64 isum = 0;
+
+    if (count == 0) count = 1;
+    values = (double*)malloc(sizeof(double)*count);
+    texts17 = malloc(sizeof(*texts17)*count);
+    texts = malloc(sizeof(*texts)*count);
+    ints = malloc(sizeof(*ints)*count);
+    for (n=0; n<count; )
+    {
+        uint64 bits = random_u64();
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        if (d != d || d - d != 0) continue;
+        values[n] = d;
+        sprintf(texts17[n], "%.17g", d);
+        dyj_format_double(d, texts[n]);
+        sprintf(ints[n], "%lld", (long long)random_u64() >> (random_u64() % 63));
+        n++;
+    }
+
+    start = now_ms();
+    for (i=0; i<count; i++)
+    {
+        boolean integer;
+        int64 v;
+        double d;
+        dyj_parse_number(texts17[i], texts17[i] + strlen(texts17[i]), &integer, &v, &d);
+        sum += d;
+    }
+    report("parse17", now_ms() - start, count);
+    start = now_ms();
+    for (i=0; i<count; i++) sum += strtod(texts17[i], NULL);
+    report("strtod17", now_ms() - start, count);
+
+    start = now_ms();
+    for (i=0; i<count; i++)
+    {
+        boolean integer;
+        int64 v;
+        double d;
+        dyj_parse_number(texts[i], texts[i] + strlen(texts[i]), &integer, &v, &d);
+        sum += d;
+    }
+    report("parse", now_ms() - start, count);
+    start = now_ms();
+    for (i=0; i<count; i++) sum += strtod(texts[i], NULL);
+    report("strtod", now_ms() - start, count);
+
+    start = now_ms();
+    for (i=0; i<count; i++)
+    {
+        boolean integer;
+        int64 v;
+        double d;
+        dyj_parse_number(ints[i], ints[i] + strlen(ints[i]), &integer, &v, &d);
+        isum += v;
+    }
+    report("parseint", now_ms() - start, count);
+    start = now_ms();
+    for (i=0; i<count; i++) isum += strtoll(ints[i], NULL, 10);
+    report("strtoll", now_ms() - start, count);
+
+    start = now_ms();
+    for (i=0; i<count; i++) isum += dyj_format_double(values[i], buffer);
+    report("format", now_ms() - start, count);
+    start = now_ms();
+    for (i=0; i<count; i++) isum += sprintf(buffer, "%.17g", values[i]);
+    report("printf17", now_ms() - start, count);
+
+    // keep the results alive
+    if (sum == 1.5 && isum == 3) printf("%g\n", sum);
+    free(values);
+    free(texts17);
+    free(texts);
+    free(ints);
+    return 0;
+}
@@ -72,6 +72,111 @@ dyb_inline void dyb_mem_move(void* dest, void* src, uint size)
     plat_mem_move(dest, src, size);
 }
 
+/**
+ *  Arena, a bump-pointer allocator for memory that is released together,
+ *  e.g. all strings decoded from one packet.
+ *  Allocations are 8-byte aligned, dyb_arena_reset keeps one chunk for the next round.
+ */
+#define DYB_ARENA_ALIGN         8U
+#define DYB_ARENA_CHUNK_SIZE    4096U
+
+typedef struct dyb_arena_chunk
+{
+    struct dyb_arena_chunk* next;           // older chunk
+    uint capacity;
+    uint used;
+} dyb_arena_chunk;
+
+typedef struct dyb_arena
+{
+    dyb_arena_chunk* head;                  // current chunk
+    uint chunk_size;
+    uint used;                              // bytes handed out since last reset
+    uint peak;                              // max used of all rounds
+    uint reserved;                          // bytes of chunks held
+} dyb_arena;
+
+#define DYB_ARENA_HEADER_SIZE   ((uint)((sizeof(dyb_arena_chunk)+DYB_ARENA_ALIGN-1) & ~(DYB_ARENA_ALIGN-1)))
+
+dyb_inline dyb_arena* dyb_arena_init(dyb_arena* arena, uint chunk_size)
+{
+    plat_mem_set(arena, 0, sizeof(*arena));
+    arena->chunk_size = chunk_size ? chunk_size : DYB_ARENA_CHUNK_SIZE;
+    return arena;
+}
+
+dyb_inline void* dyb_arena_alloc(dyb_arena* arena, uint size)
+{
+    dyb_arena_chunk* chunk = arena->head;
+    uint aligned = (size + DYB_ARENA_ALIGN-1) & ~(DYB_ARENA_ALIGN-1);
+    uint8* mem;
+
+    if (aligned < size) return null;        // overflow
+    if (chunk == null || chunk->capacity - chunk->used < aligned)
+    {
+        uint capacity = MAX(arena->chunk_size, aligned);
+        uint alloc_size = DYB_ARENA_HEADER_SIZE + capacity;
+        if (alloc_size < capacity) return null;
+        chunk = (dyb_arena_chunk*)dyb_mem_alloc(&alloc_size, false);
+        if (chunk == null) return null;
+        chunk->capacity = capacity;
+        chunk->used = 0;
+        chunk->next = arena->head;
+        arena->head = chunk;
+        arena->reserved += alloc_size;
+    }
+
+    mem = (uint8*)chunk + DYB_ARENA_HEADER_SIZE + chunk->used;
+    chunk->used += aligned;
+    arena->used += aligned;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    return mem;
+}
+
+dyb_inline void* dyb_arena_copy(dyb_arena* arena, const void* data, uint size)
+{
+    void* mem = dyb_arena_alloc(arena, size);
+    if (mem) plat_mem_copy(mem, data, size);
+    return mem;
+}
+
+/**
+ *  Release all allocations at once, the newest chunk is kept for reuse.
+ */
+dyb_inline dyb_arena* dyb_arena_reset(dyb_arena* arena)
+{
+    dyb_arena_chunk* chunk = arena->head;
+    if (chunk)
+    {
+        dyb_arena_chunk* next = chunk->next;
+        chunk->next = null;
+        chunk->used = 0;
+        arena->reserved = DYB_ARENA_HEADER_SIZE + chunk->capacity;
+        while (next)
+        {
+            chunk = next;
+            next = chunk->next;
+            dyb_mem_release(chunk, 0);
+        }
+    }
+    arena->used = 0;
+    return arena;
+}
+
+dyb_inline void dyb_arena_release(dyb_arena* arena)
+{
+    dyb_arena_chunk* chunk = arena->head;
+    while (chunk)
+    {
+        dyb_arena_chunk* next = chunk->next;
+        dyb_mem_release(chunk, 0);
+        chunk = next;
+    }
+    arena->head = null;
+    arena->used = 0;
+    arena->reserved = 0;
+}
+
 dyb_inline uint32 dyb_swap_u32(uint32 value)
 {
     union{
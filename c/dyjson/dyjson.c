@@ -0,0 +1,1138 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "dyjson_private.h"
+
+
+/// ========== document, values
+
+dyj_document* dyj_document_init(dyj_document* doc)
+{
+    dyb_arena_init(&doc->arena, 0);
+    return doc;
+}
+
+void dyj_document_reset(dyj_document* doc)
+{
+    dyb_arena_reset(&doc->arena);
+}
+
+void dyj_document_release(dyj_document* doc)
+{
+    dyb_arena_release(&doc->arena);
+}
+
+static inline dyj_value* dyj_make(dyj_document* doc, enum dyj_type type)
+{
+    dyj_value* value = (dyj_value*)dyb_arena_alloc(&doc->arena, sizeof(dyj_value));
+    if (value == null) return null;
+    value->type = type;
+    return value;
+}
+
+dyj_value* dyj_make_null(dyj_document* doc)
+{
+    return dyj_make(doc, dyj_null);
+}
+
+dyj_value* dyj_make_bool(dyj_document* doc, boolean value)
+{
+    dyj_value* v = dyj_make(doc, dyj_bool);
+    if (v) v->u.b = value ? true : false;
+    return v;
+}
+
+dyj_value* dyj_make_int(dyj_document* doc, int64 value)
+{
+    dyj_value* v = dyj_make(doc, dyj_int);
+    if (v) v->u.i = value;
+    return v;
+}
+
+dyj_value* dyj_make_double(dyj_document* doc, double value)
+{
+    dyj_value* v = dyj_make(doc, dyj_double);
+    if (v) v->u.d = value;
+    return v;
+}
+
+dyj_value* dyj_make_string(dyj_document* doc, const char* data, uint size)
+{
+    dyj_value* v = dyj_make(doc, dyj_string);
+    char* copy;
+    if (v == null) return null;
+    copy = (char*)dyb_arena_alloc(&doc->arena, size+1);
+    if (copy == null) return null;
+    if (size) dyb_mem_copy(copy, (void*)data, size);
+    copy[size] = 0;
+    v->u.s.data = copy;
+    v->u.s.size = size;
+    return v;
+}
+
+dyj_value* dyj_make_array(dyj_document* doc, uint capacity)
+{
+    dyj_value* v = dyj_make(doc, dyj_array);
+    if (v == null) return null;
+    v->u.a.size = 0;
+    v->u.a.capacity = capacity;
+    v->u.a.items = null;
+    if (capacity)
+    {
+        v->u.a.items = (dyj_value**)dyb_arena_alloc(&doc->arena, capacity*sizeof(dyj_value*));
+        if (v->u.a.items == null) return null;
+    }
+    return v;
+}
+
+dyj_value* dyj_make_object(dyj_document* doc, uint capacity)
+{
+    dyj_value* v = dyj_make(doc, dyj_object);
+    if (v == null) return null;
+    v->u.o.size = 0;
+    v->u.o.capacity = capacity;
+    v->u.o.members = null;
+    v->u.o.index = null;
+    if (capacity)
+    {
+        v->u.o.members = (dyj_member*)dyb_arena_alloc(&doc->arena, capacity*sizeof(dyj_member));
+        if (v->u.o.members == null) return null;
+    }
+    return v;
+}
+
+// arena memory can't be resized, copy to a twice larger block
+static void* dyj_arena_grow(dyj_document* doc, void* items, uint size, uint* capacity, uint item_size)
+{
+    uint new_capacity = MAX(4U, (*capacity)*2);
+    void* new_items = dyb_arena_alloc(&doc->arena, new_capacity*item_size);
+    if (new_items == null) return null;
+    if (size) dyb_mem_copy(new_items, items, size*item_size);
+    *capacity = new_capacity;
+    return new_items;
+}
+
+enum dyj_err dyj_array_push(dyj_document* doc, dyj_value* array, dyj_value* item)
+{
+    if (array == null || item == null || array->type != dyj_array) return dyj_err_invalid_args;
+    if (array->u.a.size == array->u.a.capacity)
+    {
+        dyj_value** items = (dyj_value**)dyj_arena_grow(doc, array->u.a.items, array->u.a.size,
+                                                        &array->u.a.capacity, sizeof(dyj_value*));
+        if (items == null) return dyj_err_no_memory;
+        array->u.a.items = items;
+    }
+    array->u.a.items[array->u.a.size++] = item;
+    return dyj_err_none;
+}
+
+// index slots hold member position+1, 0 is empty, at least twice the capacity so probes stay short
+static inline uint dyj_object_slots(uint capacity)
+{
+    uint slots = 2*DYJ_OBJECT_INDEX_MIN;
+    while (slots < capacity*2) slots <<= 1;
+    return slots;
+}
+
+static void dyj_object_index_add(dyj_value* object, uint position)
+{
+    dyj_member* m = &object->u.o.members[position];
+    uint mask = dyj_object_slots(object->u.o.capacity)-1;
+    uint slot = dyj_hash_bytes(m->key, m->key_size) & mask;
+    while (object->u.o.index[slot]) slot = (slot+1) & mask;
+    object->u.o.index[slot] = position+1;
+}
+
+// without memory for the index the object stays unindexed and find scans the members
+static void dyj_object_index(dyj_document* doc, dyj_value* object)
+{
+    uint slots = dyj_object_slots(object->u.o.capacity), i;
+    object->u.o.index = (uint*)dyb_arena_alloc(&doc->arena, slots*sizeof(uint));
+    if (object->u.o.index == null) return;
+    memset(object->u.o.index, 0, slots*sizeof(uint));
+    for (i=0; i<object->u.o.size; i++) dyj_object_index_add(object, i);
+}
+
+static inline dyj_member* dyj_object_find(const dyj_value* object, const char* key, uint key_size)
+{
+    uint i;
+    if (object->u.o.index)
+    {
+        uint mask = dyj_object_slots(object->u.o.capacity)-1;
+        uint slot = dyj_hash_bytes(key, key_size) & mask;
+        while ((i = object->u.o.index[slot]) != 0)
+        {
+            dyj_member* m = &object->u.o.members[i-1];
+            if (m->key_size == key_size && memcmp(m->key, key, key_size) == 0) return m;
+            slot = (slot+1) & mask;
+        }
+        return null;
+    }
+    for (i=0; i<object->u.o.size; i++)
+    {
+        dyj_member* m = &object->u.o.members[i];
+        if (m->key_size == key_size && memcmp(m->key, key, key_size) == 0) return m;
+    }
+    return null;
+}
+
+enum dyj_err dyj_object_put(dyj_document* doc, dyj_value* object, const char* key, uint key_size, dyj_value* value)
+{
+    dyj_member* m;
+    char* copy;
+
+    if (object == null || key == null || value == null || object->type != dyj_object) return dyj_err_invalid_args;
+    m = dyj_object_find(object, key, key_size);
+    if (m)
+    {
+        m->value = value;
+        return dyj_err_none;
+    }
+    if (object->u.o.size == object->u.o.capacity)
+    {
+        dyj_member* members = (dyj_member*)dyj_arena_grow(doc, object->u.o.members, object->u.o.size,
+                                                           &object->u.o.capacity, sizeof(dyj_member));
+        if (members == null) return dyj_err_no_memory;
+        object->u.o.members = members;
+        // the slot count depends on the capacity, rebuilt below
+        object->u.o.index = null;
+    }
+    copy = (char*)dyb_arena_alloc(&doc->arena, key_size+1);
+    if (copy == null) return dyj_err_no_memory;
+    if (key_size) dyb_mem_copy(copy, (void*)key, key_size);
+    copy[key_size] = 0;
+    m = &object->u.o.members[object->u.o.size++];
+    m->key = copy;
+    m->key_size = key_size;
+    m->value = value;
+    if (object->u.o.index) dyj_object_index_add(object, object->u.o.size-1);
+    else if (object->u.o.size >= DYJ_OBJECT_INDEX_MIN) dyj_object_index(doc, object);
+    return dyj_err_none;
+}
+
+dyj_value* dyj_object_get(const dyj_value* object, const char* key, uint key_size)
+{
+    dyj_member* m;
+    if (object == null || object->type != dyj_object) return null;
+    m = dyj_object_find(object, key, key_size);
+    return m ? m->value : null;
+}
+
+boolean dyj_equal(const dyj_value* value0, const dyj_value* value1)
+{
+    uint i;
+
+    if (value0 == value1) return true;
+    if (value0 == null || value1 == null) return false;
+    // JSON has one number type
+    if (value0->type == dyj_int && value1->type == dyj_double) return (double)value0->u.i == value1->u.d;
+    if (value0->type == dyj_double && value1->type == dyj_int) return value0->u.d == (double)value1->u.i;
+    if (value0->type != value1->type) return false;
+
+    switch (value0->type)
+    {
+        case dyj_null:
+            return true;
+        case dyj_bool:
+            return value0->u.b == value1->u.b;
+        case dyj_int:
+            return value0->u.i == value1->u.i;
+        case dyj_double:
+            return value0->u.d == value1->u.d;
+        case dyj_string:
+            return value0->u.s.size == value1->u.s.size &&
+                   memcmp(value0->u.s.data, value1->u.s.data, value0->u.s.size) == 0;
+        case dyj_array:
+            if (value0->u.a.size != value1->u.a.size) return false;
+            for (i=0; i<value0->u.a.size; i++)
+            {
+                if (!dyj_equal(value0->u.a.items[i], value1->u.a.items[i])) return false;
+            }
+            return true;
+        case dyj_object:
+            // member order is not significant
+            if (value0->u.o.size != value1->u.o.size) return false;
+            for (i=0; i<value0->u.o.size; i++)
+            {
+                dyj_member* m = &value0->u.o.members[i];
+                if (!dyj_equal(m->value, dyj_object_get(value1, m->key, m->key_size))) return false;
+            }
+            return true;
+    }
+    return false;
+}
+
+const char* dyj_err_string(enum dyj_err err)
+{
+    switch (err)
+    {
+        case dyj_err_none: return "no error";
+        case dyj_err_no_memory: return "out of memory";
+        case dyj_err_invalid_args: return "invalid arguments";
+        case dyj_err_unsafe_integer: return "integer outside JavaScript safe integer range";
+        case dyj_err_non_finite: return "number must be finite";
+        case dyj_err_too_deep: return "nesting too deep";
+        case dyj_err_truncated: return "truncated JSON-dybuf data";
+        case dyj_err_bad_marker: return "missing JSON-dybuf TYPDEX_TYP_OBJ marker";
+        case dyj_err_bad_version: return "unsupported JSON-dybuf format version";
+        case dyj_err_bad_dictionary: return "malformed JSON-dybuf dictionary";
+        case dyj_err_missing_dictionary: return "missing JSON dictionary for path";
+        case dyj_err_bad_index: return "invalid key index in JSON object";
+        case dyj_err_bad_type: return "unsupported JSON typdex type";
+        case dyj_err_trailing_bytes: return "trailing bytes after JSON-dybuf payload";
+        case dyj_err_syntax: return "JSON syntax error";
+        case dyj_err_duplicate_key: return "duplicate key in JSON object";
+        case dyj_err_bad_state: return "JSON writer call out of order";
+        case dyj_err_io: return "failed to write JSON text";
+        case dyj_err_not_found: return "JSON-dybuf key or index not found";
+        case dyj_err_unknown_dictionary: return "shared JSON-dybuf dictionary set not registered";
+        case dyj_err_bad_column: return "malformed JSON-dybuf column";
+    }
+    return "unknown error";
+}
+
+
+/// ========== encoder
+
+/**
+ *  Pass 1 builds the dictionaries in traversal order (same order as the Python, Java and
+ *  JavaScript encoders, so the bytes are identical), records the key id of every member
+ *  and the payload size. Pass 2 writes the header and the payload without lookups.
+ *
+ *  The canonical mode renumbers every dictionary after pass 1: keys used by more members
+ *  come first, equal counts in byte order of the key. Dictionaries are written in byte
+ *  order of their path and members in key index order, so the bytes depend on the value
+ *  only, not on member order.
+ *
+ *  The columnar mode writes arrays of objects column by column, out of traversal order:
+ *  key indices are looked up instead of taken from member_keys, and out grows while
+ *  writing because pass 1 sized the row layout.
+ */
+#define DYJ_COLUMNAR_MIN_ROWS       4
+
+static inline uint8 dyj_value_typdex(const dyj_value* value)
+{
+    switch (value->type)
+    {
+        case dyj_null: return typdex_typ_none;
+        case dyj_bool: return typdex_typ_bool;
+        case dyj_int: return value->u.i < 0 ? typdex_typ_int : typdex_typ_uint;
+        case dyj_double: return typdex_typ_double;
+        case dyj_string: return typdex_typ_string;
+        case dyj_array: return typdex_typ_array;
+        case dyj_object: return typdex_typ_map;
+    }
+    return typdex_typ_none;
+}
+
+static inline boolean dyj_is_container(const dyj_value* value)
+{
+    return value->type == dyj_array || value->type == dyj_object;
+}
+
+enum dyj_err dyj_encode_collect(dyj_encoder* enc, const dyj_value* value, uint node, uint index, uint depth)
+{
+    enum dyj_err err;
+    uint i, id, child = DYJ_NONE;
+
+    enc->payload_size += dyj_typdex_size(dyj_value_typdex(value), index);
+    switch (value->type)
+    {
+        case dyj_null:
+            return dyj_err_none;
+        case dyj_bool:
+            enc->payload_size += 1;
+            return dyj_err_none;
+        case dyj_int:
+            if (value->u.i < DYJ_MIN_SAFE_INTEGER || value->u.i > DYJ_MAX_SAFE_INTEGER) return dyj_err_unsafe_integer;
+            enc->payload_size += value->u.i < 0 ? dyj_var_s64_size(value->u.i) : dyj_var_u64_size((uint64)value->u.i);
+            return dyj_err_none;
+        case dyj_double:
+            if (!isfinite(value->u.d)) return dyj_err_non_finite;
+            enc->payload_size += 8;
+            return dyj_err_none;
+        case dyj_string:
+            enc->payload_size += dyj_var_u64_size(value->u.s.size) + value->u.s.size;
+            return dyj_err_none;
+        case dyj_array:
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            enc->payload_size += dyj_var_u64_size(value->u.a.size);
+            for (i=0; i<value->u.a.size; i++)
+            {
+                const dyj_value* item = value->u.a.items[i];
+                if (dyj_is_container(item) && child == DYJ_NONE)
+                {
+                    child = dyj_dicts_array_child(&enc->dicts, node);
+                    if (child == DYJ_NONE) return dyj_err_no_memory;
+                }
+                err = dyj_encode_collect(enc, item, child, 0, depth+1);
+                if (err != dyj_err_none) return err;
+            }
+            return dyj_err_none;
+        case dyj_object:
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            if (!dyj_dicts_ensure_dictionary(&enc->dicts, node)) return dyj_err_no_memory;
+            enc->payload_size += dyj_var_u64_size(value->u.o.size);
+            // canonical writes keep 3 uint per member while the members are written
+            enc->scratch_count += 3*value->u.o.size;
+            if (enc->scratch_count < 3*value->u.o.size) return dyj_err_no_memory;
+            enc->scratch_peak = MAX(enc->scratch_peak, enc->scratch_count);
+            for (i=0; i<value->u.o.size; i++)
+            {
+                const dyj_member* m = &value->u.o.members[i];
+                id = dyj_dicts_intern(&enc->dicts, node, m->key, m->key_size, dyj_hash_bytes(m->key, m->key_size));
+                if (id == DYJ_NONE) return dyj_err_no_memory;
+                // nested objects append their keys in between, grow per member
+                if (!dyj_grow((void**)&enc->member_keys, &enc->member_capacity, enc->member_count+1, sizeof(uint)))
+                {
+                    return dyj_err_no_memory;
+                }
+                enc->member_keys[enc->member_count++] = id;
+                child = DYJ_NONE;
+                if (dyj_is_container(m->value))
+                {
+                    child = dyj_dicts_child(&enc->dicts, node, enc->dicts.keys[id].index);
+                    if (child == DYJ_NONE) return dyj_err_no_memory;
+                }
+                err = dyj_encode_collect(enc, m->value, child, enc->dicts.keys[id].index, depth+1);
+                if (err != dyj_err_none) return err;
+            }
+            enc->scratch_count -= 3*value->u.o.size;
+            return dyj_err_none;
+    }
+    return dyj_err_invalid_args;
+}
+
+/// canonical mode
+
+typedef int (*dyj_compare)(const void* context, uint item0, uint item1);
+
+// stable bottom-up merge sort, tmp holds count items
+static void dyj_sort(uint* items, uint* tmp, uint count, dyj_compare compare, const void* context)
+{
+    uint width, i, *from = items, *to = tmp, *swap;
+
+    for (width=1; width<count; width*=2)
+    {
+        for (i=0; i<count; i+=2*width)
+        {
+            uint left = i, middle = MIN(i+width, count), end = MIN(i+2*width, count), right = middle, k = i;
+            while (left < middle && right < end)
+            {
+                to[k++] = compare(context, from[right], from[left]) < 0 ? from[right++] : from[left++];
+            }
+            while (left < middle) to[k++] = from[left++];
+            while (right < end) to[k++] = from[right++];
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != items) dyb_mem_copy(items, from, count*sizeof(uint));
+}
+
+static int dyj_compare_bytes(const char* data0, uint size0, const char* data1, uint size1)
+{
+    int c = memcmp(data0, data1, MIN(size0, size1));
+    if (c != 0) return c;
+    return size0 < size1 ? -1 : (size0 > size1 ? 1 : 0);
+}
+
+typedef struct dyj_canonical_keys
+{
+    const dyj_dicts* dicts;
+    const uint* uses;
+} dyj_canonical_keys;
+
+// key ids: more uses first, then key bytes
+static int dyj_compare_keys(const void* context, uint id0, uint id1)
+{
+    const dyj_canonical_keys* c = (const dyj_canonical_keys*)context;
+    const dyj_dict_key* k0 = &c->dicts->keys[id0];
+    const dyj_dict_key* k1 = &c->dicts->keys[id1];
+
+    if (c->uses[id0] != c->uses[id1]) return c->uses[id0] > c->uses[id1] ? -1 : 1;
+    return dyj_compare_bytes(k0->data, k0->size, k1->data, k1->size);
+}
+
+typedef struct dyj_canonical_path
+{
+    const char* data;
+    uint size;
+} dyj_canonical_path;
+
+static int dyj_compare_paths(const void* context, uint i0, uint i1)
+{
+    const dyj_canonical_path* paths = (const dyj_canonical_path*)context;
+    return dyj_compare_bytes(paths[i0].data, paths[i0].size, paths[i1].data, paths[i1].size);
+}
+
+static int dyj_compare_uints(const void* context, uint i0, uint i1)
+{
+    const uint* values = (const uint*)context;
+    return values[i0] < values[i1] ? -1 : (values[i0] > values[i1] ? 1 : 0);
+}
+
+/**
+ *  Renumber the keys of every dictionary, move the child paths with their keys and sort
+ *  the dictionaries by path.
+ */
+static enum dyj_err dyj_encode_canonicalize(dyj_encoder* enc)
+{
+    dyj_dicts* dicts = &enc->dicts;
+    dyj_canonical_keys context;
+    dyj_canonical_path* paths = null;
+    dyb_arena path_strings;
+    char path[DYJ_PATH_BUFFER_SIZE];
+    uint *uses = null, *tmp = null, *children = null;
+    uint size, i, j, count = MAX(dicts->key_count, dicts->dict_count);
+    enum dyj_err err = dyj_err_no_memory;
+
+    dyb_arena_init(&path_strings, 0);
+    size = MAX(1U, dicts->key_count)*sizeof(uint);
+    uses = (uint*)dyb_mem_alloc(&size, false);
+    size = MAX(1U, count)*sizeof(uint);
+    tmp = (uint*)dyb_mem_alloc(&size, false);
+    children = (uint*)dyb_mem_alloc(&size, false);
+    size = MAX(1U, dicts->dict_count)*sizeof(dyj_canonical_path);
+    paths = (dyj_canonical_path*)dyb_mem_alloc(&size, false);
+    if (uses == null || tmp == null || children == null || paths == null) goto done;
+
+    plat_mem_set(uses, 0, dicts->key_count*sizeof(uint));
+    for (i=0; i<enc->member_count; i++) uses[enc->member_keys[i]]++;
+    context.dicts = dicts;
+    context.uses = uses;
+    for (i=0; i<dicts->dict_count; i++)
+    {
+        dyj_path_node* n = &dicts->nodes[dicts->order[i]];
+        dyj_sort(n->keys, tmp, n->key_count, dyj_compare_keys, &context);
+        if (n->key_count > n->children_capacity &&
+            !dyj_grow((void**)&n->children, &n->children_capacity, n->key_count, sizeof(uint))) goto done;
+        for (j=0; j<n->key_count; j++)
+        {
+            uint old_index = dicts->keys[n->keys[j]].index;
+            children[j] = old_index < n->children_capacity ? n->children[old_index] : 0;
+        }
+        for (j=0; j<n->key_count; j++)
+        {
+            dicts->keys[n->keys[j]].index = j;
+            n->children[j] = children[j];
+            if (children[j]) dicts->nodes[children[j]].step = j;
+        }
+    }
+
+    for (i=0; i<dicts->dict_count; i++)
+    {
+        paths[i].size = dyj_dicts_path(dicts, dicts->order[i], path, sizeof(path));
+        paths[i].data = (const char*)dyb_arena_copy(&path_strings, path, paths[i].size);
+        if (paths[i].size == 0 || paths[i].data == null) goto done;
+        children[i] = i;
+    }
+    dyj_sort(children, tmp, dicts->dict_count, dyj_compare_paths, paths);
+    for (i=0; i<dicts->dict_count; i++) tmp[i] = dicts->order[children[i]];
+    if (dicts->dict_count) dyb_mem_copy(dicts->order, tmp, dicts->dict_count*sizeof(uint));
+
+    // typdex sizes changed with the indices, reserve for the largest
+    enc->payload_size += 3*(uint64)enc->member_count;
+    if (!dyj_grow((void**)&enc->scratch, &enc->scratch_capacity, MAX(1U, enc->scratch_peak), sizeof(uint))) goto done;
+    err = dyj_err_none;
+
+done:
+    if (uses) dyb_mem_release(uses, 0);
+    if (tmp) dyb_mem_release(tmp, 0);
+    if (children) dyb_mem_release(children, 0);
+    if (paths) dyb_mem_release(paths, 0);
+    dyb_arena_release(&path_strings);
+    return err;
+}
+
+
+// members in key index order, the scratch is reserved by pass 1
+static void dyj_encode_write_canonical(dyj_encoder* enc, dybuf* out, const dyj_value* value, uint node)
+{
+    uint i, count = value->u.o.size, base = enc->scratch_count;
+    uint *order = enc->scratch + base, *indices = order + count;
+
+    for (i=0; i<count; i++)
+    {
+        const dyj_member* m = &value->u.o.members[i];
+        uint id = dyj_dicts_find(&enc->dicts, node, m->key, m->key_size, dyj_hash_bytes(m->key, m->key_size));
+        order[i] = i;
+        indices[i] = enc->dicts.keys[id].index;
+    }
+    dyj_sort(order, indices + count, count, dyj_compare_uints, indices);
+    enc->scratch_count += 3*count;
+    for (i=0; i<count; i++)
+    {
+        const dyj_value* member = value->u.o.members[order[i]].value;
+        uint key_index = indices[order[i]];
+        uint child = dyj_is_container(member) ? enc->dicts.nodes[node].children[key_index] : DYJ_NONE;
+        dyj_encode_write(enc, out, member, child, key_index);
+    }
+    enc->scratch_count = base;
+}
+
+/// columnar mode
+
+static boolean dyj_encode_reserve(dyj_encoder* enc, dybuf* out, uint64 extra)
+{
+    if (enc->failed) return false;
+    if (extra > 0x7FFFFFFFU || !dyj_out_reserve(out, (uint)extra)) enc->failed = true;
+    return !enc->failed;
+}
+
+static boolean dyj_encode_scratch(dyj_encoder* enc, uint64 extra)
+{
+    if (enc->failed) return false;
+    if (enc->scratch_count+extra > 0x7FFFFFFFU ||
+        !dyj_grow((void**)&enc->scratch, &enc->scratch_capacity, enc->scratch_count+(uint)extra, sizeof(uint)))
+    {
+        enc->failed = true;
+    }
+    return !enc->failed;
+}
+
+static inline uint dyj_encode_key_index(dyj_encoder* enc, uint node, const dyj_member* m)
+{
+    uint id = dyj_dicts_find(&enc->dicts, node, m->key, m->key_size, dyj_hash_bytes(m->key, m->key_size));
+    return enc->dicts.keys[id].index;
+}
+
+static boolean dyj_encode_is_table(const dyj_value* value)
+{
+    uint i, members = 0;
+
+    if (value->u.a.size < DYJ_COLUMNAR_MIN_ROWS) return false;
+    for (i=0; i<value->u.a.size; i++)
+    {
+        if (value->u.a.items[i]->type != dyj_object) return false;
+        members += value->u.a.items[i]->u.o.size;
+    }
+    return members > 0;
+}
+
+// one type for the present values, typdex_typ_obj when they need a record each
+static uint8 dyj_encode_column_type(const dyj_value* value, const uint* rows, uint present)
+{
+    uint8 type = dyj_value_typdex(value->u.a.items[rows[0]]->u.o.members[rows[1]].value), t;
+    uint i;
+
+    for (i=1; i<present; i++)
+    {
+        const dyj_value* row = value->u.a.items[rows[2*i]];
+        t = dyj_value_typdex(row->u.o.members[rows[2*i+1]].value);
+        if (t == typdex_typ_uint && type == typdex_typ_int) continue;
+        if (t == typdex_typ_int && type == typdex_typ_uint) type = typdex_typ_int;
+        else if (t != type) return typdex_typ_obj;
+    }
+    return type == typdex_typ_array || type == typdex_typ_map ? typdex_typ_obj : type;
+}
+
+
+/**
+ *  Members are grouped by key index with a counting sort in the scratch: key_count+1
+ *  column starts, then (row, member) pairs in row order per column. Nested tables push
+ *  their own scratch above it, the scratch may move while a column is written.
+ */
+static void dyj_encode_write_table(dyj_encoder* enc, dybuf* out, const dyj_value* value, uint node, uint index)
+{
+    uint rows = value->u.a.size, element = enc->dicts.nodes[node].array_child;
+    uint key_count = enc->dicts.nodes[element].key_count, base = enc->scratch_count;
+    uint members = 0, columns = 0, i, j, k, present, start, pairs;
+    uint8 type;
+
+    for (i=0; i<rows; i++) members += value->u.a.items[i]->u.o.size;
+    if (!dyj_encode_scratch(enc, key_count+1 + 3*(uint64)members)) return;
+    start = base;
+    pairs = base + key_count+1;
+    plat_mem_set(enc->scratch + start, 0, (key_count+1)*sizeof(uint));
+    for (i=0, j=pairs + 2*members; i<rows; i++)
+    {
+        const dyj_value* row = value->u.a.items[i];
+        for (k=0; k<row->u.o.size; k++, j++)
+        {
+            enc->scratch[j] = dyj_encode_key_index(enc, element, &row->u.o.members[k]);
+            enc->scratch[start + enc->scratch[j]+1]++;
+        }
+    }
+    for (k=0; k<key_count; k++)
+    {
+        if (enc->scratch[start+k+1]) columns++;
+        enc->scratch[start+k+1] += enc->scratch[start+k];
+    }
+    for (i=0, j=pairs + 2*members; i<rows; i++)
+    {
+        const dyj_value* row = value->u.a.items[i];
+        for (k=0; k<row->u.o.size; k++, j++)
+        {
+            uint* pair = enc->scratch + pairs + 2*enc->scratch[start + enc->scratch[j]]++;
+            pair[0] = i;
+            pair[1] = k;
+        }
+    }
+    // the starts moved to the ends of their columns
+    enc->scratch_count = pairs + 2*members;
+
+    if (!dyj_encode_reserve(enc, out, 4 + 2*9)) return;
+    dyb_append_typdex(out, typdex_typ_obj, index);
+    dyb_append_var_u64(out, rows);
+    dyb_append_var_u64(out, columns);
+    for (k=0; k<key_count && !enc->failed; k++)
+    {
+        uint first = k ? enc->scratch[start+k-1] : 0, end = enc->scratch[start+k];
+        uint child = DYJ_NONE;
+
+        present = end - first;
+        if (present == 0) continue;
+        type = dyj_encode_column_type(value, enc->scratch + pairs + 2*first, present);
+        if (!dyj_encode_reserve(enc, out, 4 + 9 + (rows+7)/8 + (present+7)/8)) return;
+        dyb_append_typdex(out, type, k);
+        dyb_append_var_u64(out, present);
+        // nulls have no values, the bitmap is their cost per row
+        if (present < rows || type == typdex_typ_none)
+        {
+            uint8 bits = 0;
+            for (i=first, j=0; j<rows; j++)
+            {
+                if (i < end && enc->scratch[pairs + 2*i] == j)
+                {
+                    bits |= (uint8)(1 << (j&7));
+                    i++;
+                }
+                if ((j&7) == 7 || j == rows-1)
+                {
+                    dyb_append_u8(out, bits);
+                    bits = 0;
+                }
+            }
+        }
+        if (type == typdex_typ_bool)
+        {
+            uint8 bits = 0;
+            for (i=first; i<end; i++)
+            {
+                const dyj_value* row = value->u.a.items[enc->scratch[pairs + 2*i]];
+                if (row->u.o.members[enc->scratch[pairs + 2*i+1]].value->u.b) bits |= (uint8)(1 << ((i-first)&7));
+                if (((i-first)&7) == 7 || i == end-1)
+                {
+                    dyb_append_u8(out, bits);
+                    bits = 0;
+                }
+            }
+            continue;
+        }
+        if (type == typdex_typ_none) continue;
+        for (i=first; i<end && !enc->failed; i++)
+        {
+            const dyj_value* row = value->u.a.items[enc->scratch[pairs + 2*i]];
+            const dyj_value* v = row->u.o.members[enc->scratch[pairs + 2*i+1]].value;
+            switch (type)
+            {
+                case typdex_typ_int:
+                    if (!dyj_encode_reserve(enc, out, 9)) return;
+                    dyb_append_var_u64(out, ((uint64)v->u.i << 1) ^ (uint64)(v->u.i >> 63));
+                    break;
+                case typdex_typ_uint:
+                    if (!dyj_encode_reserve(enc, out, 9)) return;
+                    dyb_append_var_u64(out, (uint64)v->u.i);
+                    break;
+                case typdex_typ_double:
+                    if (!dyj_encode_reserve(enc, out, 8)) return;
+                    dyb_append_double(out, v->u.d);
+                    break;
+                case typdex_typ_string:
+                    if (!dyj_encode_reserve(enc, out, 9 + (uint64)v->u.s.size)) return;
+                    dyb_append_data_with_var_len(out, (uint8*)v->u.s.data, v->u.s.size);
+                    break;
+                default:
+                    if (dyj_is_container(v) && child == DYJ_NONE) child = enc->dicts.nodes[element].children[k];
+                    dyj_encode_write(enc, out, v, dyj_is_container(v) ? child : DYJ_NONE, 0);
+                    break;
+            }
+        }
+    }
+    enc->scratch_count = base;
+}
+
+void dyj_encode_write(dyj_encoder* enc, dybuf* out, const dyj_value* value, uint node, uint index)
+{
+    uint i, child = DYJ_NONE;
+
+    if (enc->columnar)
+    {
+        if (!dyj_encode_reserve(enc, out, 4 + 9 + (value->type == dyj_string ? (uint64)value->u.s.size : 0))) return;
+        if (value->type == dyj_array && dyj_encode_is_table(value))
+        {
+            dyj_encode_write_table(enc, out, value, node, index);
+            return;
+        }
+    }
+    dyb_append_typdex(out, dyj_value_typdex(value), index);
+    switch (value->type)
+    {
+        case dyj_null:
+            break;
+        case dyj_bool:
+            dyb_append_bool(out, value->u.b);
+            break;
+        case dyj_int:
+            // zigzag, same bytes as dyb_append_var_s64 without shifting a negative value
+            if (value->u.i < 0) dyb_append_var_u64(out, ((uint64)value->u.i << 1) ^ (uint64)(value->u.i >> 63));
+            else dyb_append_var_u64(out, (uint64)value->u.i);
+            break;
+        case dyj_double:
+            dyb_append_double(out, value->u.d);
+            break;
+        case dyj_string:
+            dyb_append_data_with_var_len(out, (uint8*)value->u.s.data, value->u.s.size);
+            break;
+        case dyj_array:
+            dyb_append_var_u64(out, value->u.a.size);
+            for (i=0; i<value->u.a.size; i++)
+            {
+                const dyj_value* item = value->u.a.items[i];
+                if (dyj_is_container(item) && child == DYJ_NONE) child = enc->dicts.nodes[node].array_child;
+                dyj_encode_write(enc, out, item, child, 0);
+            }
+            break;
+        case dyj_object:
+            dyb_append_var_u64(out, value->u.o.size);
+            if (enc->canonical)
+            {
+                dyj_encode_write_canonical(enc, out, value, node);
+                break;
+            }
+            for (i=0; i<value->u.o.size; i++)
+            {
+                const dyj_value* member = value->u.o.members[i].value;
+                uint id = enc->columnar ? DYJ_NONE : enc->member_keys[enc->member_cursor++];
+                uint key_index = enc->columnar ? dyj_encode_key_index(enc, node, &value->u.o.members[i])
+                                               : enc->dicts.keys[id].index;
+                child = dyj_is_container(member) ? enc->dicts.nodes[node].children[key_index] : DYJ_NONE;
+                dyj_encode_write(enc, out, member, child, enc->key_map ? enc->key_map[id] : key_index);
+            }
+            break;
+    }
+}
+
+void dyj_encoder_release(dyj_encoder* enc)
+{
+    if (enc->member_keys) dyb_mem_release(enc->member_keys, 0);
+    if (enc->scratch) dyb_mem_release(enc->scratch, 0);
+    dyj_dicts_release(&enc->dicts);
+}
+
+static enum dyj_err dyj_encode_document(dybuf* out, const dyj_value* value, boolean canonical, boolean columnar)
+{
+    dyj_encoder enc;
+    enum dyj_err err;
+    uint position = out ? dyb_get_position(out) : 0;
+
+    if (out == null || value == null) return dyj_err_invalid_args;
+    plat_mem_set(&enc, 0, sizeof(enc));
+    enc.canonical = canonical;
+    enc.columnar = columnar;
+    if (!dyj_dicts_init(&enc.dicts, null)) return dyj_err_no_memory;
+
+    err = dyj_encode_collect(&enc, value, DYJ_ROOT_NODE, 0, 0);
+    if (err == dyj_err_none && canonical) err = dyj_encode_canonicalize(&enc);
+    if (err == dyj_err_none)
+    {
+        if (enc.payload_size > 0x7FFFFFFFU) err = dyj_err_no_memory;
+        else if (!dyj_out_reserve(out, dyj_dicts_header_size(&enc.dicts) + 1 + (uint)enc.payload_size)) err = dyj_err_no_memory;
+        else if (!dyj_dicts_write_header(&enc.dicts, columnar ? DYJ_FORMAT_VERSION_COLUMNAR : DYJ_FORMAT_VERSION, out))
+        {
+            err = dyj_err_no_memory;
+        }
+    }
+    if (err == dyj_err_none)
+    {
+        dyb_append_typdex(out, typdex_typ_obj, 1);
+        dyj_encode_write(&enc, out, value, DYJ_ROOT_NODE, 0);
+        if (enc.failed)
+        {
+            dyb_set_position(out, position);
+            err = dyj_err_no_memory;
+        }
+    }
+
+    dyj_encoder_release(&enc);
+    return err;
+}
+
+enum dyj_err dyj_encode(dybuf* out, const dyj_value* value)
+{
+    return dyj_encode_document(out, value, false, false);
+}
+
+enum dyj_err dyj_encode_canonical(dybuf* out, const dyj_value* value)
+{
+    return dyj_encode_document(out, value, true, false);
+}
+
+enum dyj_err dyj_encode_columnar(dybuf* out, const dyj_value* value)
+{
+    return dyj_encode_document(out, value, false, true);
+}
+
+
+/// ========== decoder
+
+typedef struct dyj_decoder
+{
+    dyj_reader r;
+    dyj_dicts* dicts;                   // own or a set of the cache
+    dyj_dicts own;
+    dyj_document* doc;
+    boolean columnar;                   // version 3
+    uint64 table_budget;                // version 3: rows and column values left for all tables
+} dyj_decoder;
+
+#define DYJ_TABLE_ROW_CAPACITY      16  // members allocated per row before growing
+
+static inline uint dyj_bit_count(uint8 bits)
+{
+    bits = (uint8)(bits - ((bits >> 1) & 0x55));
+    bits = (uint8)((bits & 0x33) + ((bits >> 2) & 0x33));
+    return (bits + (bits >> 4)) & 0x0F;
+}
+
+static enum dyj_err dyj_decode_value(dyj_decoder* dec, uint8 type, uint node, uint depth, dyj_value** out);
+
+static enum dyj_err dyj_decode_scalar(dyj_decoder* dec, uint8 type, dyj_value** out)
+{
+    dyj_scalar scalar;
+    enum dyj_err err = dyj_read_scalar(&dec->r, type, &scalar);
+
+    if (err != dyj_err_none) return err;
+    switch (type)
+    {
+        case typdex_typ_none: *out = dyj_make_null(dec->doc); break;
+        case typdex_typ_bool: *out = dyj_make_bool(dec->doc, scalar.u.b); break;
+        case typdex_typ_double: *out = dyj_make_double(dec->doc, scalar.u.d); break;
+        case typdex_typ_string: *out = dyj_make_string(dec->doc, (const char*)scalar.u.s.data, scalar.u.s.size); break;
+        default: *out = dyj_make_int(dec->doc, scalar.u.i); break;
+    }
+    return *out ? dyj_err_none : dyj_err_no_memory;
+}
+
+static enum dyj_err dyj_decode_column_value(dyj_decoder* dec, uint8 type, const uint8* bits, uint i,
+                                            uint node, uint depth, dyj_value** out)
+{
+    uint8 item_type;
+    uint item_index;
+
+    switch (type)
+    {
+        case typdex_typ_bool:
+            *out = dyj_make_bool(dec->doc, (bits[i>>3] >> (i&7)) & 1);
+            return *out ? dyj_err_none : dyj_err_no_memory;
+        case typdex_typ_obj:
+            if (!dyj_read_typdex(&dec->r, &item_type, &item_index)) return dyj_err_truncated;
+            return dyj_decode_value(dec, item_type, dyj_typdex_is_container(item_type) ? node : DYJ_NONE, depth, out);
+        default:
+            return dyj_decode_scalar(dec, type, out);
+    }
+}
+
+/**
+ *  Rows are made first, every column appends one member to the rows it is present in.
+ *  Every column takes at least a bit per row (bitmap, bits or values), so the rows and the
+ *  present counts of all tables are charged to one budget of 16 per payload byte: forged
+ *  counts can't make the decoded members grow faster than the input.
+ */
+static enum dyj_err dyj_decode_table(dyj_decoder* dec, uint node, uint depth, dyj_value** out)
+{
+    dyj_value* value;
+    enum dyj_err err;
+    uint64 rows, count;
+    uint columns, element, stamp, present, column, i, row, id, child, bitmap_size;
+    const uint8 *bitmap, *bits;
+    uint8 type;
+
+    if (depth+1 >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+    if (!dyj_read_var_u64(&dec->r, &rows)) return dyj_err_truncated;
+    if (rows > dec->table_budget || rows > 0xFFFFFFFFU/sizeof(dyj_value*)) return dyj_err_bad_column;
+    dec->table_budget -= rows;
+    if (!dyj_read_count(&dec->r, &columns)) return dyj_err_truncated;
+    element = dyj_dicts_array_child(dec->dicts, node);
+    if (element == DYJ_NONE) return dyj_err_no_memory;
+    if (!dec->dicts->nodes[element].has_dictionary) return dyj_err_missing_dictionary;
+    if (columns == 0 || columns > dec->dicts->nodes[element].key_count) return dyj_err_bad_column;
+
+    value = dyj_make_array(dec->doc, (uint)rows);
+    if (value == null) return dyj_err_no_memory;
+    for (row=0; row<rows; row++)
+    {
+        value->u.a.items[row] = dyj_make_object(dec->doc, MIN(columns, DYJ_TABLE_ROW_CAPACITY));
+        if (value->u.a.items[row] == null) return dyj_err_no_memory;
+    }
+    value->u.a.size = (uint)rows;
+    stamp = dyj_dicts_next_stamp(dec->dicts);
+
+    bitmap_size = (uint)((rows+7)/8);
+    for (column=0; column<columns; column++)
+    {
+        const dyj_dict_key* key;
+
+        // the column typdex is read like a member, a child is made for columns of containers
+        if ((err = dyj_read_member(&dec->r, dec->dicts, element, stamp, &type, &id, &child)) != dyj_err_none) return err;
+        key = &dec->dicts->keys[id];
+        if (!dyj_read_var_u64(&dec->r, &count)) return dyj_err_truncated;
+        if (count > value->u.a.size || count > dec->table_budget) return dyj_err_bad_column;
+        dec->table_budget -= count;
+        present = (uint)count;
+        bitmap = null;
+        if (present < value->u.a.size || type == typdex_typ_none)
+        {
+            bitmap = dyj_read_bytes(&dec->r, bitmap_size);
+            if (bitmap == null) return dyj_err_truncated;
+            for (i=0, row=0; i<bitmap_size; i++) row += dyj_bit_count(bitmap[i]);
+            if (row != present || (bitmap[bitmap_size-1] >> (((value->u.a.size-1)&7)+1)) != 0) return dyj_err_bad_column;
+        }
+        bits = null;
+        if (type == typdex_typ_bool)
+        {
+            bits = dyj_read_bytes(&dec->r, (present+7)/8);
+            if (bits == null) return dyj_err_truncated;
+        }
+
+        for (i=0, row=0; i<present; i++, row++)
+        {
+            dyj_value* object;
+            dyj_member* m;
+
+            if (bitmap) while (((bitmap[row>>3] >> (row&7)) & 1) == 0) row++;
+            object = value->u.a.items[row];
+            if (object->u.o.size == object->u.o.capacity)
+            {
+                dyj_member* members = (dyj_member*)dyj_arena_grow(dec->doc, object->u.o.members, object->u.o.size,
+                                                                   &object->u.o.capacity, sizeof(dyj_member));
+                if (members == null) return dyj_err_no_memory;
+                object->u.o.members = members;
+            }
+            m = &object->u.o.members[object->u.o.size];
+            m->key = key->data;
+            m->key_size = key->size;
+            err = dyj_decode_column_value(dec, type, bits, i, child, depth+2, &m->value);
+            if (err != dyj_err_none) return err;
+            object->u.o.size++;
+        }
+    }
+    *out = value;
+    return dyj_err_none;
+}
+
+static enum dyj_err dyj_decode_value(dyj_decoder* dec, uint8 type, uint node, uint depth, dyj_value** out)
+{
+    dyj_value* value;
+    enum dyj_err err;
+    uint i, count, stamp, id, child = DYJ_NONE;
+    uint8 item_type;
+
+    switch (type)
+    {
+        case typdex_typ_array:
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            if (!dyj_read_count(&dec->r, &count)) return dyj_err_truncated;
+            value = dyj_make_array(dec->doc, count);
+            if (value == null) return dyj_err_no_memory;
+            for (i=0; i<count; i++)
+            {
+                if ((err = dyj_read_item(&dec->r, dec->dicts, node, &item_type, &child)) != dyj_err_none) return err;
+                err = dyj_decode_value(dec, item_type, child, depth+1, &value->u.a.items[i]);
+                if (err != dyj_err_none) return err;
+            }
+            value->u.a.size = count;
+            break;
+        case typdex_typ_map:
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            if ((err = dyj_read_object(&dec->r, dec->dicts, node, &count, &stamp)) != dyj_err_none) return err;
+            value = dyj_make_object(dec->doc, count);
+            if (value == null) return dyj_err_no_memory;
+            for (i=0; i<count; i++)
+            {
+                dyj_member* m = &value->u.o.members[i];
+                err = dyj_read_member(&dec->r, dec->dicts, node, stamp, &item_type, &id, &child);
+                if (err != dyj_err_none) return err;
+                m->key = dec->dicts->keys[id].data;
+                m->key_size = dec->dicts->keys[id].size;
+                err = dyj_decode_value(dec, item_type, child, depth+1, &m->value);
+                if (err != dyj_err_none) return err;
+            }
+            value->u.o.size = count;
+            break;
+        case typdex_typ_obj:
+            if (!dec->columnar) return dyj_err_bad_type;
+            return dyj_decode_table(dec, node, depth, out);
+        default:
+            return dyj_decode_scalar(dec, type, out);
+    }
+
+    *out = value;
+    return dyj_err_none;
+}
+
+static enum dyj_err dyj_decode_document(dybuf* in, dyj_dict_cache* cache, dyj_document* doc, dyj_value** value)
+{
+    dyj_decoder dec;
+    enum dyj_err err;
+    uint8 type;
+    uint index, version = 0;
+
+    if (in == null || doc == null || value == null) return dyj_err_invalid_args;
+    dec.r.data = in->_data;
+    dec.r.position = dyb_get_position(in);
+    dec.r.limit = dyb_get_limit(in);
+    dec.doc = doc;
+    dec.dicts = &dec.own;
+    // dictionary keys are referenced by the decoded members
+    if (!dyj_dicts_init(&dec.own, &doc->arena)) return dyj_err_no_memory;
+
+    err = dyj_dict_cache_read_header(cache, &dec.own, &dec.r, &dec.dicts, &version);
+    dec.columnar = version == DYJ_FORMAT_VERSION_COLUMNAR;
+    dec.table_budget = 16*(uint64)(dec.r.limit - dec.r.position);
+    if (err == dyj_err_none)
+    {
+        if (!dyj_read_typdex(&dec.r, &type, &index)) err = dyj_err_truncated;
+        else if (type != typdex_typ_obj || index != 1) err = dyj_err_bad_marker;
+    }
+    if (err == dyj_err_none)
+    {
+        if (!dyj_read_typdex(&dec.r, &type, &index)) err = dyj_err_truncated;
+        else err = dyj_decode_value(&dec, type, DYJ_ROOT_NODE, 0, value);
+    }
+    if (err == dyj_err_none) dyb_set_position(in, dec.r.position);
+
+    dyj_dicts_release(&dec.own);
+    return err;
+}
+
+enum dyj_err dyj_decode(dybuf* in, dyj_document* doc, dyj_value** value)
+{
+    return dyj_decode_document(in, null, doc, value);
+}
+
+enum dyj_err dyj_decode_shared(dybuf* in, dyj_dict_cache* cache, dyj_document* doc, dyj_value** value)
+{
+    if (cache == null) return dyj_err_invalid_args;
+    return dyj_decode_document(in, cache, doc, value);
+}
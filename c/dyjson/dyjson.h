@@ -0,0 +1,328 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * dyjson: JSON-dybuf encoder/decoder, document-level dictionary variant
+ * (see DYPKT_SCHEMA_CONVENTION.md, "Style 2: JSON-Equivalent Encoding").
+ *
+ *     Typdex(TYPDEX_TYP_OBJ, 0)
+ *     Var uint(json_dybuf_format_version)
+ *     Var uint(dictionary_count)
+ *     repeat dictionary_count times:
+ *         Var-len string(path)  Var uint(key_count)  repeat key_count times: Var-len string(key)
+ *     Typdex(TYPDEX_TYP_OBJ, 1)
+ *     Typdex(root_json_value_type, 0) Root JSON payload
+ *
+ * Version 2 shares the dictionaries of a stream: the header carries a set id and version,
+ * the collection follows only in the document that defines that version.
+ *
+ *     Typdex(TYPDEX_TYP_OBJ, 0)
+ *     Var uint(2)  Var uint(set_id)  Var uint(set_version)  Var uint(defined)
+ *     if defined: Var uint(dictionary_count) and the dictionaries as above
+ *
+ * Version 3 has the header and payload of version 1, arrays of objects may be written by
+ * column instead of row by row:
+ *
+ *     Typdex(TYPDEX_TYP_OBJ, index)  Var uint(row_count)  Var uint(column_count)
+ *     repeat column_count times:
+ *         Typdex(column_type, key_index)  Var uint(present_count)
+ *         if present_count < row_count or column_type is none:
+ *             Bytes(ceil(row_count/8)) presence bitmap
+ *         present_count values of column_type, without typdex
+ *
+ * Values live in a dyj_document, all nodes and strings are allocated from its arena
+ * and released together.
+ */
+
+#ifndef DYBUF_C_DYJSON_H
+#define DYBUF_C_DYJSON_H
+
+#include <stdio.h>
+#include "plat_type.h"
+#include "dybuf.h"
+
+#define DYJ_FORMAT_VERSION          1
+#define DYJ_FORMAT_VERSION_SHARED   2                           // dictionaries shared by a stream
+#define DYJ_FORMAT_VERSION_COLUMNAR 3                           // arrays of objects by column
+#define DYJ_MAX_SAFE_INTEGER        9007199254740991LL          // 2^53-1
+#define DYJ_MIN_SAFE_INTEGER        (-DYJ_MAX_SAFE_INTEGER)
+#define DYJ_MAX_DEPTH               512                         // nesting limit of encoder/decoder
+#define DYJ_MAX_KEY_INDEX           0x0FFFFF                    // largest 4-byte typdex index
+#define DYJ_DOUBLE_BUFFER_SIZE      32                          // dyj_format_double output with NUL
+#define DYJ_COUNT_UNKNOWN           0xFFFFFFFFU                 // dyj_write_begin_*: count set at end
+#define DYJ_OBJECT_INDEX_MIN        8                           // dyj_object_put indexes larger objects
+
+enum dyj_err
+{
+    dyj_err_none                = 0,
+    dyj_err_no_memory,
+    dyj_err_invalid_args,
+    dyj_err_unsafe_integer,             // integer outside +-(2^53-1)
+    dyj_err_non_finite,                 // NaN or infinity
+    dyj_err_too_deep,                   // nesting deeper than DYJ_MAX_DEPTH
+    dyj_err_truncated,                  // input ends inside a record
+    dyj_err_bad_marker,                 // missing TYPDEX_TYP_OBJ 0/1 marker
+    dyj_err_bad_version,                // unsupported json_dybuf_format_version
+    dyj_err_bad_dictionary,             // malformed path, duplicate path or duplicate key
+    dyj_err_missing_dictionary,         // object at a path without dictionary
+    dyj_err_bad_index,                  // key index out of range or duplicated in one object
+    dyj_err_bad_type,                   // typdex type is not a JSON value type
+    dyj_err_trailing_bytes,
+    dyj_err_syntax,                     // JSON text syntax error
+    dyj_err_duplicate_key,              // writer: key written twice in one object
+    dyj_err_bad_state,                  // writer: call out of order or count mismatch
+    dyj_err_io,                         // writing to FILE* failed
+    dyj_err_not_found,                  // view: no such key or index
+    dyj_err_unknown_dictionary,         // shared dictionary set (id, version) not in the cache
+    dyj_err_bad_column,                 // column count or presence bitmap does not match the rows
+};
+
+enum dyj_type
+{
+    dyj_null            = 0,
+    dyj_bool,
+    dyj_int,                            // integer inside the safe range
+    dyj_double,
+    dyj_string,
+    dyj_array,
+    dyj_object,
+};
+
+typedef struct dyj_value dyj_value;
+
+typedef struct dyj_member
+{
+    const char* key;                    // NUL terminated
+    uint key_size;
+    dyj_value* value;
+} dyj_member;
+
+struct dyj_value
+{
+    enum dyj_type type;
+    union
+    {
+        boolean b;
+        int64 i;
+        double d;
+        struct { const char* data; uint size; } s;              // NUL terminated
+        struct { dyj_value** items; uint size, capacity; } a;
+        struct { dyj_member* members; uint size, capacity; uint* index; } o;  // in insertion order
+    } u;
+};
+
+typedef struct dyj_document
+{
+    dyb_arena arena;
+} dyj_document;
+
+dyj_document* dyj_document_init(dyj_document* doc);
+void dyj_document_reset(dyj_document* doc);
+void dyj_document_release(dyj_document* doc);
+
+dyj_value* dyj_make_null(dyj_document* doc);
+dyj_value* dyj_make_bool(dyj_document* doc, boolean value);
+dyj_value* dyj_make_int(dyj_document* doc, int64 value);
+dyj_value* dyj_make_double(dyj_document* doc, double value);
+dyj_value* dyj_make_string(dyj_document* doc, const char* data, uint size);
+dyj_value* dyj_make_array(dyj_document* doc, uint capacity);
+dyj_value* dyj_make_object(dyj_document* doc, uint capacity);
+enum dyj_err dyj_array_push(dyj_document* doc, dyj_value* array, dyj_value* item);
+// replace the value if key exists, otherwise append; from DYJ_OBJECT_INDEX_MIN members on,
+// the object keeps a hash index of its keys so that put and get don't scan the members
+enum dyj_err dyj_object_put(dyj_document* doc, dyj_value* object, const char* key, uint key_size, dyj_value* value);
+dyj_value* dyj_object_get(const dyj_value* object, const char* key, uint key_size);
+boolean dyj_equal(const dyj_value* value0, const dyj_value* value1);
+
+/**
+ *  Append one JSON-dybuf document (dictionary collection + payload) to out.
+ */
+enum dyj_err dyj_encode(dybuf* out, const dyj_value* value);
+
+/**
+ *  dyj_encode with canonical dictionaries, the bytes depend on the value only: keys that
+ *  occur in more objects at a path get the lower indices (1-byte typdex up to index 7),
+ *  equal counts are in byte order, dictionaries are in byte order of their path and members
+ *  in key index order. The output is a version 1 document for every decoder, decoded
+ *  members come in key index order.
+ */
+enum dyj_err dyj_encode_canonical(dybuf* out, const dyj_value* value);
+
+/**
+ *  dyj_encode as a version 3 document: arrays of at least 4 objects are written by column,
+ *  each key of the rows is one typed run (var ints, doubles, strings, bits) with a presence
+ *  bitmap when some rows lack the key or the values are null. Columns of mixed types or
+ *  containers hold one value record per present row. Decoded rows list their members in
+ *  key index order.
+ */
+enum dyj_err dyj_encode_columnar(dybuf* out, const dyj_value* value);
+
+/**
+ *  dyj_encode with up to threads workers for a root array: every worker collects and writes
+ *  a chunk of the items with its own dictionaries, the dictionaries are merged in chunk
+ *  order. The bytes are the same as dyj_encode. Arrays of fewer than 256 items per worker
+ *  and other roots are encoded by the calling thread.
+ */
+enum dyj_err dyj_encode_parallel(dybuf* out, const dyj_value* value, uint threads);
+
+/**
+ *  Read one JSON-dybuf document from the position of in, the position is moved to the end
+ *  of the document. Values are allocated in doc. Reads version 1 and 3 documents.
+ */
+enum dyj_err dyj_decode(dybuf* in, dyj_document* doc, dyj_value** value);
+
+/**
+ *  Reader side of shared dictionaries (DYJ_FORMAT_VERSION_SHARED), one cache per stream or
+ *  connection. A document that defines a set stores it in the cache, later documents of
+ *  the set are decoded with it. Keys of decoded members point into the cache, they are
+ *  valid until dyj_dict_cache_release, also after their set is redefined. The keys of
+ *  replaced definitions are kept as well, a cache holds at most 16 MiB of keys, a definition
+ *  past that fails with dyj_err_bad_dictionary and the stream needs a new cache.
+ *  dyj_decode_shared also reads version 1 and 3 documents.
+ */
+typedef struct dyj_dict_cache dyj_dict_cache;
+
+dyj_dict_cache* dyj_dict_cache_create(void);
+void dyj_dict_cache_release(dyj_dict_cache* cache);
+enum dyj_err dyj_decode_shared(dybuf* in, dyj_dict_cache* cache, dyj_document* doc, dyj_value** value);
+
+/**
+ *  Single-pass writer. Values are written to a payload buffer while the dictionaries are
+ *  built, dyj_writer_finish appends the dictionary header and then the payload to out with
+ *  one copy. The bytes are the same as dyj_encode. A writer is reused for many documents,
+ *  its buffers and tables are kept between them.
+ *
+ *      dyj_write_begin_object(w, 2);
+ *      dyj_write_key(w, "id", 2);      dyj_write_int(w, 1);
+ *      dyj_write_key(w, "tags", 4);    dyj_write_begin_array(w, 0); dyj_write_end_array(w);
+ *      dyj_write_end_object(w);
+ *      dyj_writer_finish(w, out);
+ *
+ *  Pass DYJ_COUNT_UNKNOWN to begin when the size is known only at the end, the count is
+ *  inserted when the payload is copied. Errors are sticky until dyj_writer_reset or
+ *  dyj_writer_finish.
+ */
+typedef struct dyj_writer dyj_writer;
+
+dyj_writer* dyj_writer_create(void);
+void dyj_writer_release(dyj_writer* writer);
+void dyj_writer_reset(dyj_writer* writer);
+enum dyj_err dyj_write_null(dyj_writer* writer);
+enum dyj_err dyj_write_bool(dyj_writer* writer, boolean value);
+enum dyj_err dyj_write_int(dyj_writer* writer, int64 value);
+enum dyj_err dyj_write_double(dyj_writer* writer, double value);
+enum dyj_err dyj_write_string(dyj_writer* writer, const char* data, uint size);
+enum dyj_err dyj_write_begin_array(dyj_writer* writer, uint count);
+enum dyj_err dyj_write_end_array(dyj_writer* writer);
+enum dyj_err dyj_write_begin_object(dyj_writer* writer, uint count);
+enum dyj_err dyj_write_key(dyj_writer* writer, const char* key, uint size);
+enum dyj_err dyj_write_end_object(dyj_writer* writer);
+enum dyj_err dyj_write_value(dyj_writer* writer, const dyj_value* value);
+enum dyj_err dyj_writer_finish(dyj_writer* writer, dybuf* out);
+/**
+ *  Write the following documents in version 2 with dictionary set set_id. The dictionaries
+ *  are kept between documents, a document defines the set when it added keys or paths
+ *  (set_version is incremented) and references it otherwise. Starts a new stream: the
+ *  dictionaries are cleared and the next document defines version 1.
+ */
+enum dyj_err dyj_writer_share_dictionaries(dyj_writer* writer, uint set_id);
+
+/**
+ *  Parse JSON text (RFC 8259) into doc. Integers outside the safe range become doubles.
+ */
+enum dyj_err dyj_parse_text(dyj_document* doc, const char* text, uint size, dyj_value** value);
+
+/**
+ *  Transcode JSON text to one JSON-dybuf document appended to out, without building values.
+ *  Memory is O(document): the writer's dictionaries, the payload held until the end, one
+ *  count record per container and one frame per nesting level.
+ *  A duplicated key in an object fails with dyj_err_duplicate_key.
+ */
+enum dyj_err dyj_transcode_text(dyj_writer* writer, const char* text, uint size, dybuf* out);
+
+/**
+ *  Write one JSON-dybuf document from the position of in as compact JSON text, without
+ *  building values. The position of in is moved to the end of the document. On error
+ *  out is set back to its position, a FILE* may hold a part of the text.
+ */
+enum dyj_err dyj_emit_text(dybuf* in, dybuf* out);
+enum dyj_err dyj_emit_text_file(dybuf* in, FILE* fp);
+
+/**
+ *  Shortest text that reads back to the same finite value, in the JavaScript number
+ *  layout (1e+21, 0.000001, 1.5e-7). Returns the length, buffer holds
+ *  DYJ_DOUBLE_BUFFER_SIZE bytes.
+ */
+uint dyj_format_double(double value, char* buffer);
+
+/**
+ *  Read the JSON number at [text, end). Integers that fit int64 are returned in *i with
+ *  *integer set, others in *d, correctly rounded. Returns the length read, 0 when it is not
+ *  a number. The JSON-dybuf readers keep integers outside the safe range as doubles.
+ */
+uint dyj_parse_number(const char* text, const char* end, boolean* integer, int64* i, double* d);
+
+/**
+ *  Read-only views of one document in memory. dyj_viewer_open reads the dictionary header,
+ *  the payload is walked when an item is asked for, records before it are skipped. Views
+ *  point into the document and the viewer, they are valid until the next open, and asking
+ *  for an item does not allocate. Item i costs a skip of the i items before it.
+ *
+ *      dyj_viewer_open(viewer, in, &root);
+ *      dyj_view_query(&root, "$.items[5].price", 16, &price);     // price.type, price.u.d
+ *
+ *  Keys that hold '.' or '[' are read with dyj_view_get. Only the records that are read
+ *  are checked, the position of in is not moved.
+ *
+ *  dyj_viewer_index walks a view once and records where every item below it starts. Views
+ *  made from an indexed view reach item i without skipping, which pays off when the same
+ *  document is queried many times.
+ */
+typedef struct dyj_viewer dyj_viewer;
+
+typedef struct dyj_view
+{
+    const dyj_viewer* viewer;
+    enum dyj_type type;
+    union
+    {
+        boolean b;
+        int64 i;
+        double d;
+        struct { const char* data; uint size; } s;              // in the document, not NUL terminated
+        struct { uint position, size, node, tape; } c;          // array or object: first item, count
+    } u;
+} dyj_view;
+
+dyj_viewer* dyj_viewer_create(void);
+void dyj_viewer_release(dyj_viewer* viewer);
+enum dyj_err dyj_viewer_open(dyj_viewer* viewer, dybuf* in, dyj_view* root);
+// index the items below view, the index is dropped by the next open
+enum dyj_err dyj_viewer_index(dyj_viewer* viewer, dyj_view* view);
+// item of an array, dyj_err_not_found when out of range or not an array
+enum dyj_err dyj_view_at(const dyj_view* view, uint index, dyj_view* item);
+// member of an object in payload order, key is NUL terminated
+enum dyj_err dyj_view_member(const dyj_view* view, uint index, const char** key, uint* key_size, dyj_view* value);
+enum dyj_err dyj_view_get(const dyj_view* view, const char* key, uint key_size, dyj_view* value);
+// "$" is view, followed by .key and [index] steps
+enum dyj_err dyj_view_query(const dyj_view* view, const char* path, uint size, dyj_view* value);
+
+const char* dyj_err_string(enum dyj_err err);
+
+#endif //DYBUF_C_DYJSON_H
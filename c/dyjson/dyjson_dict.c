@@ -0,0 +1,547 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Structural dictionaries of a JSON-dybuf document: a trie of value paths, every
+ * object path owns an ordered key dictionary. Keys of all dictionaries share one
+ * open addressing table keyed by (node, key bytes).
+ *
+ * The root node is never a child, so 0 in children/array_child means "no child".
+ */
+
+#include <string.h>
+#include "dyjson_private.h"
+
+static uint dyj_dicts_new_node(dyj_dicts* dicts, uint parent, uint step)
+{
+    dyj_path_node* node;
+    if (!dyj_grow((void**)&dicts->nodes, &dicts->node_capacity, dicts->node_count+1, sizeof(dyj_path_node)))
+    {
+        return DYJ_NONE;
+    }
+    node = &dicts->nodes[dicts->node_count];
+    if (dicts->node_count < dicts->node_high)
+    {
+        // slot of a cleared collection, keep its arrays
+        uint* children = node->children;
+        uint children_capacity = node->children_capacity;
+        uint* keys = node->keys;
+        uint key_capacity = node->key_capacity;
+        if (children) plat_mem_set(children, 0, children_capacity*sizeof(uint));
+        plat_mem_set(node, 0, sizeof(*node));
+        node->children = children;
+        node->children_capacity = children_capacity;
+        node->keys = keys;
+        node->key_capacity = key_capacity;
+    }
+    else
+    {
+        plat_mem_set(node, 0, sizeof(*node));
+        dicts->node_high = dicts->node_count+1;
+    }
+    node->parent = parent;
+    node->step = step;
+    return dicts->node_count++;
+}
+
+boolean dyj_dicts_init(dyj_dicts* dicts, dyb_arena* strings)
+{
+    plat_mem_set(dicts, 0, sizeof(*dicts));
+    dyb_arena_init(&dicts->own_strings, 0);
+    dicts->strings = strings ? strings : &dicts->own_strings;
+    return dyj_dicts_new_node(dicts, DYJ_NONE, DYJ_NONE) == DYJ_ROOT_NODE;
+}
+
+void dyj_dicts_clear(dyj_dicts* dicts)
+{
+    dicts->node_count = 0;
+    dicts->key_count = 0;
+    dicts->dict_count = 0;
+    if (dicts->slots) plat_mem_set(dicts->slots, 0, dicts->slot_capacity*sizeof(uint));
+    if (dicts->strings == &dicts->own_strings) dyb_arena_reset(&dicts->own_strings);
+    dyj_dicts_new_node(dicts, DYJ_NONE, DYJ_NONE);
+}
+
+void dyj_dicts_release(dyj_dicts* dicts)
+{
+    uint i;
+    for (i=0; i<dicts->node_high; i++)
+    {
+        if (dicts->nodes[i].children) dyb_mem_release(dicts->nodes[i].children, 0);
+        if (dicts->nodes[i].keys) dyb_mem_release(dicts->nodes[i].keys, 0);
+    }
+    if (dicts->nodes) dyb_mem_release(dicts->nodes, 0);
+    if (dicts->keys) dyb_mem_release(dicts->keys, 0);
+    if (dicts->order) dyb_mem_release(dicts->order, 0);
+    if (dicts->slots) dyb_mem_release(dicts->slots, 0);
+    if (dicts->stamps) dyb_mem_release(dicts->stamps, 0);
+    dyb_arena_release(&dicts->own_strings);
+    plat_mem_set(dicts, 0, sizeof(*dicts));
+}
+
+uint32 dyj_hash_bytes(const char* data, uint size)
+{
+    // FNV-1a
+    uint32 hash = 2166136261U;
+    uint i;
+    for (i=0; i<size; i++)
+    {
+        hash ^= (uint8)data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static inline uint32 dyj_slot_hash(uint node, uint32 hash)
+{
+    uint32 h = hash ^ (node * 0x9E3779B1U);
+    h ^= h >> 15;
+    return h;
+}
+
+uint dyj_dicts_child(dyj_dicts* dicts, uint node, uint step)
+{
+    dyj_path_node* n = &dicts->nodes[node];
+    uint child;
+
+    if (step == DYJ_NONE)
+    {
+        if (n->array_child) return n->array_child;
+    }
+    else
+    {
+        if (step < n->children_capacity && n->children[step]) return n->children[step];
+        if (step > DYJ_MAX_KEY_INDEX) return DYJ_NONE;
+        if (!dyj_grow((void**)&n->children, &n->children_capacity, step+1, sizeof(uint))) return DYJ_NONE;
+    }
+
+    child = dyj_dicts_new_node(dicts, node, step);
+    if (child == DYJ_NONE) return DYJ_NONE;
+    // nodes may have moved
+    n = &dicts->nodes[node];
+    if (step == DYJ_NONE) n->array_child = child;
+    else n->children[step] = child;
+    return child;
+}
+
+boolean dyj_dicts_ensure_dictionary(dyj_dicts* dicts, uint node)
+{
+    if (dicts->nodes[node].has_dictionary) return true;
+    if (!dyj_grow((void**)&dicts->order, &dicts->order_capacity, dicts->dict_count+1, sizeof(uint))) return false;
+    dicts->order[dicts->dict_count++] = node;
+    dicts->nodes[node].has_dictionary = true;
+    return true;
+}
+
+uint dyj_dicts_find(dyj_dicts* dicts, uint node, const char* key, uint size, uint32 hash)
+{
+    uint mask, slot, id;
+    dyj_dict_key* k;
+
+    if (dicts->slot_capacity == 0) return DYJ_NONE;
+    mask = dicts->slot_capacity - 1;
+    slot = dyj_slot_hash(node, hash) & mask;
+    while ((id = dicts->slots[slot]) != 0)
+    {
+        k = &dicts->keys[id-1];
+        if (k->hash == hash && k->node == node && k->size == size && memcmp(k->data, key, size) == 0)
+        {
+            return id-1;
+        }
+        slot = (slot+1) & mask;
+    }
+    return DYJ_NONE;
+}
+
+static boolean dyj_dicts_rehash(dyj_dicts* dicts, uint capacity)
+{
+    uint size = capacity*sizeof(uint);
+    uint* slots = (uint*)dyb_mem_alloc(&size, false);
+    uint mask = capacity-1, i, slot;
+
+    if (slots == null) return false;
+    for (i=0; i<dicts->key_count; i++)
+    {
+        slot = dyj_slot_hash(dicts->keys[i].node, dicts->keys[i].hash) & mask;
+        while (slots[slot]) slot = (slot+1) & mask;
+        slots[slot] = i+1;
+    }
+    if (dicts->slots) dyb_mem_release(dicts->slots, 0);
+    dicts->slots = slots;
+    dicts->slot_capacity = capacity;
+    return true;
+}
+
+uint dyj_dicts_intern(dyj_dicts* dicts, uint node, const char* key, uint size, uint32 hash)
+{
+    uint id = dyj_dicts_find(dicts, node, key, size, hash);
+    dyj_path_node* n;
+    dyj_dict_key* k;
+    char* copy;
+    uint mask, slot;
+
+    if (id != DYJ_NONE) return id;
+
+    n = &dicts->nodes[node];
+    if (n->key_count > DYJ_MAX_KEY_INDEX) return DYJ_NONE;
+    // keep the load factor under 1/2
+    if ((dicts->key_count+1)*2 > dicts->slot_capacity)
+    {
+        if (!dyj_dicts_rehash(dicts, MAX(64U, dicts->slot_capacity*2))) return DYJ_NONE;
+    }
+    if (!dyj_grow((void**)&dicts->keys, &dicts->key_capacity, dicts->key_count+1, sizeof(dyj_dict_key))) return DYJ_NONE;
+    if (!dyj_grow((void**)&n->keys, &n->key_capacity, n->key_count+1, sizeof(uint))) return DYJ_NONE;
+    copy = (char*)dyb_arena_alloc(dicts->strings, size+1);
+    if (copy == null) return DYJ_NONE;
+    dyb_mem_copy(copy, (void*)key, size);
+    copy[size] = 0;
+
+    id = dicts->key_count++;
+    k = &dicts->keys[id];
+    k->data = copy;
+    k->size = size;
+    k->hash = hash;
+    k->node = node;
+    k->index = n->key_count;
+    n->keys[n->key_count++] = id;
+
+    mask = dicts->slot_capacity-1;
+    slot = dyj_slot_hash(node, hash) & mask;
+    while (dicts->slots[slot]) slot = (slot+1) & mask;
+    dicts->slots[slot] = id+1;
+    return id;
+}
+
+uint dyj_dicts_path(dyj_dicts* dicts, uint node, char* path, uint size)
+{
+    uint steps[DYJ_MAX_DEPTH+1];
+    uint depth = 0, length = 0, i;
+    char digits[DYJ_PATH_MAX_STEP_DIGITS+1];
+
+    while (node != DYJ_ROOT_NODE)
+    {
+        if (depth > DYJ_MAX_DEPTH) return 0;
+        steps[depth++] = dicts->nodes[node].step;
+        node = dicts->nodes[node].parent;
+    }
+
+    if (size < 1) return 0;
+    path[length++] = '$';
+    while (depth > 0)
+    {
+        uint step = steps[--depth];
+        if (step == DYJ_NONE)
+        {
+            if (length+3 > size) return 0;
+            path[length++] = '.';
+            path[length++] = '[';
+            path[length++] = ']';
+        }
+        else
+        {
+            uint n = 0;
+            do
+            {
+                digits[n++] = (char)('0' + step%10);
+                step /= 10;
+            } while (step);
+            if (length+1+n > size) return 0;
+            path[length++] = '.';
+            for (i=n; i>0; i--) path[length++] = digits[i-1];
+        }
+    }
+    return length;
+}
+
+uint dyj_dicts_parse_path(dyj_dicts* dicts, const char* path, uint size)
+{
+    uint node = DYJ_ROOT_NODE;
+    uint i = 1, depth = 0;
+
+    if (size == 0 || path[0] != '$') return DYJ_NONE;
+    while (i < size)
+    {
+        uint step;
+        if (path[i] != '.' || i+1 >= size) return DYJ_NONE;
+        i++;
+        if (++depth > DYJ_MAX_DEPTH) return DYJ_NONE;
+        if (path[i] == '[')
+        {
+            if (i+1 >= size || path[i+1] != ']') return DYJ_NONE;
+            i += 2;
+            step = DYJ_NONE;
+        }
+        else
+        {
+            uint n = 0;
+            step = 0;
+            if (path[i] == '0' && i+1 < size && path[i+1] != '.') return DYJ_NONE;       // leading zero
+            while (i < size && path[i] >= '0' && path[i] <= '9')
+            {
+                step = step*10 + (uint)(path[i]-'0');
+                if (++n > DYJ_PATH_MAX_STEP_DIGITS || step > DYJ_MAX_KEY_INDEX) return DYJ_NONE;
+                i++;
+            }
+            if (n == 0) return DYJ_NONE;
+        }
+        node = dyj_dicts_child(dicts, node, step);
+        if (node == DYJ_NONE) return DYJ_NONE;
+    }
+    return node;
+}
+
+static uint64 dyj_dicts_collection_size(dyj_dicts* dicts)
+{
+    char path[DYJ_PATH_BUFFER_SIZE];
+    uint64 size = dyj_var_u64_size(dicts->dict_count);
+    uint i, j, length;
+
+    for (i=0; i<dicts->dict_count; i++)
+    {
+        dyj_path_node* n = &dicts->nodes[dicts->order[i]];
+        length = dyj_dicts_path(dicts, dicts->order[i], path, sizeof(path));
+        size += dyj_var_u64_size(length) + length + dyj_var_u64_size(n->key_count);
+        for (j=0; j<n->key_count; j++)
+        {
+            dyj_dict_key* k = &dicts->keys[n->keys[j]];
+            size += dyj_var_u64_size(k->size) + k->size;
+        }
+    }
+    return size;
+}
+
+uint dyj_dicts_header_size(dyj_dicts* dicts)
+{
+    uint64 size = 1 + dyj_var_u64_size(DYJ_FORMAT_VERSION) + dyj_dicts_collection_size(dicts);
+    return size > 0x7FFFFFFFU ? 0x7FFFFFFFU : (uint)size;
+}
+
+uint dyj_dicts_shared_header_size(dyj_dicts* dicts, const dyj_shared_ref* ref)
+{
+    uint64 size = 1 + dyj_var_u64_size(DYJ_FORMAT_VERSION_SHARED) + dyj_var_u64_size(ref->id)
+                  + dyj_var_u64_size(ref->version) + 1;
+    if (ref->define) size += dyj_dicts_collection_size(dicts);
+    return size > 0x7FFFFFFFU ? 0x7FFFFFFFU : (uint)size;
+}
+
+static boolean dyj_dicts_write_collection(dyj_dicts* dicts, dybuf* out)
+{
+    char path[DYJ_PATH_BUFFER_SIZE];
+    uint i, j, length;
+
+    dyb_append_var_u64(out, dicts->dict_count);
+    for (i=0; i<dicts->dict_count; i++)
+    {
+        dyj_path_node* n = &dicts->nodes[dicts->order[i]];
+        length = dyj_dicts_path(dicts, dicts->order[i], path, sizeof(path));
+        if (length == 0) return false;
+        dyb_append_data_with_var_len(out, (uint8*)path, length);
+        dyb_append_var_u64(out, n->key_count);
+        for (j=0; j<n->key_count; j++)
+        {
+            dyj_dict_key* k = &dicts->keys[n->keys[j]];
+            dyb_append_data_with_var_len(out, (uint8*)k->data, k->size);
+        }
+    }
+    return true;
+}
+
+boolean dyj_dicts_write_header(dyj_dicts* dicts, uint version, dybuf* out)
+{
+    if (!dyj_out_reserve(out, dyj_dicts_header_size(dicts))) return false;
+    dyb_append_typdex(out, typdex_typ_obj, 0);
+    dyb_append_var_u64(out, version);
+    return dyj_dicts_write_collection(dicts, out);
+}
+
+boolean dyj_dicts_write_shared_header(dyj_dicts* dicts, const dyj_shared_ref* ref, dybuf* out)
+{
+    if (!dyj_out_reserve(out, dyj_dicts_shared_header_size(dicts, ref))) return false;
+    dyb_append_typdex(out, typdex_typ_obj, 0);
+    dyb_append_var_u64(out, DYJ_FORMAT_VERSION_SHARED);
+    dyb_append_var_u64(out, ref->id);
+    dyb_append_var_u64(out, ref->version);
+    dyb_append_var_u64(out, ref->define ? 1 : 0);
+    return ref->define ? dyj_dicts_write_collection(dicts, out) : true;
+}
+
+static enum dyj_err dyj_dicts_read_version(dyj_reader* r, uint64* version)
+{
+    uint8 type;
+    uint index;
+
+    if (!dyj_read_typdex(r, &type, &index)) return dyj_err_truncated;
+    if (type != typdex_typ_obj || index != 0) return dyj_err_bad_marker;
+    if (!dyj_read_var_u64(r, version)) return dyj_err_truncated;
+    return dyj_err_none;
+}
+
+static enum dyj_err dyj_dicts_read_collection(dyj_dicts* dicts, dyj_reader* r)
+{
+    uint count, key_count, size, i, j, node;
+    const char* data;
+
+    if (!dyj_read_count(r, &count)) return dyj_err_truncated;
+
+    for (i=0; i<count; i++)
+    {
+        if (!dyj_read_count(r, &size)) return dyj_err_truncated;
+        data = (const char*)dyj_read_bytes(r, size);
+        if (data == null) return dyj_err_truncated;
+        node = dyj_dicts_parse_path(dicts, data, size);
+        if (node == DYJ_NONE) return dyj_err_bad_dictionary;
+        if (dicts->nodes[node].has_dictionary) return dyj_err_bad_dictionary;
+        if (!dyj_dicts_ensure_dictionary(dicts, node)) return dyj_err_no_memory;
+
+        if (!dyj_read_count(r, &key_count)) return dyj_err_truncated;
+        if (key_count > DYJ_MAX_KEY_INDEX+1) return dyj_err_bad_dictionary;
+        for (j=0; j<key_count; j++)
+        {
+            uint32 hash;
+            if (!dyj_read_count(r, &size)) return dyj_err_truncated;
+            data = (const char*)dyj_read_bytes(r, size);
+            if (data == null) return dyj_err_truncated;
+            hash = dyj_hash_bytes(data, size);
+            if (dyj_dicts_find(dicts, node, data, size, hash) != DYJ_NONE) return dyj_err_bad_dictionary;
+            if (dyj_dicts_intern(dicts, node, data, size, hash) == DYJ_NONE) return dyj_err_no_memory;
+        }
+    }
+    return dyj_err_none;
+}
+
+enum dyj_err dyj_dicts_read_header(dyj_dicts* dicts, dyj_reader* r)
+{
+    uint64 version;
+    enum dyj_err err = dyj_dicts_read_version(r, &version);
+
+    if (err != dyj_err_none) return err;
+    if (version != DYJ_FORMAT_VERSION) return dyj_err_bad_version;
+    return dyj_dicts_read_collection(dicts, r);
+}
+
+boolean dyj_dicts_prepare_stamps(dyj_dicts* dicts)
+{
+    uint i, total = 0, size;
+
+    for (i=0; i<dicts->node_count; i++)
+    {
+        dicts->nodes[i].stamp_base = total;
+        total += dicts->nodes[i].key_count;
+    }
+    if (dicts->stamps) dyb_mem_release(dicts->stamps, 0);
+    size = MAX(1U, total)*sizeof(uint);
+    dicts->stamps = (uint*)dyb_mem_alloc(&size, false);
+    dicts->stamp = 0;
+    return dicts->stamps != null;
+}
+
+/// ===== shared dictionaries =====
+
+dyj_dict_cache* dyj_dict_cache_create(void)
+{
+    uint size = sizeof(dyj_dict_cache);
+    dyj_dict_cache* cache = (dyj_dict_cache*)dyb_mem_alloc(&size, false);
+
+    if (cache == null) return null;
+    plat_mem_set(cache, 0, sizeof(*cache));
+    dyb_arena_init(&cache->strings, 0);
+    return cache;
+}
+
+void dyj_dict_cache_release(dyj_dict_cache* cache)
+{
+    uint i;
+
+    if (cache == null) return;
+    for (i=0; i<cache->set_count; i++) dyj_dicts_release(&cache->sets[i].dicts);
+    if (cache->sets) dyb_mem_release(cache->sets, 0);
+    dyb_arena_release(&cache->strings);
+    dyb_mem_release(cache, 0);
+}
+
+static dyj_dict_set* dyj_dict_cache_find(dyj_dict_cache* cache, uint64 id)
+{
+    uint i;
+    for (i=0; i<cache->set_count; i++)
+    {
+        if (cache->sets[i].id == id) return &cache->sets[i];
+    }
+    return null;
+}
+
+enum dyj_err dyj_dict_cache_read_header(dyj_dict_cache* cache, dyj_dicts* own, dyj_reader* r, dyj_dicts** dicts,
+                                        uint* format_version)
+{
+    dyj_dict_set* set;
+    uint64 version, id, set_version, define;
+    enum dyj_err err = dyj_dicts_read_version(r, &version);
+
+    if (err != dyj_err_none) return err;
+    if (version == DYJ_FORMAT_VERSION || version == DYJ_FORMAT_VERSION_COLUMNAR)
+    {
+        *dicts = own;
+        *format_version = (uint)version;
+        err = dyj_dicts_read_collection(own, r);
+        if (err == dyj_err_none && !dyj_dicts_prepare_stamps(own)) err = dyj_err_no_memory;
+        return err;
+    }
+    if (version != DYJ_FORMAT_VERSION_SHARED || cache == null) return dyj_err_bad_version;
+    *format_version = (uint)version;
+    if (!dyj_read_var_u64(r, &id) || !dyj_read_var_u64(r, &set_version) || !dyj_read_var_u64(r, &define))
+    {
+        return dyj_err_truncated;
+    }
+    if (define > 1) return dyj_err_bad_dictionary;
+
+    set = dyj_dict_cache_find(cache, id);
+    if (define == 0)
+    {
+        if (set == null || !set->valid || set->version != set_version) return dyj_err_unknown_dictionary;
+        *dicts = &set->dicts;
+        return dyj_err_none;
+    }
+    if (set == null)
+    {
+        if (cache->set_count >= DYJ_MAX_SHARED_SETS) return dyj_err_bad_dictionary;
+        if (!dyj_grow((void**)&cache->sets, &cache->set_capacity, cache->set_count+1, sizeof(dyj_dict_set))) return dyj_err_no_memory;
+        set = &cache->sets[cache->set_count];
+        // keys are kept in the cache arena, decoded members stay valid after a set is replaced
+        if (!dyj_dicts_init(&set->dicts, &cache->strings))
+        {
+            dyj_dicts_release(&set->dicts);
+            return dyj_err_no_memory;
+        }
+        cache->set_count++;
+        set->id = id;
+    }
+    else
+    {
+        dyj_dicts_clear(&set->dicts);
+    }
+    set->valid = false;
+    err = dyj_dicts_read_collection(&set->dicts, r);
+    // a redefinition does not reclaim the keys it replaces, the cache stops taking keys at the cap
+    if (err == dyj_err_none && cache->strings.used > DYJ_MAX_SHARED_STRINGS) err = dyj_err_bad_dictionary;
+    if (err == dyj_err_none && !dyj_dicts_prepare_stamps(&set->dicts)) err = dyj_err_no_memory;
+    if (err != dyj_err_none) return err;
+    set->version = set_version;
+    set->valid = true;
+    *dicts = &set->dicts;
+    return dyj_err_none;
+}
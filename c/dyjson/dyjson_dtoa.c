@@ -0,0 +1,368 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Double to text with Grisu2 (Loitsch, "Printing Floating-Point Numbers Quickly and
+ * Accurately with Integers"). The digits always read back to the same double. Grisu2
+ * misses a shorter form for a few values with 16 or 17 digits, those are checked with
+ * dyj_parse_number. The layout follows ECMAScript Number::toString, as JSON.stringify prints it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dyjson_private.h"
+
+typedef struct dyj_diy_fp
+{
+    uint64 f;
+    int e;
+} dyj_diy_fp;
+
+#define DYJ_DP_SIGNIFICAND_MASK     0x000FFFFFFFFFFFFFULL
+#define DYJ_DP_HIDDEN_BIT           0x0010000000000000ULL
+#define DYJ_DP_EXPONENT_BIAS        (0x3FF + 52)
+
+// normalized 10^k, k = -348, -340, ..., 340
+static const uint64 dyj_cached_f[] = {
+    0xFA8FD5A0081C0288ULL, 0xBAAEE17FA23EBF76ULL, 0x8B16FB203055AC76ULL,
+    0xCF42894A5DCE35EAULL, 0x9A6BB0AA55653B2DULL, 0xE61ACF033D1A45DFULL,
+    0xAB70FE17C79AC6CAULL, 0xFF77B1FCBEBCDC4FULL, 0xBE5691EF416BD60CULL,
+    0x8DD01FAD907FFC3CULL, 0xD3515C2831559A83ULL, 0x9D71AC8FADA6C9B5ULL,
+    0xEA9C227723EE8BCBULL, 0xAECC49914078536DULL, 0x823C12795DB6CE57ULL,
+    0xC21094364DFB5637ULL, 0x9096EA6F3848984FULL, 0xD77485CB25823AC7ULL,
+    0xA086CFCD97BF97F4ULL, 0xEF340A98172AACE5ULL, 0xB23867FB2A35B28EULL,
+    0x84C8D4DFD2C63F3BULL, 0xC5DD44271AD3CDBAULL, 0x936B9FCEBB25C996ULL,
+    0xDBAC6C247D62A584ULL, 0xA3AB66580D5FDAF6ULL, 0xF3E2F893DEC3F126ULL,
+    0xB5B5ADA8AAFF80B8ULL, 0x87625F056C7C4A8BULL, 0xC9BCFF6034C13053ULL,
+    0x964E858C91BA2655ULL, 0xDFF9772470297EBDULL, 0xA6DFBD9FB8E5B88FULL,
+    0xF8A95FCF88747D94ULL, 0xB94470938FA89BCFULL, 0x8A08F0F8BF0F156BULL,
+    0xCDB02555653131B6ULL, 0x993FE2C6D07B7FACULL, 0xE45C10C42A2B3B06ULL,
+    0xAA242499697392D3ULL, 0xFD87B5F28300CA0EULL, 0xBCE5086492111AEBULL,
+    0x8CBCCC096F5088CCULL, 0xD1B71758E219652CULL, 0x9C40000000000000ULL,
+    0xE8D4A51000000000ULL, 0xAD78EBC5AC620000ULL, 0x813F3978F8940984ULL,
+    0xC097CE7BC90715B3ULL, 0x8F7E32CE7BEA5C70ULL, 0xD5D238A4ABE98068ULL,
+    0x9F4F2726179A2245ULL, 0xED63A231D4C4FB27ULL, 0xB0DE65388CC8ADA8ULL,
+    0x83C7088E1AAB65DBULL, 0xC45D1DF942711D9AULL, 0x924D692CA61BE758ULL,
+    0xDA01EE641A708DEAULL, 0xA26DA3999AEF774AULL, 0xF209787BB47D6B85ULL,
+    0xB454E4A179DD1877ULL, 0x865B86925B9BC5C2ULL, 0xC83553C5C8965D3DULL,
+    0x952AB45CFA97A0B3ULL, 0xDE469FBD99A05FE3ULL, 0xA59BC234DB398C25ULL,
+    0xF6C69A72A3989F5CULL, 0xB7DCBF5354E9BECEULL, 0x88FCF317F22241E2ULL,
+    0xCC20CE9BD35C78A5ULL, 0x98165AF37B2153DFULL, 0xE2A0B5DC971F303AULL,
+    0xA8D9D1535CE3B396ULL, 0xFB9B7CD9A4A7443CULL, 0xBB764C4CA7A44410ULL,
+    0x8BAB8EEFB6409C1AULL, 0xD01FEF10A657842CULL, 0x9B10A4E5E9913129ULL,
+    0xE7109BFBA19C0C9DULL, 0xAC2820D9623BF429ULL, 0x80444B5E7AA7CF85ULL,
+    0xBF21E44003ACDD2DULL, 0x8E679C2F5E44FF8FULL, 0xD433179D9C8CB841ULL,
+    0x9E19DB92B4E31BA9ULL, 0xEB96BF6EBADF77D9ULL, 0xAF87023B9BF0EE6BULL
+};
+
+static const short dyj_cached_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066
+};
+
+static const uint64 dyj_pow10[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static inline dyj_diy_fp dyj_diy_fp_make(uint64 f, int e)
+{
+    dyj_diy_fp r;
+    r.f = f;
+    r.e = e;
+    return r;
+}
+
+static inline dyj_diy_fp dyj_diy_fp_multiply(dyj_diy_fp x, dyj_diy_fp y)
+{
+    // upper 64 bits of the 128-bit product, rounded
+    uint64 a = x.f >> 32, b = x.f & 0xFFFFFFFFULL;
+    uint64 c = y.f >> 32, d = y.f & 0xFFFFFFFFULL;
+    uint64 ac = a*c, bc = b*c, ad = a*d, bd = b*d;
+    uint64 middle = (bd >> 32) + (ad & 0xFFFFFFFFULL) + (bc & 0xFFFFFFFFULL) + (1ULL << 31);
+    return dyj_diy_fp_make(ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64);
+}
+
+static inline dyj_diy_fp dyj_diy_fp_normalize(dyj_diy_fp x)
+{
+    while ((x.f & 0x8000000000000000ULL) == 0)
+    {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/**
+ *  Boundaries m- and m+ of v, both with the exponent of the normalized m+.
+ */
+static void dyj_diy_fp_boundaries(dyj_diy_fp v, dyj_diy_fp* minus, dyj_diy_fp* plus)
+{
+    dyj_diy_fp p = dyj_diy_fp_normalize(dyj_diy_fp_make((v.f << 1) + 1, v.e - 1));
+    dyj_diy_fp m = (v.f == DYJ_DP_HIDDEN_BIT) ? dyj_diy_fp_make((v.f << 2) - 1, v.e - 2)
+                                               : dyj_diy_fp_make((v.f << 1) - 1, v.e - 1);
+    m.f <<= m.e - p.e;
+    m.e = p.e;
+    *minus = m;
+    *plus = p;
+}
+
+static inline uint dyj_count_digits(uint32 n)
+{
+    if (n < 10) return 1;
+    if (n < 100) return 2;
+    if (n < 1000) return 3;
+    if (n < 10000) return 4;
+    if (n < 100000) return 5;
+    if (n < 1000000) return 6;
+    if (n < 10000000) return 7;
+    if (n < 100000000) return 8;
+    if (n < 1000000000) return 9;
+    return 10;
+}
+
+// move the last digit towards w while it stays inside the interval
+static inline void dyj_grisu_round(char* buffer, uint length, uint64 delta, uint64 rest, uint64 ten_kappa, uint64 wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buffer[length-1]--;
+        rest += ten_kappa;
+    }
+}
+
+static uint dyj_grisu_digits(dyj_diy_fp w, dyj_diy_fp mp, uint64 delta, char* buffer, int* k)
+{
+    dyj_diy_fp one = dyj_diy_fp_make(1ULL << -mp.e, mp.e);
+    uint64 wp_w = mp.f - w.f;
+    uint32 p1 = (uint32)(mp.f >> -one.e);
+    uint64 p2 = mp.f & (one.f - 1);
+    int kappa = (int)dyj_count_digits(p1);
+    uint length = 0;
+
+    while (kappa > 0)
+    {
+        uint32 divisor = (uint32)dyj_pow10[kappa-1];
+        uint32 d = p1 / divisor;
+        uint64 rest;
+        p1 %= divisor;
+        if (d || length) buffer[length++] = (char)('0' + d);
+        kappa--;
+        rest = ((uint64)p1 << -one.e) + p2;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            dyj_grisu_round(buffer, length, delta, rest, dyj_pow10[kappa] << -one.e, wp_w);
+            return length;
+        }
+    }
+
+    while (1)
+    {
+        uint d;
+        p2 *= 10;
+        delta *= 10;
+        d = (uint)(p2 >> -one.e);
+        if (d || length) buffer[length++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            *k += kappa;
+            dyj_grisu_round(buffer, length, delta, p2, one.f, -kappa < 20 ? wp_w * dyj_pow10[-kappa] : 0);
+            return length;
+        }
+    }
+}
+
+/**
+ *  Shortest digits of a positive finite value: value = digits * 10^k.
+ */
+static uint dyj_grisu2(double value, char* buffer, int* k)
+{
+    uint64 bits;
+    dyj_diy_fp v, w, minus, plus, c, wp, wm;
+    int biased, cached_k, index;
+    double dk;
+
+    dyb_mem_copy(&bits, &value, sizeof(bits));
+    biased = (int)((bits >> 52) & 0x7FF);
+    v.f = bits & DYJ_DP_SIGNIFICAND_MASK;
+    if (biased)
+    {
+        v.f += DYJ_DP_HIDDEN_BIT;
+        v.e = biased - DYJ_DP_EXPONENT_BIAS;
+    }
+    else
+    {
+        v.e = 1 - DYJ_DP_EXPONENT_BIAS;
+    }
+
+    dyj_diy_fp_boundaries(v, &minus, &plus);
+
+    // cached power c = 10^-cached_k so that the product exponent is in [-60, -32]
+    dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    cached_k = (int)dk;
+    if (dk - cached_k > 0.0) cached_k++;
+    index = (cached_k >> 3) + 1;
+    cached_k = -(-348 + index*8);
+    c = dyj_diy_fp_make(dyj_cached_f[index], dyj_cached_e[index]);
+
+    w = dyj_diy_fp_multiply(dyj_diy_fp_normalize(v), c);
+    wp = dyj_diy_fp_multiply(plus, c);
+    wm = dyj_diy_fp_multiply(minus, c);
+    wm.f++;
+    wp.f--;
+    *k = cached_k;
+    return dyj_grisu_digits(w, wp, wp.f - wm.f, buffer, k);
+}
+
+// digits*10^k read back as value
+static boolean dyj_digits_match(double value, const char* digits, uint length, int k)
+{
+    char text[40];
+    boolean integer;
+    int64 i;
+    double read;
+    uint size;
+
+    dyb_mem_copy(text, (void*)digits, length);
+    size = length + (uint)sprintf(text+length, "e%d", k);
+    return dyj_parse_number(text, text+size, &integer, &i, &read) == size && read == value;
+}
+
+/**
+ *  Try the two neighbours with one digit less, the nearest one first.
+ */
+static boolean dyj_digits_shorten(double value, char* digits, uint* length, int* k)
+{
+    char candidate[20];
+    uint n = *length-1, i, attempt;
+    boolean up = digits[n] >= '5';
+
+    for (attempt=0; attempt<2; attempt++, up = !up)
+    {
+        uint size = n;
+        int exponent = *k+1;
+        dyb_mem_copy(candidate, digits, n);
+        if (up)
+        {
+            for (i=n; i>0 && candidate[i-1] == '9'; i--) candidate[i-1] = '0';
+            if (i == 0)
+            {
+                candidate[0] = '1';
+                size = 1;
+                exponent += (int)n;
+            }
+            else
+            {
+                candidate[i-1]++;
+            }
+        }
+        while (size > 1 && candidate[size-1] == '0')
+        {
+            size--;
+            exponent++;
+        }
+        if (dyj_digits_match(value, candidate, size, exponent))
+        {
+            dyb_mem_copy(digits, candidate, size);
+            *length = size;
+            *k = exponent;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint dyj_format_double(double value, char* buffer)
+{
+    char digits[20];
+    uint length, i, size = 0;
+    int k, n;
+
+    if (value == 0.0)
+    {
+        // JSON.stringify(-0) is "0"
+        buffer[0] = '0';
+        buffer[1] = 0;
+        return 1;
+    }
+    if (value < 0)
+    {
+        buffer[size++] = '-';
+        value = -value;
+    }
+    length = dyj_grisu2(value, digits, &k);
+    while (length >= 16 && dyj_digits_shorten(value, digits, &length, &k)) {}
+    // value = 0.digits * 10^n
+    n = (int)length + k;
+
+    if ((int)length <= n && n <= 21)
+    {
+        dyb_mem_copy(buffer+size, digits, length);
+        size += length;
+        for (i=length; i<(uint)n; i++) buffer[size++] = '0';
+    }
+    else if (0 < n && n <= 21)
+    {
+        dyb_mem_copy(buffer+size, digits, (uint)n);
+        size += (uint)n;
+        buffer[size++] = '.';
+        dyb_mem_copy(buffer+size, digits+n, length-(uint)n);
+        size += length-(uint)n;
+    }
+    else if (-6 < n && n <= 0)
+    {
+        buffer[size++] = '0';
+        buffer[size++] = '.';
+        for (i=0; i<(uint)-n; i++) buffer[size++] = '0';
+        dyb_mem_copy(buffer+size, digits, length);
+        size += length;
+    }
+    else
+    {
+        int e = n-1;
+        buffer[size++] = digits[0];
+        if (length > 1)
+        {
+            buffer[size++] = '.';
+            dyb_mem_copy(buffer+size, digits+1, length-1);
+            size += length-1;
+        }
+        buffer[size++] = 'e';
+        buffer[size++] = e < 0 ? '-' : '+';
+        if (e < 0) e = -e;
+        if (e >= 100) buffer[size++] = (char)('0' + e/100);
+        if (e >= 10) buffer[size++] = (char)('0' + e/10%10);
+        buffer[size++] = (char)('0' + e%10);
+    }
+    buffer[size] = 0;
+    return size;
+}
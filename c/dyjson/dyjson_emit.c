@@ -0,0 +1,269 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * JSON-dybuf -> compact JSON text, straight from the payload records. The input is
+ * checked like dyj_decode. Text is written to a dybuf, or to a dybuf that is flushed
+ * to a FILE* whenever it holds DYJ_EMIT_FLUSH_SIZE bytes.
+ */
+
+#include <math.h>
+#include "dyjson_private.h"
+
+#define DYJ_EMIT_FLUSH_SIZE         (64*1024)
+
+typedef struct dyj_emitter
+{
+    dyj_reader r;
+    dyj_dicts dicts;
+    dybuf* out;
+    FILE* fp;                           // null when writing to out only
+} dyj_emitter;
+
+// 0: copied as is, otherwise the character after the backslash; 0xED may start a surrogate
+static const char dyj_escapes[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 'S', 0, 0,
+};
+
+static inline boolean dyj_emit_reserve(dyj_emitter* em, uint extra)
+{
+    return dyj_out_reserve(em->out, extra);
+}
+
+static inline void dyj_emit_bytes(dyj_emitter* em, const char* data, uint size)
+{
+    dyb_append_data_without_len(em->out, (uint8*)data, size);
+}
+
+static boolean dyj_emit_flush(dyj_emitter* em)
+{
+    uint size = dyb_get_position(em->out);
+    if (size && fwrite(em->out->_data, 1, size, em->fp) != size) return false;
+    dyb_clear(em->out);
+    return true;
+}
+
+/**
+ *  Runs without escapes are copied at once. The output is reserved for the worst case
+ *  and one more byte for the ':' after a key. A lone surrogate (kept by the text parser
+ *  as 3 bytes) is written as \uXXXX, like JSON.stringify.
+ */
+static enum dyj_err dyj_emit_string(dyj_emitter* em, const uint8* data, uint size)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint i, start = 0;
+
+    if ((uint64)size*6 + 3 > 0x7FFFFFFFU || !dyj_emit_reserve(em, size*6 + 3)) return dyj_err_no_memory;
+    dyb_append_u8(em->out, '"');
+    for (i=0; i<size; i++)
+    {
+        char escape = dyj_escapes[data[i]];
+        uint code;
+        if (escape == 0) continue;
+        if (escape == 'S')
+        {
+            if (i+2 >= size || data[i+1] < 0xA0 || data[i+1] > 0xBF || (data[i+2]&0xC0) != 0x80) continue;
+            code = 0xD000 | ((uint)(data[i+1]&0x3F) << 6) | (data[i+2]&0x3F);
+        }
+        else
+        {
+            code = data[i];
+        }
+        if (i > start) dyj_emit_bytes(em, (const char*)data+start, i-start);
+        dyb_append_u8(em->out, '\\');
+        if (escape == 'u' || escape == 'S')
+        {
+            dyb_append_u8(em->out, 'u');
+            dyb_append_u8(em->out, (uint8)hex[code>>12]);
+            dyb_append_u8(em->out, (uint8)hex[(code>>8)&0x0F]);
+            dyb_append_u8(em->out, (uint8)hex[(code>>4)&0x0F]);
+            dyb_append_u8(em->out, (uint8)hex[code&0x0F]);
+        }
+        else
+        {
+            dyb_append_u8(em->out, (uint8)escape);
+        }
+        if (escape == 'S') i += 2;
+        start = i+1;
+    }
+    if (size > start) dyj_emit_bytes(em, (const char*)data+start, size-start);
+    dyb_append_u8(em->out, '"');
+    return dyj_err_none;
+}
+
+static void dyj_emit_uint(dyj_emitter* em, boolean negative, uint64 value)
+{
+    char digits[21];
+    uint n = sizeof(digits);
+
+    do
+    {
+        digits[--n] = (char)('0' + value%10);
+        value /= 10;
+    } while (value);
+    if (negative) digits[--n] = '-';
+    dyj_emit_bytes(em, digits+n, sizeof(digits)-n);
+}
+
+static enum dyj_err dyj_emit_value(dyj_emitter* em, uint8 type, uint node, uint depth)
+{
+    enum dyj_err err;
+    dyj_scalar scalar;
+    uint i, count, stamp, id, child = DYJ_NONE;
+    uint8 item_type;
+
+    // the largest scalar: a double or a 20 digits integer
+    if (!dyj_emit_reserve(em, DYJ_DOUBLE_BUFFER_SIZE)) return dyj_err_no_memory;
+    switch (type)
+    {
+        case typdex_typ_array:
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            if (!dyj_read_count(&em->r, &count)) return dyj_err_truncated;
+            dyb_append_u8(em->out, '[');
+            for (i=0; i<count; i++)
+            {
+                if (em->fp && dyb_get_position(em->out) >= DYJ_EMIT_FLUSH_SIZE && !dyj_emit_flush(em)) return dyj_err_io;
+                if ((err = dyj_read_item(&em->r, &em->dicts, node, &item_type, &child)) != dyj_err_none) return err;
+                if (i) dyb_append_u8(em->out, ',');
+                err = dyj_emit_value(em, item_type, child, depth+1);
+                if (err != dyj_err_none) return err;
+            }
+            if (!dyj_emit_reserve(em, 1)) return dyj_err_no_memory;
+            dyb_append_u8(em->out, ']');
+            return dyj_err_none;
+        case typdex_typ_map:
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            if ((err = dyj_read_object(&em->r, &em->dicts, node, &count, &stamp)) != dyj_err_none) return err;
+            dyb_append_u8(em->out, '{');
+            for (i=0; i<count; i++)
+            {
+                const dyj_dict_key* key;
+                if (em->fp && dyb_get_position(em->out) >= DYJ_EMIT_FLUSH_SIZE && !dyj_emit_flush(em)) return dyj_err_io;
+                err = dyj_read_member(&em->r, &em->dicts, node, stamp, &item_type, &id, &child);
+                if (err != dyj_err_none) return err;
+                key = &em->dicts.keys[id];
+                if (i) dyb_append_u8(em->out, ',');
+                err = dyj_emit_string(em, (const uint8*)key->data, key->size);
+                if (err != dyj_err_none) return err;
+                dyb_append_u8(em->out, ':');
+                err = dyj_emit_value(em, item_type, child, depth+1);
+                if (err != dyj_err_none) return err;
+            }
+            if (!dyj_emit_reserve(em, 1)) return dyj_err_no_memory;
+            dyb_append_u8(em->out, '}');
+            return dyj_err_none;
+    }
+
+    if ((err = dyj_read_scalar(&em->r, type, &scalar)) != dyj_err_none) return err;
+    switch (type)
+    {
+        case typdex_typ_none:
+            dyj_emit_bytes(em, "null", 4);
+            break;
+        case typdex_typ_bool:
+            if (scalar.u.b) dyj_emit_bytes(em, "true", 4);
+            else dyj_emit_bytes(em, "false", 5);
+            break;
+        case typdex_typ_double:
+        {
+            char text[DYJ_DOUBLE_BUFFER_SIZE];
+            dyj_emit_bytes(em, text, dyj_format_double(scalar.u.d, text));
+            break;
+        }
+        case typdex_typ_string:
+            return dyj_emit_string(em, scalar.u.s.data, scalar.u.s.size);
+        default:
+            dyj_emit_uint(em, scalar.u.i < 0, scalar.u.i < 0 ? (uint64)-scalar.u.i : (uint64)scalar.u.i);
+            break;
+    }
+    return dyj_err_none;
+}
+
+static enum dyj_err dyj_emit(dybuf* in, dyj_emitter* em)
+{
+    enum dyj_err err;
+    uint8 type;
+    uint index;
+
+    em->r.data = in->_data;
+    em->r.position = dyb_get_position(in);
+    em->r.limit = dyb_get_limit(in);
+    if (!dyj_dicts_init(&em->dicts, null)) return dyj_err_no_memory;
+
+    err = dyj_dicts_read_header(&em->dicts, &em->r);
+    if (err == dyj_err_none && !dyj_dicts_prepare_stamps(&em->dicts)) err = dyj_err_no_memory;
+    if (err == dyj_err_none)
+    {
+        if (!dyj_read_typdex(&em->r, &type, &index)) err = dyj_err_truncated;
+        else if (type != typdex_typ_obj || index != 1) err = dyj_err_bad_marker;
+    }
+    if (err == dyj_err_none)
+    {
+        if (!dyj_read_typdex(&em->r, &type, &index)) err = dyj_err_truncated;
+        else err = dyj_emit_value(em, type, DYJ_ROOT_NODE, 0);
+    }
+    if (err == dyj_err_none) dyb_set_position(in, em->r.position);
+
+    dyj_dicts_release(&em->dicts);
+    return err;
+}
+
+enum dyj_err dyj_emit_text(dybuf* in, dybuf* out)
+{
+    dyj_emitter em;
+    enum dyj_err err;
+    uint start;
+
+    if (in == null || out == null) return dyj_err_invalid_args;
+    em.out = out;
+    em.fp = null;
+    start = dyb_get_position(out);
+    err = dyj_emit(in, &em);
+    if (err != dyj_err_none) dyb_set_position(out, start);
+    return err;
+}
+
+enum dyj_err dyj_emit_text_file(dybuf* in, FILE* fp)
+{
+    dyj_emitter em;
+    enum dyj_err err;
+
+    if (in == null || fp == null) return dyj_err_invalid_args;
+    em.out = dyb_create(null, DYJ_EMIT_FLUSH_SIZE + 256);
+    if (em.out == null) return dyj_err_no_memory;
+    em.fp = fp;
+    err = dyj_emit(in, &em);
+    if (err == dyj_err_none && !dyj_emit_flush(&em)) err = dyj_err_io;
+    dyb_release(em.out);
+    return err;
+}
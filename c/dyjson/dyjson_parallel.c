@@ -0,0 +1,246 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Parallel encoding of a root array. The items are split into one chunk per worker, each
+ * worker collects its chunk with its own dictionaries. The dictionaries are merged in
+ * chunk order, which gives the paths and keys the same order as one pass over the whole
+ * array. Typdex sizes depend on the key index only (JSON types are below 0x10), so every
+ * chunk size is known after the merge and the workers write their chunks in place,
+ * translating local key ids to merged indices.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+#include <pthread.h>
+#include "dyjson_private.h"
+
+#define DYJ_PARALLEL_MAX_WORKERS    64
+#define DYJ_PARALLEL_MIN_ITEMS      256                 // items per worker, fewer run serially
+
+typedef struct dyj_parallel_worker
+{
+    dyj_encoder enc;
+    const dyj_value* array;
+    uint begin, end;                    // items of the chunk
+    uint* uses;                         // members per local key id
+    uint* key_map;                      // local key id -> merged index
+    uint* node_map;                     // local node -> merged node
+    uint64 size;                        // chunk bytes with merged indices
+    uint8* data;                        // where the chunk is written in out
+    enum dyj_err err;
+} dyj_parallel_worker;
+
+static void* dyj_parallel_collect(void* context)
+{
+    dyj_parallel_worker* worker = (dyj_parallel_worker*)context;
+    dyj_encoder* enc = &worker->enc;
+    uint i, size, child = DYJ_NONE;
+
+    for (i=worker->begin; i<worker->end && worker->err == dyj_err_none; i++)
+    {
+        const dyj_value* item = worker->array->u.a.items[i];
+        if ((item->type == dyj_array || item->type == dyj_object) && child == DYJ_NONE)
+        {
+            child = dyj_dicts_array_child(&enc->dicts, DYJ_ROOT_NODE);
+            if (child == DYJ_NONE) worker->err = dyj_err_no_memory;
+        }
+        if (worker->err == dyj_err_none) worker->err = dyj_encode_collect(enc, item, child, 0, 1);
+    }
+    if (worker->err != dyj_err_none) return null;
+
+    size = MAX(1U, enc->dicts.key_count)*sizeof(uint);
+    worker->uses = (uint*)dyb_mem_alloc(&size, false);
+    if (worker->uses == null)
+    {
+        worker->err = dyj_err_no_memory;
+        return null;
+    }
+    plat_mem_set(worker->uses, 0, enc->dicts.key_count*sizeof(uint));
+    for (i=0; i<enc->member_count; i++) worker->uses[enc->member_keys[i]]++;
+    return null;
+}
+
+static void* dyj_parallel_write(void* context)
+{
+    dyj_parallel_worker* worker = (dyj_parallel_worker*)context;
+    dyj_encoder* enc = &worker->enc;
+    dybuf chunk;
+    uint i, child = DYJ_NONE;
+
+    dyb_refer(&chunk, worker->data, (uint)worker->size, true);
+    enc->key_map = worker->key_map;
+    for (i=worker->begin; i<worker->end; i++)
+    {
+        const dyj_value* item = worker->array->u.a.items[i];
+        if ((item->type == dyj_array || item->type == dyj_object) && child == DYJ_NONE)
+        {
+            child = enc->dicts.nodes[DYJ_ROOT_NODE].array_child;
+        }
+        dyj_encode_write(enc, &chunk, item, child, 0);
+    }
+    if (dyb_get_position(&chunk) != worker->size) worker->err = dyj_err_bad_state;
+    return null;
+}
+
+// local node of a worker in the merged dictionaries, its parent's keys are merged already
+static uint dyj_parallel_map_node(dyj_dicts* dicts, dyj_parallel_worker* worker, uint node)
+{
+    dyj_dicts* local = &worker->enc.dicts;
+    uint parent, step;
+
+    if (worker->node_map[node] != DYJ_NONE) return worker->node_map[node];
+    parent = dyj_parallel_map_node(dicts, worker, local->nodes[node].parent);
+    if (parent == DYJ_NONE) return DYJ_NONE;
+    step = local->nodes[node].step;
+    if (step != DYJ_NONE) step = worker->key_map[local->nodes[local->nodes[node].parent].keys[step]];
+    worker->node_map[node] = dyj_dicts_child(dicts, parent, step);
+    return worker->node_map[node];
+}
+
+/**
+ *  Add the dictionaries of a worker in their creation order, then the chunk size: the
+ *  collected payload plus the typdex size change of every member.
+ */
+static enum dyj_err dyj_parallel_merge(dyj_dicts* dicts, dyj_parallel_worker* worker)
+{
+    dyj_dicts* local = &worker->enc.dicts;
+    uint i, j, node, id, size;
+    int64 delta = 0;
+
+    size = MAX(1U, local->key_count)*sizeof(uint);
+    worker->key_map = (uint*)dyb_mem_alloc(&size, false);
+    size = MAX(1U, local->node_count)*sizeof(uint);
+    worker->node_map = (uint*)dyb_mem_alloc(&size, false);
+    if (worker->key_map == null || worker->node_map == null) return dyj_err_no_memory;
+    plat_mem_set(worker->node_map, 0xFF, local->node_count*sizeof(uint));
+    worker->node_map[DYJ_ROOT_NODE] = DYJ_ROOT_NODE;
+
+    for (i=0; i<local->dict_count; i++)
+    {
+        dyj_path_node* n = &local->nodes[local->order[i]];
+        node = dyj_parallel_map_node(dicts, worker, local->order[i]);
+        if (node == DYJ_NONE || !dyj_dicts_ensure_dictionary(dicts, node)) return dyj_err_no_memory;
+        for (j=0; j<n->key_count; j++)
+        {
+            const dyj_dict_key* k = &local->keys[n->keys[j]];
+            id = dyj_dicts_intern(dicts, node, k->data, k->size, k->hash);
+            if (id == DYJ_NONE) return dyj_err_no_memory;
+            worker->key_map[n->keys[j]] = dicts->keys[id].index;
+        }
+    }
+
+    for (id=0; id<local->key_count; id++)
+    {
+        if (worker->uses[id] == 0) continue;
+        delta += (int64)worker->uses[id] * ((int64)dyj_typdex_size(typdex_typ_none, worker->key_map[id]) -
+                                            (int64)dyj_typdex_size(typdex_typ_none, local->keys[id].index));
+    }
+    worker->size = (uint64)((int64)worker->enc.payload_size + delta);
+    return dyj_err_none;
+}
+
+static enum dyj_err dyj_parallel_run(dyj_parallel_worker* workers, uint count, void* (*run)(void*))
+{
+    pthread_t threads[DYJ_PARALLEL_MAX_WORKERS];
+    uint i, started;
+    enum dyj_err err = dyj_err_none;
+
+    // the calling thread takes the first chunk
+    for (started=1; started<count; started++)
+    {
+        if (pthread_create(&threads[started], null, run, &workers[started]) != 0) break;
+    }
+    run(&workers[0]);
+    for (i=1; i<started; i++) pthread_join(threads[i], null);
+    for (i=started; i<count; i++) run(&workers[i]);
+    for (i=0; i<count && err == dyj_err_none; i++) err = workers[i].err;
+    return err;
+}
+
+enum dyj_err dyj_encode_parallel(dybuf* out, const dyj_value* value, uint threads)
+{
+    dyj_parallel_worker* workers;
+    dyj_dicts dicts;
+    uint i, count, items, size, start, position;
+    uint64 total;
+    enum dyj_err err;
+
+    if (out == null || value == null || threads == 0) return dyj_err_invalid_args;
+    if (value->type != dyj_array) return dyj_encode(out, value);
+    start = dyb_get_position(out);
+    items = value->u.a.size;
+    count = MIN(MIN(threads, (uint)DYJ_PARALLEL_MAX_WORKERS), items/DYJ_PARALLEL_MIN_ITEMS);
+    if (count <= 1) return dyj_encode(out, value);
+
+    size = count*sizeof(dyj_parallel_worker);
+    workers = (dyj_parallel_worker*)dyb_mem_alloc(&size, false);
+    if (workers == null) return dyj_err_no_memory;
+    plat_mem_set(workers, 0, count*sizeof(dyj_parallel_worker));
+    err = dyj_dicts_init(&dicts, null) ? dyj_err_none : dyj_err_no_memory;
+    for (i=0; i<count; i++)
+    {
+        workers[i].array = value;
+        workers[i].begin = (uint)((uint64)items*i/count);
+        workers[i].end = (uint)((uint64)items*(i+1)/count);
+        if (!dyj_dicts_init(&workers[i].enc.dicts, null)) err = dyj_err_no_memory;
+    }
+
+    if (err == dyj_err_none) err = dyj_parallel_run(workers, count, dyj_parallel_collect);
+    for (i=0; i<count && err == dyj_err_none; i++) err = dyj_parallel_merge(&dicts, &workers[i]);
+    if (err == dyj_err_none)
+    {
+        total = dyj_dicts_header_size(&dicts) + 1 + dyj_typdex_size(typdex_typ_array, 0) + dyj_var_u64_size(items);
+        for (i=0; i<count; i++) total += workers[i].size;
+        if (total > 0x7FFFFFFFU || !dyj_out_reserve(out, (uint)total)) err = dyj_err_no_memory;
+        else if (!dyj_dicts_write_header(&dicts, DYJ_FORMAT_VERSION, out)) err = dyj_err_no_memory;
+    }
+    if (err == dyj_err_none)
+    {
+        dyb_append_typdex(out, typdex_typ_obj, 1);
+        dyb_append_typdex(out, typdex_typ_array, 0);
+        dyb_append_var_u64(out, items);
+        position = dyb_get_position(out);
+        for (i=0; i<count; i++)
+        {
+            workers[i].data = out->_data + position;
+            position += (uint)workers[i].size;
+        }
+        err = dyj_parallel_run(workers, count, dyj_parallel_write);
+        if (err == dyj_err_none)
+        {
+            dyb_set_limit(out, MAX(position, dyb_get_limit(out)));
+            dyb_set_position(out, position);
+        }
+        else
+        {
+            dyb_set_position(out, start);
+        }
+    }
+
+    for (i=0; i<count; i++)
+    {
+        if (workers[i].uses) dyb_mem_release(workers[i].uses, 0);
+        if (workers[i].key_map) dyb_mem_release(workers[i].key_map, 0);
+        if (workers[i].node_map) dyb_mem_release(workers[i].node_map, 0);
+        dyj_encoder_release(&workers[i].enc);
+    }
+    dyb_mem_release(workers, 0);
+    dyj_dicts_release(&dicts);
+    return err;
+}
@@ -0,0 +1,530 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Internal helpers shared by the dyjson translation units and the cjson binding
+ * (json/cjson_dybuf.c), not installed.
+ */
+
+#ifndef DYBUF_C_DYJSON_PRIVATE_H
+#define DYBUF_C_DYJSON_PRIVATE_H
+
+#include <math.h>
+#include "dyjson.h"
+
+#define DYJ_NONE                    0xFFFFFFFFU         // no node / no key
+#define DYJ_PATH_MAX_STEP_DIGITS    7                   // DYJ_MAX_KEY_INDEX in decimal
+#define DYJ_PATH_BUFFER_SIZE        (DYJ_MAX_DEPTH*(DYJ_PATH_MAX_STEP_DIGITS+1)+2)
+
+/// ===== memory =====
+
+/**
+ *  Grow (*items) to hold at least need items, capacity doubles.
+ */
+plat_inline boolean dyj_grow(void** items, uint* capacity, uint need, uint item_size)
+{
+    uint new_capacity, size;
+    void* new_items;
+
+    if (need <= *capacity) return true;
+    new_capacity = MAX(CACHE_SIZE_UNIT, *capacity);
+    while (new_capacity < need)
+    {
+        if (new_capacity > 0x7FFFFFFFU/2) return false;
+        new_capacity *= 2;
+    }
+    if ((uint64)new_capacity*item_size > 0x7FFFFFFFU) return false;
+    size = new_capacity*item_size;
+    new_items = dyb_mem_alloc(&size, false);
+    if (new_items == null) return false;
+    if (*items)
+    {
+        dyb_mem_copy(new_items, *items, (*capacity)*item_size);
+        dyb_mem_release(*items, 0);
+    }
+    *items = new_items;
+    *capacity = new_capacity;
+    return true;
+}
+
+/**
+ *  Make sure extra bytes can be appended to out without reallocation.
+ *  dyb_set_limit grows to the exact size, so reserve geometrically here.
+ */
+plat_inline boolean dyj_out_reserve(dybuf* out, uint extra)
+{
+    uint need = dyb_get_position(out) + extra;
+    uint capacity;
+
+    if (need < extra) return false;
+    if (need <= (uint)dyb_get_capacity(out)) return true;
+    capacity = MAX(need, (uint)dyb_get_capacity(out)*2);
+    return dyb_set_capacity(out, capacity) != null;
+}
+
+/// ===== sizes =====
+
+plat_inline uint dyj_typdex_size(uint8 type, uint index)
+{
+    if (type <= 0x0F && index <= 0x07) return 1;
+    if (type <= 0x3F && index <= 0xFF) return 2;
+    if (index <= 0x1FFF) return 3;
+    return 4;
+}
+
+plat_inline uint dyj_var_u64_size(uint64 value)
+{
+    if (value <= 0x7FULL) return 1;
+    if (value <= 0x407FULL) return 2;
+    if (value <= 0x20407FULL) return 3;
+    if (value <= 0x1020407FULL) return 4;
+    if (value <= 0x081020407FULL) return 5;
+    if (value <= 0x04081020407FULL) return 6;
+    if (value <= 0x0204081020407FULL) return 7;
+    if (value <= 0x010204081020407FULL) return 8;
+    return 9;
+}
+
+plat_inline uint dyj_var_s64_size(int64 value)
+{
+    return dyj_var_u64_size(((uint64)value << 1) ^ (uint64)(value >> 63));
+}
+
+/// ===== bounded reader =====
+
+/**
+ *  dybuf readers trust their input, the decoders read untrusted documents through this.
+ */
+typedef struct dyj_reader
+{
+    const uint8* data;
+    uint position;
+    uint limit;
+} dyj_reader;
+
+plat_inline boolean dyj_read_u8(dyj_reader* r, uint8* value)
+{
+    if (r->position >= r->limit) return false;
+    *value = r->data[r->position++];
+    return true;
+}
+
+plat_inline boolean dyj_read_typdex(dyj_reader* r, uint8* type, uint* index)
+{
+    const uint8* p = r->data + r->position;
+    uint remainder = r->limit - r->position;
+
+    if (remainder == 0) return false;
+    if ((p[0]&0x80) == 0)
+    {
+        *type = (p[0]>>3) & 0x0F;
+        *index = p[0] & 0x07;
+        r->position += 1;
+    }
+    else if ((p[0]&0x40) == 0)
+    {
+        if (remainder < 2) return false;
+        *type = p[0] & 0x3F;
+        *index = p[1];
+        r->position += 2;
+    }
+    else if ((p[0]&0x20) == 0)
+    {
+        uint32 v;
+        if (remainder < 3) return false;
+        v = ((uint32)p[0]<<16) | ((uint32)p[1]<<8) | p[2];
+        *type = (uint8)((v>>13) & 0xFF);
+        *index = v & 0x1FFF;
+        r->position += 3;
+    }
+    else if ((p[0]&0x10) == 0)
+    {
+        uint32 v;
+        if (remainder < 4) return false;
+        v = ((uint32)p[0]<<24) | ((uint32)p[1]<<16) | ((uint32)p[2]<<8) | p[3];
+        *type = (uint8)((v>>20) & 0xFF);
+        *index = v & 0x0FFFFF;
+        r->position += 4;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+plat_inline boolean dyj_read_var_u64(dyj_reader* r, uint64* value)
+{
+    static const uint64 bases[9] = {
+        0, 0x80ULL, 0x4080ULL, 0x204080ULL, 0x10204080ULL, 0x0810204080ULL,
+        0x040810204080ULL, 0x02040810204080ULL, 0x0102040810204080ULL };
+    const uint8* p = r->data + r->position;
+    uint remainder = r->limit - r->position;
+    uint extra, i;
+    uint64 v;
+    uint8 b;
+
+    if (remainder == 0) return false;
+    b = p[0];
+    if ((b&0x80) == 0)
+    {
+        *value = b;
+        r->position += 1;
+        return true;
+    }
+    // count leading ones: number of extra bytes
+    extra = 1;
+    while (extra < 8 && (b & (0x80 >> extra))) extra++;
+    if (remainder < extra+1) return false;
+    v = (extra < 8) ? (uint64)(b & (0xFF >> (extra+1))) : 0;
+    for (i=1; i<=extra; i++)
+    {
+        v = (v<<8) | p[i];
+    }
+    *value = v + bases[extra];
+    if (*value < v) return false;               // overflow of the 9-byte form
+    r->position += extra+1;
+    return true;
+}
+
+plat_inline const uint8* dyj_read_bytes(dyj_reader* r, uint size)
+{
+    const uint8* p;
+    if (r->limit - r->position < size) return null;
+    p = r->data + r->position;
+    r->position += size;
+    return p;
+}
+
+plat_inline boolean dyj_read_count(dyj_reader* r, uint* count)
+{
+    uint64 v;
+    if (!dyj_read_var_u64(r, &v)) return false;
+    // every counted item takes at least one byte
+    if (v > r->limit - r->position) return false;
+    *count = (uint)v;
+    return true;
+}
+
+plat_inline boolean dyj_read_double(dyj_reader* r, double* value)
+{
+    const uint8* p = dyj_read_bytes(r, 8);
+    uint64 bits = 0;
+    uint i;
+    if (p == null) return false;
+    for (i=0; i<8; i++) bits = (bits<<8) | p[i];
+    dyb_mem_copy(value, &bits, sizeof(*value));
+    return true;
+}
+
+/// ===== dictionaries =====
+
+/**
+ *  One node per structural value path ($, $.K, $.[], ...). Nodes that hold objects carry
+ *  a dictionary; key i of the dictionary leads to children[i], array elements lead to
+ *  array_child.
+ */
+typedef struct dyj_path_node
+{
+    uint parent;
+    uint step;                          // key index, or DYJ_NONE for an array element
+    uint array_child;
+    uint* children;
+    uint children_capacity;
+    boolean has_dictionary;
+    uint* keys;                         // key ids in index order
+    uint key_count;
+    uint key_capacity;
+    uint stamp_base;                    // decoder: offset of this node in dyj_dicts.stamps
+} dyj_path_node;
+
+typedef struct dyj_dict_key
+{
+    const char* data;                   // NUL terminated copy
+    uint size;
+    uint32 hash;
+    uint node;
+    uint index;
+} dyj_dict_key;
+
+typedef struct dyj_dicts
+{
+    dyj_path_node* nodes;
+    uint node_count, node_capacity;
+    uint node_high;                     // slots ever used, their arrays are kept by dyj_dicts_clear
+    dyj_dict_key* keys;
+    uint key_count, key_capacity;
+    uint* order;                        // nodes with dictionary in creation order
+    uint dict_count, order_capacity;
+    uint* slots;                        // open addressing (node, key) -> key id+1
+    uint slot_capacity;
+    uint* stamps;                       // decoder: key seen marks, see stamp_base
+    uint stamp;
+    dyb_arena* strings;                 // key copies
+    dyb_arena own_strings;
+} dyj_dicts;
+
+#define DYJ_ROOT_NODE               0U
+
+/**
+ *  strings: arena for key copies, null to use an internal one.
+ */
+boolean dyj_dicts_init(dyj_dicts* dicts, dyb_arena* strings);
+// forget all paths and keys, keep the memory for the next document
+void dyj_dicts_clear(dyj_dicts* dicts);
+void dyj_dicts_release(dyj_dicts* dicts);
+uint32 dyj_hash_bytes(const char* data, uint size);
+uint dyj_dicts_child(dyj_dicts* dicts, uint node, uint step);
+boolean dyj_dicts_ensure_dictionary(dyj_dicts* dicts, uint node);
+// return key id, add the key when it is new, DYJ_NONE if out of memory or too many keys
+uint dyj_dicts_intern(dyj_dicts* dicts, uint node, const char* key, uint size, uint32 hash);
+uint dyj_dicts_find(dyj_dicts* dicts, uint node, const char* key, uint size, uint32 hash);
+// "$", "$.2", "$.2.[]", returns the length written, 0 if size is too small
+uint dyj_dicts_path(dyj_dicts* dicts, uint node, char* path, uint size);
+// parse a path string, create missing nodes
+uint dyj_dicts_parse_path(dyj_dicts* dicts, const char* path, uint size);
+uint dyj_dicts_header_size(dyj_dicts* dicts);
+boolean dyj_dicts_write_header(dyj_dicts* dicts, uint version, dybuf* out);
+// version 1 header only
+enum dyj_err dyj_dicts_read_header(dyj_dicts* dicts, dyj_reader* r);
+boolean dyj_dicts_prepare_stamps(dyj_dicts* dicts);
+
+/// ===== shared dictionaries =====
+
+#define DYJ_MAX_SHARED_SETS         256                 // sets one cache accepts
+#define DYJ_MAX_SHARED_STRINGS      (16U<<20)           // key bytes one cache keeps, 16 MiB
+
+// version 2 header: the set is defined (collection follows) or referenced
+typedef struct dyj_shared_ref
+{
+    uint id;
+    uint version;
+    boolean define;
+} dyj_shared_ref;
+
+typedef struct dyj_dict_set
+{
+    uint64 id;
+    uint64 version;
+    boolean valid;                      // false while or after a broken definition
+    dyj_dicts dicts;
+} dyj_dict_set;
+
+struct dyj_dict_cache
+{
+    dyj_dict_set* sets;
+    uint set_count, set_capacity;
+    dyb_arena strings;                  // keys of all sets and replaced definitions, released with the cache
+};
+
+uint dyj_dicts_shared_header_size(dyj_dicts* dicts, const dyj_shared_ref* ref);
+boolean dyj_dicts_write_shared_header(dyj_dicts* dicts, const dyj_shared_ref* ref, dybuf* out);
+/**
+ *  Version 1 and 3 are read into own, version 2 defines or looks up a set of the cache
+ *  (bad version without cache). dicts is set to the dictionaries of the document, their
+ *  stamps are prepared.
+ */
+enum dyj_err dyj_dict_cache_read_header(dyj_dict_cache* cache, dyj_dicts* own, dyj_reader* r, dyj_dicts** dicts,
+                                        uint* format_version);
+
+/// ===== writer =====
+
+typedef struct dyj_writer_frame
+{
+    uint node;
+    uint remaining;                     // values still expected
+    boolean object;
+    uint key_index;                     // object: index of the pending key, DYJ_NONE without key
+    uint next_key;                      // object: index after the last key, tried before hashing
+    uint stamp;                         // object: mark of its keys in key_stamps
+    uint fixup;                         // DYJ_COUNT_UNKNOWN: index in fixups, otherwise DYJ_NONE
+} dyj_writer_frame;
+
+// count of a container begun with DYJ_COUNT_UNKNOWN, inserted at position of the payload
+typedef struct dyj_writer_fixup
+{
+    uint position;
+    uint count;
+} dyj_writer_fixup;
+
+struct dyj_writer
+{
+    dyj_dicts dicts;
+    dybuf* payload;
+    dyj_writer_frame* frames;
+    uint depth, frame_capacity;
+    uint* key_stamps;                   // per key id
+    uint key_stamp_capacity;
+    uint stamp;
+    dyj_writer_fixup* fixups;           // in payload order
+    uint fixup_count, fixup_capacity;
+    uint fixup_size;                    // bytes of the inserted counts
+    boolean root_written;
+    enum dyj_err err;
+    boolean shared;                     // version 2, the dictionaries outlive a document
+    dyj_shared_ref shared_ref;
+    uint shared_keys, shared_dicts;     // sizes of the defined version
+};
+
+plat_inline uint dyj_dicts_array_child(dyj_dicts* dicts, uint node)
+{
+    return dyj_dicts_child(dicts, node, DYJ_NONE);
+}
+
+/// ===== record readers =====
+
+/**
+ *  Payload records checked the same way by dyj_decode, dyj_emit_text and cjson_from_dybuf.
+ *  A scalar is read into dyj_scalar, strings point into the payload without NUL. Arrays and
+ *  objects read their count, then one typdex per item or member; containers get the node
+ *  of their path, made when first used.
+ */
+typedef struct dyj_scalar
+{
+    uint8 type;                         // typdex_typ_none, _bool, _int, _uint, _double or _string
+    union
+    {
+        boolean b;
+        int64 i;                        // int and uint, within the safe range
+        double d;                       // finite
+        struct { const uint8* data; uint size; } s;
+    } u;
+} dyj_scalar;
+
+plat_inline boolean dyj_typdex_is_container(uint8 type)
+{
+    return type == typdex_typ_array || type == typdex_typ_map || type == typdex_typ_obj;
+}
+
+plat_inline enum dyj_err dyj_read_scalar(dyj_reader* r, uint8 type, dyj_scalar* scalar)
+{
+    uint64 u;
+    uint8 b;
+
+    scalar->type = type;
+    switch (type)
+    {
+        case typdex_typ_none:
+            return dyj_err_none;
+        case typdex_typ_bool:
+            if (!dyj_read_u8(r, &b)) return dyj_err_truncated;
+            scalar->u.b = b != 0;
+            return dyj_err_none;
+        case typdex_typ_int:
+            if (!dyj_read_var_u64(r, &u)) return dyj_err_truncated;
+            scalar->u.i = (int64)(u >> 1) ^ -(int64)(u & 1);
+            if (scalar->u.i < DYJ_MIN_SAFE_INTEGER || scalar->u.i > DYJ_MAX_SAFE_INTEGER) return dyj_err_unsafe_integer;
+            return dyj_err_none;
+        case typdex_typ_uint:
+            if (!dyj_read_var_u64(r, &u)) return dyj_err_truncated;
+            if (u > (uint64)DYJ_MAX_SAFE_INTEGER) return dyj_err_unsafe_integer;
+            scalar->u.i = (int64)u;
+            return dyj_err_none;
+        case typdex_typ_double:
+            if (!dyj_read_double(r, &scalar->u.d)) return dyj_err_truncated;
+            if (!isfinite(scalar->u.d)) return dyj_err_non_finite;
+            return dyj_err_none;
+        case typdex_typ_string:
+            if (!dyj_read_count(r, &scalar->u.s.size)) return dyj_err_truncated;
+            scalar->u.s.data = dyj_read_bytes(r, scalar->u.s.size);
+            return scalar->u.s.data ? dyj_err_none : dyj_err_truncated;
+    }
+    return dyj_err_bad_type;
+}
+
+// *child is DYJ_NONE before the first item, the element node from the first container on
+plat_inline enum dyj_err dyj_read_item(dyj_reader* r, dyj_dicts* dicts, uint node, uint8* type, uint* child)
+{
+    uint index;
+
+    if (!dyj_read_typdex(r, type, &index)) return dyj_err_truncated;
+    if (dyj_typdex_is_container(*type) && *child == DYJ_NONE)
+    {
+        *child = dyj_dicts_array_child(dicts, node);
+        if (*child == DYJ_NONE) return dyj_err_no_memory;
+    }
+    return dyj_err_none;
+}
+
+// a new mark for the keys of one object in dicts->stamps
+plat_inline uint dyj_dicts_next_stamp(dyj_dicts* dicts)
+{
+    if (++dicts->stamp == 0)
+    {
+        plat_mem_set(dicts->stamps, 0, dicts->key_count*sizeof(uint));
+        dicts->stamp = 1;
+    }
+    return dicts->stamp;
+}
+
+// count of an object at node, *stamp marks the members read since
+plat_inline enum dyj_err dyj_read_object(dyj_reader* r, dyj_dicts* dicts, uint node, uint* count, uint* stamp)
+{
+    const dyj_path_node* n = &dicts->nodes[node];
+
+    if (!n->has_dictionary) return dyj_err_missing_dictionary;
+    if (!dyj_read_count(r, count)) return dyj_err_truncated;
+    if (*count > n->key_count) return dyj_err_bad_index;
+    *stamp = dyj_dicts_next_stamp(dicts);
+    return dyj_err_none;
+}
+
+// key id of the next member (or column), indices beyond the dictionary and repeated keys are errors
+plat_inline enum dyj_err dyj_read_member(dyj_reader* r, dyj_dicts* dicts, uint node, uint stamp,
+                                         uint8* type, uint* key_id, uint* child)
+{
+    const dyj_path_node* n = &dicts->nodes[node];
+    uint index;
+
+    if (!dyj_read_typdex(r, type, &index)) return dyj_err_truncated;
+    if (index >= n->key_count || dicts->stamps[n->stamp_base+index] == stamp) return dyj_err_bad_index;
+    dicts->stamps[n->stamp_base+index] = stamp;
+    *key_id = n->keys[index];
+    *child = DYJ_NONE;
+    if (dyj_typdex_is_container(*type))
+    {
+        *child = dyj_dicts_child(dicts, node, index);
+        if (*child == DYJ_NONE) return dyj_err_no_memory;
+    }
+    return dyj_err_none;
+}
+
+/// ===== encoder =====
+
+typedef struct dyj_encoder
+{
+    dyj_dicts dicts;
+    uint* member_keys;                  // key id of every member in traversal order
+    uint member_count, member_capacity, member_cursor;
+    uint64 payload_size;
+    boolean canonical;
+    boolean columnar;
+    boolean failed;                     // columnar: out of memory while writing
+    uint* scratch;                      // canonical: member order of the objects being written
+    uint scratch_count, scratch_capacity, scratch_peak;
+    const uint* key_map;                // parallel: key id -> index in the merged dictionaries
+} dyj_encoder;
+
+// pass 1: dictionaries, member keys and payload size of value at node
+enum dyj_err dyj_encode_collect(dyj_encoder* enc, const dyj_value* value, uint node, uint index, uint depth);
+// pass 2: out must hold payload_size more bytes, except in columnar mode
+void dyj_encode_write(dyj_encoder* enc, dybuf* out, const dyj_value* value, uint node, uint index);
+void dyj_encoder_release(dyj_encoder* enc);
+
+#endif //DYBUF_C_DYJSON_PRIVATE_H
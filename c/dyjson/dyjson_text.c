@@ -0,0 +1,460 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * JSON text -> dyj_value tree. Items of open arrays/objects are kept on parser stacks
+ * and moved to exact-size arena blocks when the container closes.
+ *
+ * JSON text -> JSON-dybuf without values: the same tokenizer drives a dyj_writer,
+ * the writer frames are the only parser stack.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dyjson_private.h"
+#include "plat_json_string.h"
+
+typedef struct dyj_text_parser
+{
+    const char* p;
+    const char* end;
+    dyj_document* doc;                  // null when transcoding
+    dyj_value** items;
+    uint item_count, item_capacity;
+    dyj_member* members;
+    uint member_count, member_capacity;
+    uint32* hashes;                     // hash of members[i].key
+    uint hash_capacity;
+    char* scratch;                      // unescaped string
+    uint scratch_capacity;
+    uint* table;                        // duplicate key check of large objects
+    uint table_capacity;
+} dyj_text_parser;
+
+static inline void dyj_text_skip_ws(dyj_text_parser* ps)
+{
+    const char* p = ps->p;
+    while (p < ps->end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    ps->p = p;
+}
+
+/**
+ *  Parse a string, ps->p is after the opening quote. Returns the content in *data:
+ *  a span of the input when there is no escape, otherwise the scratch buffer.
+ */
+static enum dyj_err dyj_text_string(dyj_text_parser* ps, const char** data, uint* size)
+{
+    const char* start = ps->p;
+    const char *quote, *out;
+    boolean escaped;
+
+    quote = plat_json_string_scan(start, ps->end, &escaped);
+    if (quote >= ps->end || *quote != '"') return dyj_err_syntax;
+    ps->p = quote+1;
+    if (!escaped)
+    {
+        *data = start;
+        *size = (uint)(quote - start);
+        return dyj_err_none;
+    }
+
+    // every escape is at least as long as its UTF-8 output
+    if (!dyj_grow((void**)&ps->scratch, &ps->scratch_capacity, (uint)(quote - start), 1)) return dyj_err_no_memory;
+    out = plat_json_string_unescape(start, quote, ps->scratch);
+    if (out == null) return dyj_err_syntax;
+    *data = ps->scratch;
+    *size = (uint)(out - ps->scratch);
+    return dyj_err_none;
+}
+
+/**
+ *  Integers inside the safe range are returned in *i with *integer set, others in *d.
+ */
+static enum dyj_err dyj_text_number(dyj_text_parser* ps, boolean* integer_out, int64* i, double* d)
+{
+    uint size = dyj_parse_number(ps->p, ps->end, integer_out, i, d);
+
+    if (size == 0) return dyj_err_syntax;
+    ps->p += size;
+    if (*integer_out && (*i > DYJ_MAX_SAFE_INTEGER || *i < DYJ_MIN_SAFE_INTEGER))
+    {
+        *integer_out = false;
+        *d = (double)*i;
+    }
+    return dyj_err_none;
+}
+
+static boolean dyj_text_literal(dyj_text_parser* ps, const char* literal, uint size)
+{
+    if ((uint)(ps->end - ps->p) < size || memcmp(ps->p, literal, size) != 0) return false;
+    ps->p += size;
+    return true;
+}
+
+/**
+ *  Keep the last value of a duplicated key at the position of the first one,
+ *  like JavaScript JSON.parse and Python json.loads.
+ */
+static uint dyj_text_dedupe(dyj_text_parser* ps, uint first, uint count)
+{
+    dyj_member* members = ps->members + first;
+    uint32* hashes = ps->hashes + first;
+    uint i, j, kept = 0;
+
+    if (count <= 16)
+    {
+        for (i=0; i<count; i++)
+        {
+            for (j=0; j<kept; j++)
+            {
+                if (hashes[j] == hashes[i] && members[j].key_size == members[i].key_size &&
+                    memcmp(members[j].key, members[i].key, members[i].key_size) == 0) break;
+            }
+            if (j < kept) members[j].value = members[i].value;
+            else
+            {
+                members[kept] = members[i];
+                hashes[kept++] = hashes[i];
+            }
+        }
+        return kept;
+    }
+
+    {
+        uint capacity = 64, mask, slot, id;
+        while (capacity < count*2) capacity *= 2;
+        if (!dyj_grow((void**)&ps->table, &ps->table_capacity, capacity, sizeof(uint))) return DYJ_NONE;
+        plat_mem_set(ps->table, 0, capacity*sizeof(uint));
+        mask = capacity-1;
+        for (i=0; i<count; i++)
+        {
+            slot = hashes[i] & mask;
+            while ((id = ps->table[slot]) != 0)
+            {
+                j = id-1;
+                if (hashes[j] == hashes[i] && members[j].key_size == members[i].key_size &&
+                    memcmp(members[j].key, members[i].key, members[i].key_size) == 0) break;
+                slot = (slot+1) & mask;
+            }
+            if (id) members[id-1].value = members[i].value;
+            else
+            {
+                members[kept] = members[i];
+                hashes[kept] = hashes[i];
+                ps->table[slot] = ++kept;
+            }
+        }
+        return kept;
+    }
+}
+
+static enum dyj_err dyj_text_value(dyj_text_parser* ps, uint depth, dyj_value** out)
+{
+    enum dyj_err err;
+    const char* data;
+    uint size;
+
+    dyj_text_skip_ws(ps);
+    if (ps->p >= ps->end) return dyj_err_syntax;
+
+    switch (*ps->p)
+    {
+        case '"':
+            ps->p++;
+            err = dyj_text_string(ps, &data, &size);
+            if (err != dyj_err_none) return err;
+            *out = dyj_make_string(ps->doc, data, size);
+            return *out ? dyj_err_none : dyj_err_no_memory;
+        case 'n':
+            if (!dyj_text_literal(ps, "null", 4)) return dyj_err_syntax;
+            *out = dyj_make_null(ps->doc);
+            return *out ? dyj_err_none : dyj_err_no_memory;
+        case 't':
+            if (!dyj_text_literal(ps, "true", 4)) return dyj_err_syntax;
+            *out = dyj_make_bool(ps->doc, true);
+            return *out ? dyj_err_none : dyj_err_no_memory;
+        case 'f':
+            if (!dyj_text_literal(ps, "false", 5)) return dyj_err_syntax;
+            *out = dyj_make_bool(ps->doc, false);
+            return *out ? dyj_err_none : dyj_err_no_memory;
+        case '[':
+        {
+            uint first = ps->item_count, count;
+            dyj_value* array;
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            ps->p++;
+            dyj_text_skip_ws(ps);
+            if (ps->p < ps->end && *ps->p == ']')
+            {
+                ps->p++;
+            }
+            else
+            {
+                while (1)
+                {
+                    dyj_value* item;
+                    err = dyj_text_value(ps, depth+1, &item);
+                    if (err != dyj_err_none) return err;
+                    if (!dyj_grow((void**)&ps->items, &ps->item_capacity, ps->item_count+1, sizeof(dyj_value*))) return dyj_err_no_memory;
+                    ps->items[ps->item_count++] = item;
+                    dyj_text_skip_ws(ps);
+                    if (ps->p >= ps->end) return dyj_err_syntax;
+                    if (*ps->p == ',') { ps->p++; continue; }
+                    if (*ps->p == ']') { ps->p++; break; }
+                    return dyj_err_syntax;
+                }
+            }
+            count = ps->item_count - first;
+            array = dyj_make_array(ps->doc, count);
+            if (array == null) return dyj_err_no_memory;
+            if (count) dyb_mem_copy(array->u.a.items, ps->items+first, count*sizeof(dyj_value*));
+            array->u.a.size = count;
+            ps->item_count = first;
+            *out = array;
+            return dyj_err_none;
+        }
+        case '{':
+        {
+            uint first = ps->member_count, count;
+            dyj_value* object;
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            ps->p++;
+            dyj_text_skip_ws(ps);
+            if (ps->p < ps->end && *ps->p == '}')
+            {
+                ps->p++;
+            }
+            else
+            {
+                while (1)
+                {
+                    dyj_member* m;
+                    char* key;
+                    dyj_value* value;
+                    uint32 hash;
+
+                    dyj_text_skip_ws(ps);
+                    if (ps->p >= ps->end || *ps->p != '"') return dyj_err_syntax;
+                    ps->p++;
+                    err = dyj_text_string(ps, &data, &size);
+                    if (err != dyj_err_none) return err;
+                    key = (char*)dyb_arena_alloc(&ps->doc->arena, size+1);
+                    if (key == null) return dyj_err_no_memory;
+                    dyb_mem_copy(key, (void*)data, size);
+                    key[size] = 0;
+                    hash = dyj_hash_bytes(key, size);
+                    dyj_text_skip_ws(ps);
+                    if (ps->p >= ps->end || *ps->p != ':') return dyj_err_syntax;
+                    ps->p++;
+                    err = dyj_text_value(ps, depth+1, &value);
+                    if (err != dyj_err_none) return err;
+
+                    if (!dyj_grow((void**)&ps->members, &ps->member_capacity, ps->member_count+1, sizeof(dyj_member))) return dyj_err_no_memory;
+                    if (!dyj_grow((void**)&ps->hashes, &ps->hash_capacity, ps->member_count+1, sizeof(uint32))) return dyj_err_no_memory;
+                    m = &ps->members[ps->member_count];
+                    m->key = key;
+                    m->key_size = size;
+                    m->value = value;
+                    ps->hashes[ps->member_count++] = hash;
+
+                    dyj_text_skip_ws(ps);
+                    if (ps->p >= ps->end) return dyj_err_syntax;
+                    if (*ps->p == ',') { ps->p++; continue; }
+                    if (*ps->p == '}') { ps->p++; break; }
+                    return dyj_err_syntax;
+                }
+            }
+            count = dyj_text_dedupe(ps, first, ps->member_count - first);
+            if (count == DYJ_NONE) return dyj_err_no_memory;
+            object = dyj_make_object(ps->doc, count);
+            if (object == null) return dyj_err_no_memory;
+            if (count) dyb_mem_copy(object->u.o.members, ps->members+first, count*sizeof(dyj_member));
+            object->u.o.size = count;
+            ps->member_count = first;
+            *out = object;
+            return dyj_err_none;
+        }
+        default:
+        {
+            boolean integer;
+            int64 i;
+            double d;
+            err = dyj_text_number(ps, &integer, &i, &d);
+            if (err != dyj_err_none) return err;
+            *out = integer ? dyj_make_int(ps->doc, i) : dyj_make_double(ps->doc, d);
+            return *out ? dyj_err_none : dyj_err_no_memory;
+        }
+    }
+}
+
+static void dyj_text_parser_release(dyj_text_parser* ps)
+{
+    if (ps->items) dyb_mem_release(ps->items, 0);
+    if (ps->members) dyb_mem_release(ps->members, 0);
+    if (ps->hashes) dyb_mem_release(ps->hashes, 0);
+    if (ps->scratch) dyb_mem_release(ps->scratch, 0);
+    if (ps->table) dyb_mem_release(ps->table, 0);
+}
+
+enum dyj_err dyj_parse_text(dyj_document* doc, const char* text, uint size, dyj_value** value)
+{
+    dyj_text_parser ps;
+    enum dyj_err err;
+
+    if (doc == null || text == null || value == null) return dyj_err_invalid_args;
+    plat_mem_set(&ps, 0, sizeof(ps));
+    ps.p = text;
+    ps.end = text + size;
+    ps.doc = doc;
+
+    err = dyj_text_value(&ps, 0, value);
+    if (err == dyj_err_none)
+    {
+        dyj_text_skip_ws(&ps);
+        if (ps.p != ps.end) err = dyj_err_syntax;
+    }
+
+    dyj_text_parser_release(&ps);
+    return err;
+}
+
+/// ========== transcoder
+
+static enum dyj_err dyj_text_transcode(dyj_text_parser* ps, dyj_writer* writer)
+{
+    enum dyj_err err;
+    const char* data;
+    uint size;
+
+value:
+    dyj_text_skip_ws(ps);
+    if (ps->p >= ps->end) return dyj_err_syntax;
+    switch (*ps->p)
+    {
+        case '"':
+            ps->p++;
+            err = dyj_text_string(ps, &data, &size);
+            if (err == dyj_err_none) err = dyj_write_string(writer, data, size);
+            break;
+        case 'n':
+            if (!dyj_text_literal(ps, "null", 4)) return dyj_err_syntax;
+            err = dyj_write_null(writer);
+            break;
+        case 't':
+            if (!dyj_text_literal(ps, "true", 4)) return dyj_err_syntax;
+            err = dyj_write_bool(writer, true);
+            break;
+        case 'f':
+            if (!dyj_text_literal(ps, "false", 5)) return dyj_err_syntax;
+            err = dyj_write_bool(writer, false);
+            break;
+        case '[':
+            ps->p++;
+            err = dyj_write_begin_array(writer, DYJ_COUNT_UNKNOWN);
+            if (err != dyj_err_none) return err;
+            dyj_text_skip_ws(ps);
+            if (ps->p < ps->end && *ps->p == ']')
+            {
+                ps->p++;
+                err = dyj_write_end_array(writer);
+                break;
+            }
+            goto value;
+        case '{':
+            ps->p++;
+            err = dyj_write_begin_object(writer, DYJ_COUNT_UNKNOWN);
+            if (err != dyj_err_none) return err;
+            dyj_text_skip_ws(ps);
+            if (ps->p < ps->end && *ps->p == '}')
+            {
+                ps->p++;
+                err = dyj_write_end_object(writer);
+                break;
+            }
+            goto key;
+        default:
+        {
+            boolean integer;
+            int64 i;
+            double d;
+            err = dyj_text_number(ps, &integer, &i, &d);
+            if (err == dyj_err_none) err = integer ? dyj_write_int(writer, i) : dyj_write_double(writer, d);
+            break;
+        }
+    }
+    if (err != dyj_err_none) return err;
+
+next:
+    // after a value: separator or end of the enclosing container
+    if (writer->depth == 0) return dyj_err_none;
+    dyj_text_skip_ws(ps);
+    if (ps->p >= ps->end) return dyj_err_syntax;
+    if (writer->frames[writer->depth-1].object)
+    {
+        if (*ps->p == ',') { ps->p++; goto key; }
+        if (*ps->p != '}') return dyj_err_syntax;
+        ps->p++;
+        err = dyj_write_end_object(writer);
+    }
+    else
+    {
+        if (*ps->p == ',') { ps->p++; goto value; }
+        if (*ps->p != ']') return dyj_err_syntax;
+        ps->p++;
+        err = dyj_write_end_array(writer);
+    }
+    if (err != dyj_err_none) return err;
+    goto next;
+
+key:
+    dyj_text_skip_ws(ps);
+    if (ps->p >= ps->end || *ps->p != '"') return dyj_err_syntax;
+    ps->p++;
+    err = dyj_text_string(ps, &data, &size);
+    if (err == dyj_err_none) err = dyj_write_key(writer, data, size);
+    if (err != dyj_err_none) return err;
+    dyj_text_skip_ws(ps);
+    if (ps->p >= ps->end || *ps->p != ':') return dyj_err_syntax;
+    ps->p++;
+    goto value;
+}
+
+enum dyj_err dyj_transcode_text(dyj_writer* writer, const char* text, uint size, dybuf* out)
+{
+    dyj_text_parser ps;
+    enum dyj_err err;
+
+    if (writer == null || text == null || out == null) return dyj_err_invalid_args;
+    plat_mem_set(&ps, 0, sizeof(ps));
+    ps.p = text;
+    ps.end = text + size;
+
+    dyj_writer_reset(writer);
+    err = dyj_text_transcode(&ps, writer);
+    if (err == dyj_err_none)
+    {
+        dyj_text_skip_ws(&ps);
+        if (ps.p != ps.end) err = dyj_err_syntax;
+    }
+    if (err == dyj_err_none) err = dyj_writer_finish(writer, out);
+    else dyj_writer_reset(writer);
+
+    dyj_text_parser_release(&ps);
+    return err;
+}
@@ -0,0 +1,458 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Read-only views of a JSON-dybuf document. Opening reads the dictionary header only,
+ * containers are walked when an item is asked for and the records before it are
+ * skipped. Only the records that are read are checked.
+ *
+ * dyj_viewer_index records the items of every container below a view in one pass (the
+ * tape): each container owns a block of entries, one per item in payload order, and an
+ * entry of a container points to the block of its items. Views made from the tape find
+ * item i without skipping. The entries are kept by the viewer for the next document.
+ */
+
+#include <math.h>
+#include "dyjson_private.h"
+
+typedef struct dyj_tape_entry
+{
+    uint position;                      // after the typdex
+    uint block;                         // container: first entry of its items, otherwise DYJ_NONE
+    uint key;                           // object member: dictionary index
+    uint8 type;
+} dyj_tape_entry;
+
+typedef struct dyj_tape_frame
+{
+    uint block;
+    uint index, count;
+} dyj_tape_frame;
+
+struct dyj_viewer
+{
+    dyj_dicts dicts;
+    const uint8* data;
+    uint limit;
+    dyj_tape_entry* tape;
+    uint tape_count, tape_capacity;
+    dyj_tape_frame* frames;
+    uint frame_capacity;
+};
+
+// child node without creating it, DYJ_NONE when no dictionary lies below the path
+static inline uint dyj_view_child(const dyj_dicts* dicts, uint node, uint step)
+{
+    const dyj_path_node* n;
+
+    if (node == DYJ_NONE) return DYJ_NONE;
+    n = &dicts->nodes[node];
+    if (step == DYJ_NONE) return n->array_child ? n->array_child : DYJ_NONE;
+    if (step < n->children_capacity && n->children[step]) return n->children[step];
+    return DYJ_NONE;
+}
+
+/**
+ *  Skip the body of a record whose typdex is read. Containers add their items to the
+ *  pending count, so nesting needs no stack.
+ */
+static enum dyj_err dyj_view_skip(dyj_reader* r, uint8 type)
+{
+    uint64 pending = 0, u;
+    uint count, index;
+
+    for (;;)
+    {
+        switch (type)
+        {
+            case typdex_typ_none:
+                break;
+            case typdex_typ_bool:
+                if (dyj_read_bytes(r, 1) == null) return dyj_err_truncated;
+                break;
+            case typdex_typ_int:
+            case typdex_typ_uint:
+                if (!dyj_read_var_u64(r, &u)) return dyj_err_truncated;
+                break;
+            case typdex_typ_double:
+                if (dyj_read_bytes(r, 8) == null) return dyj_err_truncated;
+                break;
+            case typdex_typ_string:
+                if (!dyj_read_count(r, &count) || dyj_read_bytes(r, count) == null) return dyj_err_truncated;
+                break;
+            case typdex_typ_array:
+            case typdex_typ_map:
+                if (!dyj_read_count(r, &count)) return dyj_err_truncated;
+                pending += count;
+                break;
+            default:
+                return dyj_err_bad_type;
+        }
+        if (pending == 0) return dyj_err_none;
+        pending--;
+        if (!dyj_read_typdex(r, &type, &index)) return dyj_err_truncated;
+    }
+}
+
+static enum dyj_err dyj_view_make(const dyj_viewer* viewer, dyj_reader* r, uint8 type, uint node, dyj_view* view)
+{
+    uint64 u;
+    uint count;
+    uint8 b;
+
+    view->viewer = viewer;
+    switch (type)
+    {
+        case typdex_typ_none:
+            view->type = dyj_null;
+            return dyj_err_none;
+        case typdex_typ_bool:
+            if (!dyj_read_u8(r, &b)) return dyj_err_truncated;
+            view->type = dyj_bool;
+            view->u.b = b != 0;
+            return dyj_err_none;
+        case typdex_typ_int:
+            if (!dyj_read_var_u64(r, &u)) return dyj_err_truncated;
+            view->type = dyj_int;
+            view->u.i = (int64)(u >> 1) ^ -(int64)(u & 1);
+            if (view->u.i < DYJ_MIN_SAFE_INTEGER || view->u.i > DYJ_MAX_SAFE_INTEGER) return dyj_err_unsafe_integer;
+            return dyj_err_none;
+        case typdex_typ_uint:
+            if (!dyj_read_var_u64(r, &u)) return dyj_err_truncated;
+            if (u > (uint64)DYJ_MAX_SAFE_INTEGER) return dyj_err_unsafe_integer;
+            view->type = dyj_int;
+            view->u.i = (int64)u;
+            return dyj_err_none;
+        case typdex_typ_double:
+            if (!dyj_read_double(r, &view->u.d)) return dyj_err_truncated;
+            if (!isfinite(view->u.d)) return dyj_err_non_finite;
+            view->type = dyj_double;
+            return dyj_err_none;
+        case typdex_typ_string:
+            if (!dyj_read_count(r, &count)) return dyj_err_truncated;
+            view->u.s.data = (const char*)dyj_read_bytes(r, count);
+            if (view->u.s.data == null) return dyj_err_truncated;
+            view->type = dyj_string;
+            view->u.s.size = count;
+            return dyj_err_none;
+        case typdex_typ_array:
+            if (!dyj_read_count(r, &count)) return dyj_err_truncated;
+            view->type = dyj_array;
+            break;
+        case typdex_typ_map:
+            if (node == DYJ_NONE || !viewer->dicts.nodes[node].has_dictionary) return dyj_err_missing_dictionary;
+            if (!dyj_read_count(r, &count)) return dyj_err_truncated;
+            if (count > viewer->dicts.nodes[node].key_count) return dyj_err_bad_index;
+            view->type = dyj_object;
+            break;
+        default:
+            return dyj_err_bad_type;
+    }
+    view->u.c.position = r->position;
+    view->u.c.size = count;
+    view->u.c.node = node;
+    view->u.c.tape = DYJ_NONE;
+    return dyj_err_none;
+}
+
+/**
+ *  View of a tape entry, step is the key index of a member or DYJ_NONE for an array item.
+ */
+static enum dyj_err dyj_view_make_entry(const dyj_viewer* viewer, dyj_reader* r, const dyj_tape_entry* e,
+                                        uint step, uint node, dyj_view* view)
+{
+    enum dyj_err err;
+
+    if (step != DYJ_NONE && step >= viewer->dicts.nodes[node].key_count) return dyj_err_bad_index;
+    err = dyj_view_make(viewer, r, e->type, dyj_view_child(&viewer->dicts, node, step), view);
+    if (err == dyj_err_none && (view->type == dyj_array || view->type == dyj_object)) view->u.c.tape = e->block;
+    return err;
+}
+
+static inline void dyj_view_reader(const dyj_view* view, dyj_reader* r)
+{
+    r->data = view->viewer->data;
+    r->position = view->u.c.position;
+    r->limit = view->viewer->limit;
+}
+
+/**
+ *  Item index of an array or object, key_index gets the dictionary index of the member.
+ */
+static enum dyj_err dyj_view_item(const dyj_view* view, uint index, uint* key_index, dyj_view* item)
+{
+    const dyj_viewer* viewer = view->viewer;
+    const dyj_path_node* n;
+    dyj_reader r;
+    enum dyj_err err;
+    uint8 type;
+    uint i, node = view->u.c.node;
+
+    if (view->type != dyj_array && view->type != dyj_object) return dyj_err_not_found;
+    if (index >= view->u.c.size) return dyj_err_not_found;
+    dyj_view_reader(view, &r);
+    if (view->u.c.tape != DYJ_NONE)
+    {
+        const dyj_tape_entry* e = &viewer->tape[view->u.c.tape+index];
+        r.position = e->position;
+        *key_index = e->key;
+        return dyj_view_make_entry(viewer, &r, e, view->type == dyj_array ? DYJ_NONE : e->key, node, item);
+    }
+    for (i=0; ; i++)
+    {
+        if (!dyj_read_typdex(&r, &type, key_index)) return dyj_err_truncated;
+        if (i == index) break;
+        err = dyj_view_skip(&r, type);
+        if (err != dyj_err_none) return err;
+    }
+    if (view->type == dyj_array) return dyj_view_make(viewer, &r, type, dyj_view_child(&viewer->dicts, node, DYJ_NONE), item);
+    n = &viewer->dicts.nodes[node];
+    if (*key_index >= n->key_count) return dyj_err_bad_index;
+    return dyj_view_make(viewer, &r, type, dyj_view_child(&viewer->dicts, node, *key_index), item);
+}
+
+dyj_viewer* dyj_viewer_create(void)
+{
+    uint size = sizeof(dyj_viewer);
+    dyj_viewer* viewer = (dyj_viewer*)dyb_mem_alloc(&size, false);
+
+    if (viewer == null) return null;
+    plat_mem_set(viewer, 0, sizeof(*viewer));
+    if (!dyj_dicts_init(&viewer->dicts, null))
+    {
+        dyj_viewer_release(viewer);
+        return null;
+    }
+    return viewer;
+}
+
+void dyj_viewer_release(dyj_viewer* viewer)
+{
+    if (viewer == null) return;
+    dyj_dicts_release(&viewer->dicts);
+    if (viewer->tape) dyb_mem_release(viewer->tape, 0);
+    if (viewer->frames) dyb_mem_release(viewer->frames, 0);
+    dyb_mem_release(viewer, 0);
+}
+
+enum dyj_err dyj_viewer_open(dyj_viewer* viewer, dybuf* in, dyj_view* root)
+{
+    dyj_reader r;
+    enum dyj_err err;
+    uint8 type;
+    uint index;
+
+    if (viewer == null || in == null || root == null) return dyj_err_invalid_args;
+    dyj_dicts_clear(&viewer->dicts);
+    viewer->tape_count = 0;
+    viewer->data = in->_data;
+    viewer->limit = dyb_get_limit(in);
+    r.data = viewer->data;
+    r.position = dyb_get_position(in);
+    r.limit = viewer->limit;
+
+    err = dyj_dicts_read_header(&viewer->dicts, &r);
+    if (err != dyj_err_none) return err;
+    if (!dyj_read_typdex(&r, &type, &index)) return dyj_err_truncated;
+    if (type != typdex_typ_obj || index != 1) return dyj_err_bad_marker;
+    if (!dyj_read_typdex(&r, &type, &index)) return dyj_err_truncated;
+    return dyj_view_make(viewer, &r, type, DYJ_ROOT_NODE, root);
+}
+
+// a block of count entries, DYJ_NONE when the tape would hold more entries than bytes
+static uint dyj_tape_block(dyj_viewer* viewer, uint count, uint budget)
+{
+    uint block = viewer->tape_count;
+
+    if (count > budget - block) return DYJ_NONE;
+    if (!dyj_grow((void**)&viewer->tape, &viewer->tape_capacity, block+count, sizeof(dyj_tape_entry))) return DYJ_NONE;
+    viewer->tape_count += count;
+    return block;
+}
+
+enum dyj_err dyj_viewer_index(dyj_viewer* viewer, dyj_view* view)
+{
+    dyj_reader r;
+    enum dyj_err err;
+    uint depth = 0, budget, block;
+
+    if (viewer == null || view == null || view->viewer != viewer) return dyj_err_invalid_args;
+    if (view->type != dyj_array && view->type != dyj_object) return dyj_err_none;
+    if (view->u.c.tape != DYJ_NONE) return dyj_err_none;
+    dyj_view_reader(view, &r);
+    // every item takes at least one byte, a valid payload never needs more entries
+    budget = viewer->tape_count + (r.limit - r.position);
+    block = dyj_tape_block(viewer, view->u.c.size, budget);
+    if (block == DYJ_NONE) return dyj_err_truncated;
+    if (!dyj_grow((void**)&viewer->frames, &viewer->frame_capacity, 1, sizeof(dyj_tape_frame))) return dyj_err_no_memory;
+    viewer->frames[0].block = block;
+    viewer->frames[0].index = 0;
+    viewer->frames[0].count = view->u.c.size;
+
+    for (;;)
+    {
+        dyj_tape_frame* f = &viewer->frames[depth];
+        dyj_tape_entry* e;
+        uint8 type;
+        uint key, count;
+
+        if (f->index == f->count)
+        {
+            if (depth == 0) break;
+            depth--;
+            continue;
+        }
+        if (!dyj_read_typdex(&r, &type, &key)) return dyj_err_truncated;
+        e = &viewer->tape[f->block + f->index++];
+        e->position = r.position;
+        e->type = type;
+        e->key = key;
+        e->block = DYJ_NONE;
+        if (type != typdex_typ_array && type != typdex_typ_map)
+        {
+            err = dyj_view_skip(&r, type);
+            if (err != dyj_err_none) return err;
+            continue;
+        }
+        if (!dyj_read_count(&r, &count)) return dyj_err_truncated;
+        if (count == 0) continue;
+        if (depth+1 >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+        block = dyj_tape_block(viewer, count, budget);
+        if (block == DYJ_NONE) return dyj_err_truncated;
+        // the tape may have moved
+        viewer->tape[f->block + f->index - 1].block = block;
+        if (!dyj_grow((void**)&viewer->frames, &viewer->frame_capacity, depth+2, sizeof(dyj_tape_frame))) return dyj_err_no_memory;
+        f = &viewer->frames[++depth];
+        f->block = block;
+        f->index = 0;
+        f->count = count;
+    }
+    view->u.c.tape = viewer->frames[0].block;
+    return dyj_err_none;
+}
+
+enum dyj_err dyj_view_at(const dyj_view* view, uint index, dyj_view* item)
+{
+    uint key_index;
+
+    if (view == null || item == null) return dyj_err_invalid_args;
+    if (view->type != dyj_array) return dyj_err_not_found;
+    return dyj_view_item(view, index, &key_index, item);
+}
+
+enum dyj_err dyj_view_member(const dyj_view* view, uint index, const char** key, uint* key_size, dyj_view* value)
+{
+    const dyj_dict_key* k;
+    dyj_view object;
+    enum dyj_err err;
+    uint key_index;
+
+    if (view == null || value == null) return dyj_err_invalid_args;
+    if (view->type != dyj_object) return dyj_err_not_found;
+    object = *view;
+    err = dyj_view_item(&object, index, &key_index, value);
+    if (err != dyj_err_none) return err;
+    k = &object.viewer->dicts.keys[object.viewer->dicts.nodes[object.u.c.node].keys[key_index]];
+    if (key) *key = k->data;
+    if (key_size) *key_size = k->size;
+    return dyj_err_none;
+}
+
+enum dyj_err dyj_view_get(const dyj_view* view, const char* key, uint key_size, dyj_view* value)
+{
+    const dyj_viewer* viewer;
+    const dyj_path_node* n;
+    dyj_reader r;
+    enum dyj_err err;
+    uint8 type;
+    uint i, id, wanted, index, node;
+
+    if (view == null || value == null || (key == null && key_size)) return dyj_err_invalid_args;
+    if (view->type != dyj_object) return dyj_err_not_found;
+    viewer = view->viewer;
+    node = view->u.c.node;
+    // the lookup does not add keys, the table is only read
+    id = dyj_dicts_find((dyj_dicts*)&viewer->dicts, node, key, key_size, dyj_hash_bytes(key, key_size));
+    if (id == DYJ_NONE) return dyj_err_not_found;
+    wanted = viewer->dicts.keys[id].index;
+    n = &viewer->dicts.nodes[node];
+    dyj_view_reader(view, &r);
+    if (view->u.c.tape != DYJ_NONE)
+    {
+        const dyj_tape_entry* e = &viewer->tape[view->u.c.tape];
+        for (i=view->u.c.size; i>0; i--, e++)
+        {
+            if (e->key != wanted) continue;
+            r.position = e->position;
+            return dyj_view_make_entry(viewer, &r, e, wanted, node, value);
+        }
+        return dyj_err_not_found;
+    }
+    for (i=view->u.c.size; i>0; i--)
+    {
+        if (!dyj_read_typdex(&r, &type, &index)) return dyj_err_truncated;
+        if (index >= n->key_count) return dyj_err_bad_index;
+        if (index == wanted) return dyj_view_make(viewer, &r, type, dyj_view_child(&viewer->dicts, node, index), value);
+        err = dyj_view_skip(&r, type);
+        if (err != dyj_err_none) return err;
+    }
+    return dyj_err_not_found;
+}
+
+enum dyj_err dyj_view_query(const dyj_view* view, const char* path, uint size, dyj_view* value)
+{
+    dyj_view current;
+    enum dyj_err err;
+    uint i = 1;
+
+    if (view == null || path == null || value == null) return dyj_err_invalid_args;
+    if (size == 0 || path[0] != '$') return dyj_err_invalid_args;
+    current = *view;
+    while (i < size)
+    {
+        if (path[i] == '.')
+        {
+            uint start = ++i;
+            while (i < size && path[i] != '.' && path[i] != '[') i++;
+            if (i == start) return dyj_err_invalid_args;
+            err = dyj_view_get(&current, path+start, i-start, &current);
+        }
+        else if (path[i] == '[')
+        {
+            uint64 index = 0;
+            uint start = ++i;
+            while (i < size && path[i] >= '0' && path[i] <= '9')
+            {
+                index = index*10 + (uint)(path[i]-'0');
+                if (index > 0xFFFFFFFFU) return dyj_err_invalid_args;
+                i++;
+            }
+            if (i == start || i >= size || path[i] != ']') return dyj_err_invalid_args;
+            i++;
+            err = dyj_view_at(&current, (uint)index, &current);
+        }
+        else
+        {
+            return dyj_err_invalid_args;
+        }
+        if (err != dyj_err_none) return err;
+    }
+    *value = current;
+    return dyj_err_none;
+}
@@ -0,0 +1,414 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Single-pass JSON-dybuf writer. The dictionary header precedes the payload but is only
+ * complete after the last value, so the payload is written to a spill buffer and copied
+ * behind the header by dyj_writer_finish. Dictionaries and child nodes are created in the
+ * same order as dyj_encode, the output is byte-identical.
+ *
+ * Var uints can't be patched in place once written, so a count given as DYJ_COUNT_UNKNOWN
+ * is not written at begin. Its payload position is kept as a fixup and the count is
+ * inserted there while the payload is copied.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "dyjson_private.h"
+
+#define DYJ_WRITER_PAYLOAD_SIZE     1024
+#define DYJ_WRITER_VALUE_SIZE       (4+9)       // largest typdex + largest var uint
+
+dyj_writer* dyj_writer_create(void)
+{
+    uint size = sizeof(dyj_writer);
+    dyj_writer* writer = (dyj_writer*)dyb_mem_alloc(&size, false);
+
+    if (writer == null) return null;
+    plat_mem_set(writer, 0, sizeof(*writer));
+    if (!dyj_dicts_init(&writer->dicts, null) || (writer->payload = dyb_create(null, DYJ_WRITER_PAYLOAD_SIZE)) == null)
+    {
+        dyj_writer_release(writer);
+        return null;
+    }
+    return writer;
+}
+
+void dyj_writer_release(dyj_writer* writer)
+{
+    if (writer == null) return;
+    dyj_dicts_release(&writer->dicts);
+    if (writer->payload) dyb_release(writer->payload);
+    if (writer->frames) dyb_mem_release(writer->frames, 0);
+    if (writer->key_stamps) dyb_mem_release(writer->key_stamps, 0);
+    if (writer->fixups) dyb_mem_release(writer->fixups, 0);
+    dyb_mem_release(writer, 0);
+}
+
+void dyj_writer_reset(dyj_writer* writer)
+{
+    if (!writer->shared) dyj_dicts_clear(&writer->dicts);
+    dyb_clear(writer->payload);
+    writer->depth = 0;
+    writer->fixup_count = 0;
+    writer->fixup_size = 0;
+    writer->root_written = false;
+    writer->err = dyj_err_none;
+}
+
+static inline enum dyj_err dyj_writer_fail(dyj_writer* writer, enum dyj_err err)
+{
+    if (writer->err == dyj_err_none) writer->err = err;
+    return writer->err;
+}
+
+/**
+ *  Take the position of the next value, append its typdex. For containers node is set to
+ *  the path node of the value.
+ */
+static enum dyj_err dyj_writer_slot(dyj_writer* writer, uint8 type, uint extra, uint* node)
+{
+    dyj_writer_frame* frame;
+    uint index = 0;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (writer->depth == 0)
+    {
+        if (writer->root_written) return dyj_writer_fail(writer, dyj_err_bad_state);
+        writer->root_written = true;
+        if (node) *node = DYJ_ROOT_NODE;
+    }
+    else
+    {
+        frame = &writer->frames[writer->depth-1];
+        if (frame->object)
+        {
+            if (frame->key_index == DYJ_NONE) return dyj_writer_fail(writer, dyj_err_bad_state);
+            index = frame->key_index;
+            frame->key_index = DYJ_NONE;
+            if (node) *node = dyj_dicts_child(&writer->dicts, frame->node, index);
+        }
+        else
+        {
+            if (frame->remaining == 0) return dyj_writer_fail(writer, dyj_err_bad_state);
+            frame->remaining--;
+            if (node) *node = dyj_dicts_array_child(&writer->dicts, frame->node);
+        }
+        if (node && *node == DYJ_NONE) return dyj_writer_fail(writer, dyj_err_no_memory);
+    }
+
+    if (!dyj_out_reserve(writer->payload, DYJ_WRITER_VALUE_SIZE + extra)) return dyj_writer_fail(writer, dyj_err_no_memory);
+    dyb_append_typdex(writer->payload, type, index);
+    return dyj_err_none;
+}
+
+enum dyj_err dyj_write_null(dyj_writer* writer)
+{
+    return dyj_writer_slot(writer, typdex_typ_none, 0, null);
+}
+
+enum dyj_err dyj_write_bool(dyj_writer* writer, boolean value)
+{
+    enum dyj_err err = dyj_writer_slot(writer, typdex_typ_bool, 0, null);
+    if (err == dyj_err_none) dyb_append_bool(writer->payload, value);
+    return err;
+}
+
+enum dyj_err dyj_write_int(dyj_writer* writer, int64 value)
+{
+    enum dyj_err err;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (value < DYJ_MIN_SAFE_INTEGER || value > DYJ_MAX_SAFE_INTEGER) return dyj_writer_fail(writer, dyj_err_unsafe_integer);
+    err = dyj_writer_slot(writer, value < 0 ? typdex_typ_int : typdex_typ_uint, 0, null);
+    if (err != dyj_err_none) return err;
+    // zigzag, same bytes as dyb_append_var_s64 without shifting a negative value
+    if (value < 0) dyb_append_var_u64(writer->payload, ((uint64)value << 1) ^ (uint64)(value >> 63));
+    else dyb_append_var_u64(writer->payload, (uint64)value);
+    return dyj_err_none;
+}
+
+enum dyj_err dyj_write_double(dyj_writer* writer, double value)
+{
+    enum dyj_err err;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (!isfinite(value)) return dyj_writer_fail(writer, dyj_err_non_finite);
+    err = dyj_writer_slot(writer, typdex_typ_double, 0, null);
+    if (err == dyj_err_none) dyb_append_double(writer->payload, value);
+    return err;
+}
+
+enum dyj_err dyj_write_string(dyj_writer* writer, const char* data, uint size)
+{
+    enum dyj_err err;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (data == null && size) return dyj_writer_fail(writer, dyj_err_invalid_args);
+    err = dyj_writer_slot(writer, typdex_typ_string, size, null);
+    if (err == dyj_err_none) dyb_append_data_with_var_len(writer->payload, (uint8*)data, size);
+    return err;
+}
+
+static enum dyj_err dyj_writer_push(dyj_writer* writer, uint node, uint count, boolean object)
+{
+    dyj_writer_frame* frame;
+    uint fixup = DYJ_NONE;
+
+    if (!dyj_grow((void**)&writer->frames, &writer->frame_capacity, writer->depth+1, sizeof(dyj_writer_frame)))
+    {
+        return dyj_writer_fail(writer, dyj_err_no_memory);
+    }
+    if (count == DYJ_COUNT_UNKNOWN)
+    {
+        if (!dyj_grow((void**)&writer->fixups, &writer->fixup_capacity, writer->fixup_count+1, sizeof(dyj_writer_fixup)))
+        {
+            return dyj_writer_fail(writer, dyj_err_no_memory);
+        }
+        fixup = writer->fixup_count++;
+        writer->fixups[fixup].position = dyb_get_position(writer->payload);
+        writer->fixups[fixup].count = 0;
+    }
+    else
+    {
+        dyb_append_var_u64(writer->payload, count);
+    }
+    frame = &writer->frames[writer->depth++];
+    frame->node = node;
+    frame->remaining = count;
+    frame->object = object;
+    frame->key_index = DYJ_NONE;
+    frame->next_key = 0;
+    frame->stamp = 0;
+    frame->fixup = fixup;
+    if (object)
+    {
+        if (++writer->stamp == 0)
+        {
+            plat_mem_set(writer->key_stamps, 0, writer->key_stamp_capacity*sizeof(uint));
+            writer->stamp = 1;
+        }
+        frame->stamp = writer->stamp;
+    }
+    return dyj_err_none;
+}
+
+static enum dyj_err dyj_writer_pop(dyj_writer* writer, dyj_writer_frame* frame)
+{
+    if (frame->fixup != DYJ_NONE)
+    {
+        uint count = DYJ_COUNT_UNKNOWN - frame->remaining;
+        writer->fixups[frame->fixup].count = count;
+        writer->fixup_size += dyj_var_u64_size(count);
+    }
+    else if (frame->remaining)
+    {
+        return dyj_writer_fail(writer, dyj_err_bad_state);
+    }
+    writer->depth--;
+    return dyj_err_none;
+}
+
+enum dyj_err dyj_write_begin_array(dyj_writer* writer, uint count)
+{
+    enum dyj_err err;
+    uint node;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (writer->depth >= DYJ_MAX_DEPTH) return dyj_writer_fail(writer, dyj_err_too_deep);
+    err = dyj_writer_slot(writer, typdex_typ_array, 0, &node);
+    if (err != dyj_err_none) return err;
+    return dyj_writer_push(writer, node, count, false);
+}
+
+enum dyj_err dyj_write_end_array(dyj_writer* writer)
+{
+    dyj_writer_frame* frame;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (writer->depth == 0) return dyj_writer_fail(writer, dyj_err_bad_state);
+    frame = &writer->frames[writer->depth-1];
+    if (frame->object) return dyj_writer_fail(writer, dyj_err_bad_state);
+    return dyj_writer_pop(writer, frame);
+}
+
+enum dyj_err dyj_write_begin_object(dyj_writer* writer, uint count)
+{
+    enum dyj_err err;
+    uint node;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (writer->depth >= DYJ_MAX_DEPTH) return dyj_writer_fail(writer, dyj_err_too_deep);
+    err = dyj_writer_slot(writer, typdex_typ_map, 0, &node);
+    if (err != dyj_err_none) return err;
+    if (!dyj_dicts_ensure_dictionary(&writer->dicts, node)) return dyj_writer_fail(writer, dyj_err_no_memory);
+    return dyj_writer_push(writer, node, count, true);
+}
+
+enum dyj_err dyj_write_key(dyj_writer* writer, const char* key, uint size)
+{
+    dyj_writer_frame* frame;
+    dyj_path_node* n;
+    uint id = DYJ_NONE;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (key == null && size) return dyj_writer_fail(writer, dyj_err_invalid_args);
+    if (writer->depth == 0) return dyj_writer_fail(writer, dyj_err_bad_state);
+    frame = &writer->frames[writer->depth-1];
+    if (!frame->object || frame->key_index != DYJ_NONE || frame->remaining == 0)
+    {
+        return dyj_writer_fail(writer, dyj_err_bad_state);
+    }
+
+    // objects of one path mostly repeat their keys in the same order
+    n = &writer->dicts.nodes[frame->node];
+    if (frame->next_key < n->key_count)
+    {
+        const dyj_dict_key* k = &writer->dicts.keys[n->keys[frame->next_key]];
+        if (k->size == size && memcmp(k->data, key, size) == 0) id = n->keys[frame->next_key];
+    }
+    if (id == DYJ_NONE)
+    {
+        id = dyj_dicts_intern(&writer->dicts, frame->node, key, size, dyj_hash_bytes(key, size));
+        if (id == DYJ_NONE) return dyj_writer_fail(writer, dyj_err_no_memory);
+    }
+    if (!dyj_grow((void**)&writer->key_stamps, &writer->key_stamp_capacity, id+1, sizeof(uint)))
+    {
+        return dyj_writer_fail(writer, dyj_err_no_memory);
+    }
+    if (writer->key_stamps[id] == frame->stamp) return dyj_writer_fail(writer, dyj_err_duplicate_key);
+    writer->key_stamps[id] = frame->stamp;
+    frame->key_index = writer->dicts.keys[id].index;
+    frame->next_key = frame->key_index+1;
+    frame->remaining--;
+    return dyj_err_none;
+}
+
+enum dyj_err dyj_write_end_object(dyj_writer* writer)
+{
+    dyj_writer_frame* frame;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (writer->depth == 0) return dyj_writer_fail(writer, dyj_err_bad_state);
+    frame = &writer->frames[writer->depth-1];
+    if (!frame->object || frame->key_index != DYJ_NONE) return dyj_writer_fail(writer, dyj_err_bad_state);
+    return dyj_writer_pop(writer, frame);
+}
+
+enum dyj_err dyj_write_value(dyj_writer* writer, const dyj_value* value)
+{
+    enum dyj_err err;
+    uint i;
+
+    if (writer->err != dyj_err_none) return writer->err;
+    if (value == null) return dyj_writer_fail(writer, dyj_err_invalid_args);
+    switch (value->type)
+    {
+        case dyj_null:
+            return dyj_write_null(writer);
+        case dyj_bool:
+            return dyj_write_bool(writer, value->u.b);
+        case dyj_int:
+            return dyj_write_int(writer, value->u.i);
+        case dyj_double:
+            return dyj_write_double(writer, value->u.d);
+        case dyj_string:
+            return dyj_write_string(writer, value->u.s.data, value->u.s.size);
+        case dyj_array:
+            err = dyj_write_begin_array(writer, value->u.a.size);
+            for (i=0; err == dyj_err_none && i<value->u.a.size; i++)
+            {
+                err = dyj_write_value(writer, value->u.a.items[i]);
+            }
+            return err == dyj_err_none ? dyj_write_end_array(writer) : err;
+        case dyj_object:
+            err = dyj_write_begin_object(writer, value->u.o.size);
+            for (i=0; err == dyj_err_none && i<value->u.o.size; i++)
+            {
+                const dyj_member* m = &value->u.o.members[i];
+                err = dyj_write_key(writer, m->key, m->key_size);
+                if (err == dyj_err_none) err = dyj_write_value(writer, m->value);
+            }
+            return err == dyj_err_none ? dyj_write_end_object(writer) : err;
+    }
+    return dyj_writer_fail(writer, dyj_err_invalid_args);
+}
+
+enum dyj_err dyj_writer_finish(dyj_writer* writer, dybuf* out)
+{
+    enum dyj_err err = writer->err;
+    uint payload_size = dyb_get_position(writer->payload);
+    uint8* payload = writer->payload->_data;
+    uint i, position = 0;
+
+    if (out == null) err = dyj_err_invalid_args;
+    else if (err == dyj_err_none && (writer->depth != 0 || !writer->root_written)) err = dyj_err_bad_state;
+    if (err == dyj_err_none)
+    {
+        uint header_size;
+        if (writer->shared)
+        {
+            dyj_shared_ref* ref = &writer->shared_ref;
+            ref->define = ref->version == 0 || writer->shared_keys != writer->dicts.key_count
+                          || writer->shared_dicts != writer->dicts.dict_count;
+            if (ref->define) ref->version++;
+            header_size = dyj_dicts_shared_header_size(&writer->dicts, ref);
+        }
+        else
+        {
+            header_size = dyj_dicts_header_size(&writer->dicts);
+        }
+        if ((uint64)payload_size + writer->fixup_size > 0x7FFFFFFFU) err = dyj_err_no_memory;
+        else if (!dyj_out_reserve(out, header_size + 1 + payload_size + writer->fixup_size)) err = dyj_err_no_memory;
+        else if (writer->shared && !dyj_dicts_write_shared_header(&writer->dicts, &writer->shared_ref, out)) err = dyj_err_no_memory;
+        else if (!writer->shared && !dyj_dicts_write_header(&writer->dicts, DYJ_FORMAT_VERSION, out)) err = dyj_err_no_memory;
+        if (err == dyj_err_none && writer->shared)
+        {
+            writer->shared_keys = writer->dicts.key_count;
+            writer->shared_dicts = writer->dicts.dict_count;
+        }
+    }
+    if (err == dyj_err_none)
+    {
+        dyb_append_typdex(out, typdex_typ_obj, 1);
+        for (i=0; i<writer->fixup_count; i++)
+        {
+            dyj_writer_fixup* fixup = &writer->fixups[i];
+            if (fixup->position > position) dyb_append_data_without_len(out, payload+position, fixup->position-position);
+            dyb_append_var_u64(out, fixup->count);
+            position = fixup->position;
+        }
+        dyb_append_data_without_len(out, payload+position, payload_size-position);
+    }
+    dyj_writer_reset(writer);
+    return err;
+}
+
+enum dyj_err dyj_writer_share_dictionaries(dyj_writer* writer, uint set_id)
+{
+    if (writer == null) return dyj_err_invalid_args;
+    writer->shared = false;
+    dyj_writer_reset(writer);
+    writer->shared = true;
+    writer->shared_ref.id = set_id;
+    writer->shared_ref.version = 0;
+    writer->shared_keys = 0;
+    writer->shared_dicts = 0;
+    return dyj_err_none;
+}
@@ -54,6 +54,9 @@ enum dype_fid
     // for dypkt
     dype_f_eof           = 0,            // without any parameters
     dype_f_version       = 1,            // dypkt version, with a variable uint (max:uint64) parameter
+    dype_f_packet        = 2,            // sub-packet of a batch, with a variable length bytes parameter
+    dype_f_protocol_def  = 3,            // protocol id definition, with a variable uint id and a variable length cstring name
+    dype_f_protocol_id   = 4,            // protocol by defined id, with a variable uint id parameter
     // for third party
     dype_f_protocol      = 7,            // protocol name, with a variable length cstring parameter
     dype_f_proto_version = 8,            // protocol version, with a variable uint (max:uint64) parameter
@@ -265,5 +268,640 @@ dyb_inline uint8* dyp_next_data(dypkt* dyp, uint* size)
     return dyb_next_data_with_var_len(dyp, size);
 }
 
+/**
+ *  Same as dyp_next_protocol/dyp_next_cstring/dyp_next_data, but the result is copied to
+ *  the arena and stays valid after the packet memory is released, until dyb_arena_reset.
+ *  Null means a truncated field or no memory, empty bytes are a non-null pointer with size 0.
+ */
+dyb_inline char* dyp_next_protocol_arena(dypkt* dyp, dyb_arena* arena, uint* size)
+{
+    uint len;
+    char* str = dyp_next_protocol(dyp, &len);
+    if (str == null) return null;
+    if (size) *size = len;
+    return (char*)dyb_arena_copy(arena, str, len+1);
+}
+
+dyb_inline char* dyp_next_cstring_arena(dypkt* dyp, dyb_arena* arena, uint* size)
+{
+    uint len;
+    char* str = dyp_next_cstring(dyp, &len);
+    if (str == null) return null;
+    if (size) *size = len;
+    return (char*)dyb_arena_copy(arena, str, len+1);
+}
+
+dyb_inline uint8* dyp_next_data_arena(dypkt* dyp, dyb_arena* arena, uint* size)
+{
+    uint len;
+    uint8* data = dyp_next_data(dyp, &len);
+    if (data == null && len != 0) return null;
+    if (size) *size = len;
+    if (len == 0) return (uint8*)dyb_arena_alloc(arena, 0);
+    return (uint8*)dyb_arena_copy(arena, data, len);
+}
+
+/// ===== bounds checks =====
+
+/**
+ *  Bounds checks for untrusted input, the dyb_next_* readers trust their input.
+ *  dyp_has_var_u64: the whole var uint at the position is in the packet, its prefix
+ *  byte gives the length. dyp_has_typdex: the same for a typdex. dyp_has_data_with_var_len:
+ *  the var uint length and the bytes it counts are in the packet.
+ */
+dyb_inline boolean dyp_has_var_u64(dypkt* dyp)
+{
+    uint size = 1;
+    uint8 b;
+
+    if (dyb_get_remainder(dyp) < 1) return false;
+    b = dyb_peek_u8(dyp);
+    while (size < 9 && (b & (0x80 >> (size-1)))) size++;
+    return dyb_get_remainder(dyp) >= size;
+}
+
+dyb_inline boolean dyp_has_typdex(dypkt* dyp)
+{
+    uint size;
+    uint8 b;
+
+    if (dyb_get_remainder(dyp) < 1) return false;
+    b = dyb_peek_u8(dyp);
+    if ((b&0x80) == 0) size = 1;
+    else if ((b&0x40) == 0) size = 2;
+    else if ((b&0x20) == 0) size = 3;
+    else if ((b&0x10) == 0) size = 4;
+    else return false;
+    return dyb_get_remainder(dyp) >= size;
+}
+
+dyb_inline boolean dyp_has_data_with_var_len(dypkt* dyp)
+{
+    uint position;
+    boolean enough;
+
+    if (!dyp_has_var_u64(dyp)) return false;
+    position = dyb_get_position(dyp);
+    enough = dyb_next_var_u64(dyp) <= (uint64)dyb_get_remainder(dyp);
+    dyb_set_position(dyp, position);
+    return enough;
+}
+
+/// ===== batch functions =====
+
+/**
+ *  A batch shares one header (dype_f_protocol, dype_f_version, ...) for N sub-packets,
+ *  each sub-packet is a length-delimited record:
+ *      Typdex(dype_f, dype_f_packet) Var-len bytes(sub-packet)
+ */
+dyb_inline dypkt* dyp_append_packet(dypkt* dyp, uint8* data, uint size)
+{
+    dyb_append_typdex(dyp, dype_f, dype_f_packet);
+    dyb_append_data_with_var_len(dyp, data, size);
+    return dyp;
+}
+
+/**
+ *  Append the written part of packet as a sub-packet.
+ */
+dyb_inline dypkt* dyp_append_packet_from(dypkt* dyp, dypkt* packet)
+{
+    uint size;
+    uint8* data = dyb_get_data_before_current_position(packet, &size);
+    return dyp_append_packet(dyp, data, size);
+}
+
+/**
+ *  Start a sub-packet in place, the records appended after this call become its body.
+ *  Return the begin position for dyp_end_packet.
+ */
+dyb_inline uint dyp_begin_packet(dypkt* dyp)
+{
+    return dyb_get_position(dyp);
+}
+
+/**
+ *  Close a sub-packet started by dyp_begin_packet. The body is moved forward by the
+ *  size of its record header, so nothing is copied through a temporary buffer.
+ */
+dyb_inline dypkt* dyp_end_packet(dypkt* dyp, uint begin)
+{
+    uint8 header[16];
+    dybuf hdr;
+    uint header_size, body_size;
+
+    if (begin > dyb_get_position(dyp)) return null;
+    body_size = dyb_get_position(dyp) - begin;
+
+    dyb_refer(&hdr, header, sizeof(header), true);
+    dyb_append_typdex(&hdr, dype_f, dype_f_packet);
+    dyb_append_var_u64(&hdr, body_size);
+    header_size = dyb_get_position(&hdr);
+
+    if (dyb_get_position(dyp)+header_size > dyb_get_limit(dyp))
+    {
+        if (dyb_set_limit(dyp, dyb_get_position(dyp)+header_size) == null) return null;
+    }
+    dyb_mem_move(dyp->_data+begin+header_size, dyp->_data+begin, body_size);
+    dyb_mem_copy(dyp->_data+begin, header, header_size);
+    dyp->_position += header_size;
+    return dyp;
+}
+
+/**
+ *  Read the next sub-packet as a view (Not owner) of dyp's memory.
+ *  Return null if the next record isn't a sub-packet or is truncated, the position is
+ *  unchanged then.
+ */
+dyb_inline dypkt* dyp_next_packet(dypkt* dyp, dypkt* packet)
+{
+    uint8 type;
+    uint index;
+    uint size, position = dyb_get_position(dyp);
+    uint8* data;
+
+    if (!dyp_has_typdex(dyp)) return null;
+    dyb_peek_typdex(dyp, &type, &index);
+    if (type != dype_f || index != dype_f_packet) return null;
+
+    dyb_next_typdex(dyp, null, null);
+    if (!dyp_has_data_with_var_len(dyp))
+    {
+        // truncated, or longer than the rest of the batch
+        dyb_set_position(dyp, position);
+        return null;
+    }
+    size = (uint)dyb_next_var_u64(dyp);
+    data = dyp->_data + dyp->_position;
+    dyp->_position += size;
+
+    return dyp_unpack(packet, data, size, false);
+}
+
+/// ===== protocol interning =====
+
+#define DYP_PROTOCOL_UNKNOWN    0U              // handle of no/unknown protocol
+#define DYP_PROTOCOL_MAX_ID     0x1000U         // largest accepted protocol id on the wire
+
+/**
+ *  Protocol names interned to small handles (1, 2, ...), one registry per connection or file.
+ *  Writer: the first dyp_append_protocol_ref of a handle defines (id, name),
+ *          later ones write the id only.
+ *  Reader: dyp_next_protocol_ref maps ids to local handles, so routing is an integer compare
+ *          against handles from dyp_protocols_intern.
+ */
+typedef struct dyp_protocols
+{
+    char** names;                               // names[handle-1], owned copies
+    boolean* defined;                           // writer: handle was defined on this connection
+    uint size;
+    uint capacity;
+    uint* id_map;                               // reader: id_map[wire id] = local handle
+    uint id_capacity;
+} dyp_protocols;
+
+dyb_inline dyp_protocols* dyp_protocols_init(dyp_protocols* protocols)
+{
+    plat_mem_set(protocols, 0, sizeof(*protocols));
+    return protocols;
+}
+
+dyb_inline void dyp_protocols_release(dyp_protocols* protocols)
+{
+    uint i;
+    for (i=0; i<protocols->size; i++)
+    {
+        dyb_mem_release(protocols->names[i], 0);
+    }
+    if (protocols->names) dyb_mem_release(protocols->names, 0);
+    if (protocols->defined) dyb_mem_release(protocols->defined, 0);
+    if (protocols->id_map) dyb_mem_release(protocols->id_map, 0);
+    plat_mem_set(protocols, 0, sizeof(*protocols));
+}
+
+/**
+ *  Forget ids exchanged on the previous connection, interned handles stay valid.
+ */
+dyb_inline dyp_protocols* dyp_protocols_reset(dyp_protocols* protocols)
+{
+    if (protocols->defined) plat_mem_set(protocols->defined, 0, protocols->capacity*sizeof(boolean));
+    if (protocols->id_map) plat_mem_set(protocols->id_map, 0, protocols->id_capacity*sizeof(uint));
+    return protocols;
+}
+
+dyb_inline uint dyp_protocols_find(dyp_protocols* protocols, const char* name)
+{
+    uint i;
+    for (i=0; i<protocols->size; i++)
+    {
+        if (strcmp(protocols->names[i], name) == 0) return i+1;
+    }
+    return DYP_PROTOCOL_UNKNOWN;
+}
+
+/**
+ *  Return the handle of name, add it if it is new. Return DYP_PROTOCOL_UNKNOWN if out of memory.
+ */
+dyb_inline uint dyp_protocols_intern(dyp_protocols* protocols, const char* name)
+{
+    uint handle = dyp_protocols_find(protocols, name);
+    uint size;
+    char* copy;
+
+    if (handle != DYP_PROTOCOL_UNKNOWN) return handle;
+    if (protocols->size+1 >= DYP_PROTOCOL_MAX_ID) return DYP_PROTOCOL_UNKNOWN;
+
+    if (protocols->size == protocols->capacity)
+    {
+        uint capacity = MAX(CACHE_SIZE_UNIT, protocols->capacity*2);
+        uint names_size = capacity*sizeof(char*);
+        uint defined_size = capacity*sizeof(boolean);
+        char** names = (char**)dyb_mem_alloc(&names_size, false);
+        boolean* defined = (boolean*)dyb_mem_alloc(&defined_size, false);
+        if (names == null || defined == null)
+        {
+            if (names) dyb_mem_release(names, names_size);
+            if (defined) dyb_mem_release(defined, defined_size);
+            return DYP_PROTOCOL_UNKNOWN;
+        }
+        if (protocols->names)
+        {
+            dyb_mem_copy(names, protocols->names, protocols->size*sizeof(char*));
+            dyb_mem_copy(defined, protocols->defined, protocols->size*sizeof(boolean));
+            dyb_mem_release(protocols->names, 0);
+            dyb_mem_release(protocols->defined, 0);
+        }
+        protocols->names = names;
+        protocols->defined = defined;
+        protocols->capacity = capacity;
+    }
+
+    size = plat_cstr_length(name)+1;
+    copy = (char*)dyb_mem_alloc(&size, false);
+    if (copy == null) return DYP_PROTOCOL_UNKNOWN;
+    dyb_mem_copy(copy, (void*)name, size);
+    protocols->names[protocols->size] = copy;
+    protocols->defined[protocols->size] = false;
+    return ++protocols->size;
+}
+
+dyb_inline const char* dyp_protocols_name(dyp_protocols* protocols, uint handle)
+{
+    if (handle == DYP_PROTOCOL_UNKNOWN || handle > protocols->size) return null;
+    return protocols->names[handle-1];
+}
+
+/**
+ *  Write the protocol as a definition the first time, then as an id only.
+ */
+dyb_inline dypkt* dyp_append_protocol_ref(dypkt* dyp, dyp_protocols* protocols, uint handle)
+{
+    if (handle == DYP_PROTOCOL_UNKNOWN || handle > protocols->size) return null;
+
+    if (protocols->defined[handle-1])
+    {
+        dyb_append_typdex(dyp, dype_f, dype_f_protocol_id);
+        dyb_append_var_u64(dyp, handle);
+    }
+    else
+    {
+        dyb_append_typdex(dyp, dype_f, dype_f_protocol_def);
+        dyb_append_var_u64(dyp, handle);
+        dyb_append_cstring_with_var_len(dyp, protocols->names[handle-1]);
+        protocols->defined[handle-1] = true;
+    }
+    return dyp;
+}
+
+dyb_inline boolean dyp_protocols_map_id(dyp_protocols* protocols, uint id, uint handle)
+{
+    if (id >= protocols->id_capacity)
+    {
+        uint capacity = MAX(CACHE_SIZE_UNIT, protocols->id_capacity*2);
+        uint size;
+        uint* id_map;
+        while (capacity <= id) capacity *= 2;
+        size = capacity*sizeof(uint);
+        id_map = (uint*)dyb_mem_alloc(&size, false);
+        if (id_map == null) return false;
+        if (protocols->id_map)
+        {
+            dyb_mem_copy(id_map, protocols->id_map, protocols->id_capacity*sizeof(uint));
+            dyb_mem_release(protocols->id_map, 0);
+        }
+        protocols->id_map = id_map;
+        protocols->id_capacity = capacity;
+    }
+    protocols->id_map[id] = handle;
+    return true;
+}
+
+/**
+ *  Read a dype_f_protocol, dype_f_protocol_def or dype_f_protocol_id record and
+ *  return the local handle. Names are compared only when they are (re)defined.
+ *  Other records and truncated ones are not consumed and give DYP_PROTOCOL_UNKNOWN.
+ */
+dyb_inline uint dyp_next_protocol_ref(dypkt* dyp, dyp_protocols* protocols)
+{
+    uint8 type;
+    uint index;
+    uint64 id = 0;
+    uint handle, size, position = dyb_get_position(dyp);
+    char* name;
+
+    if (!dyp_has_typdex(dyp)) return DYP_PROTOCOL_UNKNOWN;
+    dyb_peek_typdex(dyp, &type, &index);
+    if (type != dype_f) return DYP_PROTOCOL_UNKNOWN;
+
+    switch ((dype_fid)index)
+    {
+        case dype_f_protocol_id:
+            dyb_next_typdex(dyp, null, null);
+            if (!dyp_has_var_u64(dyp)) break;
+            id = dyb_next_var_u64(dyp);
+            if (id >= protocols->id_capacity) return DYP_PROTOCOL_UNKNOWN;
+            return protocols->id_map[id];
+        case dype_f_protocol_def:
+        case dype_f_protocol:
+            dyb_next_typdex(dyp, null, null);
+            if (index == dype_f_protocol_def)
+            {
+                if (!dyp_has_var_u64(dyp)) break;
+                id = dyb_next_var_u64(dyp);
+            }
+            // the length counts the NUL, 0 is malformed
+            if (!dyp_has_data_with_var_len(dyp) || dyb_peek_u8(dyp) == 0) break;
+            name = dyb_next_cstring_with_var_len(dyp, &size);
+            if (name[size] != 0) return DYP_PROTOCOL_UNKNOWN;
+            if (index == dype_f_protocol) return dyp_protocols_intern(protocols, name);
+            if (id == 0 || id >= DYP_PROTOCOL_MAX_ID) return DYP_PROTOCOL_UNKNOWN;
+            handle = dyp_protocols_intern(protocols, name);
+            if (!dyp_protocols_map_id(protocols, (uint)id, handle)) return DYP_PROTOCOL_UNKNOWN;
+            return handle;
+        default:
+            return DYP_PROTOCOL_UNKNOWN;
+    }
+    // truncated record
+    dyb_set_position(dyp, position);
+    return DYP_PROTOCOL_UNKNOWN;
+}
+
+/// ===== skip functions =====
+
+/**
+ *  Consume the payload of a record whose typdex was already read.
+ *  Only canonical primitive payloads can be skipped, array/map/obj payloads are
+ *  protocol-defined and return false.
+ */
+dyb_inline boolean dyp_skip_payload(dypkt* dyp, dype type)
+{
+    uint len;
+
+    switch (type)
+    {
+        case dype_none:
+            return true;
+        case dype_bool:
+            if (dyb_get_remainder(dyp) < 1) return false;
+            dyb_next_bool(dyp);
+            return true;
+        case dype_int:
+        case dype_uint:
+            if (!dyp_has_var_u64(dyp)) return false;
+            dyb_next_var_u64(dyp);
+            return true;
+#if !defined(DISABLE_FP)
+        case dype_float:
+            return dyb_next_data_without_len(dyp, 4) != null;
+        case dype_double:
+            return dyb_next_data_without_len(dyp, 8) != null;
+#endif
+        case dype_string:
+        case dype_bytes:
+            if (!dyp_has_data_with_var_len(dyp)) return false;
+            len = (uint)dyb_next_var_u64(dyp);
+            return len == 0 || dyb_next_data_without_len(dyp, len) != null;
+        default:
+            return false;
+    }
+}
+
+/**
+ *  Consume the next record (typdex and payload).
+ *  Function records are skipped according to their function id.
+ */
+dyb_inline boolean dyp_skip_next(dypkt* dyp)
+{
+    uint8 type;
+    uint index;
+
+    if (!dyp_has_typdex(dyp)) return false;
+    dyb_next_typdex(dyp, &type, &index);
+
+    if (type == dype_f)
+    {
+        switch ((dype_fid)index)
+        {
+            case dype_f_eof:
+                return true;
+            case dype_f_version:
+            case dype_f_proto_version:
+                return dyp_skip_payload(dyp, dype_uint);
+            case dype_f_protocol:
+                return dyp_skip_payload(dyp, dype_string);
+            case dype_f_packet:
+                return dyp_skip_payload(dyp, dype_bytes);
+            case dype_f_protocol_def:
+                return dyp_skip_payload(dyp, dype_uint) && dyp_skip_payload(dyp, dype_string);
+            case dype_f_protocol_id:
+                return dyp_skip_payload(dyp, dype_uint);
+            default:
+                return false;
+        }
+    }
+
+    return dyp_skip_payload(dyp, (dype)type);
+}
+
+/// ===== dispatch functions =====
+
+/**
+ *  Record handler, called with the position at the record's typdex.
+ *  It should consume the whole record (e.g. by dyp_next_xxx) and return true,
+ *  or return false to stop dyp_dispatch_all.
+ */
+typedef boolean (*dyp_handler)(dypkt* dyp, dype type, uint index, void* ctx);
+
+struct dyp_handler_entry
+{
+    uint32 key;                                 // (type << 20) | index
+    dyp_handler handler;
+};
+
+/**
+ *  Handlers indexed by the first typdex byte:
+ *  1 byte typdex (0xxx xxxx) is the index of short_form,
+ *  2 bytes typdex (10tt tttt iiii iiii) selects long_form[type][index],
+ *  3/4 bytes typdex fall back to a sorted wide table.
+ */
+typedef struct dyp_dispatch_table
+{
+    dyp_handler short_form[0x80];
+    dyp_handler* long_form[0x40];
+    struct dyp_handler_entry* wide;
+    uint wide_size;
+    uint wide_capacity;
+    dyp_handler fallback;                       // unregistered records, null means stop
+} dyp_dispatch_table;
+
+dyb_inline dyp_dispatch_table* dyp_dispatch_init(dyp_dispatch_table* table)
+{
+    plat_mem_set(table, 0, sizeof(*table));
+    return table;
+}
+
+dyb_inline void dyp_dispatch_release(dyp_dispatch_table* table)
+{
+    uint i;
+    for (i=0; i<0x40; i++)
+    {
+        if (table->long_form[i]) dyb_mem_release(table->long_form[i], 0x100*sizeof(dyp_handler));
+    }
+    if (table->wide) dyb_mem_release(table->wide, table->wide_capacity*sizeof(table->wide[0]));
+    plat_mem_set(table, 0, sizeof(*table));
+}
+
+dyb_inline dyp_handler dyp_dispatch_find_wide(dyp_dispatch_table* table, uint32 key)
+{
+    uint s = 0, e = table->wide_size;
+    while (s < e)
+    {
+        uint m = (s+e) >> 1;
+        if (table->wide[m].key == key) return table->wide[m].handler;
+        if (table->wide[m].key < key) s = m+1;
+        else e = m;
+    }
+    return null;
+}
+
+/**
+ *  Attach a handler to (type, index), a null handler detaches it.
+ */
+dyb_inline dyp_dispatch_table* dyp_dispatch_register(dyp_dispatch_table* table, dype type, uint index, dyp_handler handler)
+{
+    if (type <= 0x0f && index <= 0x07)
+    {
+        table->short_form[(type<<3) | index] = handler;
+    }
+    else if (type <= 0x3f && index <= 0xff)
+    {
+        if (table->long_form[type] == null)
+        {
+            uint size = 0x100*sizeof(dyp_handler);
+            table->long_form[type] = (dyp_handler*)dyb_mem_alloc(&size, false);
+            if (table->long_form[type] == null) return null;
+        }
+        table->long_form[type][index] = handler;
+    }
+    else if (type <= 0xff && index <= 0x0fffff)
+    {
+        uint32 key = ((uint32)type << 20) | index;
+        uint s = 0, e = table->wide_size;
+        while (s < e)
+        {
+            uint m = (s+e) >> 1;
+            if (table->wide[m].key < key) s = m+1;
+            else e = m;
+        }
+        if (s < table->wide_size && table->wide[s].key == key)
+        {
+            table->wide[s].handler = handler;
+            return table;
+        }
+        if (table->wide_size == table->wide_capacity)
+        {
+            uint capacity = MAX(CACHE_SIZE_UNIT, table->wide_capacity*2);
+            uint size = capacity*sizeof(table->wide[0]);
+            struct dyp_handler_entry* wide = (struct dyp_handler_entry*)dyb_mem_alloc(&size, false);
+            if (wide == null) return null;
+            if (table->wide)
+            {
+                dyb_mem_copy(wide, table->wide, table->wide_size*sizeof(wide[0]));
+                dyb_mem_release(table->wide, table->wide_capacity*sizeof(wide[0]));
+            }
+            table->wide = wide;
+            table->wide_capacity = capacity;
+        }
+        dyb_mem_move(&table->wide[s+1], &table->wide[s], (table->wide_size-s)*sizeof(table->wide[0]));
+        table->wide[s].key = key;
+        table->wide[s].handler = handler;
+        table->wide_size++;
+    }
+    else
+    {
+        return null;
+    }
+    return table;
+}
+
+dyb_inline dyp_dispatch_table* dyp_dispatch_set_fallback(dyp_dispatch_table* table, dyp_handler handler)
+{
+    table->fallback = handler;
+    return table;
+}
+
+/**
+ *  A fallback handler skipping canonical records, see dyp_skip_next.
+ */
+dyb_inline boolean dyp_dispatch_skip(dypkt* dyp, dype type, uint index, void* ctx)
+{
+    (void)type;
+    (void)index;
+    (void)ctx;
+    return dyp_skip_next(dyp);
+}
+
+/**
+ *  Run handlers on all remaining records, one indirect call per record.
+ *  Return false if a record has no handler, a handler fails or doesn't consume its record.
+ */
+dyb_inline boolean dyp_dispatch_all(dypkt* dyp, dyp_dispatch_table* table, void* ctx)
+{
+    while (dyb_get_remainder(dyp) > 0)
+    {
+        uint position = dyb_get_position(dyp);
+        uint8 b = dyb_peek_u8(dyp);
+        uint8 type;
+        uint index;
+        dyp_handler handler;
+
+        if ((b&0x80) == 0)
+        {
+            type = (b >> 3) & 0x0F;
+            index = b & 0x07;
+            handler = table->short_form[b];
+        }
+        else if ((b&0x40) == 0)
+        {
+            if (dyb_get_remainder(dyp) < 2) return false;
+            type = b & 0x3F;
+            index = dyp->_data[position+1];
+            handler = table->long_form[type] ? table->long_form[type][index] : null;
+        }
+        else
+        {
+            if (dyb_get_remainder(dyp) < (uint)((b&0x20) ? 4 : 3)) return false;
+            dyb_peek_typdex(dyp, &type, &index);
+            handler = dyp_dispatch_find_wide(table, ((uint32)type << 20) | index);
+        }
+
+        if (handler == null) handler = table->fallback;
+        if (handler == null) return false;
+        if (!handler(dyp, (dype)type, index, ctx)) return false;
+        if (dyb_get_position(dyp) == position) return false;
+    }
+    return true;
+}
+
 
 #endif
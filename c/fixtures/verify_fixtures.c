@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include "../dybuf.h"
+#include "../dyjson/dyjson.h"
 
 static int verbose_mode = 0;
 
@@ -1041,6 +1042,191 @@ static int verify_varlen_strings(const char *dir) {
     return status;
 }
 
+/* Decode with the dybuf_json library and encode again, bytes must not change. */
+static int verify_json_library_round_trip(const uint8 *encoded, size_t encoded_len) {
+    dyj_document doc;
+    dyj_value *value = NULL;
+    dybuf reader_store, writer_store;
+    int status = -1;
+
+    dyj_document_init(&doc);
+    dybuf *reader = dyb_refer(&reader_store, (byte *)encoded, (uint)encoded_len, false);
+    dybuf *writer = dyb_create(&writer_store, (uint)(encoded_len + 16));
+    if (reader && writer &&
+        dyj_decode(reader, &doc, &value) == dyj_err_none &&
+        dyb_get_remainder(reader) == 0 &&
+        dyj_encode(writer, value) == dyj_err_none) {
+        uint out_len = 0;
+        uint8 *out_bytes = dyb_get_data_before_current_position(writer, &out_len);
+        if (out_len == encoded_len && compare_bytes(out_bytes, encoded, encoded_len) == 0) {
+            status = 0;
+        }
+    }
+    if (status == 0) {
+        /* the single-pass writer must produce the same bytes */
+        dyj_writer *single = dyj_writer_create();
+        status = -1;
+        dyb_clear(writer);
+        if (single &&
+            dyj_write_value(single, value) == dyj_err_none &&
+            dyj_writer_finish(single, writer) == dyj_err_none) {
+            uint out_len = 0;
+            uint8 *out_bytes = dyb_get_data_before_current_position(writer, &out_len);
+            if (out_len == encoded_len && compare_bytes(out_bytes, encoded, encoded_len) == 0) {
+                status = 0;
+            }
+        }
+        dyj_writer_release(single);
+    }
+    if (status == 0) {
+        /* canonical bytes decode to the same value and are a fixed point */
+        dyj_document canonical_doc;
+        dyj_value *canonical = NULL;
+        dybuf again_store;
+        dybuf *again = dyb_create(&again_store, (uint)(encoded_len + 16));
+        status = -1;
+        dyj_document_init(&canonical_doc);
+        dyb_clear(writer);
+        if (again &&
+            dyj_encode_canonical(writer, value) == dyj_err_none &&
+            dyb_flip(writer) &&
+            dyj_decode(writer, &canonical_doc, &canonical) == dyj_err_none &&
+            dyj_equal(value, canonical) &&
+            dyj_encode_canonical(again, canonical) == dyj_err_none) {
+            uint out_len = 0;
+            uint8 *out_bytes = dyb_get_data_before_current_position(again, &out_len);
+            if (out_len == dyb_get_limit(writer) && compare_bytes(out_bytes, writer->_data, out_len) == 0) {
+                status = 0;
+            }
+        }
+        if (again) dyb_release(again);
+        dyj_document_release(&canonical_doc);
+    }
+    if (status == 0) {
+        /* columnar bytes decode to the same value */
+        dyj_document columnar_doc;
+        dyj_value *columnar = NULL;
+        status = -1;
+        dyj_document_init(&columnar_doc);
+        dyb_clear(writer);
+        if (dyj_encode_columnar(writer, value) == dyj_err_none &&
+            dyb_flip(writer) &&
+            dyj_decode(writer, &columnar_doc, &columnar) == dyj_err_none &&
+            dyb_get_remainder(writer) == 0 &&
+            dyj_equal(value, columnar)) {
+            status = 0;
+        }
+        dyj_document_release(&columnar_doc);
+    }
+    dyb_release(writer);
+    dyj_document_release(&doc);
+    return status;
+}
+
+/* Text of an array of count copies of item. */
+static char *repeat_json_items(const char *item, uint count) {
+    size_t item_len = strlen(item);
+    char *text = malloc(count * (item_len + 1) + 3);
+    char *p = text;
+    uint i;
+    if (!text) return NULL;
+    *p++ = '[';
+    for (i = 0; i < count; i++) {
+        if (i) *p++ = ',';
+        memcpy(p, item, item_len);
+        p += item_len;
+    }
+    *p++ = ']';
+    *p = 0;
+    return text;
+}
+
+/* Arrays of objects that the columnar encoder writes as tables, and forged tables. */
+static int verify_json_columnar(void) {
+    static const struct { const char *item; uint count; } tables[] = {
+        {"{\"a\":null}", 1000},
+        {"{\"a\":null,\"b\":null}", 9},
+        {"{}", 4},
+        {"{\"a\":true,\"b\":null}", 17},
+        {"{\"a\":1,\"b\":\"x\",\"c\":[{\"d\":null},{\"d\":null},{\"d\":null},{\"d\":null}]}", 5},
+    };
+    dyj_document doc;
+    dyj_value *value, *decoded;
+    dybuf out_store, forged_store;
+    dybuf *out = dyb_create(&out_store, 256);
+    dybuf *forged = dyb_create(&forged_store, 256);
+    uint out_len, header, i;
+    uint8 *out_bytes;
+    enum dyj_err err;
+    int status = 0;
+
+    if (!out || !forged) return -1;
+    dyj_document_init(&doc);
+    for (i = 0; i < sizeof(tables)/sizeof(tables[0]) && status == 0; i++) {
+        char *text = repeat_json_items(tables[i].item, tables[i].count);
+        dyb_clear(out);
+        if (!text ||
+            dyj_parse_text(&doc, text, (uint)strlen(text), &value) != dyj_err_none ||
+            dyj_encode_columnar(out, value) != dyj_err_none ||
+            !dyb_flip(out) ||
+            (err = dyj_decode(out, &doc, &decoded)) != dyj_err_none ||
+            dyb_get_remainder(out) != 0 ||
+            !dyj_equal(value, decoded)) {
+            fprintf(stderr, "json columnar round-trip mismatch (%u x %s)\n", tables[i].count, tables[i].item);
+            status = -1;
+        }
+        free(text);
+    }
+
+    /* 4 rows of {"a":null}: the root table is the last 6 bytes, after the payload marker */
+    if (status == 0) {
+        char *text = repeat_json_items("{\"a\":null}", 4);
+        dyb_clear(out);
+        if (!text ||
+            dyj_parse_text(&doc, text, (uint)strlen(text), &value) != dyj_err_none ||
+            dyj_encode_columnar(out, value) != dyj_err_none) {
+            status = -1;
+        }
+        free(text);
+    }
+    if (status == 0) {
+        /* a million rows and values claimed by a few bytes */
+        out_bytes = dyb_get_data_before_current_position(out, &out_len);
+        header = out_len - 6;
+        dyb_append_data_without_len(forged, out_bytes, header);
+        dyb_append_typdex(forged, typdex_typ_obj, 0);
+        dyb_append_var_u64(forged, 1000000);
+        dyb_append_var_u64(forged, 1);
+        dyb_append_typdex(forged, typdex_typ_none, 0);
+        dyb_append_var_u64(forged, 1000000);
+        dyb_flip(forged);
+        if (dyj_decode(forged, &doc, &decoded) != dyj_err_bad_column) {
+            fprintf(stderr, "json columnar forged row count accepted\n");
+            status = -1;
+        }
+
+        /* no columns */
+        dyb_clear(forged);
+        dyb_append_data_without_len(forged, out_bytes, header);
+        dyb_append_typdex(forged, typdex_typ_obj, 0);
+        dyb_append_var_u64(forged, 4);
+        dyb_append_var_u64(forged, 0);
+        dyb_flip(forged);
+        if (dyj_decode(forged, &doc, &decoded) != dyj_err_bad_column) {
+            fprintf(stderr, "json columnar table without columns accepted\n");
+            status = -1;
+        }
+    }
+
+    dyb_release(forged);
+    dyb_release(out);
+    dyj_document_release(&doc);
+    if (status == 0 && verbose_mode) {
+        printf("json columnar: OK\n");
+    }
+    return status;
+}
+
 static int verify_json_values(const char *dir) {
     char path[PATH_MAX];
     snprintf(path, sizeof(path), "%s/json_values.json", dir);
@@ -1126,6 +1312,14 @@ static int verify_json_values(const char *dir) {
             break;
         }
 
+        if (verify_json_library_round_trip(encoded_bytes, encoded_len) != 0) {
+            fprintf(stderr, "%s: json_values dybuf_json round-trip mismatch (%s)\n", path, id);
+            dyb_release(writer);
+            free(encoded_bytes);
+            status = -1;
+            break;
+        }
+
         dyb_release(writer);
         free(encoded_bytes);
 
@@ -1170,6 +1364,7 @@ int main(int argc, char **argv) {
     if (verify_varlen_bytes(dir) != 0) return EXIT_FAILURE;
     if (verify_varlen_strings(dir) != 0) return EXIT_FAILURE;
     if (verify_json_values(dir) != 0) return EXIT_FAILURE;
+    if (verify_json_columnar() != 0) return EXIT_FAILURE;
 
     printf("Fixture verification succeeded for %s\n", dir);
     return EXIT_SUCCESS;
@@ -21,9 +21,11 @@
 // Created by Yuchi on 2016/2/6.
 //
 
+#include <stdlib.h>
 #include <string.h>
 #include "plat_mem.h"
 #include "cjson.h"
+#include "dyjson.h"
 
 
 /// ============= cjson obj
@@ -76,6 +78,276 @@ static inline void cjson_memory_move(void* dst, void* src, unsigned int size)
     memmove(dst, src, size);
 }
 
+/// ========== document ==========
+
+#define CJSON_DOCUMENT_CHUNK_SIZE       (64*1024)
+#define CJSON_DOCUMENT_CHUNK_MAX        (1024*1024)
+#define CJSON_DOCUMENT_CHUNK_HEADER     ((sizeof(struct cjson_document_chunk)+7) & ~7U)
+#define CJSON_DOCUMENT_CAPACITY         4           // of new containers, grown vectors are not reused
+
+struct cjson_document_chunk
+{
+    struct cjson_document_chunk* next;
+};
+
+struct cjson_document_kept
+{
+    struct jsobj* obj;
+    struct cjson_document_kept* next;
+};
+
+struct cjson_document
+{
+    struct cjson_document_chunk* chunks;    // the current one first
+    unsigned char* free;                    // unused (zeroed) bytes of the current chunk
+    unsigned int left;
+    unsigned int chunk_size;                // of the next chunk, doubled up to CJSON_DOCUMENT_CHUNK_MAX
+    struct cjson_document_kept* kept;       // reference counted nodes moved into the document
+    unsigned int keys_capacity, keys_size;  // interned map keys, power of 2, 0 when not interned
+    struct jsobj_string** keys;
+};
+
+struct cjson_document* cjson_document_create(unsigned int chunk_size)
+{
+    struct cjson_document* doc = cjson_memory_allocate(sizeof(*doc));
+    if (doc==NULL) return NULL;
+    doc->chunk_size = chunk_size ? chunk_size : CJSON_DOCUMENT_CHUNK_SIZE;
+    return doc;
+}
+
+// zeroed and 8 bytes aligned, from the heap when doc is NULL
+static void* cjson_document_allocate(struct cjson_document* doc, unsigned int size)
+{
+    struct cjson_document_chunk* chunk;
+    unsigned char* mem;
+
+    if (doc==NULL) return cjson_memory_allocate(size);
+    if (size > 0xFFFFFFFFU - CJSON_DOCUMENT_CHUNK_HEADER - 7) return NULL;
+
+    size = (size + 7) & ~7U;
+    if (size > doc->left)
+    {
+        if (size > doc->chunk_size / 4)
+        {
+            // large vectors get a chunk of their own, the current one stays
+            chunk = cjson_memory_allocate(CJSON_DOCUMENT_CHUNK_HEADER + size);
+            if (chunk==NULL) return NULL;
+            if (doc->chunks)
+            {
+                chunk->next = doc->chunks->next;
+                doc->chunks->next = chunk;
+            }
+            else doc->chunks = chunk;
+            return (unsigned char*)chunk + CJSON_DOCUMENT_CHUNK_HEADER;
+        }
+
+        chunk = cjson_memory_allocate(CJSON_DOCUMENT_CHUNK_HEADER + doc->chunk_size);
+        if (chunk==NULL) return NULL;
+        chunk->next = doc->chunks;
+        doc->chunks = chunk;
+        doc->free = (unsigned char*)chunk + CJSON_DOCUMENT_CHUNK_HEADER;
+        doc->left = doc->chunk_size;
+        if (doc->chunk_size < CJSON_DOCUMENT_CHUNK_MAX) doc->chunk_size *= 2;
+    }
+
+    mem = doc->free;
+    doc->free += size;
+    doc->left -= size;
+    return mem;
+}
+
+// document memory goes with the document
+static inline void cjson_document_deallocate(struct cjson_document* doc, void* mem)
+{
+    if (doc==NULL) cjson_memory_release(mem);
+}
+
+void cjson_document_free(struct cjson_document* doc)
+{
+    struct cjson_document_kept* kept;
+    struct cjson_document_chunk* chunk;
+
+    if (doc==NULL) return;
+    for (kept=doc->kept; kept; kept=kept->next)
+    {
+        cjson_release(kept->obj);
+    }
+    while ((chunk = doc->chunks) != NULL)
+    {
+        doc->chunks = chunk->next;
+        cjson_memory_release(chunk);
+    }
+    cjson_memory_release(doc->keys);
+    cjson_memory_release(doc);
+}
+
+// FNV-1a, as cached in string nodes
+static unsigned int cjson_hash_string(const char* value)
+{
+    const unsigned char* p = (const unsigned char*)value;
+    unsigned int hash = 2166136261U;
+    while (p && *p) hash = (hash ^ *p++) * 16777619U;
+    return hash ? hash : 1;
+}
+
+enum jserr cjson_document_intern_keys(struct cjson_document* doc)
+{
+    if (doc==NULL) return jserr_invalid_args;
+    if (doc->keys_capacity) return jserr_no_error;
+    doc->keys = cjson_memory_allocate(sizeof(doc->keys[0]) * 64);
+    if (doc->keys==NULL) return jserr_no_memory;
+    doc->keys_capacity = 64;
+    return jserr_no_error;
+}
+
+// slot of the interned key with text value, or the empty slot for it
+static unsigned int cjson_document_find_key(struct cjson_document* doc, const char* value, unsigned int hash)
+{
+    unsigned int mask = doc->keys_capacity - 1;
+    unsigned int slot = hash & mask;
+    struct jsobj_string* key;
+
+    while ((key = doc->keys[slot]) != NULL)
+    {
+        if (key->hash == hash && strcmp(key->value, value) == 0) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// adds key at slot, the table stays at most half full
+static void cjson_document_add_key(struct cjson_document* doc, unsigned int slot, struct jsobj_string* key)
+{
+    struct jsobj_string** keys = doc->keys;
+    unsigned int capacity = doc->keys_capacity, i;
+
+    doc->keys[slot] = key;
+    if ((++doc->keys_size)*2 <= capacity) return;
+
+    doc->keys = cjson_memory_allocate(sizeof(keys[0]) * capacity * 2);
+    if (doc->keys==NULL)
+    {
+        doc->keys = keys;       // full, keys are not interned any more
+        return;
+    }
+    doc->keys_capacity = capacity * 2;
+    for (i=0; i<capacity; i++)
+    {
+        if (keys[i]) doc->keys[cjson_document_find_key(doc, keys[i]->value, keys[i]->hash)] = keys[i];
+    }
+    cjson_memory_release(keys);
+}
+
+struct jsobj* cjson_document_make_key(struct cjson_document* doc, const char* value)
+{
+    unsigned int hash, slot;
+    struct jsobj* key;
+
+    if (doc==NULL || doc->keys_capacity==0 || doc->keys_size*2 >= doc->keys_capacity)
+        return cjson_document_make_string(doc, value);
+
+    hash = cjson_hash_string(value);
+    slot = cjson_document_find_key(doc, value ? value : "", hash);
+    if (doc->keys[slot]) return &doc->keys[slot]->base;
+
+    key = cjson_document_make_string(doc, value);
+    if (key != NULL && key->document == doc) cjson_document_add_key(doc, slot, _obj2inst_s(key));
+    return key;
+}
+
+// the interned node for a string key made in doc
+static struct jsobj* cjson_document_intern(struct cjson_document* doc, struct jsobj* key)
+{
+    unsigned int hash, slot;
+
+    if (doc==NULL || doc->keys_capacity==0 || doc->keys_size*2 >= doc->keys_capacity ||
+        key==NULL || key->type!=jstype_string || key->document!=doc)
+        return key;
+
+    hash = cjson_hash(key);
+    slot = cjson_document_find_key(doc, _obj2string(key), hash);
+    if (doc->keys[slot]) return &doc->keys[slot]->base;
+    cjson_document_add_key(doc, slot, _obj2inst_s(key));
+    return key;
+}
+
+/// ========== immortal values ==========
+
+// nil, true, false, "" and small ints are shared and never freed, cjson_release skips them as
+// document nodes. They must not be changed.
+static struct cjson_document cjson_static_document;
+
+#define CJSON_STATIC_BASE(t)    { .type = (t), .reference_count = 1, .document = &cjson_static_document }
+#define CJSON_SMALL_INT_MIN     (-128)
+#define CJSON_SMALL_INT_COUNT   512             // -128 to 383
+#define CJSON_STATIC_INT(n)     { CJSON_STATIC_BASE(jstype_int), CJSON_SMALL_INT_MIN + (n) }
+#define CJSON_STATIC_INT4(n)    CJSON_STATIC_INT(n), CJSON_STATIC_INT((n)+1), CJSON_STATIC_INT((n)+2), CJSON_STATIC_INT((n)+3)
+#define CJSON_STATIC_INT16(n)   CJSON_STATIC_INT4(n), CJSON_STATIC_INT4((n)+4), CJSON_STATIC_INT4((n)+8), CJSON_STATIC_INT4((n)+12)
+#define CJSON_STATIC_INT64(n)   CJSON_STATIC_INT16(n), CJSON_STATIC_INT16((n)+16), CJSON_STATIC_INT16((n)+32), CJSON_STATIC_INT16((n)+48)
+#define CJSON_STATIC_INT256(n)  CJSON_STATIC_INT64(n), CJSON_STATIC_INT64((n)+64), CJSON_STATIC_INT64((n)+128), CJSON_STATIC_INT64((n)+192)
+
+static struct jsobj_nil cjson_static_nil = { CJSON_STATIC_BASE(jstype_nil) };
+static struct jsobj_bool cjson_static_bools[2] = {
+        { CJSON_STATIC_BASE(jstype_bool), false },
+        { CJSON_STATIC_BASE(jstype_bool), true },
+};
+static char cjson_static_empty[1] = "";
+static struct jsobj_string cjson_static_empty_string = {
+        CJSON_STATIC_BASE(jstype_string), cjson_static_empty, 2166136261U,      // hash of ""
+};
+static struct jsobj_int cjson_static_ints[CJSON_SMALL_INT_COUNT] = {
+        CJSON_STATIC_INT256(0), CJSON_STATIC_INT256(256),
+};
+
+// value as stored in a container of doc: it is taken as is, kept or copied
+static struct jsobj* cjson_document_adopt(struct cjson_document* doc, struct jsobj* value)
+{
+    struct cjson_document_kept* kept;
+
+    if (value==NULL || value->document==doc || value->document==&cjson_static_document) return value;
+    if (value->document) return cjson_document_clone(doc, value);   // of another document
+
+    // reference counted, released by cjson_document_free
+    kept = cjson_document_allocate(doc, sizeof(*kept));
+    if (kept)
+    {
+        kept->obj = value;
+        kept->next = doc->kept;
+        doc->kept = kept;
+    }
+    return value;
+}
+
+// a value removed from container, the values of a document are freed with it
+static inline void cjson_release_child(struct jsobj* container, struct jsobj* value)
+{
+    if (container->document==NULL) cjson_release(value);
+}
+
+// resizes a values/pairs vector to hold required items
+static enum jserr cjson_memory_reserve(struct cjson_document* doc, void** items, unsigned int item_size,
+                                       unsigned int size, unsigned int* capacity, unsigned int required)
+{
+    void* new_items;
+
+    if (required <= *capacity) return jserr_no_error;
+    if (required > 0xFFFFFFFFU / item_size) return jserr_no_memory;
+
+    new_items = cjson_document_allocate(doc, item_size * required);
+    if (new_items==NULL) return jserr_no_memory;
+    if (size) cjson_memory_copy(new_items, *items, item_size * size);
+    cjson_document_deallocate(doc, *items);
+    *items = new_items;
+    *capacity = required;
+    return jserr_no_error;
+}
+
+// capacity after adding one item to a full vector: doubled, so n adds copy O(n) items
+static inline unsigned int cjson_memory_grown(unsigned int capacity)
+{
+    return capacity < 2 ? 4 : capacity > 0x7FFFFFFFU ? capacity+1 : capacity*2;
+}
+
 /// ========== cjson =========
 
 struct jsobj* cjson_make(enum jstype type)
@@ -98,24 +370,72 @@ struct jsobj* cjson_make(enum jstype type)
 enum jserr cjson_release(struct jsobj* obj)
 {
     if (obj == NULL) return jserr_invalid_args;
+    if (obj->document) return jserr_no_error;       // freed with its document
     switch(obj->type)
     {
-        case jstype_nil: cjson_release_nil(_obj2inst_n(obj));
-        case jstype_bool: cjson_release_bool(_obj2inst_b(obj));
-        case jstype_int: cjson_release_int(_obj2inst_i(obj));
-        case jstype_double: cjson_release_double(_obj2inst_d(obj));
-        case jstype_string: cjson_release_string(_obj2inst_s(obj));
-        case jstype_array: cjson_release_array(_obj2inst_a(obj));
-        case jstype_tuple: cjson_release_tuple(_obj2inst_t(obj));
-        case jstype_map: cjson_release_map(_obj2inst_m(obj));
-        case jstype_rt: cjson_release_runtime(_obj2inst_r(obj));
+        case jstype_nil: return cjson_release_nil(_obj2inst_n(obj));
+        case jstype_bool: return cjson_release_bool(_obj2inst_b(obj));
+        case jstype_int: return cjson_release_int(_obj2inst_i(obj));
+        case jstype_double: return cjson_release_double(_obj2inst_d(obj));
+        case jstype_string: return cjson_release_string(_obj2inst_s(obj));
+        case jstype_array: return cjson_release_array(_obj2inst_a(obj));
+        case jstype_tuple: return cjson_release_tuple(_obj2inst_t(obj));
+        case jstype_map: return cjson_release_map(_obj2inst_m(obj));
+        case jstype_rt: return cjson_release_runtime(_obj2inst_r(obj));
     }
     return jserr_invalid_args;
 }
 
+struct jsobj* cjson_document_clone(struct cjson_document* doc, struct jsobj* obj)
+{
+    struct jsobj* copy;
+    unsigned int i;
+
+    if (doc == NULL) return cjson_clone(obj);
+    if (obj == NULL) return cjson_document_make_nil(doc);
+    if (obj->document == &cjson_static_document) return obj;
+    switch(obj->type)
+    {
+        case jstype_nil: return cjson_document_make_nil(doc);
+        case jstype_bool: return cjson_document_make_bool(doc, _obj2bool(obj));
+        case jstype_int: return cjson_document_make_int(doc, _obj2int(obj));
+        case jstype_double: return cjson_document_make_double(doc, _obj2double(obj));
+        case jstype_string: return cjson_document_make_string(doc, _obj2string(obj));
+        case jstype_array: {
+            struct jsobj_array* array_obj = _obj2inst_a(obj);
+            copy = cjson_document_make_array(doc);
+            cjson_array_reserve(copy, array_obj->size);
+            for (i=0; i<array_obj->size; i++)
+                cjson_array_push_move(copy, cjson_document_clone(doc, array_obj->values[i]));
+            return copy;
+        }
+        case jstype_tuple: {
+            struct jsobj_tuple* tuple_obj = _obj2inst_t(obj);
+            copy = cjson_document_make_tuple(doc, tuple_obj->size);
+            for (i=0; i<tuple_obj->size; i++)
+                cjson_tuple_set_move(copy, i, cjson_document_clone(doc, tuple_obj->values[i]));
+            return copy;
+        }
+        case jstype_map: {
+            struct jsobj_map* map_obj = _obj2inst_m(obj);
+            copy = cjson_document_make_map(doc);
+            cjson_map_reserve(copy, map_obj->size);
+            for (i=0; i<map_obj->size; i++)
+                cjson_map_put_move(copy, cjson_document_clone(doc, map_obj->pairs[i]->values[0]),
+                                   cjson_document_clone(doc, map_obj->pairs[i]->values[1]));
+            return copy;
+        }
+        case jstype_rt:
+            break;
+    }
+    // kept by the document
+    return cjson_document_adopt(doc, cjson_clone(obj));
+}
+
 struct jsobj* cjson_clone(struct jsobj* obj)
 {
     if (obj == NULL) return cjson_make_nil();
+    if (obj->document == &cjson_static_document) return obj;
     switch(obj->type)
     {
         case jstype_nil: return cjson_clone_nil(_obj2inst_n(obj));
@@ -145,7 +465,11 @@ int cjson_compare(struct jsobj* obj0, struct jsobj* obj1)
         {
             case jstype_nil: return 0;
             case jstype_bool: return _obj2bool(obj0) - _obj2bool(obj1);
-            case jstype_int: return _obj2int(obj0) - _obj2int(obj1);
+            case jstype_int: {
+                int64 i0 = _obj2int(obj0);
+                int64 i1 = _obj2int(obj1);
+                return i0==i1?0:i0>i1?1:-1;
+            }
             case jstype_double: {
                 double d0 = _obj2double(obj0);
                 double d1 = _obj2double(obj1);
@@ -166,30 +490,74 @@ int cjson_compare(struct jsobj* obj0, struct jsobj* obj1)
     }
 }
 
+static inline unsigned int cjson_hash_mix(unsigned int hash, unsigned int value)
+{
+    hash ^= value + 0x9E3779B9U + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+unsigned int cjson_hash(struct jsobj* obj)
+{
+    unsigned int hash, i;
+
+    if (obj == NULL) return 0;
+    hash = (unsigned int)obj->type;
+    switch(obj->type)
+    {
+        case jstype_nil: return hash;
+        case jstype_bool: return cjson_hash_mix(hash, _obj2bool(obj) ? 1 : 0);
+        case jstype_int: return cjson_hash_mix(cjson_hash_mix(hash, (unsigned int)_obj2int(obj)),
+                                               (unsigned int)((uint64)_obj2int(obj) >> 32));
+        case jstype_double: {
+            double d = _obj2double(obj);
+            unsigned int words[2];
+            if (d == 0) d = 0;              // -0 == 0
+            memcpy(words, &d, sizeof(words));
+            return cjson_hash_mix(cjson_hash_mix(hash, words[0]), words[1]);
+        }
+        case jstype_string: return _obj2inst_s(obj)->hash;         // FNV-1a, set at creation
+        case jstype_array: {
+            struct jsobj_array* array_obj = _obj2inst_a(obj);
+            for (i=0; i<array_obj->size; i++) hash = cjson_hash_mix(hash, cjson_hash(array_obj->values[i]));
+            return hash;
+        }
+        case jstype_tuple: {
+            struct jsobj_tuple* tuple_obj = _obj2inst_t(obj);
+            for (i=0; i<tuple_obj->size; i++) hash = cjson_hash_mix(hash, cjson_hash(tuple_obj->values[i]));
+            return hash;
+        }
+        case jstype_map:
+            // maps with the same keys in any order are equal
+            return cjson_hash_mix(hash, _obj2inst_m(obj)->size);
+        case jstype_rt:
+            return hash;
+    }
+    return hash;
+}
+
 /// ========== nil ==========
 
+struct jsobj* cjson_document_make_nil(struct cjson_document* doc)
+{
+    (void)doc;
+    return &cjson_static_nil.base;
+}
+
 struct jsobj* cjson_make_nil(void)
 {
-    struct jsobj_nil* obj = cjson_memory_allocate(sizeof(*obj));
-    obj->base = (struct jsobj) {
-        .type = jstype_nil,
-        .should_copy = 0,
-        .reference_count = 1,
-        .wrapper = NULL,
-        .this = NULL,
-    };
-    return &(obj->base);
+    return cjson_document_make_nil(NULL);
 }
 
 struct jsobj* cjson_clone_nil(struct jsobj_nil* nil_obj)
 {
-    // TO-DO: use only one nil instance
+    (void)nil_obj;
     return cjson_make_nil();
 }
 
 enum jserr cjson_release_nil(struct jsobj_nil* nil_obj)
 {
     if (nil_obj==NULL) return jserr_invalid_args;
+    if (nil_obj->base.document) return jserr_no_error;
     if ((--nil_obj->base.reference_count) <= 0)
         cjson_memory_release(nil_obj);
     return jserr_no_error;
@@ -198,18 +566,15 @@ enum jserr cjson_release_nil(struct jsobj_nil* nil_obj)
 
 /// ========== bool ==========
 
+struct jsobj* cjson_document_make_bool(struct cjson_document* doc, bool value)
+{
+    (void)doc;
+    return &cjson_static_bools[value ? 1 : 0].base;
+}
+
 struct jsobj* cjson_make_bool(bool value)
 {
-    struct jsobj_bool* obj = cjson_memory_allocate(sizeof(*obj));
-    obj->base = (struct jsobj) {
-            .type = jstype_bool,
-            .should_copy = 0,
-            .reference_count = 1,
-            .wrapper = NULL,
-            .this = NULL,
-    };
-    obj->value = value;
-    return &(obj->base);
+    return cjson_document_make_bool(NULL, value);
 }
 
 struct jsobj* cjson_clone_bool(struct jsobj_bool* bool_obj)
@@ -221,6 +586,7 @@ struct jsobj* cjson_clone_bool(struct jsobj_bool* bool_obj)
 enum jserr cjson_release_bool(struct jsobj_bool* bool_obj)
 {
     if (bool_obj==NULL) return jserr_invalid_args;
+    if (bool_obj->base.document) return jserr_no_error;
     if ((--bool_obj->base.reference_count) <= 0)
         cjson_memory_release(bool_obj);
     return jserr_no_error;
@@ -229,13 +595,18 @@ enum jserr cjson_release_bool(struct jsobj_bool* bool_obj)
 
 /// ========== int ==========
 
-struct jsobj* cjson_make_int(int value)
+struct jsobj* cjson_document_make_int(struct cjson_document* doc, int64 value)
 {
-    struct jsobj_int* obj = cjson_memory_allocate(sizeof(*obj));
+    // unsigned difference, value - CJSON_SMALL_INT_MIN overflows near INT64_MAX
+    uint64 index = (uint64)value - (uint64)CJSON_SMALL_INT_MIN;
+    if (index < CJSON_SMALL_INT_COUNT) return &cjson_static_ints[index].base;
+
+    struct jsobj_int* obj = cjson_document_allocate(doc, sizeof(*obj));
     obj->base = (struct jsobj) {
         .type = jstype_int,
         .should_copy = 0,
         .reference_count = 1,
+        .document = doc,
         .wrapper = NULL,
         .this = NULL,
     };
@@ -243,14 +614,30 @@ struct jsobj* cjson_make_int(int value)
     return &(obj->base);
 }
 
+struct jsobj* cjson_make_int(int64 value)
+{
+    return cjson_document_make_int(NULL, value);
+}
+
+// decimal or 0x hex text as an int or a double, 0 when it is not a number
+static boolean cjson_number_from_string(const char* string, int64* i, double* d)
+{
+    boolean integer = true;
+    const char* digits = string + (string[0] == '-');
+
+    *i = 0;
+    if (digits[0] == '0' && digits[1] == 'x') *i = (int64)strtoull(string, NULL, 16);
+    else if (dyj_parse_number(string, string + strlen(string), &integer, i, d) == 0) integer = true;
+    return integer;
+}
+
 struct jsobj* cjson_make_int_from_string(char* string)
 {
+    int64 i;
+    double d;
+
     if (string==NULL) return cjson_make_nil();
-    char* buf = plat_mem_allocate(strlen(string));
-    plat_mem_copy(buf, string, strlen(string));
-    int v = (int)strtol(buf, NULL, 0);
-    free(buf);
-    return cjson_make_int(v);
+    return cjson_make_int(cjson_number_from_string(string, &i, &d) ? i : (int64)d);
 }
 
 struct jsobj* cjson_clone_int(struct jsobj_int* int_obj)
@@ -262,6 +649,7 @@ struct jsobj* cjson_clone_int(struct jsobj_int* int_obj)
 enum jserr cjson_release_int(struct jsobj_int* int_obj)
 {
     if (int_obj==NULL) return jserr_invalid_args;
+    if (int_obj->base.document) return jserr_no_error;
     if ((--int_obj->base.reference_count) <= 0)
         cjson_memory_release(int_obj);
     return jserr_no_error;
@@ -269,13 +657,14 @@ enum jserr cjson_release_int(struct jsobj_int* int_obj)
 
 /// ========== double ==========
 
-struct jsobj* cjson_make_double(double value)
+struct jsobj* cjson_document_make_double(struct cjson_document* doc, double value)
 {
-    struct jsobj_double* obj = cjson_memory_allocate(sizeof(*obj));
+    struct jsobj_double* obj = cjson_document_allocate(doc, sizeof(*obj));
     obj->base = (struct jsobj) {
             .type = jstype_double,
             .should_copy = 0,
             .reference_count = 1,
+            .document = doc,
             .wrapper = NULL,
             .this = NULL,
     };
@@ -283,9 +672,18 @@ struct jsobj* cjson_make_double(double value)
     return &(obj->base);
 }
 
+struct jsobj* cjson_make_double(double value)
+{
+    return cjson_document_make_double(NULL, value);
+}
+
 struct jsobj* cjson_make_double_from_string(char* string)
 {
-    return cjson_make_double(strtod(string, NULL));
+    int64 i;
+    double d;
+
+    if (string==NULL) return cjson_make_nil();
+    return cjson_make_double(cjson_number_from_string(string, &i, &d) ? (double)i : d);
 }
 
 struct jsobj* cjson_clone_double(struct jsobj_double* double_obj)
@@ -297,28 +695,78 @@ struct jsobj* cjson_clone_double(struct jsobj_double* double_obj)
 enum jserr cjson_release_double(struct jsobj_double* double_obj)
 {
     if (double_obj==NULL) return jserr_invalid_args;
+    if (double_obj->base.document) return jserr_no_error;
     if ((--double_obj->base.reference_count) <= 0)
         cjson_memory_release(double_obj);
     return jserr_no_error;
 }
 
+unsigned int cjson_format_number(struct jsobj* number, char* buffer)
+{
+    char digits[21];
+    unsigned int n = sizeof(digits), size;
+    uint64 value;
+
+    if (number == NULL || buffer == NULL) return 0;
+    if (number->type == jstype_double)
+    {
+        double d = _obj2double(number);
+        if (d != d || d - d != 0) return 0;     // NaN or infinity
+        return dyj_format_double(d, buffer);
+    }
+    if (number->type != jstype_int) return 0;
+
+    value = _obj2int(number) < 0 ? 0 - (uint64)_obj2int(number) : (uint64)_obj2int(number);
+    do
+    {
+        digits[--n] = (char)('0' + value%10);
+        value /= 10;
+    } while (value);
+    if (_obj2int(number) < 0) digits[--n] = '-';
+    size = (unsigned int)sizeof(digits) - n;
+    plat_mem_copy(buffer, digits + n, size);
+    buffer[size] = 0;
+    return size;
+}
+
 /// ============= string ================
-struct jsobj* cjson_make_string(char *value)
+struct jsobj* cjson_document_make_string(struct cjson_document* doc, const char *value)
 {
-    unsigned int len = ((value==NULL)?0:strlen(value)) + 1;
-    struct jsobj_string* obj = cjson_memory_allocate(sizeof(*obj));
+    if (value==NULL) return &cjson_static_empty_string.base;
+    return cjson_document_make_string_size(doc, value, strlen(value));
+}
+
+struct jsobj* cjson_document_make_string_size(struct cjson_document* doc, const char *value, unsigned int size)
+{
+    if (value==NULL || size==0) return &cjson_static_empty_string.base;
+    if (size==0xFFFFFFFFU) return NULL;
+
+    struct jsobj_string* obj = cjson_document_allocate(doc, sizeof(*obj));
+    if (obj==NULL) return NULL;
     obj->base = (struct jsobj) {
             .type = jstype_string,
             .should_copy = 0,
             .reference_count = 1,
+            .document = doc,
             .wrapper = NULL,
             .this = NULL,
     };
-    obj->value = cjson_memory_allocate(len);
-    strncpy(obj->value, value, len);
+    obj->value = cjson_document_allocate(doc, size + 1);      // zeroed, ends with NUL
+    if (obj->value==NULL)
+    {
+        if (doc==NULL) cjson_memory_release(obj);
+        return NULL;
+    }
+    cjson_memory_copy(obj->value, (void*)value, size);
+    obj->hash = cjson_hash_string(obj->value);                  // while the node is private
     return &(obj->base);
 }
 
+struct jsobj* cjson_make_string(char *value)
+{
+    return cjson_document_make_string(NULL, value);
+}
+
 struct jsobj* cjson_clone_string(struct jsobj_string* string_obj)
 {
     if (string_obj == NULL) return cjson_make_nil();
@@ -328,6 +776,7 @@ struct jsobj* cjson_clone_string(struct jsobj_string* string_obj)
 enum jserr cjson_release_string(struct jsobj_string* string_obj)
 {
     if (string_obj==NULL) return jserr_invalid_args;
+    if (string_obj->base.document) return jserr_no_error;
     if ((--string_obj->base.reference_count) <= 0) {
         cjson_memory_release(string_obj->value);
         cjson_memory_release(string_obj);
@@ -337,23 +786,29 @@ enum jserr cjson_release_string(struct jsobj_string* string_obj)
 
 /// ========== array ==========
 
-struct jsobj* cjson_make_array(void)
+struct jsobj* cjson_document_make_array(struct cjson_document* doc)
 {
-    const unsigned int capacity = 16;
-    struct jsobj_array* obj = cjson_memory_allocate(sizeof(*obj));
+    const unsigned int capacity = doc ? CJSON_DOCUMENT_CAPACITY : 16;
+    struct jsobj_array* obj = cjson_document_allocate(doc, sizeof(*obj));
     obj->base = (struct jsobj) {
             .type = jstype_array,
             .should_copy = 0,
             .reference_count = 1,
+            .document = doc,
             .wrapper = NULL,
             .this = NULL,
     };
-    obj->values = cjson_memory_allocate(sizeof(obj->values[0]) * capacity);
+    obj->values = cjson_document_allocate(doc, sizeof(obj->values[0]) * capacity);
     obj->capacity = capacity;
     obj->size = 0;
     return &(obj->base);
 }
 
+struct jsobj* cjson_make_array(void)
+{
+    return cjson_document_make_array(NULL);
+}
+
 struct jsobj* cjson_clone_array(struct jsobj_array* array_obj)
 {
     if (array_obj == NULL) return cjson_make_nil();
@@ -401,27 +856,44 @@ enum jserr cjson_array_add_object(struct jsobj* array, struct jsobj* value)
         return jserr_invalid_args;
     }
 
+    return cjson_array_push_move(array, cjson_clone(value));
+}
+
+enum jserr cjson_array_push_move(struct jsobj* array, struct jsobj* value)
+{
+    if (array==NULL || array->type!=jstype_array) {
+        cjson_release(value);
+        return jserr_invalid_args;
+    }
+
     struct jsobj_array* obj = _obj2inst(array, struct jsobj_array);
 
-    if (obj->size+1 >= obj->capacity)
+    if (obj->size+1 > obj->capacity &&
+        cjson_array_reserve(array, cjson_memory_grown(obj->capacity)) != jserr_no_error)
     {
-        const unsigned int capacity = 16 + obj->capacity;
-        struct jsobj** values = cjson_memory_allocate(sizeof(values[0]) * capacity);
-        if (values==NULL) return jserr_no_memory;
-        cjson_memory_copy(values, obj->values, sizeof(values[0]) * obj->capacity);
-        cjson_memory_release(obj->values);
-        obj->values = values;
-        obj->capacity = capacity;
+        cjson_release(value);
+        return jserr_no_memory;
     }
 
-    obj->values[obj->size++] = cjson_clone(value);
+    obj->values[obj->size++] = cjson_document_adopt(array->document, value);
 
     return jserr_no_error;
 }
 
+enum jserr cjson_array_reserve(struct jsobj* array, unsigned int capacity)
+{
+    if (array==NULL || array->type!=jstype_array) {
+        return jserr_invalid_args;
+    }
+
+    struct jsobj_array* obj = _obj2inst_a(array);
+    return cjson_memory_reserve(array->document, (void**)&obj->values, sizeof(obj->values[0]), obj->size, &obj->capacity, capacity);
+}
+
 enum jserr cjson_release_array(struct jsobj_array* array_obj)
 {
     if (array_obj==NULL) return jserr_invalid_args;
+    if (array_obj->base.document) return jserr_no_error;
 
     if ((--array_obj->base.reference_count) <= 0)
     {
@@ -438,26 +910,32 @@ enum jserr cjson_release_array(struct jsobj_array* array_obj)
 }
 
 /// ========== tuple =========
-struct jsobj* cjson_make_tuple(unsigned int size)
+struct jsobj* cjson_document_make_tuple(struct cjson_document* doc, unsigned int size)
 {
     unsigned int i;
-    struct jsobj_tuple* obj = cjson_memory_allocate(sizeof(*obj));
+    struct jsobj_tuple* obj = cjson_document_allocate(doc, sizeof(*obj));
     obj->base = (struct jsobj) {
             .type = jstype_tuple,
             .should_copy = 0,
             .reference_count = 1,
+            .document = doc,
             .wrapper = NULL,
             .this = NULL,
     };
-    obj->values = cjson_memory_allocate(sizeof(obj->values[0]) * size);
+    obj->values = cjson_document_allocate(doc, sizeof(obj->values[0]) * size);
     obj->size = size;
     for (i=0; i<size; i++)
     {
-        obj->values[i] = cjson_make_nil();
+        obj->values[i] = cjson_document_make_nil(doc);
     }
     return &(obj->base);
 }
 
+struct jsobj* cjson_make_tuple(unsigned int size)
+{
+    return cjson_document_make_tuple(NULL, size);
+}
+
 struct jsobj* cjson_clone_tuple(struct jsobj_tuple* tuple_obj)
 {
     if (tuple_obj==NULL) return cjson_make_nil();
@@ -498,25 +976,40 @@ enum jserr cjson_tuple_set_object(struct jsobj* tuple, unsigned int index, struc
 {
     if (tuple==NULL || tuple->type!=jstype_tuple) return jserr_invalid_args;
 
+    return cjson_tuple_set_move(tuple, index, cjson_clone(value));
+}
+
+enum jserr cjson_tuple_set_move(struct jsobj* tuple, unsigned int index, struct jsobj* value)
+{
+    if (tuple==NULL || tuple->type!=jstype_tuple) {
+        cjson_release(value);
+        return jserr_invalid_args;
+    }
+
     struct jsobj_tuple* obj = _obj2inst_t(tuple);
 
     if (index >= obj->size)
     {
         unsigned int i;
-        struct jsobj** values = cjson_memory_allocate(sizeof(obj->values[0]) * (index+1));
-        plat_mem_copy(values, obj->values, sizeof(obj->values[0]) * obj->size);
+        struct jsobj** values = cjson_document_allocate(tuple->document, sizeof(obj->values[0]) * (index+1));
+        if (values==NULL)
+        {
+            cjson_release(value);
+            return jserr_no_memory;
+        }
+        cjson_memory_copy(values, obj->values, sizeof(obj->values[0]) * obj->size);
         for (i=obj->size; i<index+1; i++)
         {
-            values[i] = cjson_make_nil();
+            values[i] = cjson_document_make_nil(tuple->document);
         }
-        plat_mem_release(obj->values);
+        cjson_document_deallocate(tuple->document, obj->values);
         obj->values = values;
         obj->size = index+1;
     }
 
     struct jsobj* oldone = obj->values[index];  // avoid to release the same one
-    obj->values[index] = cjson_clone(value);
-    cjson_release(oldone);
+    obj->values[index] = cjson_document_adopt(tuple->document, value);
+    cjson_release_child(tuple, oldone);
 
     return jserr_no_error;
 }
@@ -539,6 +1032,7 @@ struct jsobj* cjson_tuple_get_object(struct jsobj* tuple, unsigned int index)
 enum jserr cjson_release_tuple(struct jsobj_tuple* tuple_obj)
 {
     if (tuple_obj==NULL) return jserr_invalid_args;
+    if (tuple_obj->base.document) return jserr_no_error;
 
     if ((--tuple_obj->base.reference_count) <= 0)
     {
@@ -556,23 +1050,31 @@ enum jserr cjson_release_tuple(struct jsobj_tuple* tuple_obj)
 
 /// ========== map ==========
 
-struct jsobj* cjson_make_map(void)
+struct jsobj* cjson_document_make_map(struct cjson_document* doc)
 {
-    const unsigned int capacity = 16;
-    struct jsobj_map* obj = cjson_memory_allocate(sizeof(*obj));
+    const unsigned int capacity = doc ? CJSON_DOCUMENT_CAPACITY : 16;
+    struct jsobj_map* obj = cjson_document_allocate(doc, sizeof(*obj));
     obj->base = (struct jsobj) {
             .type = jstype_map,
             .should_copy = 0,
             .reference_count = 1,
+            .document = doc,
             .wrapper = NULL,
             .this = NULL,
     };
-    obj->pairs = cjson_memory_allocate(sizeof(obj->pairs[0]) * capacity);
+    obj->pairs = cjson_document_allocate(doc, sizeof(obj->pairs[0]) * capacity);
     obj->capacity = capacity;
     obj->size = 0;
+    obj->index_capacity = 2 * capacity;
+    obj->index = cjson_document_allocate(doc, sizeof(obj->index[0]) * obj->index_capacity);
     return &(obj->base);
 }
 
+struct jsobj* cjson_make_map(void)
+{
+    return cjson_document_make_map(NULL);
+}
+
 struct jsobj* cjson_clone_map(struct jsobj_map* map_obj)
 {
     if (map_obj==NULL) return cjson_make_nil();
@@ -589,6 +1091,10 @@ struct jsobj* cjson_clone_map(struct jsobj_map* map_obj)
     obj->pairs = cjson_memory_allocate(sizeof(obj->pairs[0]) * capacity);
     obj->capacity = capacity;
     obj->size = map_obj->size;
+    // same pair positions, the index is copied as is
+    obj->index_capacity = map_obj->index_capacity;
+    obj->index = cjson_memory_allocate(sizeof(obj->index[0]) * obj->index_capacity);
+    cjson_memory_copy(obj->index, map_obj->index, sizeof(obj->index[0]) * obj->index_capacity);
 
     unsigned int i;
     for (i=0; i<map_obj->size; i++)
@@ -599,19 +1105,67 @@ struct jsobj* cjson_clone_map(struct jsobj_map* map_obj)
     return &(obj->base);
 }
 
-int cjson_compare_map(struct jsobj_map* map0, struct jsobj_map* map1)
+// slot of key in the index: its pair, or the empty slot where it would be added
+static unsigned int cjson_map_find(struct jsobj_map* obj, struct jsobj* key, unsigned int hash)
+{
+    unsigned int mask = obj->index_capacity - 1;
+    unsigned int slot = hash & mask;
+
+    while (obj->index[slot])
+    {
+        struct jsobj_tuple* pair = obj->pairs[obj->index[slot]-1];
+        if (key == pair->values[0] || cjson_compare(key, pair->values[0]) == 0) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static enum jserr cjson_map_rehash(struct jsobj_map* obj, unsigned int index_capacity)
+{
+    unsigned int* index = cjson_document_allocate(obj->base.document, sizeof(index[0]) * index_capacity);
+    unsigned int i, slot;
+
+    if (index==NULL) return jserr_no_memory;
+    cjson_document_deallocate(obj->base.document, obj->index);
+    obj->index = index;
+    obj->index_capacity = index_capacity;
+    for (i=0; i<obj->size; i++)
+    {
+        slot = cjson_map_find(obj, obj->pairs[i]->values[0], cjson_hash(obj->pairs[i]->values[0]));
+        obj->index[slot] = i+1;
+    }
+    return jserr_no_error;
+}
+
+// smallest key of map0 that is not in map1, NULL if there is none
+static struct jsobj* cjson_map_smallest_missing(struct jsobj_map* map0, struct jsobj_map* map1)
 {
+    struct jsobj* smallest = NULL;
     unsigned int i;
 
-    for (i=0; i<map0->size && i<map1->size; i++)
+    // pairs are in insertion order, look the keys up
+    for (i=0; i<map0->size; i++)
     {
-        int r = cjson_compare(cjson_tuple_get_object(&map0->pairs[i]->base,0), cjson_tuple_get_object(&map1->pairs[i]->base,0));
-        if (r!=0) return r;
+        struct jsobj* key = map0->pairs[i]->values[0];
+        if (cjson_map_get(&map1->base, key) != NULL) continue;
+        if (smallest == NULL || cjson_compare(key, smallest) < 0) smallest = key;
     }
+    return smallest;
+}
+
+int cjson_compare_map(struct jsobj_map* map0, struct jsobj_map* map1)
+{
+    struct jsobj *missing0, *missing1;
 
-    if (map0->size == map1->size) return 0;
     if (map0->size > map1->size) return 1;
-    else return -1;
+    if (map0->size < map1->size) return -1;
+
+    // as if the keys were sorted: the map holding the smallest key that the other one lacks
+    // is the smaller one
+    missing0 = cjson_map_smallest_missing(map0, map1);
+    if (missing0 == NULL) return 0;
+    missing1 = cjson_map_smallest_missing(map1, map0);
+    return cjson_compare(missing0, missing1) < 0 ? -1 : 1;
 }
 
 enum jserr cjson_map_add_pair(struct jsobj *map, struct jsobj *key, struct jsobj *value)
@@ -619,68 +1173,94 @@ enum jserr cjson_map_add_pair(struct jsobj *map, struct jsobj *key, struct jsobj
     if (map==NULL || map->type!=jstype_map)
         return jserr_invalid_args;
 
-    struct jsobj_map* obj = _obj2inst(map, struct jsobj_map);
+    return cjson_map_put_move(map, cjson_clone(key), cjson_clone(value));
+}
 
-    int s = 0, e = obj->size, m = 0;
-    int r = 0;
+// takes pair, a tuple of (key, value)
+static enum jserr cjson_map_put_tuple(struct jsobj_map* obj, struct jsobj_tuple* pair)
+{
+    struct jsobj* key = pair->values[0];
+    unsigned int hash = cjson_hash(key);
+    unsigned int slot = cjson_map_find(obj, key, hash);
 
-    while (s < e)
+    if (obj->index[slot])
     {
-        m = (s+e) >> 1;
-        r = cjson_compare(key, cjson_tuple_get_object(&obj->pairs[m]->base,0));
-        if (r > 0)
-        {
-            e = m-1;
-        }
-        else if (r < 0)
-        {
-            s = m+1;
-        }
-        else break;
-    }
-
-    if (s >= e)
-    {
-        // insert at s
-        if (obj->size+1 > obj->capacity) {
-            // create more space
-            unsigned int capacity = obj->capacity+16;
-            struct jsobj_tuple** pairs = cjson_memory_allocate(sizeof(pairs[0]) * capacity);
-            if (pairs==NULL) return jserr_no_memory;
-            if (s>0) cjson_memory_copy(pairs, obj->pairs, sizeof(pairs[0])*(s-1));
-            pairs[s] = _obj2inst_t(cjson_make_tuple(2));
-            cjson_tuple_set_object(&pairs[s]->base, 0, key);
-            cjson_tuple_set_object(&pairs[s]->base, 1, value);
-            if (s<obj->size) cjson_memory_copy(&pairs[s+1], &obj->pairs[s], sizeof(pairs[0])*(obj->size-s));
-            cjson_memory_release(obj->pairs);
-            obj->pairs = pairs;
-            obj->capacity = capacity;
-        } else {
-            if (s<obj->size) cjson_memory_move(&obj->pairs[s+1], &obj->pairs[s], sizeof(obj->pairs[0])*(obj->size-s));
-            obj->pairs[s] = _obj2inst_t(cjson_make_tuple(2));
-            cjson_tuple_set_object(&obj->pairs[s]->base, 0, key);
-            cjson_tuple_set_object(&obj->pairs[s]->base, 1, value);
-        }
-
-        obj->size++;
+        // replace, the pair keeps its position
+        unsigned int position = obj->index[slot]-1;
+        cjson_release_child(&obj->base, &obj->pairs[position]->base);
+        obj->pairs[position] = pair;
+        return jserr_no_error;
     }
-    else if (r==0)
+
+    if (obj->size+1 > obj->capacity || (obj->size+1)*2 > obj->index_capacity)
     {
-        // replace at m
-        cjson_release_tuple(obj->pairs[m]);
-        obj->pairs[m] = _obj2inst_t(cjson_make_tuple(2));
-        cjson_tuple_set_object(&obj->pairs[m]->base, 0, key);
-        cjson_tuple_set_object(&obj->pairs[m]->base, 1, value);
+        if (cjson_map_reserve(&obj->base, cjson_memory_grown(obj->size)) != jserr_no_error)
+        {
+            cjson_release_child(&obj->base, &pair->base);
+            return jserr_no_memory;
+        }
+        slot = cjson_map_find(obj, key, hash);
     }
-    else
+
+    obj->pairs[obj->size++] = pair;
+    obj->index[slot] = obj->size;
+
+    return jserr_no_error;
+}
+
+enum jserr cjson_map_put_move(struct jsobj *map, struct jsobj *key, struct jsobj *value)
+{
+    if (map==NULL || map->type!=jstype_map)
     {
-        // impossible case
-        return jserr_incorrect_map_alg;
+        cjson_release(key);
+        cjson_release(value);
+        return jserr_invalid_args;
     }
 
+    struct cjson_document* doc = map->document;
+    struct jsobj_tuple* pair = cjson_document_allocate(doc, sizeof(*pair));
+    pair->base = (struct jsobj) {
+            .type = jstype_tuple,
+            .should_copy = 0,
+            .reference_count = 1,
+            .document = doc,
+            .wrapper = NULL,
+            .this = NULL,
+    };
+    pair->values = cjson_document_allocate(doc, sizeof(pair->values[0]) * 2);
+    pair->size = 2;
+    pair->values[0] = cjson_document_intern(doc, cjson_document_adopt(doc, key));
+    pair->values[1] = cjson_document_adopt(doc, value);
+
+    return cjson_map_put_tuple(_obj2inst_m(map), pair);
+}
+
+enum jserr cjson_map_reserve(struct jsobj *map, unsigned int capacity)
+{
+    if (map==NULL || map->type!=jstype_map)
+        return jserr_invalid_args;
+
+    struct jsobj_map* obj = _obj2inst_m(map);
+    unsigned int index_capacity = obj->index_capacity;
+
+    if (capacity > 0x7FFFFFFFU / sizeof(obj->index[0]) ||
+        cjson_memory_reserve(map->document, (void**)&obj->pairs, sizeof(obj->pairs[0]), obj->size, &obj->capacity, capacity) != jserr_no_error)
+        return jserr_no_memory;
+    while (capacity*2 > index_capacity) index_capacity *= 2;
+    if (index_capacity != obj->index_capacity) return cjson_map_rehash(obj, index_capacity);
     return jserr_no_error;
 }
 
+struct jsobj* cjson_map_get(struct jsobj *map, struct jsobj *key)
+{
+    if (map==NULL || map->type!=jstype_map) return NULL;
+
+    struct jsobj_map* obj = _obj2inst_m(map);
+    unsigned int slot = cjson_map_find(obj, key, cjson_hash(key));
+
+    return obj->index[slot] ? obj->pairs[obj->index[slot]-1]->values[1] : NULL;
+}
+
 enum jserr cjson_map_add_tuple(struct jsobj *map, struct jsobj_tuple *pair)
 {
     if (map==NULL || map->type!=jstype_map || pair==NULL || pair->size!=2) {
@@ -690,9 +1270,21 @@ enum jserr cjson_map_add_tuple(struct jsobj *map, struct jsobj_tuple *pair)
     return cjson_map_add_pair(map, cjson_tuple_get_object(&pair->base, 0), cjson_tuple_get_object(&pair->base, 1));
 }
 
+enum jserr cjson_map_add_tuple_move(struct jsobj *map, struct jsobj_tuple *pair)
+{
+    if (map==NULL || map->type!=jstype_map || pair==NULL || pair->size!=2) {
+        if (pair) cjson_release_tuple(pair);
+        return jserr_invalid_args;
+    }
+
+    pair = _obj2inst_t(cjson_document_adopt(map->document, &pair->base));
+    return cjson_map_put_tuple(_obj2inst_m(map), pair);
+}
+
 enum jserr cjson_release_map(struct jsobj_map* map_obj)
 {
     if (map_obj==NULL) return jserr_invalid_args;
+    if (map_obj->base.document) return jserr_no_error;
 
     if ((--map_obj->base.reference_count) <= 0)
     {
@@ -702,6 +1294,7 @@ enum jserr cjson_release_map(struct jsobj_map* map_obj)
             cjson_release_tuple(map_obj->pairs[i]);
         }
         cjson_memory_release(map_obj->pairs);
+        cjson_memory_release(map_obj->index);
         cjson_memory_release(map_obj);
     }
 
@@ -719,7 +1312,8 @@ struct jsobj* cjson_make_runtime(void)
             .wrapper = NULL,
             .this = NULL,
     };
-    obj->code = cjson_make_array();
+    obj->source = cjson_document_create(0);
+    obj->code = cjson_document_make_array(obj->source);
     return &(obj->base);
 }
 
@@ -733,7 +1327,8 @@ struct jsobj* cjson_clone_runtime(struct jsobj_runtime* rt_obj)
             .wrapper = NULL,
             .this = NULL,
     };
-    obj->code = cjson_clone(rt_obj->code);
+    obj->source = cjson_document_create(0);
+    obj->code = cjson_document_clone(obj->source, rt_obj->code);
     return &(obj->base);
 }
 
@@ -762,6 +1357,7 @@ enum jserr cjson_release_runtime(struct jsobj_runtime* rt_obj)
 
     if ((--rt_obj->base.reference_count) <= 0) {
         cjson_release(rt_obj->code);
+        cjson_document_free(rt_obj->source);
         cjson_memory_release(rt_obj);
     }
 
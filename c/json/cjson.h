@@ -67,6 +67,11 @@ enum jserr
     jserr_no_source,
     jserr_invalid_args,
     jserr_incorrect_map_alg,
+    jserr_syntax_error,             // cjson_parser_error_offset tells where
+    jserr_too_deep,                 // containers nested deeper than the parser allows, or runtimes or sources stacked
+    jserr_bad_value,                // no JSON-dybuf form: NaN, infinity, runtime, map key that is not a string
+    jserr_bad_dybuf,                // malformed or unsupported JSON-dybuf document
+    jserr_import_cycle,             // import of a resource that is on the source stack
 };
 
 enum jstype
@@ -93,11 +98,14 @@ enum jstype
     jstype_rt           = 0x900,          // runtime, environment
 };
 
+struct cjson_document;
+
 struct jsobj
 {
     enum jstype type;
     unsigned int should_copy:1;
     unsigned int reference_count;
+    struct cjson_document* document;  // arena of the node, NULL when it is reference counted
     struct jsobj * wrapper;           // belong to which closure
     struct jsobj * this;
 };
@@ -139,7 +147,7 @@ struct jsobj_bool
 struct jsobj_int
 {
     struct jsobj base;
-    int value;
+    int64 value;
 };
 
 struct jsobj_double
@@ -152,6 +160,7 @@ struct jsobj_string
 {
     struct jsobj base;
     char* value;
+    unsigned int hash;      // FNV-1a of value, set when the string is made
 };
 
 struct jsobj_array
@@ -172,18 +181,22 @@ struct jsobj_map
 {
     struct jsobj base;
     unsigned int capacity, size;
-    struct jsobj_tuple** pairs;
+    struct jsobj_tuple** pairs;         // (key, value) in insertion order
+    unsigned int index_capacity;        // power of 2, at most half full
+    unsigned int* index;                // open addressing, pair position+1, 0 is empty
 };
 
 struct jsobj_runtime
 {
     struct jsobj base;
     struct jsobj *code;
+    struct cjson_document* source;      // of the parsed code, freed with the runtime
 };
 
 
 struct jsobj* cjson_clone(struct jsobj* obj);
 int cjson_compare(struct jsobj* obj0, struct jsobj* obj1);
+unsigned int cjson_hash(struct jsobj* obj);         // equal objects have equal hashes
 struct jsobj* cjson_make(enum jstype type);
 enum jserr cjson_release(struct jsobj* obj);
 
@@ -195,7 +208,7 @@ struct jsobj* cjson_make_bool(bool value);
 struct jsobj* cjson_clone_bool(struct jsobj_bool* bool_obj);
 enum jserr cjson_release_bool(struct jsobj_bool* bool_obj);
 
-struct jsobj* cjson_make_int(int value);
+struct jsobj* cjson_make_int(int64 value);
 struct jsobj* cjson_make_int_from_string(char* string);
 struct jsobj* cjson_clone_int(struct jsobj_int* int_obj);
 enum jserr cjson_release_int(struct jsobj_int* int_obj);
@@ -205,6 +218,11 @@ struct jsobj* cjson_make_double_from_string(char* string);
 struct jsobj* cjson_clone_double(struct jsobj_double* double_obj);
 enum jserr cjson_release_double(struct jsobj_double* double_obj);
 
+// an int or double as JSON text, doubles with the shortest digits that read back (dyj_format_double);
+// returns the length, 0 for other values and non-finite doubles
+#define CJSON_NUMBER_BUFFER_SIZE    32
+unsigned int cjson_format_number(struct jsobj* number, char* buffer);
+
 struct jsobj* cjson_make_string(char *value);
 struct jsobj* cjson_clone_string(struct jsobj_string* string_obj);
 enum jserr cjson_release_string(struct jsobj_string* string_obj);
@@ -213,20 +231,27 @@ struct jsobj* cjson_make_array(void);
 struct jsobj* cjson_clone_array(struct jsobj_array* array_obj);
 int cjson_compare_array(struct jsobj_array* array0, struct jsobj_array* array1);
 enum jserr cjson_array_add_object(struct jsobj* array, struct jsobj* value);
+enum jserr cjson_array_push_move(struct jsobj* array, struct jsobj* value);    // takes value, not cloned, released on error
+enum jserr cjson_array_reserve(struct jsobj* array, unsigned int capacity);   // room for capacity values without growing
 enum jserr cjson_release_array(struct jsobj_array* array_obj);
 
 struct jsobj* cjson_make_tuple(unsigned int size);
 struct jsobj* cjson_clone_tuple(struct jsobj_tuple* tuple_obj);
 int cjson_compare_tuple(struct jsobj_tuple* tuple0, struct jsobj_tuple* tuple1);
 enum jserr cjson_tuple_set_object(struct jsobj* tuple, unsigned int index, struct jsobj* value);
+enum jserr cjson_tuple_set_move(struct jsobj* tuple, unsigned int index, struct jsobj* value);    // takes value
 struct jsobj* cjson_tuple_get_object(struct jsobj* tuple, unsigned int index);
 enum jserr cjson_release_tuple(struct jsobj_tuple* tuple_obj);
 
 struct jsobj* cjson_make_map(void);
 struct jsobj* cjson_clone_map(struct jsobj_map* map_obj);
-int cjson_compare_map(struct jsobj_map* map0, struct jsobj_map* map1);      // if two map have the same keys in all pairs, they are the same.
+int cjson_compare_map(struct jsobj_map* map0, struct jsobj_map* map1);      // if two map have the same keys in all pairs, they are the same, else ordered as sorted key lists.
 enum jserr cjson_map_add_pair(struct jsobj *map, struct jsobj *key, struct jsobj *value);
+enum jserr cjson_map_put_move(struct jsobj *map, struct jsobj *key, struct jsobj *value);   // takes key and value
+struct jsobj* cjson_map_get(struct jsobj *map, struct jsobj *key);          // NULL if key is not in map
+enum jserr cjson_map_reserve(struct jsobj *map, unsigned int capacity);     // room for capacity pairs without growing
 enum jserr cjson_map_add_tuple(struct jsobj *map, struct jsobj_tuple *pair);
+enum jserr cjson_map_add_tuple_move(struct jsobj *map, struct jsobj_tuple *pair);          // takes pair
 enum jserr cjson_release_map(struct jsobj_map* map_obj);
 
 struct jsobj* cjson_make_runtime(void);
@@ -235,6 +260,30 @@ int cjson_compare_runtime(struct jsobj_runtime* rt0, struct jsobj_runtime* rt1);
 enum jserr cjson_runtime_add_code_segment(struct jsobj* rt, struct jsobj* code_segment);
 enum jserr cjson_release_runtime(struct jsobj_runtime* rt_obj);
 
+/*
+ * Documents, nodes made in a document are allocated from its chunks and freed all at once
+ * by cjson_document_free, cjson_release does nothing for them. Objects moved into a document
+ * container are kept until the document is freed, nodes of a document moved into another
+ * container are copied.
+ *
+ * nil, true, false, "" and ints from -128 to 383 are immortal shared nodes, in and out of
+ * documents. They must not be changed.
+ */
+struct cjson_document* cjson_document_create(unsigned int chunk_size);     // 0: default chunk size
+struct jsobj* cjson_document_make_nil(struct cjson_document* doc);        // doc NULL: cjson_make_*
+struct jsobj* cjson_document_make_bool(struct cjson_document* doc, bool value);
+struct jsobj* cjson_document_make_int(struct cjson_document* doc, int64 value);
+struct jsobj* cjson_document_make_double(struct cjson_document* doc, double value);
+struct jsobj* cjson_document_make_string(struct cjson_document* doc, const char *value);
+struct jsobj* cjson_document_make_string_size(struct cjson_document* doc, const char *value, unsigned int size);  // value need not end with NUL
+struct jsobj* cjson_document_make_array(struct cjson_document* doc);
+struct jsobj* cjson_document_make_tuple(struct cjson_document* doc, unsigned int size);
+struct jsobj* cjson_document_make_map(struct cjson_document* doc);
+struct jsobj* cjson_document_clone(struct cjson_document* doc, struct jsobj* obj);
+enum jserr cjson_document_intern_keys(struct cjson_document* doc);      // map keys with the same text share one node
+struct jsobj* cjson_document_make_key(struct cjson_document* doc, const char* value);  // the shared node if interned
+void cjson_document_free(struct cjson_document* doc);
+
 // debug
 void cjson_memory_profile(void** alloc_record, unsigned int* alloc_idx, void** release_record, unsigned int* release_idx, unsigned int size);
 
@@ -0,0 +1,439 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Writing is two passes like dyj_encode: the first collects the dictionaries, the member
+ * keys and the payload size, the second writes the header and the payload straight to out.
+ * Reading walks the payload records with the record readers of dyjson, the ones dyj_decode
+ * and dyj_emit_text use, and makes cjson nodes instead.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "plat_mem.h"
+#include "dyjson_private.h"
+#include "cjson_dybuf.h"
+
+/// ============= cjson -> JSON-dybuf
+
+// typdex of obj as written, ints outside the safe range are doubles
+static uint8 cjson_dybuf_typdex(struct jsobj* obj)
+{
+    if (obj==NULL) return typdex_typ_none;
+    switch (obj->type)
+    {
+        case jstype_bool: return typdex_typ_bool;
+        case jstype_int:
+        {
+            int64 value = _obj2int(obj);
+            if (value < DYJ_MIN_SAFE_INTEGER || value > DYJ_MAX_SAFE_INTEGER) return typdex_typ_double;
+            return value < 0 ? typdex_typ_int : typdex_typ_uint;
+        }
+        case jstype_double: return typdex_typ_double;
+        case jstype_string: return typdex_typ_string;
+        case jstype_array:
+        case jstype_tuple: return typdex_typ_array;
+        case jstype_map: return typdex_typ_map;
+        default: return typdex_typ_none;
+    }
+}
+
+static inline boolean cjson_dybuf_is_container(struct jsobj* obj)
+{
+    return obj != NULL && (obj->type == jstype_array || obj->type == jstype_tuple || obj->type == jstype_map);
+}
+
+static inline struct jsobj** cjson_dybuf_items(struct jsobj* obj, unsigned int* size)
+{
+    if (obj->type == jstype_array)
+    {
+        *size = _obj2inst_a(obj)->size;
+        return _obj2inst_a(obj)->values;
+    }
+    *size = _obj2inst_t(obj)->size;
+    return _obj2inst_t(obj)->values;
+}
+
+// pass 1, like dyj_encode_collect
+static enum dyj_err cjson_dybuf_collect(dyj_encoder* enc, struct jsobj* obj, uint node, uint index, uint depth)
+{
+    enum dyj_err err;
+    struct jsobj** values;
+    unsigned int size, i, id, child = DYJ_NONE;
+    uint8 type = cjson_dybuf_typdex(obj);
+
+    enc->payload_size += dyj_typdex_size(type, index);
+    if (obj==NULL) return dyj_err_none;
+    switch (obj->type)
+    {
+        case jstype_nil:
+            return dyj_err_none;
+        case jstype_bool:
+            enc->payload_size += 1;
+            return dyj_err_none;
+        case jstype_int:
+            if (type == typdex_typ_double) enc->payload_size += 8;
+            else if (type == typdex_typ_int) enc->payload_size += dyj_var_s64_size(_obj2int(obj));
+            else enc->payload_size += dyj_var_u64_size((uint64)_obj2int(obj));
+            return dyj_err_none;
+        case jstype_double:
+            if (!isfinite(_obj2double(obj))) return dyj_err_non_finite;
+            enc->payload_size += 8;
+            return dyj_err_none;
+        case jstype_string:
+            size = (unsigned int)strlen(_obj2string(obj));
+            enc->payload_size += dyj_var_u64_size(size) + size;
+            return dyj_err_none;
+        case jstype_array:
+        case jstype_tuple:
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            values = cjson_dybuf_items(obj, &size);
+            enc->payload_size += dyj_var_u64_size(size);
+            for (i=0; i<size; i++)
+            {
+                if (cjson_dybuf_is_container(values[i]) && child == DYJ_NONE)
+                {
+                    child = dyj_dicts_array_child(&enc->dicts, node);
+                    if (child == DYJ_NONE) return dyj_err_no_memory;
+                }
+                if ((err = cjson_dybuf_collect(enc, values[i], child, 0, depth+1)) != dyj_err_none) return err;
+            }
+            return dyj_err_none;
+        case jstype_map:
+        {
+            struct jsobj_map* map = _obj2inst_m(obj);
+            unsigned int next_key = 0;
+
+            if (depth >= DYJ_MAX_DEPTH) return dyj_err_too_deep;
+            if (!dyj_dicts_ensure_dictionary(&enc->dicts, node)) return dyj_err_no_memory;
+            enc->payload_size += dyj_var_u64_size(map->size);
+            for (i=0; i<map->size; i++)
+            {
+                struct jsobj *key = map->pairs[i]->values[0], *value = map->pairs[i]->values[1];
+                const dyj_path_node* n = &enc->dicts.nodes[node];
+                const char* text;
+
+                if (key==NULL || key->type!=jstype_string) return dyj_err_bad_type;
+                text = _obj2string(key);
+                size = (unsigned int)strlen(text);
+                // maps of one path mostly repeat their keys in the same order, like dyj_write_key
+                id = DYJ_NONE;
+                if (next_key < n->key_count)
+                {
+                    const dyj_dict_key* k = &enc->dicts.keys[n->keys[next_key]];
+                    if (k->size == size && memcmp(k->data, text, size) == 0) id = n->keys[next_key];
+                }
+                if (id == DYJ_NONE)
+                {
+                    id = dyj_dicts_intern(&enc->dicts, node, text, size, dyj_hash_bytes(text, size));
+                    if (id == DYJ_NONE) return dyj_err_no_memory;
+                }
+                next_key = enc->dicts.keys[id].index+1;
+                if (!dyj_grow((void**)&enc->member_keys, &enc->member_capacity, enc->member_count+1, sizeof(uint)))
+                {
+                    return dyj_err_no_memory;
+                }
+                enc->member_keys[enc->member_count++] = id;
+                child = DYJ_NONE;
+                if (cjson_dybuf_is_container(value))
+                {
+                    child = dyj_dicts_child(&enc->dicts, node, enc->dicts.keys[id].index);
+                    if (child == DYJ_NONE) return dyj_err_no_memory;
+                }
+                err = cjson_dybuf_collect(enc, value, child, enc->dicts.keys[id].index, depth+1);
+                if (err != dyj_err_none) return err;
+            }
+            return dyj_err_none;
+        }
+        default:
+            return dyj_err_bad_type;
+    }
+}
+
+// pass 2, out holds the payload
+static void cjson_dybuf_write(dyj_encoder* enc, dybuf* out, struct jsobj* obj, uint node, uint index)
+{
+    struct jsobj** values;
+    unsigned int size, i, child = DYJ_NONE;
+    uint8 type = cjson_dybuf_typdex(obj);
+
+    dyb_append_typdex(out, type, index);
+    switch (type)
+    {
+        case typdex_typ_none:
+            break;
+        case typdex_typ_bool:
+            dyb_append_bool(out, _obj2bool(obj) != 0);
+            break;
+        case typdex_typ_int:
+            // zigzag, same bytes as dyb_append_var_s64 without shifting a negative value
+            dyb_append_var_u64(out, ((uint64)_obj2int(obj) << 1) ^ (uint64)(_obj2int(obj) >> 63));
+            break;
+        case typdex_typ_uint:
+            dyb_append_var_u64(out, (uint64)_obj2int(obj));
+            break;
+        case typdex_typ_double:
+            dyb_append_double(out, obj->type == jstype_int ? (double)_obj2int(obj) : _obj2double(obj));
+            break;
+        case typdex_typ_string:
+        {
+            const char* text = _obj2string(obj);
+            dyb_append_data_with_var_len(out, (uint8*)text, (uint)strlen(text));
+            break;
+        }
+        case typdex_typ_array:
+            values = cjson_dybuf_items(obj, &size);
+            dyb_append_var_u64(out, size);
+            for (i=0; i<size; i++)
+            {
+                if (cjson_dybuf_is_container(values[i]) && child == DYJ_NONE) child = enc->dicts.nodes[node].array_child;
+                cjson_dybuf_write(enc, out, values[i], child, 0);
+            }
+            break;
+        case typdex_typ_map:
+        {
+            struct jsobj_map* map = _obj2inst_m(obj);
+
+            dyb_append_var_u64(out, map->size);
+            for (i=0; i<map->size; i++)
+            {
+                struct jsobj* value = map->pairs[i]->values[1];
+                uint key_index = enc->dicts.keys[enc->member_keys[enc->member_cursor++]].index;
+                child = cjson_dybuf_is_container(value) ? enc->dicts.nodes[node].children[key_index] : DYJ_NONE;
+                cjson_dybuf_write(enc, out, value, child, key_index);
+            }
+            break;
+        }
+    }
+}
+
+enum jserr cjson_to_dybuf(struct jsobj* obj, dybuf* out)
+{
+    dyj_encoder enc;
+    enum dyj_err err;
+
+    if (obj==NULL || out==NULL) return jserr_invalid_args;
+    plat_mem_set(&enc, 0, sizeof(enc));
+    if (!dyj_dicts_init(&enc.dicts, null)) return jserr_no_memory;
+
+    err = cjson_dybuf_collect(&enc, obj, DYJ_ROOT_NODE, 0, 0);
+    if (err == dyj_err_none)
+    {
+        if (enc.payload_size > 0x7FFFFFFFU) err = dyj_err_no_memory;
+        else if (!dyj_out_reserve(out, dyj_dicts_header_size(&enc.dicts) + 1 + (uint)enc.payload_size)) err = dyj_err_no_memory;
+        else if (!dyj_dicts_write_header(&enc.dicts, DYJ_FORMAT_VERSION, out)) err = dyj_err_no_memory;
+    }
+    if (err == dyj_err_none)
+    {
+        dyb_append_typdex(out, typdex_typ_obj, 1);
+        cjson_dybuf_write(&enc, out, obj, DYJ_ROOT_NODE, 0);
+    }
+    dyj_encoder_release(&enc);
+
+    switch (err)
+    {
+        case dyj_err_none: return jserr_no_error;
+        case dyj_err_no_memory: return jserr_no_memory;
+        case dyj_err_too_deep: return jserr_too_deep;
+        case dyj_err_bad_type:
+        case dyj_err_non_finite: return jserr_bad_value;
+        default: return jserr_invalid_args;
+    }
+}
+
+/// ============= JSON-dybuf -> cjson
+
+struct cjson_dybuf_reader
+{
+    dyj_reader r;
+    dyj_dicts dicts;
+    struct cjson_document* doc;         // of the values, NULL: reference counted
+    struct jsobj** keys;                // doc: key node of each dictionary key, made when first used
+};
+
+static inline enum jserr cjson_dybuf_error(enum dyj_err err)
+{
+    return err == dyj_err_no_memory ? jserr_no_memory : jserr_bad_dybuf;
+}
+
+static enum jserr cjson_dybuf_read(struct cjson_dybuf_reader* reader, uint8 type, uint node, uint depth, struct jsobj** value);
+
+static enum jserr cjson_dybuf_read_array(struct cjson_dybuf_reader* reader, uint node, uint depth, struct jsobj** value)
+{
+    struct jsobj *array, *item;
+    enum jserr err = jserr_no_error;
+    enum dyj_err derr;
+    uint i, count, child = DYJ_NONE;
+    uint8 type;
+
+    if (depth >= DYJ_MAX_DEPTH) return jserr_too_deep;
+    if (!dyj_read_count(&reader->r, &count)) return jserr_bad_dybuf;
+    array = cjson_document_make_array(reader->doc);
+    if (array==NULL || cjson_array_reserve(array, count) != jserr_no_error)
+    {
+        cjson_release(array);
+        return jserr_no_memory;
+    }
+    for (i=0; i<count; i++)
+    {
+        if ((derr = dyj_read_item(&reader->r, &reader->dicts, node, &type, &child)) != dyj_err_none)
+        {
+            err = cjson_dybuf_error(derr);
+            break;
+        }
+        if ((err = cjson_dybuf_read(reader, type, child, depth+1, &item)) != jserr_no_error) break;
+        if ((err = cjson_array_push_move(array, item)) != jserr_no_error) break;
+    }
+    if (err != jserr_no_error)
+    {
+        cjson_release(array);
+        return err;
+    }
+    *value = array;
+    return jserr_no_error;
+}
+
+static enum jserr cjson_dybuf_read_map(struct cjson_dybuf_reader* reader, uint node, uint depth, struct jsobj** value)
+{
+    struct jsobj *map, *key, *item;
+    enum jserr err = jserr_no_error;
+    enum dyj_err derr;
+    uint i, count, child, id, stamp;
+    uint8 type;
+
+    if (depth >= DYJ_MAX_DEPTH) return jserr_too_deep;
+    if ((derr = dyj_read_object(&reader->r, &reader->dicts, node, &count, &stamp)) != dyj_err_none)
+    {
+        return cjson_dybuf_error(derr);
+    }
+    map = cjson_document_make_map(reader->doc);
+    if (map==NULL || cjson_map_reserve(map, count) != jserr_no_error)
+    {
+        cjson_release(map);
+        return jserr_no_memory;
+    }
+
+    for (i=0; i<count; i++)
+    {
+        const dyj_dict_key* k;
+
+        if ((derr = dyj_read_member(&reader->r, &reader->dicts, node, stamp, &type, &id, &child)) != dyj_err_none)
+        {
+            err = cjson_dybuf_error(derr);
+            break;
+        }
+        k = &reader->dicts.keys[id];
+        if (reader->keys == NULL) key = cjson_document_make_string_size(NULL, k->data, k->size);
+        else
+        {
+            if (reader->keys[id] == NULL) reader->keys[id] = cjson_document_make_key(reader->doc, k->data);
+            key = reader->keys[id];
+        }
+        if (key == NULL)
+        {
+            err = jserr_no_memory;
+            break;
+        }
+        if ((err = cjson_dybuf_read(reader, type, child, depth+1, &item)) != jserr_no_error)
+        {
+            cjson_release(key);
+            break;
+        }
+        if ((err = cjson_map_put_move(map, key, item)) != jserr_no_error) break;
+    }
+    if (err != jserr_no_error)
+    {
+        cjson_release(map);
+        return err;
+    }
+    *value = map;
+    return jserr_no_error;
+}
+
+static enum jserr cjson_dybuf_read(struct cjson_dybuf_reader* reader, uint8 type, uint node, uint depth, struct jsobj** value)
+{
+    dyj_scalar scalar;
+    enum dyj_err err;
+
+    switch (type)
+    {
+        case typdex_typ_array:
+            return cjson_dybuf_read_array(reader, node, depth, value);
+        case typdex_typ_map:
+            return cjson_dybuf_read_map(reader, node, depth, value);
+    }
+
+    if ((err = dyj_read_scalar(&reader->r, type, &scalar)) != dyj_err_none) return cjson_dybuf_error(err);
+    switch (type)
+    {
+        case typdex_typ_none:
+            *value = cjson_document_make_nil(reader->doc);
+            return jserr_no_error;
+        case typdex_typ_bool:
+            *value = cjson_document_make_bool(reader->doc, scalar.u.b);
+            return jserr_no_error;
+        case typdex_typ_double:
+            *value = cjson_document_make_double(reader->doc, scalar.u.d);
+            break;
+        case typdex_typ_string:
+            *value = cjson_document_make_string_size(reader->doc, (const char*)scalar.u.s.data, scalar.u.s.size);
+            break;
+        default:
+            *value = cjson_document_make_int(reader->doc, scalar.u.i);
+            break;
+    }
+    return *value ? jserr_no_error : jserr_no_memory;
+}
+
+enum jserr cjson_from_dybuf(dybuf* in, struct cjson_document* doc, struct jsobj** value)
+{
+    struct cjson_dybuf_reader reader;
+    enum jserr err = jserr_no_error;
+    uint8 type;
+    uint index;
+
+    if (in==NULL || value==NULL) return jserr_invalid_args;
+    *value = NULL;
+    reader.r.data = in->_data;
+    reader.r.position = dyb_get_position(in);
+    reader.r.limit = dyb_get_limit(in);
+    reader.doc = doc;
+    reader.keys = NULL;
+    if (!dyj_dicts_init(&reader.dicts, null)) return jserr_no_memory;
+
+    if (dyj_dicts_read_header(&reader.dicts, &reader.r) != dyj_err_none) err = jserr_bad_dybuf;
+    else if (!dyj_dicts_prepare_stamps(&reader.dicts)) err = jserr_no_memory;
+    if (err == jserr_no_error && doc && reader.dicts.key_count)
+    {
+        reader.keys = plat_mem_allocate(sizeof(reader.keys[0]) * reader.dicts.key_count);
+        if (reader.keys == NULL) err = jserr_no_memory;
+        else plat_mem_set(reader.keys, 0, sizeof(reader.keys[0]) * reader.dicts.key_count);
+    }
+    if (err == jserr_no_error)
+    {
+        if (!dyj_read_typdex(&reader.r, &type, &index) || type != typdex_typ_obj || index != 1) err = jserr_bad_dybuf;
+        else if (!dyj_read_typdex(&reader.r, &type, &index)) err = jserr_bad_dybuf;
+        else err = cjson_dybuf_read(&reader, type, DYJ_ROOT_NODE, 0, value);
+    }
+    if (err == jserr_no_error) dyb_set_position(in, reader.r.position);
+
+    if (reader.keys) plat_mem_release(reader.keys);
+    dyj_dicts_release(&reader.dicts);
+    return err;
+}
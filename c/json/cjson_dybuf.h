@@ -0,0 +1,49 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DYBUF_C_CJSON_DYBUF_H
+#define DYBUF_C_CJSON_DYBUF_H
+
+#include "cjson.h"
+#include "dyjson.h"
+
+/*
+ * cjson values to and from JSON-dybuf documents (dictionary header and payload), without
+ * JSON text or dyj_value trees in between.
+ *
+ * cjson_to_dybuf appends obj to out as one version 1 document, in two passes like
+ * dyj_encode: the payload is written in place, not buffered and copied. Tuples are written
+ * as arrays, ints outside the safe range as doubles like the JSON-dybuf text reader does.
+ * NaN, infinity, runtimes and map keys that are not strings fail with jserr_bad_value, out
+ * is not changed on error.
+ *
+ * cjson_from_dybuf reads one version 1 document from the position of in, straight from the
+ * payload records and checked like dyj_decode, and moves the position to its end. Values
+ * are made in doc, or reference counted when doc is NULL. The strings are copied once, cjson
+ * strings end with NUL and the payload ones do not. In doc, the members with the same
+ * dictionary key share one key node.
+ *
+ *      cjson_to_dybuf(value, out);
+ *      dyb_set_position(out, 0);
+ *      cjson_from_dybuf(out, doc, &copy);
+ */
+enum jserr cjson_to_dybuf(struct jsobj* obj, dybuf* out);
+enum jserr cjson_from_dybuf(dybuf* in, struct cjson_document* doc, struct jsobj** value);
+
+#endif //DYBUF_C_CJSON_DYBUF_H
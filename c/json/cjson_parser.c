@@ -0,0 +1,374 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "plat_mem.h"
+#include "plat_json_string.h"
+#include "dyjson.h"
+#include "cjson_parser.h"
+
+#define CJSON_PARSER_MAX_DEPTH      512
+#define CJSON_PARSER_BUFFER         256
+
+struct cjson_parser
+{
+    struct cjson_document* doc;         // of the values, NULL: reference counted
+    const char *text, *p, *end;
+    unsigned int depth;
+    char* buffer;                       // decoded string or number text, NUL terminated
+    unsigned int buffer_capacity;
+    unsigned int error_offset;
+};
+
+struct cjson_parser* cjson_parser_create(void)
+{
+    struct cjson_parser* parser = plat_mem_allocate(sizeof(*parser));
+    if (parser==NULL) return NULL;
+    plat_mem_set(parser, 0, sizeof(*parser));
+
+    parser->buffer = plat_mem_allocate(CJSON_PARSER_BUFFER);
+    if (parser->buffer==NULL)
+    {
+        plat_mem_release(parser);
+        return NULL;
+    }
+    parser->buffer_capacity = CJSON_PARSER_BUFFER;
+    return parser;
+}
+
+void cjson_parser_release(struct cjson_parser* parser)
+{
+    if (parser==NULL) return;
+    plat_mem_release(parser->buffer);
+    plat_mem_release(parser);
+}
+
+unsigned int cjson_parser_error_offset(struct cjson_parser* parser)
+{
+    return parser ? parser->error_offset : 0;
+}
+
+static enum jserr cjson_parser_fail(struct cjson_parser* parser, enum jserr err)
+{
+    parser->error_offset = (unsigned int)(parser->p - parser->text);
+    return err;
+}
+
+// room for size bytes in buffer, the first used bytes are kept
+static enum jserr cjson_parser_reserve(struct cjson_parser* parser, unsigned int used, unsigned int size)
+{
+    unsigned int capacity = parser->buffer_capacity;
+    char* buffer;
+
+    if (size <= capacity) return jserr_no_error;
+    while (capacity < size)
+    {
+        if (capacity > 0x7FFFFFFFU) return jserr_no_memory;
+        capacity *= 2;
+    }
+    buffer = plat_mem_allocate(capacity);
+    if (buffer==NULL) return jserr_no_memory;
+    plat_mem_copy(buffer, parser->buffer, used);
+    plat_mem_release(parser->buffer);
+    parser->buffer = buffer;
+    parser->buffer_capacity = capacity;
+    return jserr_no_error;
+}
+
+static inline void cjson_parser_skip_space(struct cjson_parser* parser)
+{
+    const char* p = parser->p;
+    while (p < parser->end && (*p==' ' || *p=='\t' || *p=='\n' || *p=='\r')) p++;
+    parser->p = p;
+}
+
+// p at the opening quote, the unescaped string goes to buffer
+static enum jserr cjson_parser_string(struct cjson_parser* parser)
+{
+    const char *start = parser->p + 1, *quote, *out;
+    unsigned int length;
+    boolean escaped;
+
+    quote = plat_json_string_scan(start, parser->end, &escaped);
+    if (quote >= parser->end || *quote != '"')
+    {
+        parser->p = quote;
+        return cjson_parser_fail(parser, jserr_syntax_error);
+    }
+
+    length = (unsigned int)(quote - start);
+    if (cjson_parser_reserve(parser, 0, length + 1) != jserr_no_error) return cjson_parser_fail(parser, jserr_no_memory);
+    if (escaped)
+    {
+        out = plat_json_string_unescape(start, quote, parser->buffer);
+        if (out == NULL) return cjson_parser_fail(parser, jserr_syntax_error);
+        length = (unsigned int)(out - parser->buffer);
+    }
+    else plat_mem_copy(parser->buffer, start, length);
+
+    parser->buffer[length] = 0;
+    parser->p = quote + 1;
+    return jserr_no_error;
+}
+
+// JSON numbers, and 0x[0-9a-fA-F]+ ints; ints beyond int64 become doubles
+static enum jserr cjson_parser_number(struct cjson_parser* parser, struct jsobj** value)
+{
+    const char *start = parser->p, *p = start, *end = parser->end;
+    boolean integer;
+    int64 i;
+    double d;
+    unsigned int size;
+
+    if (end - p > 2 && p[0] == '0' && p[1] == 'x')
+    {
+        uint64 number = 0;
+        unsigned int digit;
+
+        // digits go to number while they fit in 63 bits, then to d
+        for (p += 2, d = 0; p < end; p++)
+        {
+            if (*p >= '0' && *p <= '9') digit = (unsigned int)(*p - '0');
+            else if (*p >= 'a' && *p <= 'f') digit = (unsigned int)(*p - 'a' + 10);
+            else if (*p >= 'A' && *p <= 'F') digit = (unsigned int)(*p - 'A' + 10);
+            else break;
+            if (d == 0 && number < (1ULL << 59)) number = (number << 4) | digit;
+            else d = (d == 0 ? (double)number : d)*16 + digit;
+        }
+        if (p == start + 2) return cjson_parser_fail(parser, jserr_syntax_error);
+        parser->p = p;
+        *value = d == 0 ? cjson_document_make_int(parser->doc, (int64)number) : cjson_document_make_double(parser->doc, d);
+        return jserr_no_error;
+    }
+
+    size = dyj_parse_number(start, end, &integer, &i, &d);
+    if (size == 0) return cjson_parser_fail(parser, jserr_syntax_error);
+    parser->p = start + size;
+    *value = integer ? cjson_document_make_int(parser->doc, i) : cjson_document_make_double(parser->doc, d);
+    return jserr_no_error;
+}
+
+static boolean cjson_parser_literal(struct cjson_parser* parser, const char* literal, unsigned int length)
+{
+    if ((unsigned int)(parser->end - parser->p) < length || memcmp(parser->p, literal, length) != 0) return false;
+    parser->p += length;
+    return true;
+}
+
+static enum jserr cjson_parser_value(struct cjson_parser* parser, struct jsobj** value);
+
+// a map key: a string, a number, true, false, null or nil
+static enum jserr cjson_parser_key(struct cjson_parser* parser, struct jsobj** key)
+{
+    enum jserr err;
+
+    if (parser->p < parser->end && *parser->p == '"')
+    {
+        if ((err = cjson_parser_string(parser)) != jserr_no_error) return err;
+        *key = cjson_document_make_key(parser->doc, parser->buffer);
+        return jserr_no_error;
+    }
+    if (parser->p < parser->end && (*parser->p == '{' || *parser->p == '['))
+        return cjson_parser_fail(parser, jserr_syntax_error);
+    return cjson_parser_value(parser, key);
+}
+
+static enum jserr cjson_parser_map(struct cjson_parser* parser, struct jsobj** value)
+{
+    struct jsobj *map, *key, *item;
+    enum jserr err;
+
+    if (++parser->depth > CJSON_PARSER_MAX_DEPTH) return cjson_parser_fail(parser, jserr_too_deep);
+    map = cjson_document_make_map(parser->doc);
+    parser->p++;
+    cjson_parser_skip_space(parser);
+    if (parser->p < parser->end && *parser->p == '}')
+    {
+        parser->p++;
+        parser->depth--;
+        *value = map;
+        return jserr_no_error;
+    }
+
+    for (;;)
+    {
+        if ((err = cjson_parser_key(parser, &key)) != jserr_no_error) break;
+        cjson_parser_skip_space(parser);
+        if (parser->p >= parser->end || *parser->p != ':')
+        {
+            cjson_release(key);
+            err = cjson_parser_fail(parser, jserr_syntax_error);
+            break;
+        }
+        parser->p++;
+        cjson_parser_skip_space(parser);
+        if ((err = cjson_parser_value(parser, &item)) != jserr_no_error)
+        {
+            cjson_release(key);
+            break;
+        }
+        if ((err = cjson_map_put_move(map, key, item)) != jserr_no_error)
+        {
+            err = cjson_parser_fail(parser, err);
+            break;
+        }
+
+        cjson_parser_skip_space(parser);
+        if (parser->p < parser->end && *parser->p == ',')
+        {
+            parser->p++;
+            cjson_parser_skip_space(parser);
+            continue;
+        }
+        if (parser->p < parser->end && *parser->p == '}')
+        {
+            parser->p++;
+            parser->depth--;
+            *value = map;
+            return jserr_no_error;
+        }
+        err = cjson_parser_fail(parser, jserr_syntax_error);
+        break;
+    }
+
+    cjson_release(map);
+    return err;
+}
+
+static enum jserr cjson_parser_array(struct cjson_parser* parser, struct jsobj** value)
+{
+    struct jsobj *array, *item;
+    enum jserr err;
+
+    if (++parser->depth > CJSON_PARSER_MAX_DEPTH) return cjson_parser_fail(parser, jserr_too_deep);
+    array = cjson_document_make_array(parser->doc);
+    parser->p++;
+    cjson_parser_skip_space(parser);
+    if (parser->p < parser->end && *parser->p == ']')
+    {
+        parser->p++;
+        parser->depth--;
+        *value = array;
+        return jserr_no_error;
+    }
+
+    for (;;)
+    {
+        if ((err = cjson_parser_value(parser, &item)) != jserr_no_error) break;
+        if ((err = cjson_array_push_move(array, item)) != jserr_no_error)
+        {
+            err = cjson_parser_fail(parser, err);
+            break;
+        }
+
+        cjson_parser_skip_space(parser);
+        if (parser->p < parser->end && *parser->p == ',')
+        {
+            parser->p++;
+            cjson_parser_skip_space(parser);
+            continue;
+        }
+        if (parser->p < parser->end && *parser->p == ']')
+        {
+            parser->p++;
+            parser->depth--;
+            *value = array;
+            return jserr_no_error;
+        }
+        err = cjson_parser_fail(parser, jserr_syntax_error);
+        break;
+    }
+
+    cjson_release(array);
+    return err;
+}
+
+static enum jserr cjson_parser_value(struct cjson_parser* parser, struct jsobj** value)
+{
+    enum jserr err;
+
+    if (parser->p >= parser->end) return cjson_parser_fail(parser, jserr_syntax_error);
+    switch (*parser->p)
+    {
+        case '{': return cjson_parser_map(parser, value);
+        case '[': return cjson_parser_array(parser, value);
+        case '"':
+            if ((err = cjson_parser_string(parser)) != jserr_no_error) return err;
+            *value = cjson_document_make_string(parser->doc, parser->buffer);
+            return jserr_no_error;
+        case 't':
+            if (!cjson_parser_literal(parser, "true", 4)) break;
+            *value = cjson_document_make_bool(parser->doc, true);
+            return jserr_no_error;
+        case 'f':
+            if (!cjson_parser_literal(parser, "false", 5)) break;
+            *value = cjson_document_make_bool(parser->doc, false);
+            return jserr_no_error;
+        case 'n':
+            if (!cjson_parser_literal(parser, "null", 4) && !cjson_parser_literal(parser, "nil", 3)) break;
+            *value = cjson_document_make_nil(parser->doc);
+            return jserr_no_error;
+        default:
+            if (*parser->p == '-' || (*parser->p >= '0' && *parser->p <= '9')) return cjson_parser_number(parser, value);
+            break;
+    }
+    return cjson_parser_fail(parser, jserr_syntax_error);
+}
+
+enum jserr cjson_parser_parse_next(struct cjson_parser* parser, struct cjson_document* doc,
+                                   const char* text, unsigned int size, unsigned int* offset, struct jsobj** value)
+{
+    enum jserr err;
+
+    if (parser==NULL || value==NULL || offset==NULL || (text==NULL && size) || *offset > size) return jserr_invalid_args;
+    *value = NULL;
+    parser->doc = doc;
+    parser->text = text;
+    parser->p = text + *offset;
+    parser->end = text + size;
+    parser->depth = 0;
+    parser->error_offset = 0;
+
+    cjson_parser_skip_space(parser);
+    if ((err = cjson_parser_value(parser, value)) != jserr_no_error) return err;
+    cjson_parser_skip_space(parser);
+    *offset = (unsigned int)(parser->p - text);
+    return jserr_no_error;
+}
+
+enum jserr cjson_parser_parse(struct cjson_parser* parser, struct cjson_document* doc,
+                              const char* text, unsigned int size, struct jsobj** value)
+{
+    unsigned int offset = 0;
+    enum jserr err;
+
+    if (value==NULL) return jserr_invalid_args;
+    if ((err = cjson_parser_parse_next(parser, doc, text, size, &offset, value)) != jserr_no_error) return err;
+
+    // the NUL of a C string
+    while (parser->p < parser->end && *parser->p == 0) parser->p++;
+    if (parser->p != parser->end)
+    {
+        cjson_release(*value);
+        *value = NULL;
+        return cjson_parser_fail(parser, jserr_syntax_error);
+    }
+    return jserr_no_error;
+}
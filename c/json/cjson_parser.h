@@ -0,0 +1,48 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DYBUF_C_CJSON_PARSER_H
+#define DYBUF_C_CJSON_PARSER_H
+
+#include "cjson.h"
+
+/*
+ * A parser holds all of its state, one parser per thread parses independently of the others.
+ * It reads one JSON value with the cjson extensions: hex ints (0x1f), nil, and numbers,
+ * true, false or null as map keys. Values are made in doc, or reference counted
+ * when doc is NULL. A parser keeps its buffers between documents.
+ *
+ *      struct cjson_parser* parser = cjson_parser_create();
+ *      struct jsobj* value;
+ *      if (cjson_parser_parse(parser, doc, text, size, &value) != jserr_no_error)
+ *          printf("error at %u\n", cjson_parser_error_offset(parser));
+ *      cjson_parser_release(parser);
+ */
+struct cjson_parser;
+
+struct cjson_parser* cjson_parser_create(void);
+enum jserr cjson_parser_parse(struct cjson_parser* parser, struct cjson_document* doc,
+                              const char* text, unsigned int size, struct jsobj** value);
+// one value of a sequence from *offset, *offset moves past it and the spaces after it
+enum jserr cjson_parser_parse_next(struct cjson_parser* parser, struct cjson_document* doc,
+                                   const char* text, unsigned int size, unsigned int* offset, struct jsobj** value);
+unsigned int cjson_parser_error_offset(struct cjson_parser* parser);      // of the last error
+void cjson_parser_release(struct cjson_parser* parser);
+
+#endif //DYBUF_C_CJSON_PARSER_H
@@ -21,124 +21,225 @@
 // Created by Yuchi on 2016/2/12.
 //
 
+#include <string.h>
 #include <plat_mem.h>
+#include <plat_io.h>
 #include "cjson_runtime.h"
+#include "cjson_parser.h"
 
-/// ==== json yacc & lex
-#include "json.lex.c"
-static struct src_stack *curbs = NULL;
+#define CJSON_RT_MAX_RUNTIMES   8               // runtimes one context stacks
+#define CJSON_SOURCE_MAX_DEPTH  16              // sources one context stacks, the analyzed one and its imports
 
-static struct jsobj* rt_list[8];
-static uint rt_index = 0;
-
-void cjson_rt_push_new_runtime(void)
+struct src_stack
 {
-    struct jsobj* rt;
+    struct src_stack *prev;
+    char* name;                 // a copy of the resource name, NULL for a buffer
+    char* text;                 // a copy of the source
+    uint depth;                 // sources on the stack with this one
+    uint size;
+    uint offset;                // of the next code segment
+};
+
+struct cjson_rt_context
+{
+    struct src_stack *curbs;                        // source being analyzed, imports above it
+    struct jsobj* rt_list[CJSON_RT_MAX_RUNTIMES];
+    uint rt_index;
+    struct cjson_parser* parser;                    // kept between analyses
+};
 
-    rt = cjson_make_runtime();
+struct cjson_rt_context* cjson_rt_context_create(void)
+{
+    struct cjson_rt_context* ctx = plat_mem_allocate(sizeof(*ctx));
+    if (ctx==NULL) return NULL;
+    plat_mem_set(ctx, 0, sizeof(*ctx));
+    return ctx;
+}
 
-    rt_list[rt_index++] = rt;
+void cjson_rt_context_release(struct cjson_rt_context* ctx)
+{
+    if (ctx==NULL) return;
+    while (ctx->curbs) cjson_source_pop(ctx);
+    while (ctx->rt_index>0) cjson_release(ctx->rt_list[--ctx->rt_index]);
+    cjson_parser_release(ctx->parser);
+    plat_mem_release(ctx);
 }
 
-struct jsobj* cjson_rt_pop_last_runtime(void)
+enum jserr cjson_rt_push_new_runtime(struct cjson_rt_context* ctx)
 {
     struct jsobj* rt;
 
-    rt = rt_list[--rt_index];
+    if (ctx->rt_index >= CJSON_RT_MAX_RUNTIMES) return jserr_too_deep;
+    rt = cjson_make_runtime();
+    if (rt==NULL) return jserr_no_memory;
 
-    return rt;
+    ctx->rt_list[ctx->rt_index++] = rt;
+    return jserr_no_error;
+}
+
+struct jsobj* cjson_rt_pop_last_runtime(struct cjson_rt_context* ctx)
+{
+    if (ctx->rt_index==0) return NULL;
+    return ctx->rt_list[--ctx->rt_index];
 }
 
-struct jsobj* cjson_rt_add_code_segment(struct jsobj* segment)
+struct jsobj* cjson_rt_add_code_segment(struct cjson_rt_context* ctx, struct jsobj* segment)
 {
     struct jsobj* rt = NULL;
 
-    if (rt_index>0)
+    if (ctx->rt_index>0)
     {
-        rt = rt_list[rt_index-1];
-        cjson_runtime_add_code_segment(rt, segment);
+        rt = ctx->rt_list[ctx->rt_index-1];
+        cjson_array_push_move(_obj2inst_r(rt)->code, segment);
     }
+    else cjson_release(segment);
 
     return rt;
 }
 
 
-enum jserr cjson_source_push_from_buffer(const char* buff, uint size)
+enum jserr cjson_source_push_from_buffer(struct cjson_rt_context* ctx, const char* buff, uint size)
 {
-    struct src_stack *bs = plat_mem_allocate(sizeof(*bs));
+    struct src_stack *bs;
+
+    if (ctx->curbs && ctx->curbs->depth >= CJSON_SOURCE_MAX_DEPTH) return jserr_too_deep;
+    bs = plat_mem_allocate(sizeof(*bs));
     if(!bs) return jserr_no_memory;
 
-    /*bs->src_buffer = plat_mem_allocate(size);
-    if(!bs->src_buffer)
+    bs->text = plat_mem_allocate(size ? size : 1);
+    if(!bs->text)
     {
         plat_mem_release(bs);
         return jserr_no_memory;
     }
+    plat_mem_copy(bs->text, buff, size);
+    bs->name = NULL;
+    bs->size = size;
+    bs->offset = 0;
+    bs->depth = ctx->curbs ? ctx->curbs->depth + 1 : 1;
 
-    bs->src_size = size;
-    plat_mem_copy(bs->src_buffer, buff, size);*/
-
-    /* remember state */
-    //if(curbs) curbs->lineno = yylineno;
-    bs->prev = curbs;
-
-    /* set up current entry */
-    //bs->bs = yy_scan_bytes(bs->src_buffer, bs->src_size);
-    bs->bs = yy_scan_bytes(buff, size);
-    yy_switch_to_buffer(bs->bs);
-    curbs = bs;
-    //yylineno = 1;
+    bs->prev = ctx->curbs;
+    ctx->curbs = bs;
 
     return jserr_no_error;
 }
 
-enum jserr cjson_source_push_from_resource(const char* resource_name)
+enum jserr cjson_source_push_from_resource(struct cjson_rt_context* ctx, const char* resource_name)
 {
-    unsigned int size;
-    char *buf;
+    unsigned int size, length = (unsigned int)strlen(resource_name);
+    struct src_stack *bs;
+    char *buf, *name;
+
+    // names are compared as given, an import of a source that is being analyzed never ends
+    for (bs = ctx->curbs; bs; bs = bs->prev)
+    {
+        if (bs->name && strcmp(bs->name, resource_name) == 0) return jserr_import_cycle;
+    }
+    if (ctx->curbs && ctx->curbs->depth >= CJSON_SOURCE_MAX_DEPTH) return jserr_too_deep;
+
+    name = plat_mem_allocate(length + 1);
+    if (!name) return jserr_no_memory;
+    plat_mem_copy(name, resource_name, length + 1);
 
     int r = plat_io_get_resource(resource_name, (void**)&buf, &size);
 
-    if (r) return jserr_no_source;
-    if (!size) return jserr_no_source;  // no content
+    if (r || !size)                     // no content
+    {
+        plat_mem_release(name);
+        return jserr_no_source;
+    }
 
-    enum jserr jsr = cjson_source_push_from_buffer(buf, size);
+    enum jserr jsr = cjson_source_push_from_buffer(ctx, buf, size);
     free(buf);
 
+    if (jsr == jserr_no_error) ctx->curbs->name = name;
+    else plat_mem_release(name);
     return jsr;
 }
 
-enum jserr cjson_source_pop(void)
+enum jserr cjson_source_pop(struct cjson_rt_context* ctx)
 {
-    struct src_stack *bs = curbs;
-    struct src_stack *prevbs;
+    struct src_stack *bs = ctx->curbs;
 
     if(!bs) return jserr_no_source;
 
-    /* get rid of current entry */
-    //plat_mem_release(bs->src_buffer);
-    yy_delete_buffer(bs->bs);
-
     /* switch back to previous */
-    prevbs = bs->prev;
+    ctx->curbs = bs->prev;
+    if (bs->name) plat_mem_release(bs->name);
+    plat_mem_release(bs->text);
     plat_mem_release(bs);
 
-    if(!prevbs) return jserr_no_source;
-
-    yy_switch_to_buffer(prevbs->bs);
-    curbs = prevbs;
-    //yylineno = curbs->lineno;
-
-    return jserr_no_error;
+    return ctx->curbs ? jserr_no_error : jserr_no_source;
 }
 
-enum jserr cjson_source_analyze(void)
+// import(resource) between code segments pushes the resource, it is analyzed before the rest;
+// at most CJSON_SOURCE_MAX_DEPTH sources are stacked, a resource on the stack is not imported again
+static enum jserr cjson_source_import(struct cjson_rt_context* ctx, struct src_stack *bs, boolean* imported)
 {
-    yyparse();
-    //yylex();
-    return jserr_no_error;
+    const char *text = bs->text, *p = text + bs->offset, *end = text + bs->size, *name;
+    char* resource;
+    enum jserr jsr;
+
+    *imported = false;
+    if (end - p < 6 || memcmp(p, "import", 6) != 0) return jserr_no_error;
+    p += 6;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (p >= end || *p != '(') return jserr_syntax_error;
+    name = ++p;
+    while (p < end && *p != ')' && *p != '\n' && *p != ' ' && *p != '\t') p++;
+    if (p >= end || *p != ')' || p == name) return jserr_syntax_error;
+
+    resource = plat_mem_allocate((uint)(p - name) + 1);
+    if (!resource) return jserr_no_memory;
+    plat_mem_copy(resource, name, (uint)(p - name));
+    resource[p - name] = 0;
+    bs->offset = (uint)(p + 1 - text);
+
+    jsr = cjson_source_push_from_resource(ctx, resource);
+    plat_mem_release(resource);
+    if (jsr == jserr_no_error) *imported = true;
+    return jsr;
 }
 
+// every source is consumed, the code segments (arrays or objects) go to the last runtime in order,
+// they are made in its document
+enum jserr cjson_source_analyze(struct cjson_rt_context* ctx)
+{
+    struct cjson_document* doc = ctx->rt_index>0 ? _obj2inst_r(ctx->rt_list[ctx->rt_index-1])->source : NULL;
+    enum jserr jsr = jserr_no_error;
 
+    if (!ctx->curbs) return jserr_no_source;
+    if (!ctx->parser && !(ctx->parser = cjson_parser_create())) return jserr_no_memory;
 
+    while (ctx->curbs)
+    {
+        struct src_stack *bs = ctx->curbs;
+        struct jsobj* segment;
+        boolean imported;
+        char c;
+
+        while (bs->offset < bs->size &&
+               ((c = bs->text[bs->offset]) == ' ' || c == '\t' || c == '\n' || c == '\r' || c == 0)) bs->offset++;
+        if (bs->offset >= bs->size)
+        {
+            cjson_source_pop(ctx);
+            continue;
+        }
+
+        if ((jsr = cjson_source_import(ctx, bs, &imported)) != jserr_no_error) break;
+        if (imported) continue;
+
+        c = bs->text[bs->offset];
+        if (c != '[' && c != '{')
+        {
+            jsr = jserr_syntax_error;
+            break;
+        }
+        jsr = cjson_parser_parse_next(ctx->parser, doc, bs->text, bs->size, &bs->offset, &segment);
+        if (jsr != jserr_no_error) break;
+        cjson_rt_add_code_segment(ctx, segment);
+    }
 
+    while (ctx->curbs) cjson_source_pop(ctx);
+    return jsr;
+}
@@ -27,13 +27,31 @@
 #include "cjson.h"
 
 
-void cjson_rt_push_new_runtime(void);
-struct jsobj* cjson_rt_pop_last_runtime(void);
-struct jsobj* cjson_rt_add_code_segment(struct jsobj* segment);
-
-enum jserr cjson_source_push_from_buffer(const char* buf, uint size);
-enum jserr cjson_source_push_from_resource(const char* resource_name);
-enum jserr cjson_source_pop(void);
-enum jserr cjson_source_analyze(void);
+/*
+ * A context holds the runtime stack and the source stack of one analysis, one context per
+ * thread analyzes independently of the others. At most 8 runtimes are stacked, a push past
+ * that fails with jserr_too_deep. Released contexts release the runtimes still on the stack.
+ * Sources stack up to 16 deep with their imports; importing a resource that is on the stack,
+ * by the same name, fails with jserr_import_cycle.
+ *
+ *      struct cjson_rt_context* ctx = cjson_rt_context_create();
+ *      cjson_rt_push_new_runtime(ctx);
+ *      if (cjson_source_push_from_buffer(ctx, text, size) == jserr_no_error) cjson_source_analyze(ctx);
+ *      rt = cjson_rt_pop_last_runtime(ctx);
+ *      cjson_rt_context_release(ctx);
+ */
+struct cjson_rt_context;
+
+struct cjson_rt_context* cjson_rt_context_create(void);
+void cjson_rt_context_release(struct cjson_rt_context* ctx);
+
+enum jserr cjson_rt_push_new_runtime(struct cjson_rt_context* ctx);
+struct jsobj* cjson_rt_pop_last_runtime(struct cjson_rt_context* ctx);          // NULL if none
+struct jsobj* cjson_rt_add_code_segment(struct cjson_rt_context* ctx, struct jsobj* segment);    // takes segment
+
+enum jserr cjson_source_push_from_buffer(struct cjson_rt_context* ctx, const char* buf, uint size);
+enum jserr cjson_source_push_from_resource(struct cjson_rt_context* ctx, const char* resource_name);
+enum jserr cjson_source_pop(struct cjson_rt_context* ctx);
+enum jserr cjson_source_analyze(struct cjson_rt_context* ctx);                 // consumes all sources
 
 #endif //DYBUF_C_CJSON_RUNTIME_H
@@ -24,17 +24,36 @@
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <cjson_runtime.h>
 #include "dybuf.h"
 #include "dypkt.h"
 #include "cjson.h"
+#include "cjson_parser.h"
+#include "cjson_dybuf.h"
 #include "plat_mgn_mem.h"
+#include "example_dypkt.h"
+#include "dyjson.h"
 
 void cjson_test(void);
 void cjson_parse_test(void);
 void dybuf_test(void);
 void dybuf_test_ref(void);
 void dypkt_test(void);
+void dypkt_schema_test(void);
+void dypkt_dispatch_test(void);
+void dypkt_batch_test(void);
+void dypkt_protocol_test(void);
+void dypkt_arena_test(void);
+void dyjson_test(void);
+void dyjson_writer_test(void);
+void dyjson_transcode_test(void);
+void dyjson_emit_test(void);
+void dyjson_view_test(void);
+void dyjson_shared_test(void);
+void dyjson_canonical_test(void);
+void dyjson_columnar_test(void);
+void dyjson_parallel_test(void);
 void mgn_m_test(void);
 
 int main(int argc, char **argv)
@@ -64,6 +83,20 @@ int main(int argc, char **argv)
     dybuf_test();
     dybuf_test_ref();
     dypkt_test();
+    dypkt_schema_test();
+    dypkt_dispatch_test();
+    dypkt_batch_test();
+    dypkt_protocol_test();
+    dypkt_arena_test();
+    dyjson_test();
+    dyjson_writer_test();
+    dyjson_transcode_test();
+    dyjson_emit_test();
+    dyjson_view_test();
+    dyjson_shared_test();
+    dyjson_canonical_test();
+    dyjson_columnar_test();
+    dyjson_parallel_test();
 
     mgn_m_test();
 
@@ -81,22 +114,261 @@ void cjson_test(void)
         obj = cjson_make(typs[i]);
         cjson_release(obj);
     }
+
+    // map: insertion order kept, keys found by hash, a second add replaces the value
+    struct jsobj *map = cjson_make_map(), *key, *value, *clone;
+    char name[16];
+    unsigned int found = 0;
+    for (i=0; i<1000; i++)
+    {
+        sprintf(name, "k%u", i);
+        key = cjson_make_string(name);
+        value = cjson_make_int(i);
+        cjson_map_add_pair(map, key, value);
+        cjson_release(key);
+        cjson_release(value);
+    }
+    key = cjson_make_string("k7");
+    value = cjson_make_int(-7);
+    cjson_map_add_pair(map, key, value);
+    cjson_release(value);
+    for (i=0; i<1000; i++)
+    {
+        sprintf(name, "k%u", i);
+        value = cjson_make_string(name);
+        if (cjson_map_get(map, value) != NULL) found++;
+        cjson_release(value);
+    }
+    clone = cjson_clone(map);
+    printf("cjson map size %u, found %u, k7 = %d, pair 7 = %d, clone equal %d\n",
+           _obj2inst_m(map)->size, found, (int)_obj2int(cjson_map_get(map, key)),
+           (int)_obj2int(_obj2inst_m(map)->pairs[7]->values[1]), cjson_compare(map, clone)==0);
+    cjson_release(clone);
+    cjson_release(key);
+    cjson_release(map);
+
+    // same size, different keys: ordered like the sorted key lists, whatever the insertion order
+    map = cjson_make_map();
+    clone = cjson_make_map();
+    value = cjson_make_int(0);
+    for (i=0; i<3; i++)
+    {
+        key = cjson_make_string(i==0 ? "c" : i==1 ? "a" : "d");
+        cjson_map_add_pair(map, key, value);
+        cjson_release(key);
+        key = cjson_make_string(i==0 ? "b" : i==1 ? "d" : "a");
+        cjson_map_add_pair(clone, key, value);
+        cjson_release(key);
+    }
+    printf("cjson map compare %d %d, self %d\n", cjson_compare(map, clone), cjson_compare(clone, map),
+           cjson_compare(map, map));
+    cjson_release(value);
+    cjson_release(clone);
+    cjson_release(map);
+
+    // capacity grows by doubling, reserve sizes it up front
+    struct jsobj *array = cjson_make_array();
+    cjson_array_reserve(array, 100);
+    unsigned int reserved = _obj2inst_a(array)->capacity;
+    for (i=0; i<1000; i++)
+    {
+        value = cjson_make_int(i);
+        cjson_array_add_object(array, value);
+        cjson_release(value);
+    }
+    map = cjson_make_map();
+    cjson_map_reserve(map, 1000);
+    printf("cjson reserve array %u, array %u of %u, map %u\n", reserved, _obj2inst_a(array)->size,
+           _obj2inst_a(array)->capacity, _obj2inst_m(map)->capacity);
+    cjson_release(array);
+    cjson_release(map);
+
+    // move variants take the object without cloning it
+    array = cjson_make_array();
+    map = cjson_make_map();
+    value = cjson_make_string("moved");
+    cjson_array_push_move(array, value);
+    key = cjson_make_string("key");
+    cjson_map_put_move(map, key, array);
+    printf("cjson move array %d, map %d\n", _obj2inst_a(array)->values[0] == value,
+           cjson_map_get(map, key) == array);
+
+    // document: nodes freed at once, heap values moved in are kept, document values moved out copied
+    struct cjson_document* doc = cjson_document_create(0);
+    struct jsobj *doc_map = cjson_document_clone(doc, map), *doc_array = cjson_document_make_array(doc);
+    for (i=0; i<100; i++) cjson_array_push_move(doc_array, cjson_document_make_int(doc, i));
+    cjson_array_push_move(doc_array, cjson_make_string("heap"));
+    cjson_map_put_move(doc_map, cjson_document_make_string(doc, "array"), doc_array);
+    clone = cjson_clone(doc_map);
+    printf("cjson document clone equal %d, heap copy %d, size %u\n", cjson_compare(doc_map, clone)==0,
+           clone->document == NULL && cjson_map_get(clone, key)->document == NULL, _obj2inst_m(clone)->size);
+    cjson_release(doc_map);
+    cjson_release(clone);
+    cjson_document_free(doc);
+    cjson_release(map);
+
+    // immortal nil/true/false/""/small ints, interned keys of a document
+    doc = cjson_document_create(0);
+    cjson_document_intern_keys(doc);
+    doc_array = cjson_document_make_array(doc);
+    for (i=0; i<3; i++)
+    {
+        doc_map = cjson_document_make_map(doc);
+        cjson_map_put_move(doc_map, cjson_document_make_key(doc, "id"), cjson_document_make_int(doc, i));
+        cjson_map_put_move(doc_map, cjson_document_make_string(doc, "name"), cjson_document_make_nil(doc));
+        cjson_array_push_move(doc_array, doc_map);
+    }
+    struct jsobj_map *map0 = _obj2inst_m(_obj2inst_a(doc_array)->values[0]),
+                     *map2 = _obj2inst_m(_obj2inst_a(doc_array)->values[2]);
+    value = cjson_make_int(100000);
+    clone = cjson_make_int(100000);
+    printf("cjson shared nil %d, true %d, int %d, big int %d, empty %d, keys %d %d\n",
+           cjson_make_nil() == cjson_document_make_nil(doc), cjson_make_bool(true) == cjson_clone(cjson_make_bool(true)),
+           cjson_make_int(7) == cjson_document_make_int(doc, 7), value == clone, cjson_make_string("") == cjson_make_string(NULL),
+           map0->pairs[0]->values[0] == map2->pairs[0]->values[0], map0->pairs[1]->values[0] == map2->pairs[1]->values[0]);
+    cjson_release(value);
+    cjson_release(clone);
+    // the ends of int64 are not small ints
+    value = cjson_make_int(0x7FFFFFFFFFFFFFFFLL);
+    clone = cjson_make_int(-0x7FFFFFFFFFFFFFFFLL - 1);
+    printf("cjson int64 max %d, min %d\n", _obj2int(value) == 0x7FFFFFFFFFFFFFFFLL,
+           _obj2int(clone) == -0x7FFFFFFFFFFFFFFFLL - 1);
+    cjson_release(value);
+    cjson_release(clone);
+    cjson_document_free(doc);
 }
 
 void cjson_parse_test(void)
 {
-    const char* json_text = "{\"abc\":1,\"efg\":[], 1:[1,2.2,3e3,4,0xa]}\n";
+    const char* json_text = "{\"abc\":1,\"efg\":[], 1:[1,2.2,3e3,4,0xa]}\n[3, 2, 1]\n";
     //const char* json_text = "[\n1]\n\0\0";
     //const char* json_text = "[1,2.2,3e3,4,0xa,\"asdfs\"]\n";
     //const char* json_text = "{1:2}\n";
-    cjson_rt_push_new_runtime();
+    struct cjson_rt_context* ctx = cjson_rt_context_create();
+    cjson_rt_push_new_runtime(ctx);
+
+    //cjson_source_push_from_resource(ctx, "");
+    if (cjson_source_push_from_buffer(ctx, json_text, strlen(json_text)+1) == jserr_no_error)
+        printf("cjson analyze %d", cjson_source_analyze(ctx));
 
-    //cjson_source_push_from_resource("");
-    if (cjson_source_push_from_buffer(json_text, strlen(json_text)+1) == jserr_no_error)
-        cjson_source_analyze();
+    struct jsobj* rt = cjson_rt_pop_last_runtime(ctx);
+    struct jsobj_array* code = _obj2inst_a(_obj2inst_r(rt)->code);
+    struct jsobj_array* items = _obj2inst_a(code->values[1]);
+    printf(", segments %u, first key %s, items %d %d %d\n", code->size,
+           _obj2string(_obj2inst_m(code->values[0])->pairs[0]->values[0]),
+           (int)_obj2int(items->values[0]), (int)_obj2int(items->values[1]), (int)_obj2int(items->values[2]));
+    cjson_release(rt);
+
+    // the runtime stack is bounded, the context releases what is left on it
+    unsigned int pushed = 0, i;
+    while (cjson_rt_push_new_runtime(ctx) == jserr_no_error) pushed++;
+    cjson_rt_context_release(ctx);
+    ctx = cjson_rt_context_create();
+    printf("cjson runtimes pushed %u, empty pop %d\n", pushed, cjson_rt_pop_last_runtime(ctx) == NULL);
 
-    struct jsobj* rt = cjson_rt_pop_last_runtime();
+    // imports are bounded and a resource on the source stack is not imported again
+    const char* import_names[2] = {"/tmp/dybuf_import_a.json", "/tmp/dybuf_import_b.json"};
+    enum jserr import_err[3];
+    FILE* fp;
+    for (i=0; i<2; i++)
+    {
+        fp = fopen(import_names[i], "w");
+        fprintf(fp, "[%u]\nimport(%s)\n", i, import_names[1-i]);
+        fclose(fp);
+    }
+    cjson_rt_push_new_runtime(ctx);
+    cjson_source_push_from_resource(ctx, import_names[0]);
+    import_err[0] = cjson_source_analyze(ctx);
+    for (pushed=0; cjson_source_push_from_buffer(ctx, "[1]", 3) == jserr_no_error; pushed++);
+    import_err[1] = cjson_source_push_from_resource(ctx, import_names[0]);
+    import_err[2] = cjson_source_analyze(ctx);
+    rt = cjson_rt_pop_last_runtime(ctx);
+    printf("cjson import cycle %d, segments %u, sources stacked %u, too deep %d, analyzed %d\n", import_err[0] == jserr_import_cycle,
+           _obj2inst_a(_obj2inst_r(rt)->code)->size, pushed, import_err[1] == jserr_too_deep, import_err[2]);
     cjson_release(rt);
+    for (i=0; i<2; i++) remove(import_names[i]);
+    cjson_rt_context_release(ctx);
+
+    // reentrant parser, values in a document or reference counted
+    struct cjson_parser* parser = cjson_parser_create();
+    struct cjson_document* doc = cjson_document_create(0);
+    struct jsobj *value, *key;
+    const char* text = "{\"b\": [1, -2.5e1, 0x1f, true, nil], \"a\\u00e9\\ud83d\\ude00\": \"x\\/y\", 2: null}";
+    enum jserr err = cjson_parser_parse(parser, doc, text, strlen(text), &value);
+    key = cjson_make_string("a\xc3\xa9\xf0\x9f\x98\x80");
+    printf("cjson parser %d, size %u, first %s, double %g, hex %d, escaped %s\n", err, _obj2inst_m(value)->size,
+           _obj2string(_obj2inst_m(value)->pairs[0]->values[0]),
+           _obj2double(_obj2inst_a(cjson_map_get(value, _obj2inst_m(value)->pairs[0]->values[0]))->values[1]),
+           (int)_obj2int(_obj2inst_a(cjson_map_get(value, _obj2inst_m(value)->pairs[0]->values[0]))->values[2]),
+           _obj2string(cjson_map_get(value, key)));
+    cjson_release(key);
+    cjson_document_free(doc);
+    err = cjson_parser_parse(parser, NULL, "[1, {\"a\" 2}]", 13, &value);
+    printf("cjson parser error %d at %u, released %d\n", err, cjson_parser_error_offset(parser), value == NULL);
+
+    // strings longer than a vector, escapes across it, invalid UTF-8
+    const char* long_text = "[\"0123456789abcdef0123456789\\\"\\u00e9xyz\", \"\xe6\x9d\xb1\xe4\xba\xac\"]";
+    const char* bad_text = "[\"ab\", \"\xc0\xaf\"]";
+    err = cjson_parser_parse(parser, NULL, bad_text, strlen(bad_text), &value);
+    printf("cjson parser invalid utf-8 %d at %u\n", err, cjson_parser_error_offset(parser));
+    err = cjson_parser_parse(parser, NULL, long_text, strlen(long_text), &value);
+    printf("cjson parser strings %d, %s, %u bytes\n", err, _obj2string(_obj2inst_a(value)->values[0]),
+           (unsigned int)strlen(_obj2string(_obj2inst_a(value)->values[1])));
+    cjson_release(value);
+
+    // 64-bit ids, doubles that read back, shortest formatting
+    char formatted[3][CJSON_NUMBER_BUFFER_SIZE];
+    const char* numbers = "[9007199254740993123, 0.1, 1.7976931348623157e308, 5e-324, 1e400]";
+    err = cjson_parser_parse(parser, NULL, numbers, strlen(numbers), &value);
+    cjson_format_number(_obj2inst_a(value)->values[0], formatted[0]);
+    cjson_format_number(_obj2inst_a(value)->values[2], formatted[1]);
+    cjson_format_number(_obj2inst_a(value)->values[3], formatted[2]);
+    printf("cjson numbers %d, %s, %d, %s, %s, inf %u\n", err, formatted[0], _obj2double(_obj2inst_a(value)->values[1]) == 0.1,
+           formatted[1], formatted[2], cjson_format_number(_obj2inst_a(value)->values[4], formatted[0]));
+    cjson_release(value);
+
+    // hex ints beyond int64 become doubles too, leading zeros are not significant
+    const char* hex = "[0x7FFFFFFFFFFFFFFF, 0x8000000000000000, 0x10000000000000000, 0x000000000000000000001]";
+    err = cjson_parser_parse(parser, NULL, hex, strlen(hex), &value);
+    printf("cjson hex %d, max int %d, 2^63 %g, 2^64 %g, zeros int %d\n", err,
+           _obj2inst_a(value)->values[0]->type == jstype_int && _obj2int(_obj2inst_a(value)->values[0]) == 0x7FFFFFFFFFFFFFFFLL,
+           _obj2double(_obj2inst_a(value)->values[1]), _obj2double(_obj2inst_a(value)->values[2]),
+           _obj2inst_a(value)->values[3]->type == jstype_int && _obj2int(_obj2inst_a(value)->values[3]) == 1);
+    cjson_release(value);
+
+    // to JSON-dybuf and back, in a document and reference counted
+    const char* record = "{\"id\": 9007199254740993123, \"tags\": [\"a\", \"b\"], \"items\": [{\"n\": 1}, {\"n\": 2.5}]}";
+    dybuf* packed = dyb_create(NULL, 64);
+    dybuf* emitted = dyb_create(NULL, 64);
+    struct jsobj *copy, *counted, *bad;
+    doc = cjson_document_create(0);
+    cjson_parser_parse(parser, doc, record, strlen(record), &value);
+    err = cjson_to_dybuf(value, packed);
+    dyb_set_position(packed, 0);
+    dyj_emit_text(packed, emitted);
+    dyb_append_u8(emitted, 0);
+    dyb_set_position(packed, 0);
+    enum jserr err1 = cjson_from_dybuf(packed, doc, &copy);
+    dyb_set_position(packed, 0);
+    enum jserr err2 = cjson_from_dybuf(packed, NULL, &counted);
+    printf("cjson dybuf %d %d %d, %s, same %d, shared key %d\n", err, err1, err2, (char*)emitted->_data,
+           cjson_compare(copy, counted) == 0 && cjson_compare(cjson_map_get(value, _obj2inst_m(value)->pairs[1]->values[0]),
+                                                              cjson_map_get(copy, _obj2inst_m(copy)->pairs[1]->values[0])) == 0,
+           _obj2inst_m(_obj2inst_a(cjson_map_get(copy, _obj2inst_m(copy)->pairs[2]->values[0]))->values[0])->pairs[0]->values[0] ==
+           _obj2inst_m(_obj2inst_a(cjson_map_get(copy, _obj2inst_m(copy)->pairs[2]->values[0]))->values[1])->pairs[0]->values[0]);
+    cjson_release(counted);
+    bad = cjson_make_array();
+    cjson_array_push_move(bad, cjson_make_double(0.0/0.0));
+    dyb_set_position(packed, 0);
+    err = cjson_to_dybuf(bad, packed);
+    dyb_set_position(packed, 0);
+    dyb_set_limit(packed, 8);
+    printf("cjson dybuf nan %d, truncated %d\n", err, cjson_from_dybuf(packed, NULL, &counted));
+    cjson_release(bad);
+    cjson_document_free(doc);
+    dyb_release(packed);
+    dyb_release(emitted);
+    cjson_parser_release(parser);
 }
 
 void dybuf_test(void)
@@ -251,6 +523,25 @@ void dypkt_test(void)
                         printf("proto_ver: %llx\n", dyp_next_protocol_version(dyp1));
                         break;
                     }
+                    case dype_f_packet:
+                    {
+                        dyp_skip_payload(dyp1, dype_bytes);
+                        printf("packet\n");
+                        break;
+                    }
+                    case dype_f_protocol_def:
+                    {
+                        dyp_skip_payload(dyp1, dype_uint);
+                        dyp_skip_payload(dyp1, dype_string);
+                        printf("protocol def\n");
+                        break;
+                    }
+                    case dype_f_protocol_id:
+                    {
+                        dyp_skip_payload(dyp1, dype_uint);
+                        printf("protocol id\n");
+                        break;
+                    }
                 }
                 break;
             }
@@ -298,6 +589,719 @@ void dypkt_test(void)
     dyp_release(dyp1);
 }
 
+void dypkt_schema_test(void)
+{
+    uint8 mem[1024];
+    uint8 avatar[] = {0x01, 0x02, 0x03};
+    dypkt* dyp0 = dyp_pack(null, mem, 1024);
+    dypkt* dyp1;
+    uint size;
+    catalog_user user0 = {0}, user1;
+    catalog_entry entry0 = {0}, entry1;
+
+    user0.id = 1001;
+    user0.name = "yuchi";
+    user0.has_email = true;
+    user0.email = "yuchi518@gmail.com";
+    user0.has_avatar = true;
+    user0.avatar = avatar;
+    user0.avatar_size = sizeof(avatar);
+    user0.has_created_at = true;
+    user0.created_at = 0x5a5a5a5aULL;
+    entry0.id = 7;
+    entry0.title = "dybuf";
+    entry0.owner = user0.id;
+
+    dyp_append_protocol(dyp0, EXAMPLE_CATALOG_PROTOCOL);
+    encode_catalog_user(dyp0, &user0);
+    encode_catalog_entry(dyp0, &entry0);
+    dyp_append_eof(dyp0);
+
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+
+    dyp1 = dyp_unpack(null, mem, size, false);
+    dyp_skip_next(dyp1);
+
+    if (!decode_catalog_user(dyp1, &user1)) printf("decode_catalog_user failed\n");
+    else printf("user: %llu %s %s %u %d %llx\n", user1.id, user1.name, user1.has_email?user1.email:"-",
+                user1.avatar_size, user1.has_admin, user1.created_at);
+
+    if (!decode_catalog_entry(dyp1, &entry1)) printf("decode_catalog_entry failed\n");
+    else printf("entry: %llu %s %llu\n", entry1.id, entry1.title, entry1.owner);
+
+    // wrong record type
+    dyb_rewind(dyp1);
+    dyp_skip_next(dyp1);
+    if (decode_catalog_entry(dyp1, &entry1)) printf("decode_catalog_entry should fail\n");
+
+    printf("schema size: %u\n", size);
+    dyp_release(dyp1);
+
+    // every cut inside the records (before the eof byte) is rejected without reading past it
+    uint cut, rejected = 0, start;
+    dyp1 = dyp_unpack(null, mem, size, false);
+    dyp_skip_next(dyp1);
+    start = dyp_get_position(dyp1);
+    dyp_release(dyp1);
+    for (cut=start; cut<size-1; cut++)
+    {
+        uint8* copy = malloc(cut);
+        memcpy(copy, mem, cut);
+        dyp1 = dyp_unpack(null, copy, cut, false);
+        dyp_skip_next(dyp1);
+        if (!decode_catalog_user(dyp1, &user1) || !decode_catalog_entry(dyp1, &entry1)) rejected++;
+        dyp_release(dyp1);
+        free(copy);
+    }
+    printf("schema truncated rejected: %u of %u\n", rejected, size-1-start);
+}
+
+static boolean dispatch_protocol(dypkt* dyp, dype type, uint index, void* ctx)
+{
+    (void)type;
+    (void)index;
+    (void)ctx;
+    printf("protocol: %s\n", dyp_next_protocol(dyp, null));
+    return true;
+}
+
+static boolean dispatch_int(dypkt* dyp, dype type, uint index, void* ctx)
+{
+    (void)type;
+    (void)index;
+    *(int64*)ctx += dyp_next_int(dyp);
+    return true;
+}
+
+static boolean dispatch_string(dypkt* dyp, dype type, uint index, void* ctx)
+{
+    (void)type;
+    (void)ctx;
+    printf("%u.cstr: %s\n", index, dyp_next_cstring(dyp, null));
+    return true;
+}
+
+static boolean dispatch_eof(dypkt* dyp, dype type, uint index, void* ctx)
+{
+    (void)type;
+    (void)index;
+    (void)ctx;
+    dyp_next_eof(dyp);
+    printf("eof\n");
+    return true;
+}
+
+void dypkt_dispatch_test(void)
+{
+    uint8 mem[1024];
+    dypkt* dyp0 = dyp_pack(null, mem, 1024);
+    dypkt* dyp1;
+    dyp_dispatch_table table;
+    uint size;
+    int64 sum = 0;
+
+    dyp_append_protocol(dyp0, "dispatch");
+    dyp_append_int(dyp0, 0, 1);
+    dyp_append_int(dyp0, 9, 20);            // 2 bytes typdex
+    dyp_append_int(dyp0, 0x1234, 300);      // 3 bytes typdex
+    dyp_append_cstring(dyp0, 1, "short");
+    dyp_append_bool(dyp0, 2, true);         // no handler, skipped by fallback
+    dyp_append_cstring(dyp0, 200, "long");
+    dyp_append_eof(dyp0);
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+
+    dyp_dispatch_init(&table);
+    dyp_dispatch_register(&table, dype_f, dype_f_protocol, dispatch_protocol);
+    dyp_dispatch_register(&table, dype_f, dype_f_eof, dispatch_eof);
+    dyp_dispatch_register(&table, dype_int, 0, dispatch_int);
+    dyp_dispatch_register(&table, dype_int, 9, dispatch_int);
+    dyp_dispatch_register(&table, dype_int, 0x1234, dispatch_int);
+    dyp_dispatch_register(&table, dype_string, 1, dispatch_string);
+    dyp_dispatch_register(&table, dype_string, 200, dispatch_string);
+
+    dyp1 = dyp_unpack(null, mem, size, false);
+    if (dyp_dispatch_all(dyp1, &table, &sum)) printf("dispatch without fallback should fail\n");
+
+    dyb_rewind(dyp1);
+    sum = 0;
+    dyp_dispatch_set_fallback(&table, dyp_dispatch_skip);
+    if (!dyp_dispatch_all(dyp1, &table, &sum)) printf("dispatch failed\n");
+    printf("dispatch sum: %lld, remainder: %u\n", sum, dyp_get_remainder(dyp1));
+
+    dyp_release(dyp1);
+    dyp_dispatch_release(&table);
+}
+
+void dypkt_batch_test(void)
+{
+    uint8 mem[1024], scratch[64];
+    dypkt* dyp0 = dyp_pack(null, mem, 1024);
+    dypkt sub, *dyp1;
+    uint size, begin, i, count = 0;
+    int64 sum = 0;
+
+    dyp_append_protocol(dyp0, "telemetry");
+    dyp_append_version(dyp0, 1);
+
+    // built in a scratch packet, then copied
+    dyp_pack(&sub, scratch, sizeof(scratch));
+    dyp_append_int(&sub, 0, 100);
+    dyp_append_packet_from(dyp0, &sub);
+    dyp_release(&sub);
+
+    // built in place
+    for (i=1; i<=3; i++)
+    {
+        begin = dyp_begin_packet(dyp0);
+        dyp_append_int(dyp0, 0, i*1000);
+        dyp_append_cstring(dyp0, 1, "sample");
+        dyp_end_packet(dyp0, begin);
+    }
+    dyp_append_eof(dyp0);
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+
+    dyp1 = dyp_unpack(null, mem, size, false);
+    printf("batch protocol: %s\n", dyp_next_protocol(dyp1, null));
+    printf("batch version: %llu\n", dyp_next_version(dyp1));
+    while (dyp_next_packet(dyp1, &sub))
+    {
+        sum += dyp_next_int(&sub);
+        count++;
+        dyp_release(&sub);
+    }
+    dyp_next_eof(dyp1);
+    printf("batch packets: %u, sum: %lld, remainder: %u\n", count, sum, dyp_get_remainder(dyp1));
+    dyp_release(dyp1);
+
+    // a length above 32 bits and truncated records are rejected, the position is kept
+    dyp0 = dyp_pack(null, mem, 1024);
+    dyb_append_typdex(dyp0, dype_f, dype_f_packet);
+    dyb_append_var_u64(dyp0, 0x100000010ULL);
+    for (i=0; i<16; i++) dyb_append_u8(dyp0, 0);
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+    dyp1 = dyp_unpack(null, mem, size, false);
+    printf("batch long length rejected: %d\n", dyp_next_packet(dyp1, &sub) == null && dyp_get_position(dyp1) == 0);
+    dyp_release(dyp1);
+
+    dyp0 = dyp_pack(null, mem, 1024);
+    begin = dyp_begin_packet(dyp0);
+    dyp_append_cstring(dyp0, 0x1234, "sample");
+    dyp_end_packet(dyp0, begin);
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+    for (i=1, count=0; i<size; i++)
+    {
+        dyp1 = dyp_unpack(null, mem, i, false);
+        if (dyp_next_packet(dyp1, &sub) == null && dyp_get_position(dyp1) == 0) count++;
+        dyp_release(dyp1);
+    }
+    printf("batch truncated rejected: %u of %u\n", count, size-1);
+}
+
+void dypkt_protocol_test(void)
+{
+    uint8 mem[256];
+    dypkt* dyp0 = dyp_pack(null, mem, sizeof(mem));
+    dypkt* dyp1;
+    dyp_protocols writer, reader;
+    uint telemetry, control, handle, size, i, count;
+
+    dyp_protocols_init(&writer);
+    telemetry = dyp_protocols_intern(&writer, "telemetry");
+    control = dyp_protocols_intern(&writer, "control");
+    for (i=0; i<3; i++)
+    {
+        dyp_append_protocol_ref(dyp0, &writer, telemetry);
+        dyp_append_protocol_ref(dyp0, &writer, control);
+    }
+    dyp_append_protocol(dyp0, "telemetry");
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+    printf("protocol refs size: %u\n", size);
+
+    // reader interns its own handles first, wire ids are mapped to them
+    dyp_protocols_init(&reader);
+    control = dyp_protocols_intern(&reader, "control");
+    telemetry = dyp_protocols_intern(&reader, "telemetry");
+    dyp1 = dyp_unpack(null, mem, size, false);
+    while (dyp_get_remainder(dyp1) > 0)
+    {
+        handle = dyp_next_protocol_ref(dyp1, &reader);
+        printf("protocol ref: %s (%s)\n", dyp_protocols_name(&reader, handle),
+               handle == telemetry ? "telemetry" : handle == control ? "control" : "unknown");
+    }
+    dyp_release(dyp1);
+    dyp_protocols_release(&reader);
+
+    // other records, truncated records and empty names are not consumed
+    dyp_protocols_init(&reader);
+    dyp0 = dyp_pack(null, mem, sizeof(mem));
+    dyp_append_cstring(dyp0, 0x12, "telemetry");
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+    dyp1 = dyp_unpack(null, mem, size, false);
+    handle = dyp_next_protocol_ref(dyp1, &reader);
+    printf("protocol other record kept: %d\n", handle == DYP_PROTOCOL_UNKNOWN && dyp_get_position(dyp1) == 0);
+    dyp_release(dyp1);
+
+    dyp0 = dyp_pack(null, mem, sizeof(mem));
+    dyb_append_typdex(dyp0, dype_f, dype_f_protocol);
+    dyb_append_var_u64(dyp0, 0);
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+    dyp1 = dyp_unpack(null, mem, size, false);
+    handle = dyp_next_protocol_ref(dyp1, &reader);
+    printf("protocol empty name rejected: %d\n", handle == DYP_PROTOCOL_UNKNOWN && dyp_get_position(dyp1) == 0);
+    dyp_release(dyp1);
+
+    // a definition record, cut at every byte
+    dyp_protocols_release(&writer);
+    dyp_protocols_init(&writer);
+    telemetry = dyp_protocols_intern(&writer, "telemetry");
+    dyp0 = dyp_pack(null, mem, sizeof(mem));
+    dyp_append_protocol_ref(dyp0, &writer, telemetry);
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+    for (i=1, count=0; i<size; i++)
+    {
+        dyp1 = dyp_unpack(null, mem, i, false);
+        if (dyp_next_protocol_ref(dyp1, &reader) == DYP_PROTOCOL_UNKNOWN && dyp_get_position(dyp1) == 0) count++;
+        dyp_release(dyp1);
+    }
+    printf("protocol truncated rejected: %u of %u\n", count, size-1);
+    dyp_protocols_release(&reader);
+    dyp_protocols_release(&writer);
+}
+
+void dypkt_arena_test(void)
+{
+    uint8 mem[1024];
+    dypkt* dyp0 = dyp_pack(null, mem, sizeof(mem));
+    dypkt* dyp1;
+    dyb_arena arena;
+    char* names[32];
+    uint size, i, round;
+
+    for (i=0; i<32; i++)
+    {
+        dyp_append_cstring(dyp0, i, i%2 ? "odd name" : "even name");
+    }
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+
+    dyb_arena_init(&arena, 128);
+    for (round=0; round<2; round++)
+    {
+        dyp1 = dyp_unpack(null, mem, size, false);
+        for (i=0; i<32; i++)
+        {
+            names[i] = dyp_next_cstring_arena(dyp1, &arena, null);
+        }
+        dyp_release(dyp1);
+        // names are still valid after the packet is released
+        printf("arena names: %s, %s, used: %u, peak: %u\n", names[0], names[31], arena.used, arena.peak);
+        dyb_arena_reset(&arena);
+    }
+    printf("arena reserved after reset: %u\n", arena.reserved);
+
+    // an empty bytes field is not an error
+    dyp0 = dyp_pack(null, mem, sizeof(mem));
+    dyp_append_data(dyp0, 0, mem, 0);
+    size = dyp_get_position(dyp0);
+    dyp_release(dyp0);
+    dyp1 = dyp_unpack(null, mem, size, false);
+    printf("arena empty bytes: %d\n", dyp_next_data_arena(dyp1, &arena, &i) != null && i == 0);
+    dyp_release(dyp1);
+    dyb_arena_release(&arena);
+}
+
+void dyjson_test(void)
+{
+    const char* text = "{\"meta\":{\"title\":\"map\",\"count\":2},"
+                       "\"items\":[{\"coord\":{\"x\":-3,\"y\":4}},{\"coord\":{\"x\":5,\"y\":-6}}]}";
+    const char* invalid[] = {"[1,2", "{\"a\":1,}", "[NaN]", "\"\\x\""};
+    dyj_document doc;
+    dyj_value *value, *decoded;
+    dybuf* out = dyb_create(null, 64);
+    uint8* data;
+    uint size, i;
+    enum dyj_err err;
+
+    dyj_document_init(&doc);
+    err = dyj_parse_text(&doc, text, (uint)strlen(text), &value);
+    if (err == dyj_err_none) err = dyj_encode(out, value);
+    data = dyb_get_data_before_current_position(out, &size);
+    printf("dyjson encode: %s, %u bytes: ", dyj_err_string(err), size);
+    for (i=0; i<size; i++) printf("%02x", data[i]);
+    printf("\n");
+
+    dyb_flip(out);
+    err = dyj_decode(out, &doc, &decoded);
+    printf("dyjson decode: %s, equal: %d, remainder: %u\n", dyj_err_string(err),
+           err == dyj_err_none && dyj_equal(value, decoded), dyb_get_remainder(out));
+
+    // truncated document
+    dyb_set_position(out, 0);
+    dyb_set_limit(out, size-1);
+    printf("dyjson truncated: %s\n", dyj_err_string(dyj_decode(out, &doc, &decoded)));
+
+    for (i=0; i<sizeof(invalid)/sizeof(invalid[0]); i++)
+    {
+        printf("dyjson parse %s: %s\n", invalid[i],
+               dyj_err_string(dyj_parse_text(&doc, invalid[i], (uint)strlen(invalid[i]), &value)));
+    }
+
+    // large objects are indexed, put replaces and get finds every key
+    value = dyj_make_object(&doc, 0);
+    for (i=0; i<1000; i++)
+    {
+        char key[16];
+        sprintf(key, "k%u", i);
+        dyj_object_put(&doc, value, key, (uint)strlen(key), dyj_make_int(&doc, i));
+    }
+    dyj_object_put(&doc, value, "k500", 4, dyj_make_int(&doc, -1));
+    for (i=0, size=0; i<1000; i++)
+    {
+        char key[16];
+        dyj_value* member;
+        sprintf(key, "k%u", i);
+        member = dyj_object_get(value, key, (uint)strlen(key));
+        if (member && member->u.i == (i == 500 ? -1 : (int64)i)) size++;
+    }
+    printf("dyjson object put: %u members, found %u, missing %d\n", value->u.o.size, size,
+           dyj_object_get(value, "k1000", 5) == null);
+
+    dyb_release(out);
+    dyj_document_release(&doc);
+}
+
+void dyjson_writer_test(void)
+{
+    const char* text = "{\"id\":7,\"tags\":[\"a\",{\"k\":-1.5}],\"ok\":true,\"none\":null}";
+    dyj_document doc;
+    dyj_value* value;
+    dyj_writer* writer = dyj_writer_create();
+    dybuf* out0 = dyb_create(null, 64);
+    dybuf* out1 = dyb_create(null, 64);
+    uint size0, size1;
+    uint8 *data0, *data1;
+    enum dyj_err err;
+
+    dyj_document_init(&doc);
+    dyj_parse_text(&doc, text, (uint)strlen(text), &value);
+    dyj_encode(out0, value);
+
+    // same document written call by call
+    dyj_write_begin_object(writer, 4);
+    dyj_write_key(writer, "id", 2);     dyj_write_int(writer, 7);
+    dyj_write_key(writer, "tags", 4);   dyj_write_begin_array(writer, 2);
+    dyj_write_string(writer, "a", 1);
+    dyj_write_begin_object(writer, 1);
+    dyj_write_key(writer, "k", 1);      dyj_write_double(writer, -1.5);
+    dyj_write_end_object(writer);
+    dyj_write_end_array(writer);
+    dyj_write_key(writer, "ok", 2);     dyj_write_bool(writer, true);
+    dyj_write_key(writer, "none", 4);   dyj_write_null(writer);
+    dyj_write_end_object(writer);
+    err = dyj_writer_finish(writer, out1);
+
+    data0 = dyb_get_data_before_current_position(out0, &size0);
+    data1 = dyb_get_data_before_current_position(out1, &size1);
+    printf("dyjson writer: %s, %u bytes, same as encode: %d\n", dyj_err_string(err), size1,
+           size0 == size1 && memcmp(data0, data1, size0) == 0);
+
+    // the writer is reused, errors are sticky until finish
+    dyj_write_begin_object(writer, 2);
+    dyj_write_key(writer, "k", 1);      dyj_write_null(writer);
+    dyj_write_key(writer, "k", 1);
+    dyj_write_null(writer);
+    printf("dyjson writer duplicate key: %s\n", dyj_err_string(dyj_writer_finish(writer, out1)));
+    dyj_write_begin_array(writer, 2);
+    dyj_write_null(writer);
+    dyj_write_end_array(writer);
+    printf("dyjson writer short array: %s\n", dyj_err_string(dyj_writer_finish(writer, out1)));
+
+    dyb_release(out0);
+    dyb_release(out1);
+    dyj_writer_release(writer);
+    dyj_document_release(&doc);
+}
+
+void dyjson_transcode_test(void)
+{
+    const char* text = " {\"rows\":[{\"id\":1,\"v\":[]},{\"id\":2,\"name\":\"\\u00e9t\\u00e9\"}],"
+                       "\"next\":{},\"total\":1e300} ";
+    const char* invalid[] = {"{\"a\":1,\"a\":2}", "[1,]", "{\"a\" 1}"};
+    dyj_document doc;
+    dyj_value* value;
+    dyj_writer* writer = dyj_writer_create();
+    dybuf* out0 = dyb_create(null, 64);
+    dybuf* out1 = dyb_create(null, 64);
+    uint size0, size1, i;
+    uint8 *data0, *data1;
+    enum dyj_err err;
+
+    dyj_document_init(&doc);
+    dyj_parse_text(&doc, text, (uint)strlen(text), &value);
+    dyj_encode(out0, value);
+    err = dyj_transcode_text(writer, text, (uint)strlen(text), out1);
+    data0 = dyb_get_data_before_current_position(out0, &size0);
+    data1 = dyb_get_data_before_current_position(out1, &size1);
+    printf("dyjson transcode: %s, %u bytes, same as encode: %d\n", dyj_err_string(err), size1,
+           size0 == size1 && memcmp(data0, data1, size0) == 0);
+
+    for (i=0; i<sizeof(invalid)/sizeof(invalid[0]); i++)
+    {
+        printf("dyjson transcode %s: %s\n", invalid[i],
+               dyj_err_string(dyj_transcode_text(writer, invalid[i], (uint)strlen(invalid[i]), out1)));
+    }
+
+    dyb_release(out0);
+    dyb_release(out1);
+    dyj_writer_release(writer);
+    dyj_document_release(&doc);
+}
+
+void dyjson_emit_test(void)
+{
+    const char* text = "{\"name\":\"tab\\t\\\"q\\\" \\u0001\",\"v\":[0.1,-2.5e-7,1e21,-3,12345678901234],\"e\":{}}";
+    const double doubles[] = {0.3, 100, 1.5e300, 5e-324, 123456.789};
+    char number[DYJ_DOUBLE_BUFFER_SIZE];
+    dyj_document doc;
+    dyj_value* value;
+    dybuf* bin = dyb_create(null, 64);
+    dybuf* out = dyb_create(null, 16);
+    uint8* data;
+    uint size, i;
+    enum dyj_err err;
+
+    dyj_document_init(&doc);
+    dyj_parse_text(&doc, text, (uint)strlen(text), &value);
+    dyj_encode(bin, value);
+    dyb_flip(bin);
+    err = dyj_emit_text(bin, out);
+    data = dyb_get_data_before_current_position(out, &size);
+    printf("dyjson emit: %s, remainder: %u, %.*s\n", dyj_err_string(err), dyb_get_remainder(bin), (int)size, data);
+
+    for (i=0; i<sizeof(doubles)/sizeof(doubles[0]); i++)
+    {
+        dyj_format_double(doubles[i], number);
+        printf("dyjson double: %s\n", number);
+    }
+
+    dyb_release(bin);
+    dyb_release(out);
+    dyj_document_release(&doc);
+}
+
+void dyjson_view_test(void)
+{
+    const char* text = "{\"items\":[{\"price\":1.5},{\"name\":\"b\",\"tags\":[[1],{\"x\":null}],\"price\":20}],\"a.b\":true}";
+    const char* paths[] = {"$.items[1].price", "$.items[1].tags[1].x", "$.items[0].price", "$.items[2]", "$.items.price", "$.a.b", "$["};
+    dyj_viewer* viewer = dyj_viewer_create();
+    dyj_document doc;
+    dyj_value* value;
+    dyj_view root, view;
+    dybuf* bin = dyb_create(null, 64);
+    const char* key;
+    uint key_size, i;
+    enum dyj_err err;
+
+    dyj_document_init(&doc);
+    dyj_parse_text(&doc, text, (uint)strlen(text), &value);
+    dyj_encode(bin, value);
+    dyb_flip(bin);
+    err = dyj_viewer_open(viewer, bin, &root);
+    printf("dyjson view open: %s, members: %u\n", dyj_err_string(err), root.u.c.size);
+
+    for (i=0; i<sizeof(paths)/sizeof(paths[0]); i++)
+    {
+        err = dyj_view_query(&root, paths[i], (uint)strlen(paths[i]), &view);
+        if (err != dyj_err_none) printf("dyjson view %s: %s\n", paths[i], dyj_err_string(err));
+        else if (view.type == dyj_int) printf("dyjson view %s: int %lld\n", paths[i], (long long)view.u.i);
+        else if (view.type == dyj_double) printf("dyjson view %s: double %g\n", paths[i], view.u.d);
+        else printf("dyjson view %s: type %d\n", paths[i], view.type);
+    }
+
+    err = dyj_view_member(&root, 1, &key, &key_size, &view);
+    printf("dyjson view member 1: %s, %.*s = %d\n", dyj_err_string(err), (int)key_size, key, view.u.b);
+    err = dyj_view_get(&root, "a.b", 3, &view);
+    printf("dyjson view get a.b: %s, type %d\n", dyj_err_string(err), view.type);
+
+    err = dyj_viewer_index(viewer, &root);
+    if (err == dyj_err_none) err = dyj_view_query(&root, paths[1], (uint)strlen(paths[1]), &view);
+    printf("dyjson view indexed %s: %s, type %d\n", paths[1], dyj_err_string(err), view.type);
+
+    dyb_release(bin);
+    dyj_viewer_release(viewer);
+    dyj_document_release(&doc);
+}
+
+void dyjson_shared_test(void)
+{
+    const char* texts[] = {"{\"id\":1,\"kind\":\"a\"}", "{\"id\":2,\"kind\":\"b\"}", "{\"id\":3,\"extra\":[{\"x\":1}]}", "{\"kind\":\"c\"}"};
+    dyj_writer* writer = dyj_writer_create();
+    dyj_dict_cache* cache = dyj_dict_cache_create();
+    dyj_dict_cache* late = dyj_dict_cache_create();
+    dyj_document doc, out_doc;
+    dyj_value *value, *decoded;
+    dybuf* out = dyb_create(null, 64);
+    uint i, start, end;
+    char* key;
+    enum dyj_err err;
+
+    dyj_document_init(&doc);
+    dyj_document_init(&out_doc);
+    dyj_writer_share_dictionaries(writer, 5);
+    for (i=0; i<sizeof(texts)/sizeof(texts[0]); i++)
+    {
+        dyj_document_reset(&doc);
+        dyj_parse_text(&doc, texts[i], (uint)strlen(texts[i]), &value);
+        start = dyb_get_position(out);
+        dyj_write_value(writer, value);
+        dyj_writer_finish(writer, out);
+        end = dyb_get_position(out);
+        dyb_set_limit(out, end);
+        dyb_set_position(out, start);
+        err = dyj_decode_shared(out, cache, &out_doc, &decoded);
+        printf("dyjson shared %u: %s, %u bytes, equal: %d", i, dyj_err_string(err), end-start,
+               err == dyj_err_none && dyj_equal(value, decoded));
+        // a reader that missed the first document, it can read from the next definition on
+        dyb_set_position(out, start);
+        err = i > 0 ? dyj_decode_shared(out, late, &out_doc, &decoded) : dyj_err_none;
+        printf(", late reader: %s\n", dyj_err_string(err));
+        dyb_set_position(out, end);
+    }
+    dyb_set_position(out, 0);
+    err = dyj_decode(out, &out_doc, &decoded);
+    printf("dyjson shared as version 1: %s\n", dyj_err_string(err));
+
+    // every document redefines the set with a new 64 KiB key, the replaced keys are capped
+    key = malloc(65536);
+    for (i=0, err=dyj_err_none; i<300 && err == dyj_err_none; i++)
+    {
+        memset(key, 'a' + i%26, 65536);
+        sprintf(key, "%u", i);
+        key[strlen(key)] = '_';
+        dyj_writer_share_dictionaries(writer, 5);
+        dyj_write_begin_object(writer, 1);
+        dyj_write_key(writer, key, 65536);
+        dyj_write_int(writer, i);
+        dyj_write_end_object(writer);
+        dyj_writer_finish(writer, dyb_clear(out));
+        err = dyj_decode_shared(dyb_flip(out), cache, &out_doc, &decoded);
+    }
+    printf("dyjson shared key bytes capped: %s after %u definitions\n", dyj_err_string(err), i);
+    free(key);
+
+    dyb_release(out);
+    dyj_dict_cache_release(cache);
+    dyj_dict_cache_release(late);
+    dyj_writer_release(writer);
+    dyj_document_release(&out_doc);
+    dyj_document_release(&doc);
+}
+
+void dyjson_canonical_test(void)
+{
+    // "z" is in every object but enters the dictionary at index 9
+    const char* texts[] = {
+        "[{\"a\":0,\"b\":1,\"c\":2,\"d\":3,\"e\":4,\"f\":5,\"g\":6,\"h\":7,\"i\":8,\"z\":9},{\"z\":1},{\"z\":2},{\"z\":3}]",
+        "[{\"z\":9,\"i\":8,\"h\":7,\"g\":6,\"f\":5,\"e\":4,\"d\":3,\"c\":2,\"b\":1,\"a\":0},{\"z\":1},{\"z\":2},{\"z\":3}]"};
+    dyj_document doc;
+    dyj_value* value;
+    dybuf* out[3];
+    uint i;
+
+    dyj_document_init(&doc);
+    for (i=0; i<3; i++) out[i] = dyb_create(null, 64);
+    dyj_parse_text(&doc, texts[0], (uint)strlen(texts[0]), &value);
+    dyj_encode(out[0], value);
+    dyj_encode_canonical(out[1], value);
+    dyj_parse_text(&doc, texts[1], (uint)strlen(texts[1]), &value);
+    dyj_encode_canonical(out[2], value);
+    printf("dyjson canonical: %u bytes, version 1 order %u bytes, same bytes for reversed keys: %d\n",
+           dyb_get_position(out[1]), dyb_get_position(out[0]),
+           dyb_get_position(out[1]) == dyb_get_position(out[2]) &&
+           memcmp(out[1]->_data, out[2]->_data, dyb_get_position(out[1])) == 0);
+
+    for (i=0; i<3; i++) dyb_release(out[i]);
+    dyj_document_release(&doc);
+}
+
+void dyjson_columnar_test(void)
+{
+    // "ok" is a bit column, "n" mixes int and double, "tags" holds arrays, "sub" a nested table
+    const char* text =
+        "{\"rows\":["
+        "{\"id\":1,\"name\":\"a\",\"ok\":true,\"n\":-1,\"tags\":[]},"
+        "{\"id\":2,\"name\":\"b\",\"ok\":false,\"n\":2.5},"
+        "{\"id\":3,\"ok\":true,\"n\":null,\"tags\":[\"x\"]},"
+        "{\"id\":4,\"name\":\"d\",\"ok\":true,\"sub\":[{\"k\":1},{\"k\":2},{\"k\":3},{}]},"
+        "{\"id\":5,\"name\":\"e\",\"ok\":false,\"n\":7}]}";
+    dyj_document doc;
+    dyj_value *value, *decoded;
+    dybuf *out0 = dyb_create(null, 64), *out1 = dyb_create(null, 64);
+    enum dyj_err err;
+
+    dyj_document_init(&doc);
+    dyj_parse_text(&doc, text, (uint)strlen(text), &value);
+    dyj_encode(out0, value);
+    err = dyj_encode_columnar(out1, value);
+    dyb_flip(out1);
+    if (err == dyj_err_none) err = dyj_decode(out1, &doc, &decoded);
+    printf("dyjson columnar: %s, %u bytes, version 1 %u bytes, equal: %d\n", dyj_err_string(err),
+           dyb_get_limit(out1), dyb_get_position(out0), err == dyj_err_none && dyj_equal(value, decoded));
+
+    dyb_release(out0);
+    dyb_release(out1);
+    dyj_document_release(&doc);
+}
+
+void dyjson_parallel_test(void)
+{
+    // later chunks add keys and paths, "v" is an array in some items and an object in others
+    dyj_document doc;
+    dyj_value *root, *item;
+    dybuf *out0 = dyb_create(null, 64), *out1 = dyb_create(null, 64);
+    char key[16];
+    uint i;
+    enum dyj_err err;
+
+    dyj_document_init(&doc);
+    root = dyj_make_array(&doc, 0);
+    for (i=0; i<2000; i++)
+    {
+        item = dyj_make_object(&doc, 0);
+        dyj_object_put(&doc, item, "id", 2, dyj_make_int(&doc, i));
+        sprintf(key, "k%u", i/100);
+        dyj_object_put(&doc, item, key, (uint)strlen(key), dyj_make_double(&doc, i*0.5));
+        if (i%300 == 299)
+        {
+            dyj_value* v = dyj_make_object(&doc, 0);
+            dyj_object_put(&doc, v, key, (uint)strlen(key), dyj_make_bool(&doc, true));
+            dyj_object_put(&doc, item, "v", 1, v);
+        }
+        else if (i%7 == 0)
+        {
+            dyj_object_put(&doc, item, "v", 1, dyj_make_array(&doc, 0));
+        }
+        dyj_array_push(&doc, root, item);
+    }
+    dyj_encode(out0, root);
+    err = dyj_encode_parallel(out1, root, 4);
+    printf("dyjson parallel: %s, %u bytes, same as encode: %d\n", dyj_err_string(err), dyb_get_position(out1),
+           dyb_get_position(out0) == dyb_get_position(out1) &&
+           memcmp(out0->_data, out1->_data, dyb_get_position(out0)) == 0);
+
+    dyb_release(out0);
+    dyb_release(out1);
+    dyj_document_release(&doc);
+}
 
 void mgn_m_test(void)
 {
@@ -0,0 +1,219 @@
+/*
+ * plat_c, platform independent library for c
+ * Copyright (C) 2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * JSON string bodies, shared by the cjson parser and the JSON-dybuf text reader.
+ * The scan stops at quote, backslash, control and non-ASCII bytes 32 (AVX2) or 16 (SSE2)
+ * bytes at a time, a byte at a time elsewhere, and validates UTF-8 on the way.
+ */
+
+#ifndef _PLAT_C_JSON_STRING_
+#define _PLAT_C_JSON_STRING_
+
+#include "plat_type.h"
+#include "plat_string.h"
+
+#if !defined(__KERNEL__) && defined(__GNUC__) && defined(__SSE2__)
+#define PLAT_JSON_SSE2          1
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define PLAT_JSON_AVX2          1
+#include <immintrin.h>
+#endif
+#endif
+
+/**
+ *  The first byte of [p, end) that is '"', '\\', below 0x20 or above 0x7F, or end.
+ */
+plat_inline const char* plat_json_string_stop(const char* p, const char* end)
+{
+#if PLAT_JSON_AVX2
+    const __m256i quote32 = _mm256_set1_epi8('"'), backslash32 = _mm256_set1_epi8('\\'), control32 = _mm256_set1_epi8(0x1F);
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote32), _mm256_cmpeq_epi8(v, backslash32)),
+                                          _mm256_cmpeq_epi8(_mm256_max_epu8(v, control32), control32));
+        uint32 mask = (uint32)_mm256_movemask_epi8(special) | (uint32)_mm256_movemask_epi8(v);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+#endif
+#if PLAT_JSON_SSE2
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), control = _mm_set1_epi8(0x1F);
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                       _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+        uint32 mask = (uint32)_mm_movemask_epi8(special) | (uint32)_mm_movemask_epi8(v);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end)
+    {
+        uint8 c = (uint8)*p;
+        if (c == '"' || c == '\\' || c < 0x20 || c > 0x7F) break;
+        p++;
+    }
+    return p;
+}
+
+/**
+ *  Length of the UTF-8 sequence at p, 0 when it is invalid: overlong, a surrogate,
+ *  above U+10FFFF or cut by end.
+ */
+plat_inline uint plat_utf8_sequence(const uint8* p, const uint8* end)
+{
+    uint8 c = p[0];
+
+    if (c < 0x80) return 1;
+    if (c < 0xC2) return 0;
+    if (c < 0xE0) return (end - p >= 2 && (p[1] & 0xC0) == 0x80) ? 2 : 0;
+    if (c < 0xF0)
+    {
+        if (end - p < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80) return 0;
+        if ((c == 0xE0 && p[1] < 0xA0) || (c == 0xED && p[1] > 0x9F)) return 0;
+        return 3;
+    }
+    if (c < 0xF5)
+    {
+        if (end - p < 4 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80) return 0;
+        if ((c == 0xF0 && p[1] < 0x90) || (c == 0xF4 && p[1] > 0x8F)) return 0;
+        return 4;
+    }
+    return 0;
+}
+
+/**
+ *  Scan a string body, p is after the opening quote. Returns the closing quote, or the byte
+ *  where the string is bad (a control byte or invalid UTF-8), or end when it is not closed.
+ *  *escaped tells if there are escapes, plat_json_string_unescape checks them.
+ */
+plat_inline const char* plat_json_string_scan(const char* p, const char* end, boolean* escaped)
+{
+    *escaped = false;
+    for (;;)
+    {
+        uint8 c;
+        uint length;
+
+        p = plat_json_string_stop(p, end);
+        if (p >= end) return end;
+        c = (uint8)*p;
+        if (c == '"') return p;
+        if (c == '\\')
+        {
+            if (end - p < 2) return end;
+            *escaped = true;
+            p += 2;
+            continue;
+        }
+        if (c < 0x20) return p;
+        length = plat_utf8_sequence((const uint8*)p, (const uint8*)end);
+        if (length == 0) return p;
+        p += length;
+    }
+}
+
+plat_inline int plat_json_hex4(const char* p)
+{
+    int code = 0, i;
+
+    for (i=0; i<4; i++)
+    {
+        char c = p[i];
+        code <<= 4;
+        if (c >= '0' && c <= '9') code |= c - '0';
+        else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+        else return -1;
+    }
+    return code;
+}
+
+/**
+ *  Decode the escapes of a scanned string body [p, end) to out, which has room for end - p
+ *  bytes: no escape is shorter than its UTF-8. The runs between escapes are copied whole.
+ *  Returns the end of the output, null for a bad escape. A lone surrogate is kept as is,
+ *  like JavaScript.
+ */
+plat_inline char* plat_json_string_unescape(const char* p, const char* end, char* out)
+{
+    while (p < end)
+    {
+        const char* backslash = (const char*)memchr(p, '\\', (size_t)(end - p));
+        int code, low;
+
+        if (backslash == NULL) backslash = end;
+        memcpy(out, p, (size_t)(backslash - p));
+        out += backslash - p;
+        p = backslash;
+        if (p >= end) break;
+        if (end - p < 2) return null;
+
+        switch (p[1])
+        {
+            case '"': *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/': *out++ = '/'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u':
+                if (end - p < 6 || (code = plat_json_hex4(p + 2)) < 0) return null;
+                p += 4;
+                if (code >= 0xD800 && code <= 0xDBFF && end - p >= 8 && p[2] == '\\' && p[3] == 'u' &&
+                    (low = plat_json_hex4(p + 4)) >= 0xDC00 && low <= 0xDFFF)
+                {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                if (code < 0x80) *out++ = (char)code;
+                else if (code < 0x800)
+                {
+                    *out++ = (char)(0xC0 | (code >> 6));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                }
+                else if (code < 0x10000)
+                {
+                    *out++ = (char)(0xE0 | (code >> 12));
+                    *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                }
+                else
+                {
+                    *out++ = (char)(0xF0 | (code >> 18));
+                    *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+                    *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            default:
+                return null;
+        }
+        p += 2;
+    }
+    return out;
+}
+
+#endif //_PLAT_C_JSON_STRING_
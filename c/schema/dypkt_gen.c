@@ -0,0 +1,504 @@
+/*
+ * dybuf, dynamic buffer library
+ * Copyright (C) 2015-2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * dypkt_gen: compile a record registry description into a C header with
+ * encode_X()/decode_X() codecs for dypkt.
+ *
+ * Schema syntax (one statement per line, '#' starts a comment):
+ *
+ *     protocol <name>                      optional, emits <PREFIX>_PROTOCOL
+ *     record <name> <obj-index>            starts a record, Typdex(TYPDEX_TYP_OBJ, obj-index)
+ *         <kind> <field> <index> [required|optional]
+ *     end
+ *
+ * <kind> is one of bool, int, uint, float, double, string, bytes.
+ *
+ * Encoded record layout (Style 1 fields inside a Style 3 object marker):
+ *
+ *     Typdex(TYPDEX_TYP_OBJ, obj-index)
+ *     Var uint(present_field_count)
+ *     repeat present_field_count times:
+ *         Typdex(kind, field-index) payload
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dybuf.h"
+
+#define MAX_NAME        64
+#define MAX_FIELDS      64
+#define MAX_RECORDS     256
+
+struct field_kind {
+    const char *name;
+    uint8 type;
+    const char *type_name;
+};
+
+static const struct field_kind field_kinds[] = {
+    {"bool",   typdex_typ_bool,   "dype_bool"},
+    {"int",    typdex_typ_int,    "dype_int"},
+    {"uint",   typdex_typ_uint,   "dype_uint"},
+    {"float",  typdex_typ_float,  "dype_float"},
+    {"double", typdex_typ_double, "dype_double"},
+    {"string", typdex_typ_string, "dype_string"},
+    {"bytes",  typdex_typ_bytes,  "dype_bytes"},
+};
+
+struct field_def {
+    char name[MAX_NAME];
+    const struct field_kind *kind;
+    uint index;
+    int optional;
+};
+
+struct record_def {
+    char name[MAX_NAME];
+    uint obj_index;
+    uint field_count;
+    struct field_def fields[MAX_FIELDS];
+};
+
+struct schema_def {
+    char protocol[256];
+    uint record_count;
+    struct record_def records[MAX_RECORDS];
+};
+
+static int schema_error(const char *path, int line_no, const char *message) {
+    fprintf(stderr, "%s:%d: %s\n", path, line_no, message);
+    return -1;
+}
+
+static int is_identifier(const char *text) {
+    if (!(isalpha((unsigned char)*text) || *text == '_')) return 0;
+    for (++text; *text; ++text) {
+        if (!(isalnum((unsigned char)*text) || *text == '_')) return 0;
+    }
+    return 1;
+}
+
+static int parse_index(const char *text, uint max, uint *out) {
+    char *end = NULL;
+    unsigned long value = strtoul(text, &end, 0);
+    if (end == text || *end != '\0' || value > max) return -1;
+    *out = (uint)value;
+    return 0;
+}
+
+static const struct field_kind *find_kind(const char *name) {
+    for (size_t i = 0; i < sizeof(field_kinds) / sizeof(field_kinds[0]); ++i) {
+        if (strcmp(name, field_kinds[i].name) == 0) return &field_kinds[i];
+    }
+    return NULL;
+}
+
+static int tokenize(char *line, char **tokens, int max_tokens) {
+    int count = 0;
+    char *hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+
+    char *p = line;
+    while (*p) {
+        while (*p && isspace((unsigned char)*p)) ++p;
+        if (!*p) break;
+        if (count == max_tokens) return -1;
+        tokens[count++] = p;
+        while (*p && !isspace((unsigned char)*p)) ++p;
+        if (*p) *p++ = '\0';
+    }
+    return count;
+}
+
+static int parse_schema(const char *path, struct schema_def *schema) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    char line[512];
+    int line_no = 0;
+    struct record_def *current = NULL;
+    int status = 0;
+
+    while (status == 0 && fgets(line, sizeof(line), fp)) {
+        char *tokens[6];
+        int count;
+
+        ++line_no;
+        count = tokenize(line, tokens, 6);
+        if (count < 0) {
+            status = schema_error(path, line_no, "too many tokens");
+            break;
+        }
+        if (count == 0) continue;
+
+        if (strcmp(tokens[0], "protocol") == 0) {
+            if (count != 2 || current) {
+                status = schema_error(path, line_no, "expected: protocol <name>");
+            } else if (strlen(tokens[1]) >= sizeof(schema->protocol)) {
+                status = schema_error(path, line_no, "protocol name is too long");
+            } else {
+                strcpy(schema->protocol, tokens[1]);
+            }
+        } else if (strcmp(tokens[0], "record") == 0) {
+            uint obj_index;
+            if (count != 3 || current) {
+                status = schema_error(path, line_no, "expected: record <name> <obj-index>");
+            } else if (!is_identifier(tokens[1]) || strlen(tokens[1]) >= MAX_NAME) {
+                status = schema_error(path, line_no, "invalid record name");
+            } else if (parse_index(tokens[2], 0x0FFFFF, &obj_index) != 0) {
+                status = schema_error(path, line_no, "invalid obj index");
+            } else if (schema->record_count == MAX_RECORDS) {
+                status = schema_error(path, line_no, "too many records");
+            } else {
+                for (uint i = 0; i < schema->record_count; ++i) {
+                    if (strcmp(schema->records[i].name, tokens[1]) == 0 ||
+                        schema->records[i].obj_index == obj_index) {
+                        status = schema_error(path, line_no, "duplicate record name or obj index");
+                    }
+                }
+                if (status == 0) {
+                    current = &schema->records[schema->record_count++];
+                    memset(current, 0, sizeof(*current));
+                    strcpy(current->name, tokens[1]);
+                    current->obj_index = obj_index;
+                }
+            }
+        } else if (strcmp(tokens[0], "end") == 0) {
+            if (count != 1 || !current) {
+                status = schema_error(path, line_no, "unexpected end");
+            }
+            current = NULL;
+        } else {
+            const struct field_kind *kind = find_kind(tokens[0]);
+            struct field_def *field;
+            uint index;
+
+            if (!current) {
+                status = schema_error(path, line_no, "field outside of record");
+            } else if (!kind) {
+                status = schema_error(path, line_no, "unknown field kind");
+            } else if (count < 3 || count > 4) {
+                status = schema_error(path, line_no, "expected: <kind> <name> <index> [required|optional]");
+            } else if (!is_identifier(tokens[1]) || strlen(tokens[1]) >= MAX_NAME) {
+                status = schema_error(path, line_no, "invalid field name");
+            } else if (parse_index(tokens[2], 0x0FFFFF, &index) != 0) {
+                status = schema_error(path, line_no, "invalid field index");
+            } else if (count == 4 && strcmp(tokens[3], "required") != 0 && strcmp(tokens[3], "optional") != 0) {
+                status = schema_error(path, line_no, "field presence must be required or optional");
+            } else if (current->field_count == MAX_FIELDS) {
+                status = schema_error(path, line_no, "too many fields");
+            } else {
+                for (uint i = 0; i < current->field_count; ++i) {
+                    if (strcmp(current->fields[i].name, tokens[1]) == 0 || current->fields[i].index == index) {
+                        status = schema_error(path, line_no, "duplicate field name or index");
+                    }
+                }
+                if (status == 0) {
+                    field = &current->fields[current->field_count++];
+                    strcpy(field->name, tokens[1]);
+                    field->kind = kind;
+                    field->index = index;
+                    field->optional = (count == 4 && strcmp(tokens[3], "optional") == 0);
+                }
+            }
+        }
+    }
+
+    if (status == 0 && current) {
+        status = schema_error(path, line_no, "missing end");
+    }
+
+    fclose(fp);
+    return status;
+}
+
+/// ===== code emitter
+
+/**
+ * Precompute the shortest typdex encoding, the same layout as dyb_append_typdex.
+ */
+static uint typdex_bytes(uint8 type, uint index, uint32 *value) {
+    if (type <= 0x0f && index <= 0x07) {
+        *value = ((uint32)type << 3) | index;
+        return 1;
+    } else if (type <= 0x3F && index <= 0x0FF) {
+        *value = 0x8000 | ((uint32)type << 8) | index;
+        return 2;
+    } else if (index <= 0x1FFF) {
+        *value = 0xC00000 | ((uint32)type << 13) | index;
+        return 3;
+    } else {
+        *value = 0xE0000000 | ((uint32)type << 20) | index;
+        return 4;
+    }
+}
+
+static void emit_typdex_append(FILE *out, uint8 type, uint index, const char *comment) {
+    static const char *appenders[] = {NULL, "dyb_append_u8", "dyb_append_u16", "dyb_append_u24", "dyb_append_u32"};
+    uint32 value;
+    uint size = typdex_bytes(type, index, &value);
+    fprintf(out, "    %s(dyp, 0x%0*x);%*s// %s\n", appenders[size], (int)size * 2, value,
+            (int)(8 - size * 2), "", comment);
+}
+
+static void upper_copy(char *dst, const char *src, size_t dst_size) {
+    size_t i = 0;
+    for (; src[i] && i + 1 < dst_size; ++i) {
+        dst[i] = isalnum((unsigned char)src[i]) ? (char)toupper((unsigned char)src[i]) : '_';
+    }
+    dst[i] = '\0';
+}
+
+static void emit_struct(FILE *out, const struct record_def *rec) {
+    fprintf(out, "// string and bytes members refer to packet memory after decode_%s()\n", rec->name);
+    fprintf(out, "typedef struct %s\n{\n", rec->name);
+    for (uint i = 0; i < rec->field_count; ++i) {
+        const struct field_def *f = &rec->fields[i];
+        if (f->optional) fprintf(out, "    boolean has_%s;\n", f->name);
+        switch (f->kind->type) {
+            case typdex_typ_bool:   fprintf(out, "    boolean %s;\n", f->name); break;
+            case typdex_typ_int:    fprintf(out, "    int64 %s;\n", f->name); break;
+            case typdex_typ_uint:   fprintf(out, "    uint64 %s;\n", f->name); break;
+            case typdex_typ_float:  fprintf(out, "    float %s;\n", f->name); break;
+            case typdex_typ_double: fprintf(out, "    double %s;\n", f->name); break;
+            case typdex_typ_string:
+                fprintf(out, "    char* %s;\n", f->name);
+                fprintf(out, "    uint %s_size;\n", f->name);
+                break;
+            case typdex_typ_bytes:
+                fprintf(out, "    uint8* %s;\n", f->name);
+                fprintf(out, "    uint %s_size;\n", f->name);
+                break;
+        }
+    }
+    fprintf(out, "} %s;\n\n", rec->name);
+}
+
+static void emit_field_append(FILE *out, const struct field_def *f) {
+    char comment[MAX_NAME + 32];
+    const char *indent = f->optional ? "    " : "";
+
+    snprintf(comment, sizeof(comment), "%s, %u: %s", f->kind->type_name, f->index, f->name);
+    if (f->optional) fprintf(out, "    if (v->has_%s)\n    {\n", f->name);
+    if (f->optional) fprintf(out, "    ");
+    emit_typdex_append(out, f->kind->type, f->index, comment);
+    switch (f->kind->type) {
+        case typdex_typ_bool:   fprintf(out, "%s    dyb_append_bool(dyp, v->%s);\n", indent, f->name); break;
+        case typdex_typ_int:    fprintf(out, "%s    dyb_append_var_s64(dyp, v->%s);\n", indent, f->name); break;
+        case typdex_typ_uint:   fprintf(out, "%s    dyb_append_var_u64(dyp, v->%s);\n", indent, f->name); break;
+        case typdex_typ_float:  fprintf(out, "%s    dyb_append_float(dyp, v->%s);\n", indent, f->name); break;
+        case typdex_typ_double: fprintf(out, "%s    dyb_append_double(dyp, v->%s);\n", indent, f->name); break;
+        case typdex_typ_string: fprintf(out, "%s    dyb_append_cstring_with_var_len(dyp, v->%s);\n", indent, f->name); break;
+        case typdex_typ_bytes:  fprintf(out, "%s    dyb_append_data_with_var_len(dyp, v->%s, v->%s_size);\n", indent, f->name, f->name); break;
+    }
+    if (f->optional) fprintf(out, "    }\n");
+}
+
+static void emit_encoder(FILE *out, const struct record_def *rec) {
+    uint required = 0;
+    char comment[MAX_NAME + 32];
+
+    for (uint i = 0; i < rec->field_count; ++i) {
+        if (!rec->fields[i].optional) required++;
+    }
+
+    fprintf(out, "dyb_inline dypkt* encode_%s(dypkt* dyp, const %s* v)\n{\n", rec->name, rec->name);
+    fprintf(out, "    uint64 count = %u;\n", required);
+    for (uint i = 0; i < rec->field_count; ++i) {
+        if (rec->fields[i].optional) fprintf(out, "    if (v->has_%s) count++;\n", rec->fields[i].name);
+    }
+    fprintf(out, "\n");
+    snprintf(comment, sizeof(comment), "dype_obj, %u: %s", rec->obj_index, rec->name);
+    emit_typdex_append(out, typdex_typ_obj, rec->obj_index, comment);
+    fprintf(out, "    dyb_append_var_u64(dyp, count);\n");
+    for (uint i = 0; i < rec->field_count; ++i) {
+        emit_field_append(out, &rec->fields[i]);
+    }
+    fprintf(out, "    return dyp;\n}\n\n");
+}
+
+static void emit_field_read(FILE *out, const struct field_def *f, uint bit, const char *indent) {
+    fprintf(out, "%sif (seen & 0x%llxULL) return false;\n", indent, 1ULL << bit);
+    switch (f->kind->type) {
+        case typdex_typ_bool:
+            fprintf(out, "%sif (dyb_get_remainder(dyp) < 1) return false;\n", indent);
+            fprintf(out, "%sv->%s = dyb_next_bool(dyp);\n", indent, f->name);
+            break;
+        case typdex_typ_int:
+            fprintf(out, "%sif (!dyp_has_var_u64(dyp)) return false;\n", indent);
+            fprintf(out, "%sv->%s = dyb_next_var_s64(dyp);\n", indent, f->name);
+            break;
+        case typdex_typ_uint:
+            fprintf(out, "%sif (!dyp_has_var_u64(dyp)) return false;\n", indent);
+            fprintf(out, "%sv->%s = dyb_next_var_u64(dyp);\n", indent, f->name);
+            break;
+        case typdex_typ_float:
+            fprintf(out, "%sif (dyb_get_remainder(dyp) < 4) return false;\n", indent);
+            fprintf(out, "%sv->%s = dyb_next_float(dyp);\n", indent, f->name);
+            break;
+        case typdex_typ_double:
+            fprintf(out, "%sif (dyb_get_remainder(dyp) < 8) return false;\n", indent);
+            fprintf(out, "%sv->%s = dyb_next_double(dyp);\n", indent, f->name);
+            break;
+        case typdex_typ_string:
+            fprintf(out, "%sif (!dyp_has_data_with_var_len(dyp)) return false;\n", indent);
+            fprintf(out, "%sv->%s = dyb_next_cstring_with_var_len(dyp, &v->%s_size);\n", indent, f->name, f->name);
+            fprintf(out, "%sif (v->%s == null || v->%s[v->%s_size] != 0) return false;\n", indent, f->name, f->name, f->name);
+            break;
+        case typdex_typ_bytes:
+            fprintf(out, "%sif (!dyp_has_data_with_var_len(dyp)) return false;\n", indent);
+            fprintf(out, "%sv->%s = dyb_next_data_with_var_len(dyp, &v->%s_size);\n", indent, f->name, f->name);
+            fprintf(out, "%sif (v->%s == null && v->%s_size != 0) return false;\n", indent, f->name, f->name);
+            break;
+    }
+    if (f->optional) fprintf(out, "%sv->has_%s = true;\n", indent, f->name);
+    fprintf(out, "%sseen |= 0x%llxULL;\n", indent, 1ULL << bit);
+}
+
+static void emit_decoder(FILE *out, const struct record_def *rec) {
+    unsigned long long required_mask = 0;
+    uint32 obj_typdex;
+    uint obj_size = typdex_bytes(typdex_typ_obj, rec->obj_index, &obj_typdex);
+    uint wide = 0;
+
+    for (uint i = 0; i < rec->field_count; ++i) {
+        if (!rec->fields[i].optional) required_mask |= 1ULL << i;
+    }
+
+    fprintf(out, "dyb_inline boolean decode_%s(dypkt* dyp, %s* v)\n{\n", rec->name, rec->name);
+    fprintf(out, "    uint64 count;\n    uint64 seen = 0;\n\n");
+    fprintf(out, "    plat_mem_set(v, 0, sizeof(*v));\n");
+    if (obj_size == 1) {
+        fprintf(out, "    if (dyb_get_remainder(dyp) < 2 || dyb_peek_u8(dyp) != 0x%02x) return false;\n", obj_typdex);
+        fprintf(out, "    dyb_next_u8(dyp);\n");
+    } else {
+        fprintf(out, "    if (dyb_get_remainder(dyp) < %u || !dyp_has_typdex(dyp)) return false;\n", obj_size + 1);
+        fprintf(out, "    {\n        uint8 type;\n        uint index;\n");
+        fprintf(out, "        dyb_next_typdex(dyp, &type, &index);\n");
+        fprintf(out, "        if (type != dype_obj || index != %uU) return false;\n    }\n", rec->obj_index);
+    }
+    fprintf(out, "    if (!dyp_has_var_u64(dyp)) return false;\n");
+    fprintf(out, "    count = dyb_next_var_u64(dyp);\n\n");
+
+    fprintf(out, "    while (count-- > 0)\n    {\n");
+    fprintf(out, "        if (dyb_get_remainder(dyp) < 1) return false;\n");
+    fprintf(out, "        switch (dyb_peek_u8(dyp))\n        {\n");
+    for (uint i = 0; i < rec->field_count; ++i) {
+        const struct field_def *f = &rec->fields[i];
+        uint32 value;
+        if (typdex_bytes(f->kind->type, f->index, &value) != 1) {
+            wide++;
+            continue;
+        }
+        fprintf(out, "            case 0x%02x:     // %s, %u: %s\n", value, f->kind->type_name, f->index, f->name);
+        fprintf(out, "            {\n                dyb_next_u8(dyp);\n");
+        emit_field_read(out, f, i, "                ");
+        fprintf(out, "                break;\n            }\n");
+    }
+    fprintf(out, "            default:\n            {\n");
+    fprintf(out, "                uint8 type;\n                uint index;\n");
+    fprintf(out, "                if (!dyp_has_typdex(dyp)) return false;\n");
+    fprintf(out, "                dyb_next_typdex(dyp, &type, &index);\n");
+    if (wide) {
+        fprintf(out, "                switch (((uint32)type << 20) | index)\n                {\n");
+        for (uint i = 0; i < rec->field_count; ++i) {
+            const struct field_def *f = &rec->fields[i];
+            uint32 value;
+            if (typdex_bytes(f->kind->type, f->index, &value) == 1) continue;
+            fprintf(out, "                    case 0x%08xU:     // %s, %u: %s\n",
+                    ((uint32)f->kind->type << 20) | f->index, f->kind->type_name, f->index, f->name);
+            fprintf(out, "                    {\n");
+            emit_field_read(out, f, i, "                        ");
+            fprintf(out, "                        continue;\n                    }\n");
+        }
+        fprintf(out, "                }\n");
+    }
+    fprintf(out, "                // a known field index with another type is a decoding error\n");
+    fprintf(out, "                switch (index)\n                {\n");
+    for (uint i = 0; i < rec->field_count; ++i) {
+        fprintf(out, "                    case %uU:\n", rec->fields[i].index);
+    }
+    fprintf(out, "                        return false;\n                }\n");
+    fprintf(out, "                if (!dyp_skip_payload(dyp, (dype)type)) return false;\n");
+    fprintf(out, "                break;\n            }\n");
+    fprintf(out, "        }\n    }\n\n");
+    fprintf(out, "    return (seen & 0x%llxULL) == 0x%llxULL;\n}\n\n", required_mask, required_mask);
+}
+
+static void guard_name(const char *out_path, char *guard, size_t guard_size) {
+    const char *base = strrchr(out_path, '/');
+    base = base ? base + 1 : out_path;
+    upper_copy(guard, base, guard_size);
+}
+
+static int emit_header(const char *schema_path, const char *out_path, const struct schema_def *schema) {
+    FILE *out = fopen(out_path, "w");
+    char guard[256];
+    char upper[MAX_NAME];
+
+    if (!out) {
+        perror(out_path);
+        return -1;
+    }
+
+    guard_name(out_path, guard, sizeof(guard));
+    fprintf(out, "// Generated by dypkt_gen from %s, do not edit.\n\n", schema_path);
+    fprintf(out, "#ifndef DYPKT_GEN_%s\n#define DYPKT_GEN_%s\n\n", guard, guard);
+    fprintf(out, "#include \"dypkt.h\"\n\n");
+
+    if (schema->protocol[0]) {
+        char prefix[256];
+        upper_copy(prefix, schema->protocol, sizeof(prefix));
+        fprintf(out, "#define %s_PROTOCOL        \"%s\"\n\n", prefix, schema->protocol);
+    }
+
+    for (uint i = 0; i < schema->record_count; ++i) {
+        const struct record_def *rec = &schema->records[i];
+        upper_copy(upper, rec->name, sizeof(upper));
+        fprintf(out, "/// ===== %s\n\n", rec->name);
+        fprintf(out, "#define DYPE_OBJ_%s        %u\n\n", upper, rec->obj_index);
+        emit_struct(out, rec);
+        emit_encoder(out, rec);
+        emit_decoder(out, rec);
+    }
+
+    fprintf(out, "#endif\n");
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    static struct schema_def schema;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <schema> <output.h>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (parse_schema(argv[1], &schema) != 0) return EXIT_FAILURE;
+    if (emit_header(argv[1], argv[2], &schema) != 0) return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
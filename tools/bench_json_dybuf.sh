@@ -0,0 +1,104 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Benchmark JSON-dybuf encode/decode of the C library (dybuf_json), JavaScript and Python
+# on the same corpus. Usage: tools/bench_json_dybuf.sh [corpus.json] [iterations]
+# Without a corpus, a deterministic one is generated under c/build/bench.
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+BUILD_DIR="${ROOT_DIR}/c/build/bench"
+CORPUS="${1:-${BUILD_DIR}/corpus.json}"
+ITERATIONS="${2:-20}"
+
+mkdir -p "${BUILD_DIR}"
+
+if [ ! -f "${CORPUS}" ]; then
+  node - "${CORPUS}" <<'JS'
+import('node:fs').then((fs) => {
+  let seed = 518;
+  const rand = () => (seed = (seed * 1103515245 + 12345) % 2147483648) / 2147483648;
+  const words = ['alpha', 'beta', 'gamma', 'delta', 'sensor', 'gateway', 'retry', 'timeout'];
+  const events = [];
+  for (let i = 0; i < 20000; i++) {
+    const event = {
+      id: i,
+      ts: 1700000000000 + i * 137,
+      kind: words[Math.floor(rand() * words.length)],
+      value: Math.round(rand() * 1e6) / 100,
+      ok: rand() > 0.1,
+      tags: [words[i % 8], words[(i * 3) % 8]],
+      source: { host: `node-${i % 64}`, port: 8000 + (i % 16) },
+    };
+    if (i % 5 === 0) event.error = { code: -Math.floor(rand() * 500), message: `failed ${words[i % 8]}` };
+    events.push(event);
+  }
+  fs.writeFileSync(process.argv[2], JSON.stringify({ version: 1, events }));
+});
+JS
+fi
+
+cc -std=c99 -O2 -I "${ROOT_DIR}/c" -I "${ROOT_DIR}/c/platform" -I "${ROOT_DIR}/c/dyjson" \
+  -o "${BUILD_DIR}/bench_dyjson" \
+  "${ROOT_DIR}/c/bench/bench_dyjson.c" \
+  "${ROOT_DIR}/c/dyjson/dyjson.c" "${ROOT_DIR}/c/dyjson/dyjson_dict.c" "${ROOT_DIR}/c/dyjson/dyjson_text.c" \
+  "${ROOT_DIR}/c/dyjson/dyjson_writer.c" "${ROOT_DIR}/c/dyjson/dyjson_emit.c" "${ROOT_DIR}/c/dyjson/dyjson_dtoa.c" "${ROOT_DIR}/c/dyjson/dyjson_atod.c" \
+  "${ROOT_DIR}/c/dyjson/dyjson_view.c" "${ROOT_DIR}/c/dyjson/dyjson_parallel.c" \
+  -lm -lpthread
+
+echo "corpus: ${CORPUS} ($(wc -c < "${CORPUS}") bytes), iterations: ${ITERATIONS}"
+"${BUILD_DIR}/bench_dyjson" "${CORPUS}" "${ITERATIONS}"
+
+if command -v node >/dev/null 2>&1; then
+  node --input-type=module - "${ROOT_DIR}/js/DyBuf.js" "${CORPUS}" "${ITERATIONS}" <<'JS'
+const [, , lib, corpus, iterations] = process.argv;
+const { encodeJson, decodeJson } = await import(lib);
+const fs = await import('node:fs');
+const text = fs.readFileSync(corpus, 'utf8');
+const n = Number(iterations);
+const report = (op, ms) => console.log(`js ${op.padEnd(8)} ${(ms / n).toFixed(3).padStart(10)} ms/op ${(text.length / 1048576 / (ms / n / 1000)).toFixed(1).padStart(10)} MB/s`);
+let start = performance.now();
+let value;
+for (let i = 0; i < n; i++) value = JSON.parse(text);
+report('parse', performance.now() - start);
+start = performance.now();
+let encoded;
+for (let i = 0; i < n; i++) encoded = encodeJson(value);
+report('encode', performance.now() - start);
+start = performance.now();
+for (let i = 0; i < n; i++) decodeJson(encoded);
+report('decode', performance.now() - start);
+console.log(`js size     json ${text.length} bytes, dybuf ${encoded.byteLength ?? encoded.length} bytes`);
+JS
+else
+  echo "js skipped: node not found"
+fi
+
+if PYTHONPATH="${ROOT_DIR}/py/src" python3 -c "import dybuf.json" >/dev/null 2>&1; then
+  PYTHONPATH="${ROOT_DIR}/py/src" python3 - "${CORPUS}" "${ITERATIONS}" <<'PY'
+import json, sys, time
+from dybuf.json import decode_json, encode_json
+
+text = open(sys.argv[1], encoding="utf-8").read()
+n = int(sys.argv[2])
+
+def report(op, seconds):
+    per_op = seconds / n
+    print(f"py {op:<8} {per_op * 1000:10.3f} ms/op {len(text) / 1048576 / per_op:10.1f} MB/s")
+
+start = time.perf_counter()
+for _ in range(n):
+    value = json.loads(text)
+report("parse", time.perf_counter() - start)
+start = time.perf_counter()
+for _ in range(n):
+    encoded = encode_json(value)
+report("encode", time.perf_counter() - start)
+start = time.perf_counter()
+for _ in range(n):
+    decode_json(encoded)
+report("decode", time.perf_counter() - start)
+print(f"py size     json {len(text)} bytes, dybuf {len(encoded)} bytes")
+PY
+else
+  echo "py skipped: dybuf Python extension is not built (cd py && pip install -e .)"
+fi
@@ -15,7 +15,11 @@ cc -std=c99 -I "${ROOT_DIR}/c" -I "${ROOT_DIR}/c/platform" \
 
 cc -std=c99 -I "${ROOT_DIR}/c" -I "${ROOT_DIR}/c/platform" \
   -o "${BUILD_DIR}/dybuf_verify_fixtures" \
-  "${ROOT_DIR}/c/fixtures/verify_fixtures.c"
+  "${ROOT_DIR}/c/fixtures/verify_fixtures.c" \
+  "${ROOT_DIR}/c/dyjson/dyjson.c" "${ROOT_DIR}/c/dyjson/dyjson_dict.c" "${ROOT_DIR}/c/dyjson/dyjson_text.c" \
+  "${ROOT_DIR}/c/dyjson/dyjson_writer.c" "${ROOT_DIR}/c/dyjson/dyjson_emit.c" "${ROOT_DIR}/c/dyjson/dyjson_dtoa.c" "${ROOT_DIR}/c/dyjson/dyjson_atod.c" \
+  "${ROOT_DIR}/c/dyjson/dyjson_view.c" "${ROOT_DIR}/c/dyjson/dyjson_parallel.c" \
+  -lm -lpthread
 
 "${BUILD_DIR}/dybuf_verify_fixtures" "${OUT_DIR}"
 